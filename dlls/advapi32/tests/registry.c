@@ -4927,6 +4927,85 @@ static void test_RegRenameKey(void)
     RegCloseKey(key);
 }
 
+static void test_many_subkeys(void)
+{
+    char name[32], prev[32];
+    BOOL seen[300];
+    HKEY key, subkey;
+    DWORD i, j, size, val, count;
+    LSTATUS ret;
+
+    ret = RegCreateKeyExA(hkey_main, "ManySubkeys", 0, NULL, 0, KEY_ALL_ACCESS, NULL, &key, NULL);
+    ok(!ret, "Unexpected return value %ld.\n", ret);
+
+    /* insert in scrambled order, enough to go past the server hash index threshold */
+    for (i = 0; i < 300; i++)
+    {
+        j = (i * 7) % 300;
+        sprintf(name, "Key%03lu", j);
+        ret = RegCreateKeyExA(key, name, 0, NULL, 0, KEY_ALL_ACCESS, NULL, &subkey, NULL);
+        ok(!ret, "RegCreateKeyExA %s returned %ld.\n", name, ret);
+        RegCloseKey(subkey);
+        sprintf(name, "Value%03lu", j);
+        ret = RegSetValueExA(key, name, 0, REG_DWORD, (BYTE *)&j, sizeof(j));
+        ok(!ret, "RegSetValueExA %s returned %ld.\n", name, ret);
+    }
+
+    for (i = 0; i < 300; i += 3)
+    {
+        sprintf(name, "KEY%03lu", i);
+        ret = RegDeleteKeyA(key, name);
+        ok(!ret, "RegDeleteKeyA %s returned %ld.\n", name, ret);
+        sprintf(name, "VALUE%03lu", i);
+        ret = RegDeleteValueA(key, name);
+        ok(!ret, "RegDeleteValueA %s returned %ld.\n", name, ret);
+    }
+    ret = RegRenameKey(key, L"Key001", L"Key000");
+    ok(!ret, "Unexpected return value %ld.\n", ret);
+
+    for (i = 0; i < 300; i++)
+    {
+        sprintf(name, "kEy%03lu", i);
+        ret = RegOpenKeyExA(key, name, 0, KEY_READ, &subkey);
+        if (i == 1 || (i && !(i % 3))) ok(ret == ERROR_FILE_NOT_FOUND, "RegOpenKeyExA %s returned %ld.\n", name, ret);
+        else ok(!ret, "RegOpenKeyExA %s returned %ld.\n", name, ret);
+        if (!ret) RegCloseKey(subkey);
+
+        sprintf(name, "vALUE%03lu", i);
+        size = sizeof(val);
+        ret = RegQueryValueExA(key, name, NULL, NULL, (BYTE *)&val, &size);
+        if (i % 3) ok(!ret && val == i, "RegQueryValueExA %s returned %ld, val %lu.\n", name, ret, val);
+        else ok(ret == ERROR_FILE_NOT_FOUND, "RegQueryValueExA %s returned %ld.\n", name, ret);
+    }
+
+    /* subkeys are enumerated sorted by name */
+    prev[0] = 0;
+    for (count = 0; ; count++)
+    {
+        size = sizeof(name);
+        if (RegEnumKeyExA(key, count, name, &size, NULL, NULL, NULL, NULL)) break;
+        ok(strcmp(prev, name) < 0, "%s enumerated after %s.\n", name, prev);
+        strcpy(prev, name);
+    }
+    ok(count == 200, "Unexpected subkey count %lu.\n", count);
+    /* values are enumerated in insertion order on Windows, only check the set of names */
+    memset(seen, 0, sizeof(seen));
+    for (count = 0; ; count++)
+    {
+        size = sizeof(name);
+        if (RegEnumValueA(key, count, name, &size, NULL, NULL, NULL, NULL)) break;
+        i = 300;
+        ok(sscanf(name, "Value%03lu", &i) == 1 && i < 300 && i % 3, "Unexpected value %s.\n", name);
+        if (i >= 300) continue;
+        ok(!seen[i], "%s enumerated twice.\n", name);
+        seen[i] = TRUE;
+    }
+    ok(count == 200, "Unexpected value count %lu.\n", count);
+
+    delete_key(key);
+    RegCloseKey(key);
+}
+
 START_TEST(registry)
 {
     /* Load pointers for functions that are not available in all Windows versions */
@@ -4968,6 +5047,7 @@ START_TEST(registry)
     test_EnumDynamicTimeZoneInformation();
     test_perflib_key();
     test_RegRenameKey();
+    test_many_subkeys();
 
     /* cleanup */
     delete_key( hkey_main );
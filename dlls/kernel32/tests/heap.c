@@ -3727,6 +3727,91 @@ static void test_heap_sizes(void)
     test_heap_size( 0x150000 );
 }
 
+/* Wine-specific, see dlls/ntdll/ntdll_misc.h */
+#define HeapWineStatistics ((HEAP_INFORMATION_CLASS)1000)
+
+typedef struct
+{
+    SIZE_T    BlockSize;
+    ULONGLONG CacheHits;
+    ULONGLONG CacheMisses;
+    SIZE_T    TotalBytes;
+    SIZE_T    UsedBytes;
+} HEAP_WINE_BIN_STATISTICS;
+
+typedef struct
+{
+    ULONGLONG CacheHits;
+    ULONGLONG CacheMisses;
+    ULONG     BinCount;
+    HEAP_WINE_BIN_STATISTICS Bins[1];
+} HEAP_WINE_STATISTICS;
+
+static void test_heap_statistics(void)
+{
+    HEAP_WINE_STATISTICS *stats;
+    SIZE_T size, used, total;
+    ULONG compat_info;
+    void *ptrs[0x20];
+    HANDLE heap;
+    UINT i, j;
+    BOOL ret;
+
+    heap = HeapCreate( 0, 0, 0 );
+    ok( !!heap, "HeapCreate failed, error %lu\n", GetLastError() );
+    compat_info = 2;
+    ret = pHeapSetInformation( heap, HeapCompatibilityInformation, &compat_info, sizeof(compat_info) );
+    ok( ret, "HeapSetInformation failed, error %lu\n", GetLastError() );
+
+    size = 0;
+    SetLastError( 0xdeadbeef );
+    ret = pHeapQueryInformation( heap, HeapWineStatistics, NULL, 0, &size );
+    ok( !ret, "HeapQueryInformation succeeded\n" );
+    if (GetLastError() != ERROR_INSUFFICIENT_BUFFER)
+    {
+        win_skip( "HeapWineStatistics not supported\n" );
+        HeapDestroy( heap );
+        return;
+    }
+    ok( size > sizeof(*stats), "got size %Iu\n", size );
+    stats = HeapAlloc( GetProcessHeap(), 0, size );
+
+    /* LFH is enabled for the bin after a few allocations */
+    for (j = 0; j < 8; j++)
+    {
+        for (i = 0; i < ARRAY_SIZE(ptrs); i++) ptrs[i] = HeapAlloc( heap, 0, 32 );
+        for (i = 0; i < ARRAY_SIZE(ptrs); i++) HeapFree( heap, 0, ptrs[i] );
+    }
+    for (i = 0; i < ARRAY_SIZE(ptrs); i++) ptrs[i] = HeapAlloc( heap, 0, 32 );
+
+    memset( stats, 0xcd, size );
+    ret = pHeapQueryInformation( heap, HeapWineStatistics, stats, size, NULL );
+    ok( ret, "HeapQueryInformation failed, error %lu\n", GetLastError() );
+    ok( stats->BinCount == 0x80, "got BinCount %lu\n", stats->BinCount );
+    ok( stats->CacheHits > 0, "got CacheHits %I64u\n", stats->CacheHits );
+    ok( stats->CacheMisses > 0, "got CacheMisses %I64u\n", stats->CacheMisses );
+    ok( stats->CacheHits > stats->CacheMisses, "got CacheHits %I64u, CacheMisses %I64u\n",
+        stats->CacheHits, stats->CacheMisses );
+
+    for (i = 0, used = total = 0; i < stats->BinCount; i++)
+    {
+        ok( stats->Bins[i].BlockSize > (i ? stats->Bins[i - 1].BlockSize : 0), "got BlockSize %Iu\n",
+            stats->Bins[i].BlockSize );
+        ok( stats->Bins[i].UsedBytes <= stats->Bins[i].TotalBytes, "got UsedBytes %Iu, TotalBytes %Iu\n",
+            stats->Bins[i].UsedBytes, stats->Bins[i].TotalBytes );
+        used += stats->Bins[i].UsedBytes;
+        total += stats->Bins[i].TotalBytes;
+    }
+    ok( used >= ARRAY_SIZE(ptrs) * 32, "got used %Iu\n", used );
+    ok( total >= used, "got total %Iu\n", total );
+
+    for (i = 0; i < ARRAY_SIZE(ptrs); i++) HeapFree( heap, 0, ptrs[i] );
+
+    HeapFree( GetProcessHeap(), 0, stats );
+    ret = HeapDestroy( heap );
+    ok( ret, "HeapDestroy failed, error %lu\n", GetLastError() );
+}
+
 START_TEST(heap)
 {
     int argc;
@@ -3764,4 +3849,5 @@ START_TEST(heap)
     }
     else win_skip( "RtlGetNtGlobalFlags not found, skipping heap debug tests\n" );
     test_heap_sizes();
+    test_heap_statistics();
 }
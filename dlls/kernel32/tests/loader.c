@@ -2409,6 +2409,187 @@ static void test_import_resolution(void)
     }
 }
 
+static void write_bound_test_image( const char *name, IMAGE_NT_HEADERS *nt, const void *data, DWORD size )
+{
+    IMAGE_SECTION_HEADER section;
+    HANDLE hfile;
+    DWORD dummy;
+
+    nt->FileHeader.NumberOfSections = 1;
+    nt->FileHeader.SizeOfOptionalHeader = sizeof(IMAGE_OPTIONAL_HEADER);
+    nt->FileHeader.Characteristics = IMAGE_FILE_EXECUTABLE_IMAGE | IMAGE_FILE_DLL;
+    nt->OptionalHeader.SectionAlignment = page_size;
+    nt->OptionalHeader.FileAlignment = 0x200;
+    nt->OptionalHeader.SizeOfImage = 2 * page_size;
+    nt->OptionalHeader.SizeOfHeaders = nt->OptionalHeader.FileAlignment;
+    nt->OptionalHeader.DllCharacteristics = IMAGE_DLLCHARACTERISTICS_NX_COMPAT;
+    nt->OptionalHeader.NumberOfRvaAndSizes = IMAGE_NUMBEROF_DIRECTORY_ENTRIES;
+
+    memset( &section, 0, sizeof(section) );
+    memcpy( section.Name, ".text", sizeof(".text") );
+    section.PointerToRawData = nt->OptionalHeader.FileAlignment;
+    section.VirtualAddress = nt->OptionalHeader.SectionAlignment;
+    section.Misc.VirtualSize = size;
+    section.SizeOfRawData = size;
+    section.Characteristics = IMAGE_SCN_CNT_INITIALIZED_DATA | IMAGE_SCN_MEM_READ | IMAGE_SCN_MEM_WRITE;
+
+    hfile = CreateFileA( name, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, 0, 0 );
+    ok( hfile != INVALID_HANDLE_VALUE, "creation failed\n" );
+    WriteFile( hfile, &dos_header, sizeof(dos_header), &dummy, NULL );
+    WriteFile( hfile, nt, sizeof(*nt), &dummy, NULL );
+    WriteFile( hfile, &section, sizeof(section), &dummy, NULL );
+    SetFilePointer( hfile, section.PointerToRawData, NULL, SEEK_SET );
+    WriteFile( hfile, data, size, &dummy, NULL );
+    CloseHandle( hfile );
+}
+
+static void test_bound_imports(void)
+{
+    static const DWORD timestamp = 0x12345678;
+    char temp_path[MAX_PATH], target_name[MAX_PATH], dll_name[MAX_PATH], *basename;
+    struct exports
+    {
+        IMAGE_EXPORT_DIRECTORY dir;
+        DWORD functions[1];
+        DWORD names[1];
+        WORD ordinals[1];
+        char module[MAX_PATH];
+        char name[8];
+        BYTE code[16];
+        struct
+        {
+            IMAGE_BASE_RELOCATION reloc;
+            USHORT type_off[2];
+        } rel;
+    } exports;
+    struct imports
+    {
+        IMAGE_IMPORT_DESCRIPTOR descr[2];
+        IMAGE_THUNK_DATA original_thunks[2];
+        IMAGE_THUNK_DATA thunks[2];
+        IMAGE_BOUND_IMPORT_DESCRIPTOR bound[2];
+        char bound_module[MAX_PATH];
+        char module[MAX_PATH];
+        struct { WORD hint; char name[8]; } function;
+    } data, *ptr;
+    IMAGE_NT_HEADERS nt;
+    HMODULE target, mod;
+    void *expect, *tmp;
+    int test;
+
+    GetTempPathA( MAX_PATH, temp_path );
+    GetTempFileNameA( temp_path, "ldr", 0, target_name );
+    GetTempFileNameA( temp_path, "ldr", 0, dll_name );
+    basename = strrchr( target_name, '\\' ) + 1;
+
+    /* target dll, not dynamically relocated so that it's normally loaded at its preferred base */
+#define DATA_RVA(ptr) (page_size + ((char *)(ptr) - (char *)&exports))
+    memset( &exports, 0, sizeof(exports) );
+    exports.dir.Name = DATA_RVA( exports.module );
+    exports.dir.Base = 1;
+    exports.dir.NumberOfFunctions = 1;
+    exports.dir.NumberOfNames = 1;
+    exports.dir.AddressOfFunctions = DATA_RVA( exports.functions );
+    exports.dir.AddressOfNames = DATA_RVA( exports.names );
+    exports.dir.AddressOfNameOrdinals = DATA_RVA( exports.ordinals );
+    exports.functions[0] = DATA_RVA( exports.code );
+    exports.names[0] = DATA_RVA( exports.name );
+    strcpy( exports.module, basename );
+    strcpy( exports.name, "func" );
+    exports.rel.reloc.VirtualAddress = page_size;
+    exports.rel.reloc.SizeOfBlock = sizeof(exports.rel);
+
+    nt = nt_header_template;
+    nt.FileHeader.TimeDateStamp = timestamp;
+    nt.OptionalHeader.ImageBase += 0x1000000;
+    memset( nt.OptionalHeader.DataDirectory, 0, sizeof(nt.OptionalHeader.DataDirectory) );
+    nt.OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXPORT].Size = sizeof(exports);
+    nt.OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXPORT].VirtualAddress = DATA_RVA( &exports.dir );
+    nt.OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_BASERELOC].Size = sizeof(exports.rel);
+    nt.OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_BASERELOC].VirtualAddress = DATA_RVA( &exports.rel );
+    write_bound_test_image( target_name, &nt, &exports, sizeof(exports) );
+#undef DATA_RVA
+
+    for (test = 0; test < 5; test++)
+    {
+#define DATA_RVA(ptr) (page_size + ((char *)(ptr) - (char *)&data))
+        winetest_push_context( "%u", test );
+
+        memset( &data, 0, sizeof(data) );
+        data.descr[0].OriginalFirstThunk = DATA_RVA( data.original_thunks );
+        data.descr[0].FirstThunk = DATA_RVA( data.thunks );
+        data.descr[0].Name = DATA_RVA( data.module );
+        data.descr[0].TimeDateStamp = timestamp;
+        data.descr[0].ForwarderChain = ~0u;
+        strcpy( data.module, basename );
+        strcpy( data.function.name, "func" );
+        data.original_thunks[0].u1.AddressOfData = DATA_RVA( &data.function );
+        data.thunks[0].u1.Function = 0xdeadbeef;
+
+        nt = nt_header_template;
+        memset( nt.OptionalHeader.DataDirectory, 0, sizeof(nt.OptionalHeader.DataDirectory) );
+        nt.OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_IMPORT].Size = sizeof(data.descr);
+        nt.OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_IMPORT].VirtualAddress = DATA_RVA( data.descr );
+
+        switch (test)
+        {
+        case 1:  /* stale timestamp */
+            data.descr[0].TimeDateStamp = timestamp + 1;
+            break;
+        case 3:  /* new style binding */
+        case 4:  /* new style binding with a stale timestamp */
+            data.descr[0].TimeDateStamp = ~0u;
+            data.descr[0].ForwarderChain = 0;
+            data.bound[0].TimeDateStamp = test == 3 ? timestamp : timestamp - 1;
+            data.bound[0].OffsetModuleName = offsetof( struct imports, bound_module ) - offsetof( struct imports, bound );
+            strcpy( data.bound_module, basename );
+            /* the bound import directory is normally in the headers, it's only accessed by rva */
+            nt.OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_BOUND_IMPORT].Size =
+                offsetof( struct imports, module ) - offsetof( struct imports, bound );
+            nt.OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_BOUND_IMPORT].VirtualAddress = DATA_RVA( data.bound );
+            break;
+        }
+        write_bound_test_image( dll_name, &nt, &data, sizeof(data) );
+
+        /* make sure that the target can't be loaded at its preferred base */
+        tmp = NULL;
+        if (test == 2)
+        {
+            tmp = VirtualAlloc( (char *)nt_header_template.OptionalHeader.ImageBase + 0x1000000, 0x10000,
+                                MEM_RESERVE, PAGE_NOACCESS );
+            ok( tmp != NULL, "VirtualAlloc failed err %lu\n", GetLastError() );
+        }
+
+        target = LoadLibraryA( target_name );
+        ok( target != NULL, "failed to load target err %lu\n", GetLastError() );
+        expect = GetProcAddress( target, "func" );
+        ok( expect == (char *)target + page_size + offsetof( struct exports, code ), "got %p\n", expect );
+        if (test == 2)
+            ok( (ULONG_PTR)target != nt_header_template.OptionalHeader.ImageBase + 0x1000000,
+                "target loaded at its preferred base %p\n", target );
+
+        mod = LoadLibraryA( dll_name );
+        ok( mod != NULL, "failed to load err %lu\n", GetLastError() );
+        if (mod)
+        {
+            ptr = (struct imports *)((char *)mod + page_size);
+            if (test == 0 || test == 3)
+                ok( ptr->thunks[0].u1.Function == 0xdeadbeef || broken( (void *)ptr->thunks[0].u1.Function == expect ),
+                    "bound thunk resolved to %p\n", (void *)ptr->thunks[0].u1.Function );
+            else
+                ok( (void *)ptr->thunks[0].u1.Function == expect, "thunk %p instead of %p\n",
+                    (void *)ptr->thunks[0].u1.Function, expect );
+            FreeLibrary( mod );
+        }
+        FreeLibrary( target );
+        if (tmp) VirtualFree( tmp, 0, MEM_RELEASE );
+        DeleteFileA( dll_name );
+        winetest_pop_context();
+#undef DATA_RVA
+    }
+    DeleteFileA( target_name );
+}
+
 #define MAX_COUNT 10
 static HANDLE attached_thread[MAX_COUNT];
 static DWORD attached_thread_count;
@@ -4282,6 +4463,7 @@ START_TEST(loader)
     test_ImportDescriptors();
     test_section_access();
     test_import_resolution();
+    test_bound_imports();
     test_ExitProcess();
     test_InMemoryOrderModuleList();
     test_LoadPackagedLibrary();
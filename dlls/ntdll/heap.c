@@ -263,6 +263,10 @@ struct bin
     /* list of groups with free blocks */
     SLIST_HEADER groups;
 
+    /* per-thread cache statistics, accumulated when a thread cache misses or is flushed */
+    LONG64 cache_hits;
+    LONG64 cache_misses;
+
     /* array of affinity reserved groups, interleaved with other bins to keep
      * all pointers of the same affinity and different bin grouped together,
      * and pointers of the same bin and different affinity away from each other,
@@ -289,6 +293,7 @@ struct heap
     /* end of the Windows 10 compatible struct layout */
 
     LONG             compat_info;   /* HeapCompatibilityInformation / heap frontend type */
+    LONG             serial;        /* Unique heap serial, to detect stale thread caches */
     struct list      entry;         /* Entry in process heap list */
     struct list      subheap_list;  /* Sub-heap list */
     struct list      large_list;    /* Large blocks list */
@@ -329,6 +334,7 @@ C_ASSERT( HEAP_MIN_LARGE_BLOCK_SIZE <= HEAP_INITIAL_GROW_SIZE );
 #define HEAP_CHECKING_ENABLED 0x80000000
 
 static struct heap *process_heap;  /* main process heap */
+static LONG next_heap_serial;
 
 static NTSTATUS heap_free_block_lfh( struct heap *heap, ULONG flags, struct block *block );
 
@@ -1521,6 +1527,7 @@ HANDLE WINAPI RtlCreateHeap( ULONG flags, void *addr, SIZE_T total_size, SIZE_T
     heap->flags         = (flags & ~HEAP_SHARED);
     heap->compat_info   = HEAP_STD;
     heap->magic         = HEAP_MAGIC;
+    heap->serial        = InterlockedIncrement( &next_heap_serial );
     heap->grow_size     = HEAP_INITIAL_GROW_SIZE;
     heap->min_size      = commit_size;
     list_init( &heap->subheap_list );
@@ -1768,14 +1775,23 @@ static inline struct block *group_get_block( struct group *group, SIZE_T block_s
     return (struct block *)(first_block + index * block_size);
 }
 
-/* lookup a free block using the group free_bits, the current thread must own the group */
-static inline struct block *group_find_free_block( struct group *group, SIZE_T block_size )
+/* lookup up to count free blocks using the group free_bits, the current thread must own the group */
+static inline UINT group_find_free_blocks( struct group *group, SIZE_T block_size, struct block **blocks, UINT count )
 {
-    ULONG i, free_bits = ReadNoFence( &group->free_bits );
+    ULONG i, free_bits = ReadNoFence( &group->free_bits ), mask = 0;
+    UINT n = 0;
+
     /* free_bits will never be 0 as the group is unlinked when it's fully used */
-    BitScanForward( &i, free_bits );
-    InterlockedAnd( &group->free_bits, ~(1 << i) );
-    return group_get_block( group, block_size, i );
+    while (n < count && BitScanForward( &i, free_bits ))
+    {
+        free_bits &= ~(1 << i);
+        mask |= 1 << i;
+        blocks[n++] = group_get_block( group, block_size, i );
+    }
+
+    /* other threads may only set free bits concurrently, the ones we've seen are still free */
+    InterlockedAnd( &group->free_bits, ~mask );
+    return n;
 }
 
 /* allocate a new group block using non-LFH allocation, returns a group owned by current thread */
@@ -1866,8 +1882,9 @@ static struct group *heap_acquire_bin_group( struct heap *heap, ULONG flags, SIZ
     return group_allocate( heap, flags, block_size );
 }
 
-/* release a thread owned and fully freed group to the bin shared group, or free its memory */
-static NTSTATUS heap_release_bin_group( struct heap *heap, ULONG flags, struct bin *bin, struct group *group )
+/* release a thread owned and fully freed group to the bin shared group, or free its memory if allowed */
+static NTSTATUS heap_release_bin_group( struct heap *heap, ULONG flags, struct bin *bin, struct group *group,
+                                        BOOL can_release )
 {
     ULONG affinity = group->affinity;
 
@@ -1878,7 +1895,7 @@ static NTSTATUS heap_release_bin_group( struct heap *heap, ULONG flags, struct b
         return STATUS_SUCCESS;
 
     /* try re-using the block group instead of releasing it */
-    if (RtlQueryDepthSList( &bin->groups ) <= ARRAY_SIZE(affinity_mapping))
+    if (!can_release || RtlQueryDepthSList( &bin->groups ) <= ARRAY_SIZE(affinity_mapping))
     {
         RtlInterlockedPushEntrySList( &bin->groups, &group->entry );
         return STATUS_SUCCESS;
@@ -1887,19 +1904,20 @@ static NTSTATUS heap_release_bin_group( struct heap *heap, ULONG flags, struct b
     return group_release( heap, flags, bin, group );
 }
 
-static struct block *find_free_bin_block( struct heap *heap, ULONG flags, SIZE_T block_size, struct bin *bin )
+static UINT find_free_bin_blocks( struct heap *heap, ULONG flags, SIZE_T block_size, struct bin *bin,
+                                  struct block **blocks, UINT count )
 {
     ULONG affinity = heap_current_thread_affinity();
-    struct block *block;
     struct group *group;
+    UINT n;
 
     /* acquire a group, the thread will own it and no other thread can clear free bits.
      * some other thread might still set the free bits if they are freeing blocks.
      */
-    if (!(group = heap_acquire_bin_group( heap, flags, block_size, bin ))) return NULL;
+    if (!(group = heap_acquire_bin_group( heap, flags, block_size, bin ))) return 0;
     group->affinity = affinity;
 
-    block = group_find_free_block( group, block_size );
+    n = group_find_free_blocks( group, block_size, blocks, count );
 
     /* serialize with heap_free_block_lfh: atomically set GROUP_FLAG_FREE when the free bits are all 0. */
     if (ReadNoFence( &group->free_bits ) || InterlockedCompareExchange( &group->free_bits, GROUP_FLAG_FREE, 0 ))
@@ -1909,63 +1927,267 @@ static struct block *find_free_bin_block( struct heap *heap, ULONG flags, SIZE_T
             RtlInterlockedPushEntrySList( &bin->groups, &group->entry );
     }
 
-    return block;
+    return n;
+}
+
+/* per-thread cache of free LFH blocks, in front of the bin groups.
+ *
+ * Blocks in the cache are marked as free, but their group free bit is kept cleared so that
+ * the group cannot be released. They are returned to their groups in batches, when the cache
+ * bin is full, when the heap slot is evicted, or when the thread exits.
+ */
+#define HEAP_CACHE_HEAP_COUNT  4
+#define HEAP_CACHE_BIN_COUNT   0x20
+#define HEAP_CACHE_DEPTH       16
+#define HEAP_CACHE_DETACHED    ((struct heap_thread_cache *)1)
+
+struct heap_cache_bin
+{
+    UINT          count;
+    UINT          hits;     /* not yet accumulated in the heap bin */
+    UINT          misses;   /* not yet accumulated in the heap bin */
+    struct block *blocks[HEAP_CACHE_DEPTH];
+};
+
+struct heap_cache
+{
+    struct heap          *heap;
+    LONG                  serial;
+    struct heap_cache_bin bins[HEAP_CACHE_BIN_COUNT];
+};
+
+struct heap_thread_cache
+{
+    UINT              next_evict;
+    struct heap_cache heaps[HEAP_CACHE_HEAP_COUNT];
+};
+
+/* the thread cache is allocated from the process heap, it must not be cached itself */
+C_ASSERT( BLOCK_SIZE_BIN( sizeof(struct heap_thread_cache) ) >= HEAP_CACHE_BIN_COUNT );
+
+static inline void *lfh_block_set_used( struct block *block, ULONG flags, SIZE_T block_size, SIZE_T size )
+{
+    block_set_type( block, BLOCK_TYPE_USED );
+    block_set_flags( block, (BYTE)~BLOCK_FLAG_LFH, BLOCK_USER_FLAGS( flags ) );
+    block->tail_size = block_size - sizeof(*block) - size;
+    initialize_block( block, 0, size, flags );
+    mark_block_tail( block, flags );
+    return block + 1;
+}
+
+static inline void lfh_block_set_free( struct block *block, ULONG flags )
+{
+    SIZE_T block_size = block_get_size( block );
+
+    valgrind_make_writable( block, sizeof(*block) );
+    block_set_type( block, BLOCK_TYPE_FREE );
+    block_set_flags( block, (BYTE)~BLOCK_FLAG_LFH, BLOCK_FLAG_FREE );
+    mark_block_free( block + 1, (char *)block + block_size - (char *)(block + 1), flags );
+}
+
+/* return free blocks to their groups, consecutive blocks of the same group are returned at once */
+static NTSTATUS bin_release_blocks( struct heap *heap, ULONG flags, struct bin *bin, struct block **blocks,
+                                    UINT count, BOOL can_release )
+{
+    NTSTATUS ret, status = STATUS_SUCCESS;
+    UINT i, j;
+
+    for (i = 0; i < count; i = j)
+    {
+        struct group *group = block_get_group( blocks[i] );
+        LONG mask = 0;
+
+        for (j = i; j < count && block_get_group( blocks[j] ) == group; j++)
+            mask |= 1 << block_get_group_index( blocks[j] );
+
+        /* if these were the last used blocks in a group and GROUP_FLAG_FREE was set */
+        if (InterlockedOr( &group->free_bits, mask ) == ~mask)
+        {
+            /* thread now owns the group, and can release it to its bin */
+            group->free_bits = ~GROUP_FLAG_FREE;
+            if ((ret = heap_release_bin_group( heap, flags, bin, group, can_release ))) status = ret;
+        }
+    }
+
+    return status;
+}
+
+static void heap_cache_bin_flush_stats( struct bin *bin, struct heap_cache_bin *cache_bin )
+{
+    if (cache_bin->hits) InterlockedAdd64( &bin->cache_hits, cache_bin->hits );
+    if (cache_bin->misses) InterlockedAdd64( &bin->cache_misses, cache_bin->misses );
+    cache_bin->hits = cache_bin->misses = 0;
+}
+
+/* check that a cached heap hasn't been destroyed, process_heap->cs must be held */
+static BOOL heap_cache_is_live( const struct heap_cache *cache )
+{
+    struct heap *heap;
+
+    if (!cache->heap) return FALSE;
+    if (cache->heap == process_heap) return TRUE;
+
+    LIST_FOR_EACH_ENTRY( heap, &process_heap->entry, struct heap, entry )
+        if (heap == cache->heap) return heap->serial == cache->serial;
+
+    return FALSE;
+}
+
+/* return all the cached blocks to their groups, process_heap->cs must be held.
+ * groups are never released here, as that would require taking the heap lock.
+ */
+static void heap_cache_flush( struct heap_cache *cache )
+{
+    struct heap *heap = cache->heap;
+    UINT i;
+
+    if (heap_cache_is_live( cache ))
+    {
+        for (i = 0; i < HEAP_CACHE_BIN_COUNT; ++i)
+        {
+            struct heap_cache_bin *cache_bin = cache->bins + i;
+            struct bin *bin = heap->bins + i;
+
+            heap_cache_bin_flush_stats( bin, cache_bin );
+            bin_release_blocks( heap, heap->flags, bin, cache_bin->blocks, cache_bin->count, FALSE );
+        }
+    }
+
+    /* blocks of destroyed heaps are simply forgotten */
+    memset( cache, 0, sizeof(*cache) );
+}
+
+static struct heap_cache *heap_find_thread_cache( struct heap *heap )
+{
+    struct heap_thread_cache *thread_cache = *get_heap_thread_cache_ptr();
+    UINT i;
+
+    if (!thread_cache || thread_cache == HEAP_CACHE_DETACHED) return NULL;
+
+    for (i = 0; i < HEAP_CACHE_HEAP_COUNT; ++i)
+    {
+        struct heap_cache *cache = thread_cache->heaps + i;
+        if (cache->heap == heap && cache->serial == heap->serial) return cache;
+    }
+
+    return NULL;
+}
+
+/* get the current thread cache for a heap, allocating or evicting a cache slot if needed */
+static struct heap_cache *heap_get_thread_cache( struct heap *heap )
+{
+    struct heap_thread_cache *thread_cache = *get_heap_thread_cache_ptr();
+    struct heap_cache *cache;
+    UINT i;
+
+    if (thread_cache == HEAP_CACHE_DETACHED) return NULL;
+    if ((cache = heap_find_thread_cache( heap ))) return cache;
+
+    if (!thread_cache)
+    {
+        if (!(thread_cache = RtlAllocateHeap( process_heap, HEAP_ZERO_MEMORY, sizeof(*thread_cache) ))) return NULL;
+        *get_heap_thread_cache_ptr() = thread_cache;
+    }
+
+    /* a slot with the same heap pointer but a different serial is from a destroyed heap */
+    for (i = 0; i < HEAP_CACHE_HEAP_COUNT; ++i)
+        if (!thread_cache->heaps[i].heap || thread_cache->heaps[i].heap == heap) break;
+
+    if (i < HEAP_CACHE_HEAP_COUNT)
+    {
+        cache = thread_cache->heaps + i;
+        memset( cache, 0, sizeof(*cache) );
+    }
+    else
+    {
+        cache = thread_cache->heaps + thread_cache->next_evict++ % HEAP_CACHE_HEAP_COUNT;
+        RtlEnterCriticalSection( &process_heap->cs );
+        heap_cache_flush( cache );
+        RtlLeaveCriticalSection( &process_heap->cs );
+    }
+
+    cache->heap = heap;
+    cache->serial = heap->serial;
+    return cache;
 }
 
 static NTSTATUS heap_allocate_block_lfh( struct heap *heap, ULONG flags, SIZE_T block_size,
                                          SIZE_T size, void **ret )
 {
     struct bin *bin, *last = heap->bins + BLOCK_SIZE_BIN_COUNT - 1;
-    struct block *block;
+    SIZE_T index = BLOCK_SIZE_BIN( block_size );
+    struct block *block = NULL;
+    struct heap_cache *cache;
 
-    bin = heap->bins + BLOCK_SIZE_BIN( block_size );
+    bin = heap->bins + index;
     if (bin == last) return STATUS_UNSUCCESSFUL;
 
     /* paired with WriteRelease in bin_try_enable. */
     if (!ReadAcquire( &bin->enabled )) return STATUS_UNSUCCESSFUL;
 
-    block_size = BLOCK_BIN_SIZE( BLOCK_SIZE_BIN( block_size ) );
+    block_size = BLOCK_BIN_SIZE( index );
 
-    if ((block = find_free_bin_block( heap, flags, block_size, bin )))
+    if (index < HEAP_CACHE_BIN_COUNT && (cache = heap_get_thread_cache( heap )))
     {
-        block_set_type( block, BLOCK_TYPE_USED );
-        block_set_flags( block, (BYTE)~BLOCK_FLAG_LFH, BLOCK_USER_FLAGS( flags ) );
-        block->tail_size = block_size - sizeof(*block) - size;
-        initialize_block( block, 0, size, flags );
-        mark_block_tail( block, flags );
-        *ret = block + 1;
+        struct heap_cache_bin *cache_bin = cache->bins + index;
+        UINT i, count;
+
+        if (cache_bin->count) cache_bin->hits++;
+        else
+        {
+            /* refill half of the cache at once, and pop the blocks in address order */
+            cache_bin->misses++;
+            heap_cache_bin_flush_stats( bin, cache_bin );
+            count = find_free_bin_blocks( heap, flags, block_size, bin, cache_bin->blocks, HEAP_CACHE_DEPTH / 2 );
+            for (i = 0; i < count / 2; ++i)
+            {
+                block = cache_bin->blocks[i];
+                cache_bin->blocks[i] = cache_bin->blocks[count - 1 - i];
+                cache_bin->blocks[count - 1 - i] = block;
+            }
+            cache_bin->count = count;
+        }
+
+        block = cache_bin->count ? cache_bin->blocks[--cache_bin->count] : NULL;
     }
+    else find_free_bin_blocks( heap, flags, block_size, bin, &block, 1 );
 
+    if (block) *ret = lfh_block_set_used( block, flags, block_size, size );
     return block ? STATUS_SUCCESS : STATUS_NO_MEMORY;
 }
 
 static NTSTATUS heap_free_block_lfh( struct heap *heap, ULONG flags, struct block *block )
 {
     struct bin *bin, *last = heap->bins + BLOCK_SIZE_BIN_COUNT - 1;
-    SIZE_T i, block_size = block_get_size( block );
-    struct group *group = block_get_group( block );
+    SIZE_T index = BLOCK_SIZE_BIN( block_get_size( block ) );
     NTSTATUS status = STATUS_SUCCESS;
+    struct heap_cache *cache;
 
     if (!(block_get_flags( block ) & BLOCK_FLAG_LFH)) return STATUS_UNSUCCESSFUL;
 
-    bin = heap->bins + BLOCK_SIZE_BIN( block_size );
+    bin = heap->bins + index;
     if (bin == last) return STATUS_UNSUCCESSFUL;
 
-    i = block_get_group_index( block );
-    valgrind_make_writable( block, sizeof(*block) );
-    block_set_type( block, BLOCK_TYPE_FREE );
-    block_set_flags( block, (BYTE)~BLOCK_FLAG_LFH, BLOCK_FLAG_FREE );
-    mark_block_free( block + 1, (char *)block + block_size - (char *)(block + 1), flags );
+    lfh_block_set_free( block, flags );
 
-    /* if this was the last used block in a group and GROUP_FLAG_FREE was set */
-    if (InterlockedOr( &group->free_bits, 1 << i ) == ~(1 << i))
+    if (index < HEAP_CACHE_BIN_COUNT && (cache = heap_get_thread_cache( heap )))
     {
-        /* thread now owns the group, and can release it to its bin */
-        group->free_bits = ~GROUP_FLAG_FREE;
-        status = heap_release_bin_group( heap, flags, bin, group );
+        struct heap_cache_bin *cache_bin = cache->bins + index;
+
+        if (cache_bin->count == HEAP_CACHE_DEPTH)
+        {
+            /* return the least recently freed half of the cache to the groups */
+            status = bin_release_blocks( heap, flags, bin, cache_bin->blocks, HEAP_CACHE_DEPTH / 2, TRUE );
+            memmove( cache_bin->blocks, cache_bin->blocks + HEAP_CACHE_DEPTH / 2,
+                     (HEAP_CACHE_DEPTH - HEAP_CACHE_DEPTH / 2) * sizeof(*cache_bin->blocks) );
+            cache_bin->count -= HEAP_CACHE_DEPTH / 2;
+        }
+
+        cache_bin->blocks[cache_bin->count++] = block;
+        return status;
     }
 
-    return status;
+    return bin_release_blocks( heap, flags, bin, &block, 1, TRUE );
 }
 
 static void bin_try_enable( struct heap *heap, struct bin *bin )
@@ -2014,16 +2236,29 @@ static void heap_thread_detach_bin_groups( struct heap *heap )
 
 void heap_thread_detach(void)
 {
+    struct heap_thread_cache *thread_cache = *get_heap_thread_cache_ptr();
     struct heap *heap;
+    UINT i;
+
+    /* blocks freed from now on go directly to their groups */
+    *get_heap_thread_cache_ptr() = HEAP_CACHE_DETACHED;
 
     RtlEnterCriticalSection( &process_heap->cs );
 
+    if (thread_cache && thread_cache != HEAP_CACHE_DETACHED)
+    {
+        for (i = 0; i < HEAP_CACHE_HEAP_COUNT; ++i)
+            heap_cache_flush( thread_cache->heaps + i );
+    }
+
     LIST_FOR_EACH_ENTRY( heap, &process_heap->entry, struct heap, entry )
         heap_thread_detach_bin_groups( heap );
 
     heap_thread_detach_bin_groups( process_heap );
 
     RtlLeaveCriticalSection( &process_heap->cs );
+
+    if (thread_cache && thread_cache != HEAP_CACHE_DETACHED) RtlFreeHeap( process_heap, 0, thread_cache );
 }
 
 /***********************************************************************
@@ -2546,6 +2781,71 @@ ULONG WINAPI RtlGetProcessHeaps( ULONG count, HANDLE *heaps )
     return total;
 }
 
+static void heap_add_group_statistics( struct group *group, HEAP_WINE_STATISTICS *stats )
+{
+    SIZE_T block_size = block_get_size( &group->first_block ), bin = BLOCK_SIZE_BIN( block_size );
+    ULONG free_bits = ReadNoFence( &group->free_bits ) & ~GROUP_FLAG_FREE;
+    UINT free_count = 0;
+
+    if (bin >= stats->BinCount) return;
+    for (; free_bits; free_bits &= free_bits - 1) free_count++;
+
+    stats->Bins[bin].TotalBytes += GROUP_BLOCK_COUNT * block_size;
+    stats->Bins[bin].UsedBytes += (GROUP_BLOCK_COUNT - free_count) * block_size;
+}
+
+/* blocks in thread caches are accounted as used, and cache counters of other threads are
+ * only accumulated on their next cache miss, so the statistics are approximate.
+ */
+static void heap_get_statistics( struct heap *heap, HEAP_WINE_STATISTICS *stats )
+{
+    struct heap_cache *cache;
+    const ARENA_LARGE *large;
+    const SUBHEAP *subheap;
+    struct block *block;
+    UINT i;
+
+    memset( stats, 0, offsetof( HEAP_WINE_STATISTICS, Bins[BLOCK_SIZE_BIN_COUNT - 1] ) );
+    stats->BinCount = BLOCK_SIZE_BIN_COUNT - 1;
+    if (!heap->bins) return;
+
+    if ((cache = heap_find_thread_cache( heap )))
+    {
+        for (i = 0; i < HEAP_CACHE_BIN_COUNT; ++i)
+            heap_cache_bin_flush_stats( heap->bins + i, cache->bins + i );
+    }
+
+    for (i = 0; i < stats->BinCount; ++i)
+    {
+        struct bin *bin = heap->bins + i;
+        stats->Bins[i].BlockSize = BLOCK_BIN_SIZE( i );
+        stats->Bins[i].CacheHits = InterlockedCompareExchange64( &bin->cache_hits, 0, 0 );
+        stats->Bins[i].CacheMisses = InterlockedCompareExchange64( &bin->cache_misses, 0, 0 );
+        stats->CacheHits += stats->Bins[i].CacheHits;
+        stats->CacheMisses += stats->Bins[i].CacheMisses;
+    }
+
+    heap_lock( heap, 0 );
+
+    LIST_FOR_EACH_ENTRY( subheap, &heap->subheap_list, SUBHEAP, entry )
+    {
+        for (block = first_block( subheap ); block; block = next_block( subheap, block ))
+        {
+            if (block_get_flags( block ) & BLOCK_FLAG_FREE) continue;
+            if (!(block_get_flags( block ) & BLOCK_FLAG_LFH)) continue;
+            heap_add_group_statistics( (struct group *)(block + 1), stats );
+        }
+    }
+
+    LIST_FOR_EACH_ENTRY( large, &heap->large_list, ARENA_LARGE, entry )
+    {
+        if (!(block_get_flags( &large->block ) & BLOCK_FLAG_LFH)) continue;
+        heap_add_group_statistics( (struct group *)(&large->block + 1), stats );
+    }
+
+    heap_unlock( heap, 0 );
+}
+
 /***********************************************************************
  *           RtlQueryHeapInformation    (NTDLL.@)
  */
@@ -2557,7 +2857,7 @@ NTSTATUS WINAPI RtlQueryHeapInformation( HANDLE handle, HEAP_INFORMATION_CLASS i
 
     TRACE( "handle %p, info_class %u, info %p, size_in %Iu, size_out %p.\n", handle, info_class, info, size_in, size_out );
 
-    switch (info_class)
+    switch ((ULONG)info_class)
     {
     case HeapCompatibilityInformation:
         if (!(heap = unsafe_heap_from_handle( handle, 0, &flags ))) return STATUS_ACCESS_VIOLATION;
@@ -2566,6 +2866,17 @@ NTSTATUS WINAPI RtlQueryHeapInformation( HANDLE handle, HEAP_INFORMATION_CLASS i
         *(ULONG *)info = ReadNoFence( &heap->compat_info );
         return STATUS_SUCCESS;
 
+    case HeapWineStatistics:
+    {
+        SIZE_T needed = offsetof( HEAP_WINE_STATISTICS, Bins[BLOCK_SIZE_BIN_COUNT - 1] );
+
+        if (!(heap = unsafe_heap_from_handle( handle, 0, &flags ))) return STATUS_ACCESS_VIOLATION;
+        if (size_out) *size_out = needed;
+        if (size_in < needed) return STATUS_BUFFER_TOO_SMALL;
+        heap_get_statistics( heap, info );
+        return STATUS_SUCCESS;
+    }
+
     default:
         FIXME( "HEAP_INFORMATION_CLASS %u not implemented!\n", info_class );
         return STATUS_INVALID_INFO_CLASS;
@@ -134,6 +134,9 @@ typedef struct _wine_modref
     struct file_id        id;
     ULONG                 CheckSum;
     BOOL                  system;
+    BOOL                  at_base;           /* mapped at its preferred base address */
+    DWORD                *export_index;      /* hash index of exported names, built on demand */
+    DWORD                 export_index_mask; /* export_index size - 1 */
 } WINE_MODREF;
 
 static UINT tls_module_count;      /* number of modules with TLS directory */
@@ -188,7 +191,7 @@ static NTSTATUS load_dll( const WCHAR *load_path, const WCHAR *libname, DWORD fl
 static NTSTATUS process_attach( LDR_DDAG_NODE *node, LPVOID lpReserved );
 static FARPROC find_ordinal_export( HMODULE module, const IMAGE_EXPORT_DIRECTORY *exports,
                                     DWORD exp_size, DWORD ordinal, LPCWSTR load_path );
-static FARPROC find_named_export( HMODULE module, const IMAGE_EXPORT_DIRECTORY *exports,
+static FARPROC find_named_export( WINE_MODREF *wm, const IMAGE_EXPORT_DIRECTORY *exports,
                                   DWORD exp_size, const char *name, int hint, LPCWSTR load_path );
 
 /* convert PE image VirtualAddress to Real Address */
@@ -946,7 +949,7 @@ static FARPROC find_forwarded_export( HMODULE module, const char *forward, LPCWS
             proc = find_ordinal_export( wm->ldr.DllBase, exports, exp_size,
                                         atoi(name+1) - exports->Base, load_path );
         } else
-            proc = find_named_export( wm->ldr.DllBase, exports, exp_size, name, -1, load_path );
+            proc = find_named_export( wm, exports, exp_size, name, -1, load_path );
     }
 
     if (!proc)
@@ -1024,15 +1027,80 @@ static int find_name_in_exports( HMODULE module, const IMAGE_EXPORT_DIRECTORY *e
 }
 
 
+/* modules with fewer exported names than this are simply searched with a binary search */
+#define MIN_EXPORT_INDEX_NAMES 64
+
+static inline DWORD hash_export_name( const char *name )
+{
+    DWORD hash = 2166136261u;
+    while (*name) hash = (hash ^ (BYTE)*name++) * 16777619;
+    return hash;
+}
+
+/*************************************************************************
+ *		build_export_index
+ *
+ * Build a hash index of the module exported names, mapping to the name positions.
+ * The loader_section must be locked while calling this function.
+ */
+static BOOL build_export_index( WINE_MODREF *wm, const IMAGE_EXPORT_DIRECTORY *exports )
+{
+    const DWORD *names = get_rva( wm->ldr.DllBase, exports->AddressOfNames );
+    DWORD i, pos, size = 1;
+
+    while (size < 2 * exports->NumberOfNames) size <<= 1;
+    if (!(wm->export_index = RtlAllocateHeap( GetProcessHeap(), HEAP_ZERO_MEMORY,
+                                              size * sizeof(*wm->export_index) )))
+        return FALSE;
+    wm->export_index_mask = size - 1;
+
+    /* entries are stored as position + 1, zero marks an empty slot */
+    for (i = 0; i < exports->NumberOfNames; i++)
+    {
+        pos = hash_export_name( get_rva( wm->ldr.DllBase, names[i] ) ) & wm->export_index_mask;
+        while (wm->export_index[pos]) pos = (pos + 1) & wm->export_index_mask;
+        wm->export_index[pos] = i + 1;
+    }
+    return TRUE;
+}
+
+/*************************************************************************
+ *		find_name_in_export_index
+ *
+ * Helper for find_named_export, using the module export name index when possible.
+ * The loader_section must be locked while calling this function.
+ */
+static int find_name_in_export_index( WINE_MODREF *wm, const IMAGE_EXPORT_DIRECTORY *exports, const char *name )
+{
+    HMODULE module = wm->ldr.DllBase;
+    const WORD *ordinals = get_rva( module, exports->AddressOfNameOrdinals );
+    const DWORD *names = get_rva( module, exports->AddressOfNames );
+    DWORD pos, index;
+
+    if (exports->NumberOfNames < MIN_EXPORT_INDEX_NAMES) return find_name_in_exports( module, exports, name );
+    if (!wm->export_index && !build_export_index( wm, exports ))
+        return find_name_in_exports( module, exports, name );
+
+    pos = hash_export_name( name ) & wm->export_index_mask;
+    while ((index = wm->export_index[pos]))
+    {
+        if (!strcmp( get_rva( module, names[index - 1] ), name )) return ordinals[index - 1];
+        pos = (pos + 1) & wm->export_index_mask;
+    }
+    return -1;
+}
+
+
 /*************************************************************************
  *		find_named_export
  *
  * Find an exported function by name.
  * The loader_section must be locked while calling this function.
  */
-static FARPROC find_named_export( HMODULE module, const IMAGE_EXPORT_DIRECTORY *exports,
+static FARPROC find_named_export( WINE_MODREF *wm, const IMAGE_EXPORT_DIRECTORY *exports,
                                   DWORD exp_size, const char *name, int hint, LPCWSTR load_path )
 {
+    HMODULE module = wm->ldr.DllBase;
     const WORD *ordinals = get_rva( module, exports->AddressOfNameOrdinals );
     const DWORD *names = get_rva( module, exports->AddressOfNames );
     int ordinal;
@@ -1045,8 +1113,8 @@ static FARPROC find_named_export( HMODULE module, const IMAGE_EXPORT_DIRECTORY *
             return find_ordinal_export( module, exports, exp_size, ordinals[hint], load_path );
     }
 
-    /* then do a binary search */
-    if ((ordinal = find_name_in_exports( module, exports, name )) == -1) return NULL;
+    /* then look it up in the name index */
+    if ((ordinal = find_name_in_export_index( wm, exports, name )) == -1) return NULL;
     return find_ordinal_export( module, exports, exp_size, ordinal, load_path );
 
 }
@@ -1079,6 +1147,79 @@ void * WINAPI RtlFindExportedRoutineByName( HMODULE module, const char *name )
 }
 
 
+/*************************************************************************
+ *		is_bound_module_valid
+ *
+ * Check that a module that an image has been bound to is loaded at its preferred base,
+ * with the same timestamp that was recorded at bind time.
+ * The loader_section must be locked while calling this function.
+ */
+static BOOL is_bound_module_valid( const WINE_MODREF *wm, DWORD timestamp )
+{
+    const IMAGE_NT_HEADERS *nt;
+
+    if (!wm || !wm->at_base) return FALSE;
+    if (!(nt = RtlImageNtHeader( wm->ldr.DllBase ))) return FALSE;
+    return nt->FileHeader.TimeDateStamp == timestamp;
+}
+
+
+/*************************************************************************
+ *		is_import_bound
+ *
+ * Check if an import descriptor has been prebound to the currently loaded dll, in which
+ * case the import address table already contains the right addresses.
+ * The loader_section must be locked while calling this function.
+ */
+static BOOL is_import_bound( HMODULE module, const IMAGE_IMPORT_DESCRIPTOR *descr, const WINE_MODREF *wm_imp )
+{
+    const IMAGE_BOUND_IMPORT_DESCRIPTOR *bound, *bound_dir;
+    const IMAGE_BOUND_FORWARDER_REF *ref;
+    const char *name = get_rva( module, descr->Name );
+    WCHAR buffer[64];
+    DWORD size;
+    UINT i, j;
+
+    if (!descr->TimeDateStamp || !descr->OriginalFirstThunk) return FALSE;
+#ifdef __arm64ec__
+    /* hybrid modules export different addresses to x64 and ARM64EC code */
+    return FALSE;
+#endif
+    /* relay and snoop thunks replace the exported addresses */
+    if (TRACE_ON(relay) || TRACE_ON(snoop)) return FALSE;
+
+    /* old style binding, forwarded entries still need to be resolved */
+    if (descr->TimeDateStamp != ~0u)
+        return descr->ForwarderChain == ~0u && is_bound_module_valid( wm_imp, descr->TimeDateStamp );
+
+    if (!(bound_dir = RtlImageDirectoryEntryToData( module, TRUE, IMAGE_DIRECTORY_ENTRY_BOUND_IMPORT, &size )))
+        return FALSE;
+
+    for (bound = bound_dir; (char *)(bound + 1) <= (char *)bound_dir + size && bound->OffsetModuleName;
+         bound = (const IMAGE_BOUND_IMPORT_DESCRIPTOR *)(ref + bound->NumberOfModuleForwarderRefs))
+    {
+        ref = (const IMAGE_BOUND_FORWARDER_REF *)(bound + 1);
+        if ((char *)(ref + bound->NumberOfModuleForwarderRefs) > (char *)bound_dir + size) return FALSE;
+        if (_stricmp( (const char *)bound_dir + bound->OffsetModuleName, name )) continue;
+        if (!is_bound_module_valid( wm_imp, bound->TimeDateStamp )) return FALSE;
+
+        /* forwarded entries are bound too, the target modules must be valid as well */
+        for (i = 0; i < bound->NumberOfModuleForwarderRefs; i++)
+        {
+            const char *ref_name = (const char *)bound_dir + ref[i].OffsetModuleName;
+
+            for (j = 0; j < ARRAY_SIZE(buffer) - 1 && ref_name[j]; j++) buffer[j] = (BYTE)ref_name[j];
+            if (ref_name[j]) return FALSE;
+            buffer[j] = 0;
+            if (!is_bound_module_valid( find_basename_module( buffer ), ref[i].TimeDateStamp )) return FALSE;
+        }
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+
 /*************************************************************************
  *		import_dll
  *
@@ -1129,6 +1270,13 @@ static BOOL import_dll( HMODULE module, const IMAGE_IMPORT_DESCRIPTOR *descr, LP
         return FALSE;
     }
 
+    if (is_import_bound( module, descr, wmImp ))
+    {
+        TRACE_(imports)( "--- %s is prebound, skipping import resolution\n", name );
+        *pwm = wmImp;
+        return TRUE;
+    }
+
     /* unprotect the import address table since it can be located in
      * readonly section */
     while (import_list[protect_size].u1.Ordinal) protect_size++;
@@ -1187,7 +1335,7 @@ static BOOL import_dll( HMODULE module, const IMAGE_IMPORT_DESCRIPTOR *descr, LP
         {
             IMAGE_IMPORT_BY_NAME *pe_name;
             pe_name = get_rva( module, (DWORD)import_list->u1.AddressOfData );
-            thunk_list->u1.Function = (ULONG_PTR)find_named_export( imp_mod, exports, exp_size,
+            thunk_list->u1.Function = (ULONG_PTR)find_named_export( wmImp, exports, exp_size,
                                                                     (const char*)pe_name->Name,
                                                                     pe_name->Hint, load_path );
             if (!thunk_list->u1.Function)
@@ -2012,7 +2160,7 @@ NTSTATUS WINAPI LdrGetProcedureAddress(HMODULE module, const ANSI_STRING *name,
     else if ((exports = RtlImageDirectoryEntryToData( module, TRUE,
                                                       IMAGE_DIRECTORY_ENTRY_EXPORT, &exp_size )))
     {
-        void *proc = name ? find_named_export( module, exports, exp_size, name->Buffer, -1, NULL )
+        void *proc = name ? find_named_export( wm, exports, exp_size, name->Buffer, -1, NULL )
                           : find_ordinal_export( module, exports, exp_size, ord - exports->Base, NULL );
         if (proc)
         {
@@ -2202,6 +2350,8 @@ static NTSTATUS build_module( LPCWSTR load_path, const UNICODE_STRING *nt_name,
     if (image_info->LoaderFlags) wm->ldr.Flags |= LDR_COR_IMAGE;
     if (image_info->ComPlusILOnly) wm->ldr.Flags |= LDR_COR_ILONLY;
     wm->system = system;
+    /* the transfer address is computed from the preferred image base */
+    wm->at_base = (image_info->TransferAddress == get_rva( *module, nt->OptionalHeader.AddressOfEntryPoint ));
 
     update_load_config( *module );
 
@@ -3933,6 +4083,7 @@ static void free_modref( WINE_MODREF *wm )
     NtUnmapViewOfSection( NtCurrentProcess(), wm->ldr.DllBase );
     if (cached_modref == wm) cached_modref = NULL;
     RtlFreeUnicodeString( &wm->ldr.FullDllName );
+    RtlFreeHeap( GetProcessHeap(), 0, wm->export_index );
     RtlFreeHeap( GetProcessHeap(), 0, wm );
 }
 
@@ -158,6 +158,32 @@ static inline void ascii_to_unicode( WCHAR *dst, const char *src, size_t len )
 extern TEB_FLS_DATA *fls_alloc_data(void);
 extern void heap_thread_detach(void);
 
+/* Wine-specific, returned by RtlQueryHeapInformation( HeapWineStatistics ) */
+#define HeapWineStatistics ((HEAP_INFORMATION_CLASS)1000)
+
+typedef struct _HEAP_WINE_BIN_STATISTICS
+{
+    SIZE_T    BlockSize;
+    ULONGLONG CacheHits;
+    ULONGLONG CacheMisses;
+    SIZE_T    TotalBytes;
+    SIZE_T    UsedBytes;
+} HEAP_WINE_BIN_STATISTICS;
+
+typedef struct _HEAP_WINE_STATISTICS
+{
+    ULONGLONG CacheHits;
+    ULONGLONG CacheMisses;
+    ULONG     BinCount;
+    HEAP_WINE_BIN_STATISTICS Bins[1];
+} HEAP_WINE_STATISTICS;
+
+/* the last pointer of the ntdll private data in the TEB is not used by the Unix side */
+static inline void **get_heap_thread_cache_ptr(void)
+{
+    return (void **)(&NtCurrentTeb()->GdiTebBatch + 1) - 1;
+}
+
 #ifdef __arm64ec__
 
 extern void *__os_arm64x_check_call;
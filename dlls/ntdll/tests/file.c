@@ -942,9 +942,9 @@ static void WINAPI user_apc_proc(ULONG_PTR arg)
 
 static void test_set_io_completion(void)
 {
-    FILE_IO_COMPLETION_INFORMATION info[2] = {{0}};
+    FILE_IO_COMPLETION_INFORMATION info[2] = {{0}}, many[100];
     LARGE_INTEGER timeout = {{0}};
-    unsigned int apc_count;
+    unsigned int apc_count, i;
     IO_STATUS_BLOCK iosb;
     ULONG_PTR key, value;
     NTSTATUS res;
@@ -1049,6 +1049,33 @@ static void test_set_io_completion(void)
         info[0].IoStatusBlock.Information );
     ok( info[0].IoStatusBlock.Status == 56, "wrong status %#lx\n", info[0].IoStatusBlock.Status);
 
+    for (i = 0; i < ARRAY_SIZE(many) + 1; ++i)
+    {
+        res = pNtSetIoCompletion( h, i, i * 2, 0, i );
+        ok( res == STATUS_SUCCESS, "NtSetIoCompletion failed: %#lx\n", res );
+    }
+
+    count = 0xdeadbeef;
+    res = pNtRemoveIoCompletionEx( h, many, ARRAY_SIZE(many), &count, &timeout, FALSE );
+    ok( res == STATUS_SUCCESS, "NtRemoveIoCompletionEx failed: %#lx\n", res );
+    ok( count == ARRAY_SIZE(many), "wrong count %lu\n", count );
+    for (i = 0; i < count; ++i)
+    {
+        ok( many[i].CompletionKey == i, "%u: wrong key %#Ix\n", i, many[i].CompletionKey );
+        ok( many[i].CompletionValue == i * 2, "%u: wrong value %#Ix\n", i, many[i].CompletionValue );
+        ok( many[i].IoStatusBlock.Information == i, "%u: wrong information %#Ix\n",
+            i, many[i].IoStatusBlock.Information );
+    }
+
+    count = get_pending_msgs(h);
+    ok( count == 1, "Unexpected msg count: %ld\n", count );
+
+    count = 0xdeadbeef;
+    res = pNtRemoveIoCompletionEx( h, many, ARRAY_SIZE(many), &count, &timeout, FALSE );
+    ok( res == STATUS_SUCCESS, "NtRemoveIoCompletionEx failed: %#lx\n", res );
+    ok( count == 1, "wrong count %lu\n", count );
+    ok( many[0].CompletionKey == ARRAY_SIZE(many), "wrong key %#Ix\n", many[0].CompletionKey );
+
     apc_count = 0;
     QueueUserAPC( user_apc_proc, GetCurrentThread(), (ULONG_PTR)&apc_count );
 
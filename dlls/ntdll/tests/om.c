@@ -57,6 +57,7 @@ static NTSTATUS (WINAPI *pNtOpenSymbolicLinkObject)(PHANDLE, ACCESS_MASK, POBJEC
 static NTSTATUS (WINAPI *pNtCreateSymbolicLinkObject)(PHANDLE, ACCESS_MASK, POBJECT_ATTRIBUTES, PUNICODE_STRING);
 static NTSTATUS (WINAPI *pNtQuerySymbolicLinkObject)(HANDLE,PUNICODE_STRING,PULONG);
 static NTSTATUS (WINAPI *pNtQueryObject)(HANDLE,OBJECT_INFORMATION_CLASS,PVOID,ULONG,PULONG);
+static NTSTATUS (WINAPI *pNtSetInformationObject)(HANDLE,OBJECT_INFORMATION_CLASS,PVOID,ULONG);
 static NTSTATUS (WINAPI *pNtReleaseSemaphore)(HANDLE, ULONG, PULONG);
 static NTSTATUS (WINAPI *pNtCreateKeyedEvent)( HANDLE *, ACCESS_MASK, const OBJECT_ATTRIBUTES *, ULONG );
 static NTSTATUS (WINAPI *pNtOpenKeyedEvent)( HANDLE *, ACCESS_MASK, const OBJECT_ATTRIBUTES * );
@@ -2300,6 +2301,91 @@ static void test_duplicate_object(void)
     if (!status) pNtClose( handle );
 }
 
+static void test_close_handle(void)
+{
+    OBJECT_HANDLE_FLAG_INFORMATION flags;
+    HANDLE handles[100], event, dup;
+    NTSTATUS status;
+    unsigned int i;
+    DWORD ret;
+
+    status = pNtCreateEvent( &event, EVENT_ALL_ACCESS, NULL, NotificationEvent, FALSE );
+    ok( !status, "NtCreateEvent failed %lx\n", status );
+    status = pNtClose( event );
+    ok( !status, "NtClose failed %lx\n", status );
+    status = pNtClose( event );
+    ok( status == STATUS_INVALID_HANDLE, "NtClose returned %lx\n", status );
+
+    /* a duplicate keeps the object alive after the original is closed */
+    status = pNtCreateEvent( &event, EVENT_ALL_ACCESS, NULL, NotificationEvent, FALSE );
+    ok( !status, "NtCreateEvent failed %lx\n", status );
+    status = pNtDuplicateObject( GetCurrentProcess(), event, GetCurrentProcess(),
+                                 &dup, 0, 0, DUPLICATE_SAME_ACCESS );
+    ok( !status, "NtDuplicateObject failed %lx\n", status );
+    status = pNtClose( event );
+    ok( !status, "NtClose failed %lx\n", status );
+    ok( SetEvent( dup ), "SetEvent failed %lu\n", GetLastError() );
+    ret = WaitForSingleObject( dup, 0 );
+    ok( ret == WAIT_OBJECT_0, "WaitForSingleObject returned %lu\n", ret );
+    status = pNtDuplicateObject( GetCurrentProcess(), dup, GetCurrentProcess(),
+                                 &event, 0, 0, DUPLICATE_SAME_ACCESS | DUPLICATE_CLOSE_SOURCE );
+    ok( !status, "NtDuplicateObject failed %lx\n", status );
+    status = pNtClose( dup );
+    ok( status == STATUS_INVALID_HANDLE, "NtClose returned %lx\n", status );
+    status = pNtClose( event );
+    ok( !status, "NtClose failed %lx\n", status );
+
+    status = pNtCreateEvent( &event, EVENT_ALL_ACCESS, NULL, NotificationEvent, FALSE );
+    ok( !status, "NtCreateEvent failed %lx\n", status );
+    ok( SetHandleInformation( event, HANDLE_FLAG_PROTECT_FROM_CLOSE, HANDLE_FLAG_PROTECT_FROM_CLOSE ),
+        "SetHandleInformation failed %lu\n", GetLastError() );
+    status = pNtClose( event );
+    ok( status == STATUS_HANDLE_NOT_CLOSABLE, "NtClose returned %lx\n", status );
+    ok( SetHandleInformation( event, HANDLE_FLAG_PROTECT_FROM_CLOSE, 0 ),
+        "SetHandleInformation failed %lu\n", GetLastError() );
+    status = pNtClose( event );
+    ok( !status, "NtClose failed %lx\n", status );
+
+    status = pNtCreateEvent( &event, EVENT_ALL_ACCESS, NULL, NotificationEvent, FALSE );
+    ok( !status, "NtCreateEvent failed %lx\n", status );
+    status = pNtDuplicateObject( GetCurrentProcess(), event, GetCurrentProcess(),
+                                 &dup, 0, 0, DUPLICATE_SAME_ACCESS );
+    ok( !status, "NtDuplicateObject failed %lx\n", status );
+    flags.Inherit = FALSE;
+    flags.ProtectFromClose = TRUE;
+    status = pNtSetInformationObject( dup, ObjectHandleFlagInformation, &flags, sizeof(flags) );
+    ok( !status, "NtSetInformationObject failed %lx\n", status );
+    status = pNtClose( dup );
+    ok( status == STATUS_HANDLE_NOT_CLOSABLE, "NtClose returned %lx\n", status );
+    memset( &flags, 0xcc, sizeof(flags) );
+    status = pNtQueryObject( dup, ObjectHandleFlagInformation, &flags, sizeof(flags), NULL );
+    ok( !status, "NtQueryObject failed %lx\n", status );
+    ok( flags.ProtectFromClose, "handle is not protected\n" );
+    status = pNtClose( event );
+    ok( !status, "NtClose failed %lx\n", status );
+    flags.ProtectFromClose = FALSE;
+    status = pNtSetInformationObject( dup, ObjectHandleFlagInformation, &flags, sizeof(flags) );
+    ok( !status, "NtSetInformationObject failed %lx\n", status );
+    status = pNtClose( dup );
+    ok( !status, "NtClose failed %lx\n", status );
+
+    for (i = 0; i < ARRAY_SIZE(handles); i++)
+    {
+        status = pNtCreateEvent( &handles[i], EVENT_ALL_ACCESS, NULL, SynchronizationEvent, FALSE );
+        ok( !status, "NtCreateEvent failed %lx\n", status );
+    }
+    for (i = 0; i < ARRAY_SIZE(handles); i++)
+    {
+        status = pNtClose( handles[i] );
+        ok( !status, "%u: NtClose failed %lx\n", i, status );
+    }
+    for (i = 0; i < ARRAY_SIZE(handles); i++)
+    {
+        status = pNtClose( handles[i] );
+        ok( status == STATUS_INVALID_HANDLE, "%u: NtClose returned %lx\n", i, status );
+    }
+}
+
 static void test_object_types(void)
 {
     static const struct { const WCHAR *name; GENERIC_MAPPING mapping; ULONG mask, broken; } tests[] =
@@ -3186,6 +3272,7 @@ START_TEST(om)
     pNtCreateSection        =  (void *)GetProcAddress(hntdll, "NtCreateSection");
     pNtOpenSection          =  (void *)GetProcAddress(hntdll, "NtOpenSection");
     pNtQueryObject          =  (void *)GetProcAddress(hntdll, "NtQueryObject");
+    pNtSetInformationObject =  (void *)GetProcAddress(hntdll, "NtSetInformationObject");
     pNtReleaseSemaphore     =  (void *)GetProcAddress(hntdll, "NtReleaseSemaphore");
     pNtCreateKeyedEvent     =  (void *)GetProcAddress(hntdll, "NtCreateKeyedEvent");
     pNtOpenKeyedEvent       =  (void *)GetProcAddress(hntdll, "NtOpenKeyedEvent");
@@ -3214,6 +3301,7 @@ START_TEST(om)
     test_process();
     test_token();
     test_duplicate_object();
+    test_close_handle();
     test_object_types();
     test_get_next_thread();
     test_globalroot();
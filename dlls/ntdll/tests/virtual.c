@@ -2273,6 +2273,59 @@ static void test_NtFreeVirtualMemory(void)
     ok(status == STATUS_SUCCESS, "Unexpected status %08lx.\n", status);
 }
 
+static void test_large_pages(void)
+{
+    const KSHARED_USER_DATA *user_shared_data = (void *)0x7ffe0000;
+    SIZE_T size, large_page_size = user_shared_data->LargePageMinimum;
+    MEMORY_WORKING_SET_EX_INFORMATION info;
+    NTSTATUS status;
+    void *addr;
+
+    if (!large_page_size)
+    {
+        skip("Large pages are not supported.\n");
+        return;
+    }
+
+    addr = NULL;
+    size = large_page_size;
+    status = NtAllocateVirtualMemory(NtCurrentProcess(), &addr, 0, &size,
+                                     MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+    if (status == STATUS_PRIVILEGE_NOT_HELD)
+    {
+        skip("Large pages require SeLockMemoryPrivilege.\n");
+        return;
+    }
+    ok(status == STATUS_SUCCESS, "Unexpected status %08lx.\n", status);
+    ok(!((UINT_PTR)addr & (large_page_size - 1)), "Unaligned address %p.\n", addr);
+    ok(size == large_page_size, "Unexpected size %p.\n", (void *)size);
+    *(volatile char *)addr = 1;
+    *((volatile char *)addr + size - 1) = 1;
+
+    info.VirtualAddress = addr;
+    status = NtQueryVirtualMemory(NtCurrentProcess(), NULL, MemoryWorkingSetExInformation,
+                                  &info, sizeof(info), NULL);
+    ok(status == STATUS_SUCCESS, "Unexpected status %08lx.\n", status);
+    ok(info.VirtualAttributes.Valid, "Page is not valid.\n");
+    ok(info.VirtualAttributes.LargePage, "Page is not reported as a large page.\n");
+
+    size = 0;
+    status = NtFreeVirtualMemory(NtCurrentProcess(), &addr, &size, MEM_RELEASE);
+    ok(status == STATUS_SUCCESS, "Unexpected status %08lx.\n", status);
+
+    addr = NULL;
+    size = large_page_size / 2;
+    status = NtAllocateVirtualMemory(NtCurrentProcess(), &addr, 0, &size,
+                                     MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+    ok(status == STATUS_INVALID_PARAMETER, "Unexpected status %08lx.\n", status);
+
+    addr = NULL;
+    size = large_page_size;
+    status = NtAllocateVirtualMemory(NtCurrentProcess(), &addr, 0, &size,
+                                     MEM_RESERVE | MEM_LARGE_PAGES, PAGE_READWRITE);
+    ok(status == STATUS_INVALID_PARAMETER, "Unexpected status %08lx.\n", status);
+}
+
 static void test_prefetch(void)
 {
     NTSTATUS status;
@@ -2705,6 +2758,90 @@ static void test_query_image_information(void)
     NtClose( file );
 }
 
+static void * volatile concurrent_query_ptr;
+static LONG concurrent_query_gen;
+static LONG concurrent_query_done;
+
+static DWORD WINAPI concurrent_query_thread( void *arg )
+{
+    MEMORY_BASIC_INFORMATION info;
+    NTSTATUS status;
+    unsigned int count = 0;
+    LONG gen;
+    void *ptr;
+    SIZE_T len;
+
+    while (!ReadAcquire( &concurrent_query_done ))
+    {
+        gen = ReadAcquire( &concurrent_query_gen );
+        ptr = concurrent_query_ptr;
+        if (!(gen & 1)) continue;
+        status = NtQueryVirtualMemory( NtCurrentProcess(), ptr, MemoryBasicInformation,
+                                       &info, sizeof(info), &len );
+        if (ReadAcquire( &concurrent_query_gen ) != gen) continue;
+        ok( !status, "NtQueryVirtualMemory failed %08lx\n", status );
+        ok( info.State == MEM_COMMIT, "%p: got state %#lx\n", ptr, info.State );
+        ok( info.AllocationBase == ptr, "%p: got allocation base %p\n", ptr, info.AllocationBase );
+        ok( info.Protect == PAGE_READWRITE || info.Protect == PAGE_READONLY,
+            "%p: got protection %#lx\n", ptr, info.Protect );
+        if (info.State != MEM_COMMIT) break;
+        count++;
+    }
+    trace( "%u concurrent queries\n", count );
+    return 0;
+}
+
+static void test_concurrent_query(void)
+{
+    void *ptr, *addr;
+    NTSTATUS status;
+    HANDLE thread;
+    SIZE_T size;
+    ULONG old;
+    unsigned int i, j;
+
+    thread = CreateThread( NULL, 0, concurrent_query_thread, NULL, 0, NULL );
+    ok( thread != NULL, "CreateThread failed %lu\n", GetLastError() );
+
+    for (i = 0; i < 2000; i++)
+    {
+        ptr = NULL;
+        size = 0x10000;
+        status = NtAllocateVirtualMemory( NtCurrentProcess(), &ptr, 0, &size,
+                                          MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE );
+        ok( !status, "NtAllocateVirtualMemory failed %08lx\n", status );
+        concurrent_query_ptr = ptr;
+        InterlockedIncrement( &concurrent_query_gen );
+
+        for (j = 0; j < 4; j++)
+        {
+            addr = ptr;
+            size = page_size;
+            status = NtProtectVirtualMemory( NtCurrentProcess(), &addr, &size,
+                                             (j & 1) ? PAGE_READWRITE : PAGE_READONLY, &old );
+            ok( !status, "NtProtectVirtualMemory failed %08lx\n", status );
+        }
+        /* releasing the last page shrinks the view */
+        addr = (char *)ptr + 0x10000 - page_size;
+        size = page_size;
+        status = NtFreeVirtualMemory( NtCurrentProcess(), &addr, &size, MEM_RELEASE );
+        ok( !status, "NtFreeVirtualMemory failed %08lx\n", status );
+        addr = (char *)ptr + page_size;
+        size = page_size;
+        status = NtFreeVirtualMemory( NtCurrentProcess(), &addr, &size, MEM_DECOMMIT );
+        ok( !status, "NtFreeVirtualMemory failed %08lx\n", status );
+
+        InterlockedIncrement( &concurrent_query_gen );
+        size = 0;
+        status = NtFreeVirtualMemory( NtCurrentProcess(), &ptr, &size, MEM_RELEASE );
+        ok( !status, "NtFreeVirtualMemory failed %08lx\n", status );
+    }
+
+    WriteRelease( &concurrent_query_done, TRUE );
+    WaitForSingleObject( thread, INFINITE );
+    CloseHandle( thread );
+}
+
 START_TEST(virtual)
 {
     HMODULE mod;
@@ -2747,6 +2884,7 @@ START_TEST(virtual)
     test_NtAllocateVirtualMemoryEx();
     test_NtAllocateVirtualMemoryEx_address_requirements();
     test_NtFreeVirtualMemory();
+    test_large_pages();
     test_RtlCreateUserStack();
     test_NtMapViewOfSection();
     test_NtMapViewOfSectionEx();
@@ -2755,4 +2893,5 @@ START_TEST(virtual)
     test_syscalls();
     test_query_region_information();
     test_query_image_information();
+    test_concurrent_query();
 }
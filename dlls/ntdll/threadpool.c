@@ -33,6 +33,7 @@
 #include "ntdll_misc.h"
 
 WINE_DEFAULT_DEBUG_CHANNEL(threadpool);
+WINE_DECLARE_DEBUG_CHANNEL(tpstats);
 
 /*
  * Old thread pooling API
@@ -99,6 +100,17 @@ struct timer_queue
 #define THREADPOOL_WORKER_TIMEOUT 5000
 #define MAXIMUM_WAITQUEUE_OBJECTS (MAXIMUM_WAIT_OBJECTS - 1)
 
+/* queueing statistics of a threadpool, updated under .cs except where noted */
+struct threadpool_stats
+{
+    LONG                    queue_depth;    /* pending callbacks, updated atomically */
+    LONG                    max_queue_depth;
+    LONG64                  submitted;      /* updated atomically */
+    LONG64                  executed;
+    LONG64                  wait_time;      /* total queue wait time, in performance counter ticks */
+    LONG64                  max_wait_time;
+};
+
 /* internal threadpool representation */
 struct threadpool
 {
@@ -116,6 +128,8 @@ struct threadpool
     int                     num_busy_workers;
     HANDLE                  compl_port;
     TP_POOL_STACK_INFORMATION stack_info;
+    /* statistics, only collected when the tpstats channel is enabled */
+    struct threadpool_stats stats;
 };
 
 enum threadpool_objtype
@@ -154,9 +168,11 @@ struct threadpool_object
     BOOL                    is_group_member;
     /* information about the pool, locked via .pool->cs */
     struct list             pool_entry;
+    LONG64                  queued_time;
     RTL_CONDITION_VARIABLE  finished_event;
     RTL_CONDITION_VARIABLE  group_finished_event;
     HANDLE                  completed_event;
+    /* modified atomically, but only increased from zero with .pool->cs held */
     LONG                    num_pending_callbacks;
     LONG                    num_running_callbacks;
     LONG                    num_associated_callbacks;
@@ -1276,7 +1292,6 @@ static void CALLBACK waitqueue_thread_proc( void *param )
                 if ((wait->u.wait.flags & (WT_EXECUTEINWAITTHREAD | WT_EXECUTEINIOTHREAD)))
                 {
                     InterlockedIncrement( &wait->refcount );
-                    wait->num_pending_callbacks++;
                     RtlEnterCriticalSection( &wait->pool->cs );
                     tp_object_execute( wait, TRUE );
                     RtlLeaveCriticalSection( &wait->pool->cs );
@@ -1333,7 +1348,6 @@ static void CALLBACK waitqueue_thread_proc( void *param )
                     if ((wait->u.wait.flags & (WT_EXECUTEINWAITTHREAD | WT_EXECUTEINIOTHREAD)))
                     {
                         wait->u.wait.signaled++;
-                        wait->num_pending_callbacks++;
                         RtlEnterCriticalSection( &wait->pool->cs );
                         tp_object_execute( wait, TRUE );
                         RtlLeaveCriticalSection( &wait->pool->cs );
@@ -1512,81 +1526,90 @@ static void tp_waitqueue_unlock( struct threadpool_object *wait )
     RtlLeaveCriticalSection( &waitqueue.cs );
 }
 
-static void CALLBACK ioqueue_thread_proc( void *param )
+/* handle a completion dequeued by the I/O completion thread, called with ioqueue.cs held */
+static void ioqueue_complete( ULONG_PTR key, ULONG_PTR value, const IO_STATUS_BLOCK *iosb )
 {
+    struct threadpool_object *io = (struct threadpool_object *)key;
     struct io_completion *completion;
-    struct threadpool_object *io;
-    IO_STATUS_BLOCK iosb;
-    ULONG_PTR key, value;
-    BOOL destroy, skip;
-    NTSTATUS status;
+    BOOL destroy = FALSE, skip = FALSE;
 
-    TRACE( "starting I/O completion thread\n" );
-    set_thread_name(L"wine_threadpool_ioqueue");
+    TRACE( "io %p, iosb.Status %#lx.\n", io, iosb->Status );
 
-    RtlEnterCriticalSection( &ioqueue.cs );
-
-    for (;;)
+    if (io && (io->shutdown || io->u.io.shutting_down))
     {
-        RtlLeaveCriticalSection( &ioqueue.cs );
-        if ((status = NtRemoveIoCompletion( ioqueue.port, &key, &value, &iosb, NULL )))
-            ERR("NtRemoveIoCompletion failed, status %#lx.\n", status);
-        RtlEnterCriticalSection( &ioqueue.cs );
+        RtlEnterCriticalSection( &io->pool->cs );
+        if (!io->u.io.pending_count)
+        {
+            if (io->u.io.skipped_count)
+                --io->u.io.skipped_count;
 
-        destroy = skip = FALSE;
-        io = (struct threadpool_object *)key;
+            if (io->u.io.skipped_count)
+                skip = TRUE;
+            else
+                destroy = TRUE;
+        }
+        RtlLeaveCriticalSection( &io->pool->cs );
+        if (skip) return;
+    }
 
-        TRACE( "io %p, iosb.Status %#lx.\n", io, iosb.Status );
+    if (destroy)
+    {
+        --ioqueue.objcount;
+        TRACE( "Releasing io %p.\n", io );
+        io->shutdown = TRUE;
+        tp_object_release( io );
+    }
+    else if (io)
+    {
+        RtlEnterCriticalSection( &io->pool->cs );
 
-        if (io && (io->shutdown || io->u.io.shutting_down))
+        TRACE( "pending_count %u.\n", io->u.io.pending_count );
+
+        if (io->u.io.pending_count)
         {
-            RtlEnterCriticalSection( &io->pool->cs );
-            if (!io->u.io.pending_count)
+            --io->u.io.pending_count;
+            if (!array_reserve((void **)&io->u.io.completions, &io->u.io.completion_max,
+                    io->u.io.completion_count + 1, sizeof(*io->u.io.completions)))
             {
-                if (io->u.io.skipped_count)
-                    --io->u.io.skipped_count;
-
-                if (io->u.io.skipped_count)
-                    skip = TRUE;
-                else
-                    destroy = TRUE;
+                ERR( "Failed to allocate memory.\n" );
+                RtlLeaveCriticalSection( &io->pool->cs );
+                return;
             }
-            RtlLeaveCriticalSection( &io->pool->cs );
-            if (skip) continue;
-        }
 
-        if (destroy)
-        {
-            --ioqueue.objcount;
-            TRACE( "Releasing io %p.\n", io );
-            io->shutdown = TRUE;
-            tp_object_release( io );
+            completion = &io->u.io.completions[io->u.io.completion_count++];
+            completion->iosb = *iosb;
+            completion->cvalue = value;
+
+            tp_object_submit( io, FALSE );
         }
-        else if (io)
-        {
-            RtlEnterCriticalSection( &io->pool->cs );
+        RtlLeaveCriticalSection( &io->pool->cs );
+    }
+}
 
-            TRACE( "pending_count %u.\n", io->u.io.pending_count );
+static void CALLBACK ioqueue_thread_proc( void *param )
+{
+    FILE_IO_COMPLETION_INFORMATION entries[16];
+    NTSTATUS status;
+    ULONG i, count;
 
-            if (io->u.io.pending_count)
-            {
-                --io->u.io.pending_count;
-                if (!array_reserve((void **)&io->u.io.completions, &io->u.io.completion_max,
-                        io->u.io.completion_count + 1, sizeof(*io->u.io.completions)))
-                {
-                    ERR( "Failed to allocate memory.\n" );
-                    RtlLeaveCriticalSection( &io->pool->cs );
-                    continue;
-                }
+    TRACE( "starting I/O completion thread\n" );
+    set_thread_name(L"wine_threadpool_ioqueue");
 
-                completion = &io->u.io.completions[io->u.io.completion_count++];
-                completion->iosb = iosb;
-                completion->cvalue = value;
+    RtlEnterCriticalSection( &ioqueue.cs );
 
-                tp_object_submit( io, FALSE );
-            }
-            RtlLeaveCriticalSection( &io->pool->cs );
+    for (;;)
+    {
+        RtlLeaveCriticalSection( &ioqueue.cs );
+        /* dequeue completions in batches to save server round trips under load */
+        if ((status = NtRemoveIoCompletionEx( ioqueue.port, entries, ARRAY_SIZE(entries), &count, NULL, FALSE )))
+        {
+            ERR("NtRemoveIoCompletionEx failed, status %#lx.\n", status);
+            count = 0;
         }
+        RtlEnterCriticalSection( &ioqueue.cs );
+
+        for (i = 0; i < count; ++i)
+            ioqueue_complete( entries[i].CompletionKey, entries[i].CompletionValue, &entries[i].IoStatusBlock );
 
         if (!ioqueue.objcount)
         {
@@ -1688,6 +1711,7 @@ static NTSTATUS tp_threadpool_alloc( struct threadpool **out )
     pool->num_busy_workers        = 0;
     pool->stack_info.StackReserve = nt->OptionalHeader.SizeOfStackReserve;
     pool->stack_info.StackCommit  = nt->OptionalHeader.SizeOfStackCommit;
+    memset( &pool->stats, 0, sizeof(pool->stats) );
 
     TRACE( "allocated threadpool %p\n", pool );
 
@@ -1710,6 +1734,30 @@ static void tp_threadpool_shutdown( struct threadpool *pool )
     RtlWakeAllConditionVariable( &pool->update_event );
 }
 
+/***********************************************************************
+ *           tp_threadpool_dump_stats    (internal)
+ *
+ * Prints the queueing statistics of a threadpool on the tpstats channel.
+ */
+static void tp_threadpool_dump_stats( struct threadpool *pool )
+{
+    struct threadpool_stats *stats = &pool->stats;
+    LARGE_INTEGER freq;
+    LONG64 executed;
+
+    if (!TRACE_ON(tpstats)) return;
+
+    RtlQueryPerformanceFrequency( &freq );
+    executed = max( stats->executed, 1 );
+    TRACE_(tpstats)( "pool %p: %s submitted, %s executed, queue depth %ld (max %ld), "
+                     "wait time avg %s us, max %s us\n", pool,
+                     wine_dbgstr_longlong( stats->submitted ),
+                     wine_dbgstr_longlong( stats->executed ),
+                     ReadNoFence( &stats->queue_depth ), stats->max_queue_depth,
+                     wine_dbgstr_longlong( stats->wait_time * 1000000 / freq.QuadPart / executed ),
+                     wine_dbgstr_longlong( stats->max_wait_time * 1000000 / freq.QuadPart ) );
+}
+
 /***********************************************************************
  *           tp_threadpool_release    (internal)
  *
@@ -1723,6 +1771,7 @@ static BOOL tp_threadpool_release( struct threadpool *pool )
         return FALSE;
 
     TRACE( "destroying threadpool %p\n", pool );
+    tp_threadpool_dump_stats( pool );
 
     assert( pool->shutdown );
     assert( !pool->objcount );
@@ -1967,10 +2016,80 @@ static void tp_object_initialize( struct threadpool_object *object, struct threa
         tp_object_release( object );
 }
 
+static void tp_stats_submit( struct threadpool *pool )
+{
+    struct threadpool_stats *stats = &pool->stats;
+    LONG depth = InterlockedIncrement( &stats->queue_depth ), max_depth;
+
+    InterlockedIncrement64( &stats->submitted );
+    while (depth > (max_depth = ReadNoFence( &stats->max_queue_depth )) &&
+           InterlockedCompareExchange( &stats->max_queue_depth, depth, max_depth ) != max_depth)
+        ;
+}
+
+static void tp_stats_execute( struct threadpool_object *object )
+{
+    struct threadpool_stats *stats = &object->pool->stats;
+    LARGE_INTEGER now;
+    LONG64 wait_time;
+
+    RtlQueryPerformanceCounter( &now );
+    wait_time = now.QuadPart - object->queued_time;
+    InterlockedDecrement( &stats->queue_depth );
+    stats->executed++;
+    stats->wait_time += wait_time;
+    if (wait_time > stats->max_wait_time) stats->max_wait_time = wait_time;
+}
+
 static void tp_object_prio_queue( struct threadpool_object *object )
 {
     ++object->pool->num_busy_workers;
     list_add_tail( &object->pool->pools[object->priority], &object->pool_entry );
+
+    if (TRACE_ON(tpstats))
+    {
+        LARGE_INTEGER now;
+        RtlQueryPerformanceCounter( &now );
+        object->queued_time = now.QuadPart;
+    }
+}
+
+/***********************************************************************
+ *           tp_object_try_resubmit    (internal)
+ *
+ * Submits another callback for a work object which is still queued
+ * without taking the pool lock. The queued entry takes care of running
+ * it, so this only bumps the pending callback count and wakes an idle
+ * worker. Fails if nothing is queued or if the pool might need another
+ * worker thread.
+ */
+static BOOL tp_object_try_resubmit( struct threadpool_object *object )
+{
+    struct threadpool *pool = object->pool;
+    LONG pending, prev;
+
+    /* unlocked read, this is only a hint whether a new worker is needed */
+    if (pool->num_busy_workers >= pool->num_workers)
+        return FALSE;
+
+    InterlockedIncrement( &object->refcount );
+    pending = ReadNoFence( &object->num_pending_callbacks );
+    while (pending)
+    {
+        if ((prev = InterlockedCompareExchange( &object->num_pending_callbacks, pending + 1, pending )) == pending)
+        {
+            if (TRACE_ON(tpstats)) tp_stats_submit( pool );
+            /* The object is already queued, but the worker running it only requeues it, so wake
+             * up an idle worker to run the new callback concurrently. */
+            RtlWakeConditionVariable( &pool->update_event );
+            return TRUE;
+        }
+        pending = prev;
+    }
+
+    /* the caller still holds a reference, this can't be the last one */
+    InterlockedDecrement( &object->refcount );
+    return FALSE;
 }
 
 /***********************************************************************
@@ -1987,6 +2106,9 @@ static void tp_object_submit( struct threadpool_object *object, BOOL signaled )
     assert( !object->shutdown );
     assert( !pool->shutdown );
 
+    if (object->type == TP_OBJECT_TYPE_WORK && tp_object_try_resubmit( object ))
+        return;
+
     RtlEnterCriticalSection( &pool->cs );
 
     /* Start new worker threads if required. */
@@ -1996,8 +2118,9 @@ static void tp_object_submit( struct threadpool_object *object, BOOL signaled )
 
     /* Queue work item and increment refcount. */
     InterlockedIncrement( &object->refcount );
-    if (!object->num_pending_callbacks++)
+    if (InterlockedIncrement( &object->num_pending_callbacks ) == 1)
         tp_object_prio_queue( object );
+    if (TRACE_ON(tpstats)) tp_stats_submit( pool );
 
     /* Count how often the object was signaled. */
     if (object->type == TP_OBJECT_TYPE_WAIT && signaled)
@@ -2024,11 +2147,10 @@ static void tp_object_cancel( struct threadpool_object *object )
     LONG pending_callbacks = 0;
 
     RtlEnterCriticalSection( &pool->cs );
-    if (object->num_pending_callbacks)
+    if ((pending_callbacks = InterlockedExchange( &object->num_pending_callbacks, 0 )))
     {
-        pending_callbacks = object->num_pending_callbacks;
-        object->num_pending_callbacks = 0;
         list_remove( &object->pool_entry );
+        if (TRACE_ON(tpstats)) InterlockedExchangeAdd( &pool->stats.queue_depth, -pending_callbacks );
 
         if (object->type == TP_OBJECT_TYPE_WAIT)
             object->u.wait.signaled = 0;
@@ -2181,8 +2303,6 @@ static void tp_object_execute( struct threadpool_object *object, BOOL wait_threa
     TP_WAIT_RESULT wait_result = 0;
     NTSTATUS status;
 
-    object->num_pending_callbacks--;
-
     /* For wait objects check if they were signaled or have timed out. */
     if (object->type == TP_OBJECT_TYPE_WAIT)
     {
@@ -2346,9 +2466,12 @@ static void CALLBACK threadpool_worker_proc( void *param )
             assert( object->num_pending_callbacks > 0 );
 
             /* If further pending callbacks are queued, move the work item to
-             * the end of the pool list. Otherwise remove it from the pool. */
+             * the end of the pool list. Otherwise remove it from the pool. The
+             * count has to be decremented atomically, as tp_object_try_resubmit
+             * may increment it concurrently without holding the lock. */
             list_remove( &object->pool_entry );
-            if (object->num_pending_callbacks > 1)
+            if (TRACE_ON(tpstats)) tp_stats_execute( object );
+            if (InterlockedDecrement( &object->num_pending_callbacks ))
                 tp_object_prio_queue( object );
 
             tp_object_execute( object, FALSE );
@@ -2377,6 +2500,7 @@ static void CALLBACK threadpool_worker_proc( void *param )
         }
     }
     pool->num_workers--;
+    tp_threadpool_dump_stats( pool );
     RtlLeaveCriticalSection( &pool->cs );
 
     TRACE( "terminating worker thread for pool %p\n", pool );
@@ -53,6 +53,7 @@
 #endif
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <sys/ioctl.h>
 #ifdef HAVE_SYS_ATTR_H
 #include <sys/attr.h>
@@ -235,6 +236,7 @@ struct dir_data
     unsigned int            count;   /* count of used entries in the names array */
     unsigned int            pos;     /* current reading position in the names array */
     struct file_identity    id;      /* directory file identity */
+    BOOL                    no_xattr; /* the directory file system doesn't support extended attributes */
     struct dir_data_names  *names;   /* directory file names */
     struct dir_data_buffer *buffer;  /* head of data buffers list */
 };
@@ -246,6 +248,21 @@ static const unsigned int dir_data_names_initial_size  = 64;
 static struct dir_data **dir_data_cache;
 static unsigned int dir_data_cache_size;
 
+/* contents of a recently searched directory, for case-insensitive lookups */
+struct dir_lookup_cache
+{
+    struct dir_data *data;           /* names of the directory entries */
+    ULONGLONG        ctime;          /* change time of the directory when it was read */
+    unsigned int    *index;          /* hash index of the long and short names, entry + 1 or 0 if free */
+    unsigned int     index_size;     /* number of index slots, a power of 2 */
+    unsigned int     last_use;       /* value of the use counter at the last lookup */
+};
+
+#define DIR_LOOKUP_CACHE_SIZE 32
+
+static struct dir_lookup_cache dir_lookup_cache[DIR_LOOKUP_CACHE_SIZE];
+static unsigned int dir_lookup_counter;
+
 static BOOL show_dot_files;
 static mode_t start_umask;
 
@@ -253,6 +270,7 @@ static mode_t start_umask;
 static const BOOL is_case_sensitive = FALSE;
 
 static pthread_mutex_t dir_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t dir_lookup_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t mnt_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 #ifndef HAVE_RENAMEAT2
@@ -1862,8 +1880,8 @@ static NTSTATUS fd_set_file_info( int fd, UINT attr, BOOL force_set_xattr )
 }
 
 
-/* get the stat info and file attributes for a file (by name) */
-static int get_file_info( const char *path, struct stat *st, ULONG *attr )
+/* get the stat info and file attributes for a file (by name), optionally an entry of an enumerated directory */
+static int get_file_info_in_dir( const char *path, struct dir_data *dir, struct stat *st, ULONG *attr )
 {
     char *parent_path;
     char attr_data[65];
@@ -1886,6 +1904,12 @@ static int get_file_info( const char *path, struct stat *st, ULONG *attr )
         if (is_reparse_dir( AT_FDCWD, path, &is_dir ) == 0)
             st->st_mode = (st->st_mode & ~S_IFMT) | (is_dir ? S_IFDIR : S_IFREG);
     }
+    else if (S_ISDIR( st->st_mode ) && dir && strcmp( path, "." ) && strcmp( path, ".." ))
+    {
+        /* the parent of a directory entry is the enumerated directory, no need to look it up */
+        if (st->st_dev != dir->id.dev || st->st_ino == dir->id.ino)
+            *attr |= FILE_ATTRIBUTE_REPARSE_POINT;
+    }
     else if (S_ISDIR( st->st_mode ) && (parent_path = malloc( strlen(path) + 4 )))
     {
         struct stat parent_st;
@@ -1901,6 +1925,12 @@ static int get_file_info( const char *path, struct stat *st, ULONG *attr )
     }
     *attr |= get_file_attributes( st );
 
+    if (dir && dir->no_xattr && st->st_dev == dir->id.dev)
+    {
+        if (is_hidden_file( path )) *attr |= FILE_ATTRIBUTE_HIDDEN;
+        return ret;
+    }
+
     attr_len = xattr_get( path, SAMBA_XATTR_DOS_ATTRIB, attr_data, sizeof(attr_data)-1 );
     if (attr_len != -1)
         *attr |= parse_samba_dos_attrib_data( attr_data, attr_len );
@@ -1908,7 +1938,12 @@ static int get_file_info( const char *path, struct stat *st, ULONG *attr )
     {
         if (is_hidden_file( path ))
             *attr |= FILE_ATTRIBUTE_HIDDEN;
-        if (errno == ENOTSUP) return ret;
+        if (errno == ENOTSUP)
+        {
+            /* don't try again for the other entries on the same file system */
+            if (dir && st->st_dev == dir->id.dev) dir->no_xattr = TRUE;
+            return ret;
+        }
 #ifdef ENODATA
         if (errno == ENODATA) return ret;
 #endif
@@ -1919,6 +1954,13 @@ static int get_file_info( const char *path, struct stat *st, ULONG *attr )
 }
 
 
+/* get the stat info and file attributes for a file (by name) */
+static int get_file_info( const char *path, struct stat *st, ULONG *attr )
+{
+    return get_file_info_in_dir( path, NULL, st, attr );
+}
+
+
 #if defined(__ANDROID__) && !defined(HAVE_FUTIMENS)
 static int futimens( int fd, const struct timespec spec[2] )
 {
@@ -2447,9 +2489,17 @@ static NTSTATUS get_dir_data_entry( struct dir_data *dir_data, void *info_ptr, I
     const struct dir_data_names *names = &dir_data->names[dir_data->pos];
     union file_directory_info *info;
     struct stat st;
-    ULONG name_len, start, dir_size, attributes;
+    ULONG name_len, start, dir_size, attributes = 0;
+    int ret;
 
-    if (get_file_info( names->unix_name, &st, &attributes ) == -1)
+    if (class == FileNamesInformation)
+    {
+        /* only check that the file still exists and isn't ignored, the attributes aren't needed */
+        if (!(ret = lstat( names->unix_name, &st )) && S_ISLNK( st.st_mode )) stat( names->unix_name, &st );
+    }
+    else ret = get_file_info_in_dir( names->unix_name, dir_data, &st, &attributes );
+
+    if (ret == -1)
     {
         TRACE( "file no longer exists %s\n", names->unix_name );
         return STATUS_SUCCESS;
@@ -2656,11 +2706,12 @@ static NTSTATUS read_directory_data_stat( struct dir_data *data, const char *uni
  *
  * Read a directory using the POSIX readdir interface; helper for NtQueryDirectoryFile.
  */
-static NTSTATUS read_directory_data_readdir( struct dir_data *data, const UNICODE_STRING *mask )
+static NTSTATUS read_directory_data_readdir( struct dir_data *data, const char *path,
+                                             const UNICODE_STRING *mask )
 {
     struct dirent *de;
     NTSTATUS status = STATUS_NO_MEMORY;
-    DIR *dir = opendir( "." );
+    DIR *dir = opendir( path );
 
     if (!dir) return STATUS_NO_SUCH_FILE;
 
@@ -2708,7 +2759,7 @@ static NTSTATUS read_directory_data( struct dir_data *data, int fd, const UNICOD
         }
     }
 
-    return read_directory_data_readdir( data, mask );
+    return read_directory_data_readdir( data, ".", mask );
 }
 
 
@@ -2914,6 +2965,159 @@ NTSTATUS WINAPI NtQueryDirectoryFile( HANDLE handle, HANDLE event, PIO_APC_ROUTI
 }
 
 
+/* case-insensitive hash of a file name */
+static unsigned int hash_dir_lookup_name( const WCHAR *name, int length )
+{
+    unsigned int hash = 0;
+    int i;
+
+    for (i = 0; i < length; i++) hash = hash * 31 + towupper( name[i] );
+    return hash;
+}
+
+/* add a name to the hash index of a directory lookup cache */
+static void add_dir_lookup_name( struct dir_lookup_cache *cache, const WCHAR *name, unsigned int pos )
+{
+    unsigned int slot = hash_dir_lookup_name( name, wcslen( name )) & (cache->index_size - 1);
+
+    while (cache->index[slot]) slot = (slot + 1) & (cache->index_size - 1);
+    cache->index[slot] = pos + 1;
+}
+
+/* find a name in a directory lookup cache, and return the corresponding Unix name */
+static const char *find_dir_lookup_name( const struct dir_lookup_cache *cache, const WCHAR *name, int length )
+{
+    const struct dir_data_names *names;
+    unsigned int pos, slot = hash_dir_lookup_name( name, length ) & (cache->index_size - 1);
+
+    while ((pos = cache->index[slot]))
+    {
+        names = &cache->data->names[pos - 1];
+        if (!wcsnicmp( names->long_name, name, length ) && !names->long_name[length]) return names->unix_name;
+        if (!wcsnicmp( names->short_name, name, length ) && !names->short_name[length]) return names->unix_name;
+        slot = (slot + 1) & (cache->index_size - 1);
+    }
+    return NULL;
+}
+
+/* read the contents of a directory and build their hash index */
+static BOOL init_dir_lookup_cache( struct dir_lookup_cache *cache, const char *unix_name )
+{
+    struct dir_data *data;
+    NTSTATUS status = STATUS_NOT_SUPPORTED;
+    unsigned int i;
+
+    if (!(data = calloc( 1, sizeof(*data) ))) return FALSE;
+    cache->data = data;
+
+#ifdef VFAT_IOCTL_READDIR_BOTH
+    {
+        int fd = open( unix_name, O_RDONLY | O_DIRECTORY );
+
+        if (fd != -1)
+        {
+            status = read_directory_data_vfat( data, fd, NULL );
+            close( fd );
+        }
+    }
+#endif
+    if (status == STATUS_NOT_SUPPORTED) status = read_directory_data_readdir( data, unix_name, NULL );
+    if (status) return FALSE;
+
+    /* each entry may be indexed under both its long and short names */
+    cache->index_size = 16;
+    while (cache->index_size < 4 * data->count) cache->index_size *= 2;
+    if (!(cache->index = calloc( cache->index_size, sizeof(*cache->index) ))) return FALSE;
+    for (i = 0; i < data->count; i++)
+    {
+        add_dir_lookup_name( cache, data->names[i].long_name, i );
+        if (data->names[i].short_name[0]) add_dir_lookup_name( cache, data->names[i].short_name, i );
+    }
+    return TRUE;
+}
+
+static void free_dir_lookup_cache( struct dir_lookup_cache *cache )
+{
+    free_dir_data( cache->data );
+    free( cache->index );
+    memset( cache, 0, sizeof(*cache) );
+}
+
+
+/***********************************************************************
+ *           find_file_in_dir_cache
+ *
+ * Find a file through the cached contents of its directory; helper for find_file_in_dir.
+ * The contents are cached as long as the directory change time doesn't change.
+ * Returns STATUS_NOT_SUPPORTED if they can't be cached, so that the directory
+ * is searched directly instead.
+ */
+static NTSTATUS find_file_in_dir_cache( char *unix_name, int pos, const WCHAR *name, int length )
+{
+    struct dir_lookup_cache *cache, new_cache;
+    LARGE_INTEGER mtime, ctime, atime, creation, now;
+    const char *found = NULL;
+    struct stat st;
+    unsigned int i;
+
+    if (stat( unix_name, &st ) == -1) return STATUS_NOT_SUPPORTED;
+    get_file_times( &st, &mtime, &ctime, &atime, &creation );
+
+    mutex_lock( &dir_lookup_mutex );
+    for (i = 0, cache = dir_lookup_cache; i < DIR_LOOKUP_CACHE_SIZE; i++, cache++)
+    {
+        if (!cache->data || cache->data->id.dev != st.st_dev || cache->data->id.ino != st.st_ino) continue;
+        if (cache->ctime != ctime.QuadPart) break;
+        cache->last_use = ++dir_lookup_counter;
+        found = find_dir_lookup_name( cache, name, length );
+        goto done;
+    }
+    mutex_unlock( &dir_lookup_mutex );
+
+    /* with coarse timestamps, a recently modified directory may change again without
+     * changing its change time, so its contents can't be cached yet */
+    NtQuerySystemTime( &now );
+    if (now.QuadPart - ctime.QuadPart < 2 * TICKSPERSEC) return STATUS_NOT_SUPPORTED;
+
+    memset( &new_cache, 0, sizeof(new_cache) );
+    if (!init_dir_lookup_cache( &new_cache, unix_name ))
+    {
+        free_dir_lookup_cache( &new_cache );
+        return STATUS_NOT_SUPPORTED;
+    }
+    new_cache.data->id.dev = st.st_dev;
+    new_cache.data->id.ino = st.st_ino;
+    new_cache.ctime = ctime.QuadPart;
+
+    /* replace the previous contents of the directory, or the least recently used entry */
+    mutex_lock( &dir_lookup_mutex );
+    cache = dir_lookup_cache;
+    for (i = 0; i < DIR_LOOKUP_CACHE_SIZE; i++)
+    {
+        if (!dir_lookup_cache[i].data) cache = &dir_lookup_cache[i];
+        else if (dir_lookup_cache[i].data->id.dev == st.st_dev && dir_lookup_cache[i].data->id.ino == st.st_ino)
+        {
+            cache = &dir_lookup_cache[i];
+            break;
+        }
+        else if (cache->data && dir_lookup_cache[i].last_use < cache->last_use) cache = &dir_lookup_cache[i];
+    }
+    free_dir_lookup_cache( cache );
+    *cache = new_cache;
+    cache->last_use = ++dir_lookup_counter;
+    found = find_dir_lookup_name( cache, name, length );
+
+done:
+    if (found)
+    {
+        unix_name[pos - 1] = '/';
+        strcpy( unix_name + pos, found );
+    }
+    mutex_unlock( &dir_lookup_mutex );
+    return found ? STATUS_SUCCESS : STATUS_OBJECT_NAME_NOT_FOUND;
+}
+
+
 /***********************************************************************
  *           find_file_in_dir
  *
@@ -2926,6 +3130,7 @@ static NTSTATUS find_file_in_dir( char *unix_name, int pos, const WCHAR *name, i
 {
     WCHAR buffer[MAX_DIR_ENTRY_LEN];
     BOOLEAN is_name_8_dot_3;
+    NTSTATUS status;
     DIR *dir;
     struct dirent *de;
     struct stat st;
@@ -2954,6 +3159,12 @@ static NTSTATUS find_file_in_dir( char *unix_name, int pos, const WCHAR *name, i
 
     if (!is_name_8_dot_3 && !get_dir_case_sensitivity( unix_name )) goto not_found;
 
+    /* look for it in the cached directory contents */
+
+    status = find_file_in_dir_cache( unix_name, pos, name, length );
+    if (status == STATUS_SUCCESS) return status;
+    if (status == STATUS_OBJECT_NAME_NOT_FOUND) goto not_found;
+
     /* now look for it through the directory */
 
 #ifdef VFAT_IOCTL_READDIR_BOTH
@@ -6577,6 +6788,61 @@ err:
 }
 
 
+#ifndef HAVE_PREADV
+static ssize_t wine_preadv( int fd, const struct iovec *iov, int count, off_t offset )
+{
+    ssize_t ret, total = 0;
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        if ((ret = pread( fd, iov[i].iov_base, iov[i].iov_len, offset + total )) == -1)
+            return total ? total : -1;
+        total += ret;
+        if (ret < iov[i].iov_len) break;
+    }
+    return total;
+}
+#define preadv wine_preadv
+#endif
+
+#ifndef HAVE_PWRITEV
+static ssize_t wine_pwritev( int fd, const struct iovec *iov, int count, off_t offset )
+{
+    ssize_t ret, total = 0;
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        if ((ret = pwrite( fd, iov[i].iov_base, iov[i].iov_len, offset + total )) == -1)
+            return total ? total : -1;
+        total += ret;
+        if (ret < iov[i].iov_len) break;
+    }
+    return total;
+}
+#define pwritev wine_pwritev
+#endif
+
+/* fill an iovec array with the page segments of a scatter/gather request, starting at byte pos */
+static int get_segments_iovec( struct iovec *iov, int max_count, const FILE_SEGMENT_ELEMENT *segments,
+                               UINT pos, UINT length )
+{
+    int count;
+
+    segments += pos / page_size;
+    pos %= page_size;
+    for (count = 0; count < max_count && length; count++, segments++)
+    {
+        iov[count].iov_base = (char *)segments->Buffer + pos;
+        iov[count].iov_len = min( length, page_size - pos );
+        length -= iov[count].iov_len;
+        pos = 0;
+    }
+    return count;
+}
+
+
 /******************************************************************************
  *              NtReadFileScatter   (NTDLL.@)
  */
@@ -6586,7 +6852,7 @@ NTSTATUS WINAPI NtReadFileScatter( HANDLE file, HANDLE event, PIO_APC_ROUTINE ap
 {
     int result, unix_handle, needs_close;
     unsigned int options, status;
-    UINT pos = 0, total = 0;
+    UINT total = 0;
     client_ptr_t iosb_ptr = iosb_client_ptr(io);
     enum server_fd_type type;
     ULONG_PTR cvalue = apc ? 0 : (ULONG_PTR)apc_user;
@@ -6610,11 +6876,13 @@ NTSTATUS WINAPI NtReadFileScatter( HANDLE file, HANDLE event, PIO_APC_ROUTINE ap
 
     while (length)
     {
+        struct iovec iov[64];
+        int count = get_segments_iovec( iov, ARRAY_SIZE(iov), segments, total, length );
+
         if (offset && offset->QuadPart != FILE_USE_FILE_POINTER_POSITION)
-            result = pread( unix_handle, (char *)segments->Buffer + pos,
-                            min( length - pos, page_size - pos ), offset->QuadPart + total );
+            result = preadv( unix_handle, iov, count, offset->QuadPart + total );
         else
-            result = read( unix_handle, (char *)segments->Buffer + pos, min( length - pos, page_size - pos ) );
+            result = readv( unix_handle, iov, count );
 
         if (result == -1)
         {
@@ -6625,11 +6893,6 @@ NTSTATUS WINAPI NtReadFileScatter( HANDLE file, HANDLE event, PIO_APC_ROUTINE ap
         if (!result) break;
         total += result;
         length -= result;
-        if ((pos += result) == page_size)
-        {
-            pos = 0;
-            segments++;
-        }
     }
 
     if (total == 0) status = STATUS_END_OF_FILE;
@@ -6891,7 +7154,7 @@ NTSTATUS WINAPI NtWriteFileGather( HANDLE file, HANDLE event, PIO_APC_ROUTINE ap
 {
     int result, unix_handle, needs_close;
     unsigned int options, status;
-    UINT pos = 0, total = 0;
+    UINT total = 0;
     client_ptr_t iosb_ptr = iosb_client_ptr(io);
     enum server_fd_type type;
     ULONG_PTR cvalue = apc ? 0 : (ULONG_PTR)apc_user;
@@ -6916,11 +7179,13 @@ NTSTATUS WINAPI NtWriteFileGather( HANDLE file, HANDLE event, PIO_APC_ROUTINE ap
 
     while (length)
     {
+        struct iovec iov[64];
+        int count = get_segments_iovec( iov, ARRAY_SIZE(iov), segments, total, length );
+
         if (offset && offset->QuadPart != FILE_USE_FILE_POINTER_POSITION)
-            result = pwrite( unix_handle, (char *)segments->Buffer + pos,
-                             page_size - pos, offset->QuadPart + total );
+            result = pwritev( unix_handle, iov, count, offset->QuadPart + total );
         else
-            result = write( unix_handle, (char *)segments->Buffer + pos, page_size - pos );
+            result = writev( unix_handle, iov, count );
 
         if (result == -1)
         {
@@ -6940,11 +7205,6 @@ NTSTATUS WINAPI NtWriteFileGather( HANDLE file, HANDLE event, PIO_APC_ROUTINE ap
         }
         total += result;
         length -= result;
-        if ((pos += result) == page_size)
-        {
-            pos = 0;
-            segments++;
-        }
     }
 
     send_completion = cvalue != 0;
@@ -8231,6 +8491,9 @@ NTSTATUS WINAPI NtSetInformationObject( HANDLE handle, OBJECT_INFORMATION_CLASS
 
         if (len < sizeof(*p)) return STATUS_INVALID_BUFFER_SIZE;
 
+        /* closing a protected handle must fail, so it has to go to the server */
+        if (p->ProtectFromClose) server_disallow_deferred_close( handle );
+
         SERVER_START_REQ( set_handle_info )
         {
             req->handle = wine_server_obj_handle( handle );
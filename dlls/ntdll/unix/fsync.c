@@ -0,0 +1,1179 @@
+/*
+ * futex-based synchronization objects
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#if 0
+#pragma makedep unix
+#endif
+
+#include "config.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#ifdef HAVE_SYS_STAT_H
+# include <sys/stat.h>
+#endif
+#ifdef HAVE_SYS_SYSCALL_H
+# include <sys/syscall.h>
+#endif
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ntstatus.h"
+#define WIN32_NO_STATUS
+#include "windef.h"
+#include "winternl.h"
+#include "wine/server.h"
+#include "wine/debug.h"
+
+#include "unix_private.h"
+#include "fsync.h"
+
+WINE_DEFAULT_DEBUG_CHANNEL(fsync);
+
+#if defined(__linux__) && defined(__NR_futex)
+
+#define FUTEX_WAIT 0
+#define FUTEX_WAKE 1
+#define FUTEX_32   2
+
+#ifndef __NR_futex_waitv
+#define __NR_futex_waitv 449
+#endif
+
+struct futex_waitv
+{
+    UINT64 val;
+    UINT64 uaddr;
+    UINT   flags;
+    UINT   __reserved;
+};
+
+struct timespec64
+{
+    LONGLONG tv_sec;
+    LONGLONG tv_nsec;
+};
+
+static BOOL use_futex_waitv;
+
+static inline int futex_wait( int *addr, int val, struct timespec *timeout )
+{
+#if (defined(__i386__) || defined(__arm__)) && _TIME_BITS==64
+    if (timeout && sizeof(*timeout) != 8)
+    {
+        struct {
+            long tv_sec;
+            long tv_nsec;
+        } timeout32 = { timeout->tv_sec, timeout->tv_nsec };
+
+        return syscall( __NR_futex, addr, FUTEX_WAIT, val, &timeout32, 0, 0 );
+    }
+#endif
+    return syscall( __NR_futex, addr, FUTEX_WAIT, val, timeout, 0, 0 );
+}
+
+static inline int futex_wake( int *addr, int val )
+{
+    return syscall( __NR_futex, addr, FUTEX_WAKE, val, NULL, 0, 0 );
+}
+
+static inline int futex_waitv( struct futex_waitv *futexes, unsigned int count,
+                               const struct timespec64 *end )
+{
+    return syscall( __NR_futex_waitv, futexes, count, 0, end, CLOCK_MONOTONIC );
+}
+
+int do_fsync(void)
+{
+    static int do_fsync_cached = -1;
+
+    if (do_fsync_cached == -1)
+    {
+        static int dummy;
+
+        do_fsync_cached = getenv("WINEFSYNC") && atoi(getenv("WINEFSYNC"));
+        if (do_fsync_cached && futex_wait( &dummy, 1, NULL ) == -1 && errno == ENOSYS)
+        {
+            FIXME("futexes not supported on this platform.\n");
+            do_fsync_cached = 0;
+        }
+        if (do_fsync_cached)
+        {
+            /* an empty wait is rejected with EINVAL if the syscall exists */
+            use_futex_waitv = !(futex_waitv( NULL, 0, NULL ) == -1 && errno == ENOSYS);
+            if (!use_futex_waitv) WARN("futex_waitv() not supported, using plain futexes.\n");
+        }
+    }
+
+    return do_fsync_cached;
+}
+
+#else
+
+static const BOOL use_futex_waitv = FALSE;
+
+struct futex_waitv
+{
+    UINT64 val;
+    UINT64 uaddr;
+    UINT   flags;
+    UINT   __reserved;
+};
+
+struct timespec64
+{
+    LONGLONG tv_sec;
+    LONGLONG tv_nsec;
+};
+
+static inline int futex_wait( int *addr, int val, struct timespec *timeout )
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+static inline int futex_wake( int *addr, int val )
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+static inline int futex_waitv( struct futex_waitv *futexes, unsigned int count,
+                               const struct timespec64 *end )
+{
+    errno = ENOSYS;
+    return -1;
+}
+
+int do_fsync(void)
+{
+    static int once;
+    if (!once++ && getenv("WINEFSYNC") && atoi(getenv("WINEFSYNC")))
+        FIXME("futexes not supported on this platform.\n");
+    return 0;
+}
+
+#endif
+
+/* The shared memory section uses the same 8-byte slot layout as esync; the
+ * futex of each object is the first int of the slot, except for semaphores
+ * where it is the count. */
+
+struct fsync
+{
+    enum esync_type type;
+    void *shm;
+};
+
+struct semaphore
+{
+    int max;
+    int count;
+};
+C_ASSERT(sizeof(struct semaphore) == 8);
+
+struct mutex
+{
+    int tid;
+    int count;    /* recursion count */
+};
+C_ASSERT(sizeof(struct mutex) == 8);
+
+struct event
+{
+    int signaled;
+    int unused;
+};
+C_ASSERT(sizeof(struct event) == 8);
+
+/* Slot 0; threads which can't use futex_waitv() for a multiple-object wait
+ * sleep on the sequence number instead, which is bumped on every wake. */
+struct wake_seq
+{
+    int seq;
+    int waiters;
+};
+C_ASSERT(sizeof(struct wake_seq) == 8);
+
+static char shm_name[29];
+static int shm_fd;
+static void **shm_addrs;
+static int shm_addrs_size;  /* length of the allocated shm_addrs array */
+static long pagesize;
+static struct wake_seq *wake_seq;
+
+static pthread_mutex_t shm_addrs_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void *get_shm( unsigned int idx )
+{
+    int entry  = (idx * 8) / pagesize;
+    int offset = (idx * 8) % pagesize;
+    void *ret;
+
+    pthread_mutex_lock( &shm_addrs_mutex );
+
+    if (entry >= shm_addrs_size)
+    {
+        int new_size = max(shm_addrs_size * 2, entry + 1);
+
+        if (!(shm_addrs = realloc( shm_addrs, new_size * sizeof(shm_addrs[0]) )))
+            ERR("Failed to grow shm_addrs array to size %d.\n", shm_addrs_size);
+        memset( shm_addrs + shm_addrs_size, 0, (new_size - shm_addrs_size) * sizeof(shm_addrs[0]) );
+        shm_addrs_size = new_size;
+    }
+
+    if (!shm_addrs[entry])
+    {
+        void *addr = mmap( NULL, pagesize, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, entry * pagesize );
+        if (addr == (void *)-1)
+            ERR("Failed to map page %d (offset %#lx).\n", entry, entry * pagesize);
+
+        TRACE("Mapping page %d at %p.\n", entry, addr);
+
+        if (InterlockedCompareExchangePointer( &shm_addrs[entry], addr, 0 ))
+            munmap( addr, pagesize ); /* someone beat us to it */
+    }
+
+    ret = (void *)((unsigned long)shm_addrs[entry] + offset);
+
+    pthread_mutex_unlock( &shm_addrs_mutex );
+
+    return ret;
+}
+
+/* Wake everybody waiting on a futex in the shared section. */
+static void fsync_wake_futex( int *addr )
+{
+    futex_wake( addr, INT_MAX );
+    InterlockedIncrement( (LONG *)&wake_seq->seq );
+    if (ReadNoFence( (LONG *)&wake_seq->waiters ))
+        futex_wake( &wake_seq->seq, INT_MAX );
+}
+
+/* We'd like lookup to be fast. To that end, we use a static list indexed by handle.
+ * This is copied and adapted from the fd cache code. */
+
+#define FSYNC_LIST_BLOCK_SIZE  (65536 / sizeof(struct fsync))
+#define FSYNC_LIST_ENTRIES     256
+
+static struct fsync *fsync_list[FSYNC_LIST_ENTRIES];
+static struct fsync fsync_list_initial_block[FSYNC_LIST_BLOCK_SIZE];
+
+static inline UINT_PTR handle_to_index( HANDLE handle, UINT_PTR *entry )
+{
+    UINT_PTR idx = (((UINT_PTR)handle) >> 2) - 1;
+    *entry = idx / FSYNC_LIST_BLOCK_SIZE;
+    return idx % FSYNC_LIST_BLOCK_SIZE;
+}
+
+static struct fsync *add_to_list( HANDLE handle, enum esync_type type, void *shm )
+{
+    UINT_PTR entry, idx = handle_to_index( handle, &entry );
+
+    if (entry >= FSYNC_LIST_ENTRIES)
+    {
+        FIXME( "too many allocated handles, not caching %p\n", handle );
+        return NULL;
+    }
+
+    if (!fsync_list[entry])  /* do we need to allocate a new block of entries? */
+    {
+        if (!entry) fsync_list[0] = fsync_list_initial_block;
+        else
+        {
+            void *ptr = anon_mmap_alloc( FSYNC_LIST_BLOCK_SIZE * sizeof(struct fsync),
+                                         PROT_READ | PROT_WRITE );
+            if (ptr == MAP_FAILED) return NULL;
+            if (InterlockedCompareExchangePointer( (void **)&fsync_list[entry], ptr, NULL ))
+                munmap( ptr, FSYNC_LIST_BLOCK_SIZE * sizeof(struct fsync) );
+        }
+    }
+
+    fsync_list[entry][idx].shm = shm;
+    InterlockedExchange( (LONG *)&fsync_list[entry][idx].type, type );
+    return &fsync_list[entry][idx];
+}
+
+static struct fsync *get_cached_object( HANDLE handle )
+{
+    UINT_PTR entry, idx = handle_to_index( handle, &entry );
+
+    if (entry >= FSYNC_LIST_ENTRIES || !fsync_list[entry]) return NULL;
+    if (!fsync_list[entry][idx].type) return NULL;
+
+    return &fsync_list[entry][idx];
+}
+
+/* Gets an object. This is either a proper fsync object (i.e. an event,
+ * semaphore, etc. created using create_esync) or a generic synchronizable
+ * server-side object which the server will signal (e.g. a process, thread,
+ * message queue, etc.) */
+static NTSTATUS get_object( HANDLE handle, struct fsync **obj )
+{
+    enum esync_type type = 0;
+    unsigned int shm_idx = 0;
+    NTSTATUS ret;
+
+    if ((*obj = get_cached_object( handle ))) return STATUS_SUCCESS;
+
+    if ((INT_PTR)handle < 0)
+    {
+        /* We can deal with pseudo-handles, but it's just easier this way */
+        return STATUS_NOT_IMPLEMENTED;
+    }
+
+    if (!handle) return STATUS_INVALID_HANDLE;
+
+    /* We need to try grabbing it from the server. */
+    SERVER_START_REQ( get_esync_fd )
+    {
+        req->handle = wine_server_obj_handle( handle );
+        if (!(ret = wine_server_call( req )))
+        {
+            type = reply->type;
+            shm_idx = reply->shm_idx;
+        }
+    }
+    SERVER_END_REQ;
+
+    if (ret)
+    {
+        WARN("Failed to retrieve shm index for handle %p, status %#x.\n", handle, (int)ret);
+        return ret;
+    }
+    if (!shm_idx) return STATUS_NOT_IMPLEMENTED;
+
+    TRACE("Got shm index %u for handle %p.\n", shm_idx, handle);
+
+    if (!(*obj = add_to_list( handle, type, get_shm( shm_idx ) ))) return STATUS_NOT_IMPLEMENTED;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS fsync_close( HANDLE handle )
+{
+    UINT_PTR entry, idx = handle_to_index( handle, &entry );
+
+    TRACE("%p.\n", handle);
+
+    if (entry < FSYNC_LIST_ENTRIES && fsync_list[entry])
+    {
+        if (InterlockedExchange( (LONG *)&fsync_list[entry][idx].type, 0 ))
+            return STATUS_SUCCESS;
+    }
+
+    return STATUS_INVALID_HANDLE;
+}
+
+static NTSTATUS create_fsync( enum esync_type type, HANDLE *handle, ACCESS_MASK access,
+                              const OBJECT_ATTRIBUTES *attr, int initval, int max )
+{
+    NTSTATUS ret;
+    data_size_t len;
+    struct object_attributes *objattr;
+    unsigned int shm_idx = 0;
+
+    if ((ret = alloc_object_attributes( attr, &objattr, &len ))) return ret;
+
+    SERVER_START_REQ( create_esync )
+    {
+        req->access  = access;
+        req->initval = initval;
+        req->type    = type;
+        req->max     = max;
+        wine_server_add_data( req, objattr, len );
+        ret = wine_server_call( req );
+        if (!ret || ret == STATUS_OBJECT_NAME_EXISTS)
+        {
+            *handle = wine_server_ptr_handle( reply->handle );
+            type = reply->type;
+            shm_idx = reply->shm_idx;
+        }
+    }
+    SERVER_END_REQ;
+
+    if (!ret || ret == STATUS_OBJECT_NAME_EXISTS)
+    {
+        add_to_list( *handle, type, get_shm( shm_idx ) );
+        TRACE("-> handle %p, shm index %u.\n", *handle, shm_idx);
+    }
+
+    free( objattr );
+    return ret;
+}
+
+static NTSTATUS open_fsync( enum esync_type type, HANDLE *handle,
+    ACCESS_MASK access, const OBJECT_ATTRIBUTES *attr )
+{
+    NTSTATUS ret;
+    unsigned int shm_idx = 0;
+
+    SERVER_START_REQ( open_esync )
+    {
+        req->access     = access;
+        req->attributes = attr->Attributes;
+        req->rootdir    = wine_server_obj_handle( attr->RootDirectory );
+        req->type       = type;
+        if (attr->ObjectName)
+            wine_server_add_data( req, attr->ObjectName->Buffer, attr->ObjectName->Length );
+        if (!(ret = wine_server_call( req )))
+        {
+            *handle = wine_server_ptr_handle( reply->handle );
+            type = reply->type;
+            shm_idx = reply->shm_idx;
+        }
+    }
+    SERVER_END_REQ;
+
+    if (!ret)
+    {
+        add_to_list( *handle, type, get_shm( shm_idx ) );
+        TRACE("-> handle %p, shm index %u.\n", *handle, shm_idx);
+    }
+    return ret;
+}
+
+NTSTATUS fsync_create_semaphore( HANDLE *handle, ACCESS_MASK access,
+    const OBJECT_ATTRIBUTES *attr, LONG initial, LONG max )
+{
+    TRACE("name %s, initial %d, max %d.\n",
+          attr ? debugstr_us(attr->ObjectName) : "<no name>", (int)initial, (int)max);
+
+    return create_fsync( ESYNC_SEMAPHORE, handle, access, attr, initial, max );
+}
+
+NTSTATUS fsync_open_semaphore( HANDLE *handle, ACCESS_MASK access,
+    const OBJECT_ATTRIBUTES *attr )
+{
+    TRACE("name %s.\n", debugstr_us(attr->ObjectName));
+
+    return open_fsync( ESYNC_SEMAPHORE, handle, access, attr );
+}
+
+NTSTATUS fsync_release_semaphore( HANDLE handle, ULONG count, ULONG *prev )
+{
+    struct fsync *obj;
+    struct semaphore *semaphore;
+    ULONG current;
+    NTSTATUS ret;
+
+    TRACE("%p, %d, %p.\n", handle, (int)count, prev);
+
+    if ((ret = get_object( handle, &obj ))) return ret;
+    if (obj->type != ESYNC_SEMAPHORE) return STATUS_OBJECT_TYPE_MISMATCH;
+    semaphore = obj->shm;
+
+    do
+    {
+        current = semaphore->count;
+
+        if (count + current > semaphore->max)
+            return STATUS_SEMAPHORE_LIMIT_EXCEEDED;
+    } while (InterlockedCompareExchange( (LONG *)&semaphore->count, count + current, current ) != current);
+
+    if (prev) *prev = current;
+
+    fsync_wake_futex( &semaphore->count );
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS fsync_query_semaphore( HANDLE handle, void *info, ULONG *ret_len )
+{
+    struct fsync *obj;
+    struct semaphore *semaphore;
+    SEMAPHORE_BASIC_INFORMATION *out = info;
+    NTSTATUS ret;
+
+    TRACE("handle %p, info %p, ret_len %p.\n", handle, info, ret_len);
+
+    if ((ret = get_object( handle, &obj ))) return ret;
+    if (obj->type != ESYNC_SEMAPHORE) return STATUS_OBJECT_TYPE_MISMATCH;
+    semaphore = obj->shm;
+
+    out->CurrentCount = semaphore->count;
+    out->MaximumCount = semaphore->max;
+    if (ret_len) *ret_len = sizeof(*out);
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS fsync_create_event( HANDLE *handle, ACCESS_MASK access,
+    const OBJECT_ATTRIBUTES *attr, EVENT_TYPE event_type, BOOLEAN initial )
+{
+    enum esync_type type = (event_type == SynchronizationEvent ? ESYNC_AUTO_EVENT : ESYNC_MANUAL_EVENT);
+
+    TRACE("name %s, %s-reset, initial %d.\n",
+          attr ? debugstr_us(attr->ObjectName) : "<no name>",
+          event_type == NotificationEvent ? "manual" : "auto", initial);
+
+    return create_fsync( type, handle, access, attr, initial, 0 );
+}
+
+NTSTATUS fsync_open_event( HANDLE *handle, ACCESS_MASK access,
+    const OBJECT_ATTRIBUTES *attr )
+{
+    TRACE("name %s.\n", debugstr_us(attr->ObjectName));
+
+    return open_fsync( ESYNC_AUTO_EVENT, handle, access, attr ); /* doesn't matter which */
+}
+
+/* Unlike esync, the futex word is the only state of an event, so there is no
+ * need for a spinlock; set and reset are plain atomic exchanges. */
+
+NTSTATUS fsync_set_event( HANDLE handle, LONG *prev )
+{
+    struct fsync *obj;
+    struct event *event;
+    LONG current;
+    NTSTATUS ret;
+
+    TRACE("%p.\n", handle);
+
+    if ((ret = get_object( handle, &obj ))) return ret;
+    if (obj->type != ESYNC_AUTO_EVENT && obj->type != ESYNC_MANUAL_EVENT)
+        return STATUS_OBJECT_TYPE_MISMATCH;
+    event = obj->shm;
+
+    if (!(current = InterlockedExchange( (LONG *)&event->signaled, 1 )))
+        fsync_wake_futex( &event->signaled );
+
+    if (prev) *prev = current;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS fsync_reset_event( HANDLE handle, LONG *prev )
+{
+    struct fsync *obj;
+    struct event *event;
+    LONG current;
+    NTSTATUS ret;
+
+    TRACE("%p.\n", handle);
+
+    if ((ret = get_object( handle, &obj ))) return ret;
+    if (obj->type != ESYNC_AUTO_EVENT && obj->type != ESYNC_MANUAL_EVENT)
+        return STATUS_OBJECT_TYPE_MISMATCH;
+    event = obj->shm;
+
+    current = InterlockedExchange( (LONG *)&event->signaled, 0 );
+
+    if (prev) *prev = current;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS fsync_pulse_event( HANDLE handle, LONG *prev )
+{
+    struct fsync *obj;
+    struct event *event;
+    LONG current;
+    NTSTATUS ret;
+
+    TRACE("%p.\n", handle);
+
+    if ((ret = get_object( handle, &obj ))) return ret;
+    if (obj->type != ESYNC_AUTO_EVENT && obj->type != ESYNC_MANUAL_EVENT)
+        return STATUS_OBJECT_TYPE_MISMATCH;
+    event = obj->shm;
+
+    /* This isn't really correct; an application could miss the wake, same as
+     * with esync. Fortunately this is rarely used (and publicly deprecated). */
+    if (!(current = InterlockedExchange( (LONG *)&event->signaled, 1 )))
+        fsync_wake_futex( &event->signaled );
+
+    /* Try to give other threads a chance to wake up. */
+    NtYieldExecution();
+
+    InterlockedExchange( (LONG *)&event->signaled, 0 );
+
+    if (prev) *prev = current;
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS fsync_query_event( HANDLE handle, void *info, ULONG *ret_len )
+{
+    struct fsync *obj;
+    struct event *event;
+    EVENT_BASIC_INFORMATION *out = info;
+    NTSTATUS ret;
+
+    TRACE("handle %p, info %p, ret_len %p.\n", handle, info, ret_len);
+
+    if ((ret = get_object( handle, &obj ))) return ret;
+    if (obj->type != ESYNC_AUTO_EVENT && obj->type != ESYNC_MANUAL_EVENT)
+        return STATUS_OBJECT_TYPE_MISMATCH;
+    event = obj->shm;
+
+    out->EventState = event->signaled;
+    out->EventType = (obj->type == ESYNC_AUTO_EVENT ? SynchronizationEvent : NotificationEvent);
+    if (ret_len) *ret_len = sizeof(*out);
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS fsync_create_mutex( HANDLE *handle, ACCESS_MASK access,
+    const OBJECT_ATTRIBUTES *attr, BOOLEAN initial )
+{
+    TRACE("name %s, initial %d.\n",
+          attr ? debugstr_us(attr->ObjectName) : "<no name>", initial);
+
+    return create_fsync( ESYNC_MUTEX, handle, access, attr, initial ? 0 : 1, 0 );
+}
+
+NTSTATUS fsync_open_mutex( HANDLE *handle, ACCESS_MASK access,
+    const OBJECT_ATTRIBUTES *attr )
+{
+    TRACE("name %s.\n", debugstr_us(attr->ObjectName));
+
+    return open_fsync( ESYNC_MUTEX, handle, access, attr );
+}
+
+NTSTATUS fsync_release_mutex( HANDLE handle, LONG *prev )
+{
+    struct fsync *obj;
+    struct mutex *mutex;
+    NTSTATUS ret;
+
+    TRACE("%p, %p.\n", handle, prev);
+
+    if ((ret = get_object( handle, &obj ))) return ret;
+    if (obj->type != ESYNC_MUTEX) return STATUS_OBJECT_TYPE_MISMATCH;
+    mutex = obj->shm;
+
+    /* This is thread-safe, because the only thread that can change the tid to
+     * or from our tid is ours. */
+    if (mutex->tid != GetCurrentThreadId()) return STATUS_MUTANT_NOT_OWNED;
+
+    if (prev) *prev = 1 - mutex->count;
+
+    if (!--mutex->count)
+    {
+        InterlockedExchange( (LONG *)&mutex->tid, 0 );
+        fsync_wake_futex( &mutex->tid );
+    }
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS fsync_query_mutex( HANDLE handle, void *info, ULONG *ret_len )
+{
+    struct fsync *obj;
+    struct mutex *mutex;
+    MUTANT_BASIC_INFORMATION *out = info;
+    NTSTATUS ret;
+
+    TRACE("handle %p, info %p, ret_len %p.\n", handle, info, ret_len);
+
+    if ((ret = get_object( handle, &obj ))) return ret;
+    if (obj->type != ESYNC_MUTEX) return STATUS_OBJECT_TYPE_MISMATCH;
+    mutex = obj->shm;
+
+    out->CurrentCount = 1 - mutex->count;
+    out->OwnedByCaller = (mutex->tid == GetCurrentThreadId());
+    out->AbandonedState = (mutex->tid == ~0);
+    if (ret_len) *ret_len = sizeof(*out);
+
+    return STATUS_SUCCESS;
+}
+
+static LONGLONG update_timeout( ULONGLONG end )
+{
+    LARGE_INTEGER now;
+    LONGLONG timeleft;
+
+    NtQuerySystemTime( &now );
+    timeleft = end - now.QuadPart;
+    if (timeleft < 0) timeleft = 0;
+    return timeleft;
+}
+
+static void set_waiter( struct futex_waitv *waiter, int *addr, int val )
+{
+    waiter->val = val;
+    waiter->uaddr = (ULONG_PTR)addr;
+    waiter->flags = FUTEX_32;
+    waiter->__reserved = 0;
+}
+
+/* Check whether an object can be acquired, without acquiring it. If not, fill
+ * in the futex which we should sleep on. */
+static BOOL is_signaled( struct fsync *obj, struct futex_waitv *waiter )
+{
+    switch (obj->type)
+    {
+    case ESYNC_SEMAPHORE:
+    {
+        struct semaphore *semaphore = obj->shm;
+        int count = ReadNoFence( (LONG *)&semaphore->count );
+
+        if (count) return TRUE;
+        set_waiter( waiter, &semaphore->count, count );
+        return FALSE;
+    }
+    case ESYNC_MUTEX:
+    {
+        struct mutex *mutex = obj->shm;
+        int tid = ReadNoFence( (LONG *)&mutex->tid );
+
+        if (!tid || tid == ~0 || tid == GetCurrentThreadId()) return TRUE;
+        set_waiter( waiter, &mutex->tid, tid );
+        return FALSE;
+    }
+    default:
+    {
+        struct event *event = obj->shm;
+        int signaled = ReadNoFence( (LONG *)&event->signaled );
+
+        if (signaled) return TRUE;
+        set_waiter( waiter, &event->signaled, signaled );
+        return FALSE;
+    }
+    }
+}
+
+/* Try to acquire an object. If it's not available, fill in the futex which we
+ * should sleep on. */
+static BOOL try_grab_object( struct fsync *obj, BOOL *abandoned, struct futex_waitv *waiter )
+{
+    *abandoned = FALSE;
+
+    switch (obj->type)
+    {
+    case ESYNC_SEMAPHORE:
+    {
+        struct semaphore *semaphore = obj->shm;
+        int count;
+
+        while ((count = ReadNoFence( (LONG *)&semaphore->count )))
+        {
+            if (InterlockedCompareExchange( (LONG *)&semaphore->count, count - 1, count ) == count)
+                return TRUE;
+        }
+        set_waiter( waiter, &semaphore->count, 0 );
+        return FALSE;
+    }
+    case ESYNC_MUTEX:
+    {
+        struct mutex *mutex = obj->shm;
+        int tid = GetCurrentThreadId(), owner;
+
+        for (;;)
+        {
+            owner = ReadNoFence( (LONG *)&mutex->tid );
+            if (owner == tid)
+            {
+                mutex->count++;
+                return TRUE;
+            }
+            if (owner && owner != ~0)
+            {
+                set_waiter( waiter, &mutex->tid, owner );
+                return FALSE;
+            }
+            if (InterlockedCompareExchange( (LONG *)&mutex->tid, tid, owner ) == owner)
+            {
+                mutex->count = 1;
+                *abandoned = (owner == ~0);
+                return TRUE;
+            }
+        }
+    }
+    case ESYNC_AUTO_EVENT:
+    case ESYNC_AUTO_SERVER:
+    {
+        struct event *event = obj->shm;
+
+        if (InterlockedCompareExchange( (LONG *)&event->signaled, 0, 1 ) == 1) return TRUE;
+        set_waiter( waiter, &event->signaled, 0 );
+        return FALSE;
+    }
+    default:
+        return is_signaled( obj, waiter );
+    }
+}
+
+/* Undo try_grab_object(), if we failed to acquire all objects in a wait-all. */
+static void put_object( struct fsync *obj, BOOL abandoned )
+{
+    switch (obj->type)
+    {
+    case ESYNC_SEMAPHORE:
+    {
+        struct semaphore *semaphore = obj->shm;
+
+        InterlockedIncrement( (LONG *)&semaphore->count );
+        fsync_wake_futex( &semaphore->count );
+        break;
+    }
+    case ESYNC_MUTEX:
+    {
+        struct mutex *mutex = obj->shm;
+
+        if (!--mutex->count)
+        {
+            InterlockedExchange( (LONG *)&mutex->tid, abandoned ? ~0 : 0 );
+            fsync_wake_futex( &mutex->tid );
+        }
+        break;
+    }
+    case ESYNC_AUTO_EVENT:
+    case ESYNC_AUTO_SERVER:
+    {
+        struct event *event = obj->shm;
+
+        InterlockedExchange( (LONG *)&event->signaled, 1 );
+        fsync_wake_futex( &event->signaled );
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+/* Sleep until one of the given futexes changes, or the timeout expires.
+ * Returns -1 and sets errno (ETIMEDOUT, EAGAIN or EINTR) on failure. */
+static int wait_futexes( struct futex_waitv *futexes, unsigned int count, int seq, const ULONGLONG *end )
+{
+    LONGLONG timeleft = end ? update_timeout( *end ) : 0;
+    int ret;
+
+    if (end && !timeleft)
+    {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+
+    if (use_futex_waitv)
+    {
+        struct timespec64 end_mono;
+
+        if (end)
+        {
+            struct timespec now;
+
+            clock_gettime( CLOCK_MONOTONIC, &now );
+            end_mono.tv_sec = now.tv_sec + timeleft / TICKSPERSEC;
+            end_mono.tv_nsec = now.tv_nsec + (timeleft % TICKSPERSEC) * 100;
+            if (end_mono.tv_nsec >= 1000000000)
+            {
+                end_mono.tv_sec++;
+                end_mono.tv_nsec -= 1000000000;
+            }
+        }
+        return futex_waitv( futexes, count, end ? &end_mono : NULL );
+    }
+    else
+    {
+        struct timespec tmo_p;
+
+        if (end)
+        {
+            tmo_p.tv_sec = timeleft / (ULONGLONG)TICKSPERSEC;
+            tmo_p.tv_nsec = (timeleft % TICKSPERSEC) * 100;
+        }
+
+        if (count == 1)
+            return futex_wait( (int *)(ULONG_PTR)futexes[0].uaddr, futexes[0].val, end ? &tmo_p : NULL );
+
+        InterlockedIncrement( (LONG *)&wake_seq->waiters );
+        ret = futex_wait( &wake_seq->seq, seq, end ? &tmo_p : NULL );
+        InterlockedDecrement( (LONG *)&wake_seq->waiters );
+        return ret;
+    }
+}
+
+static int *get_apc_futex(void)
+{
+    struct ntdll_thread_data *data = ntdll_get_thread_data();
+    unsigned int shm_idx = 0;
+
+    if (data->fsync_apc_futex) return data->fsync_apc_futex;
+
+    SERVER_START_REQ( get_esync_apc_fd )
+    {
+        if (!wine_server_call( req ))
+            shm_idx = reply->shm_idx;
+    }
+    SERVER_END_REQ;
+
+    if (shm_idx) data->fsync_apc_futex = get_shm( shm_idx );
+    return data->fsync_apc_futex;
+}
+
+/* A value of STATUS_NOT_IMPLEMENTED returned from this function means that we
+ * need to delegate to server_select(). */
+static NTSTATUS __fsync_wait_objects( DWORD count, const HANDLE *handles, BOOLEAN wait_any,
+                                      BOOLEAN alertable, const LARGE_INTEGER *timeout )
+{
+    static const LARGE_INTEGER zero;
+
+    struct fsync *objs[MAXIMUM_WAIT_OBJECTS];
+    struct futex_waitv futexes[MAXIMUM_WAIT_OBJECTS + 1];
+    BOOL abandoned[MAXIMUM_WAIT_OBJECTS];
+    int has_fsync = 0, has_server = 0;
+    int *apc_futex = NULL;
+    unsigned int waitcount;
+    LARGE_INTEGER now;
+    ULONGLONG end;
+    int i, j, seq;
+    NTSTATUS ret;
+
+    if (alertable && !(apc_futex = get_apc_futex())) return STATUS_NOT_IMPLEMENTED;
+
+    NtQuerySystemTime( &now );
+    if (timeout)
+    {
+        if (timeout->QuadPart == TIMEOUT_INFINITE)
+            timeout = NULL;
+        else if (timeout->QuadPart >= 0)
+            end = timeout->QuadPart;
+        else
+            end = now.QuadPart - timeout->QuadPart;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        ret = get_object( handles[i], &objs[i] );
+        if (ret == STATUS_SUCCESS)
+            has_fsync = 1;
+        else if (ret == STATUS_NOT_IMPLEMENTED)
+            has_server = 1;
+        else
+            return ret;
+    }
+
+    if (has_fsync && has_server)
+        FIXME("Can't wait on fsync and server objects at the same time!\n");
+    if (has_server)
+        return STATUS_NOT_IMPLEMENTED;
+
+    if (TRACE_ON(fsync))
+    {
+        TRACE("Waiting for %s of %d handles:", wait_any ? "any" : "all", (int)count);
+        for (i = 0; i < count; i++)
+            TRACE(" %p", handles[i]);
+
+        if (alertable)
+            TRACE(", alertable");
+
+        if (!timeout)
+            TRACE(", timeout = INFINITE.\n");
+        else
+        {
+            LONGLONG timeleft = update_timeout( end );
+            TRACE(", timeout = %ld.%07ld sec.\n",
+                  (long) (timeleft / TICKSPERSEC), (long) (timeleft % TICKSPERSEC));
+        }
+    }
+
+    for (;;)
+    {
+        /* Read this before checking anything, so that a wake in between can't
+         * get lost if we have to fall back to the wake sequence. */
+        seq = ReadNoFence( (LONG *)&wake_seq->seq );
+        waitcount = 0;
+
+        if (apc_futex && ReadNoFence( (LONG *)apc_futex )) goto userapc;
+
+        if (wait_any || count == 1)
+        {
+            for (i = 0; i < count; i++)
+            {
+                if (try_grab_object( objs[i], &abandoned[i], &futexes[waitcount] ))
+                {
+                    if (abandoned[i])
+                    {
+                        TRACE("Woken up by abandoned mutex %p [%d].\n", handles[i], i);
+                        return STATUS_ABANDONED_WAIT_0 + i;
+                    }
+                    TRACE("Woken up by handle %p [%d].\n", handles[i], i);
+                    return i;
+                }
+                waitcount++;
+            }
+        }
+        else
+        {
+            /* Wait-all. Only try to grab the objects once we've seen all of
+             * them signaled; if somebody steals one in the meantime, put back
+             * whatever we already have and start over. */
+            for (i = 0; i < count; i++)
+            {
+                if (!is_signaled( objs[i], &futexes[waitcount] )) waitcount++;
+            }
+
+            if (!waitcount)
+            {
+                BOOL any_abandoned = FALSE;
+
+                for (i = 0; i < count; i++)
+                {
+                    if (!try_grab_object( objs[i], &abandoned[i], &futexes[0] )) break;
+                    any_abandoned |= abandoned[i];
+                }
+
+                if (i == count)
+                {
+                    if (any_abandoned)
+                    {
+                        TRACE("Wait successful, but some object(s) were abandoned.\n");
+                        return STATUS_ABANDONED;
+                    }
+                    TRACE("Wait successful.\n");
+                    return STATUS_SUCCESS;
+                }
+
+                /* We were too slow. Put everything back. */
+                for (j = i - 1; j >= 0; j--)
+                    put_object( objs[j], abandoned[j] );
+                continue;
+            }
+        }
+
+        if (apc_futex) set_waiter( &futexes[waitcount++], apc_futex, 0 );
+
+        if (wait_futexes( futexes, waitcount, seq, timeout ? &end : NULL ) == -1)
+        {
+            if (errno == ETIMEDOUT)
+            {
+                TRACE("Wait timed out.\n");
+                return STATUS_TIMEOUT;
+            }
+            /* EAGAIN means one of the futexes changed under us, and EINTR that
+             * we were probably suspended (SIGUSR1); just try again. */
+            if (errno != EAGAIN && errno != EINTR)
+            {
+                ERR("futex wait failed: %s\n", strerror( errno ));
+                return errno_to_status( errno );
+            }
+        }
+    }
+
+userapc:
+    TRACE("Woken up by user APC.\n");
+
+    /* We have to make a server call anyway to get the APC to execute, so just
+     * delegate down to server_select(). */
+    ret = server_wait( NULL, 0, SELECT_INTERRUPTIBLE | SELECT_ALERTABLE, &zero );
+
+    /* This can happen if we received a system APC, and the APC futex was woken
+     * up before we got SIGUSR1. The right thing to do seems to be to return
+     * STATUS_USER_APC anyway. */
+    if (ret == STATUS_TIMEOUT) ret = STATUS_USER_APC;
+    return ret;
+}
+
+/* We need to let the server know when we are doing a message wait, and when we
+ * are done with one, so that all of the code surrounding hung queues works.
+ * We also need this for WaitForInputIdle(). */
+static void server_set_msgwait( int in_msgwait )
+{
+    SERVER_START_REQ( esync_msgwait )
+    {
+        req->in_msgwait = in_msgwait;
+        wine_server_call( req );
+    }
+    SERVER_END_REQ;
+}
+
+NTSTATUS fsync_wait_objects( DWORD count, const HANDLE *handles, BOOLEAN wait_any,
+                             BOOLEAN alertable, const LARGE_INTEGER *timeout )
+{
+    BOOL msgwait = FALSE;
+    struct fsync *obj;
+    NTSTATUS ret;
+
+    if (count && !get_object( handles[count - 1], &obj ) && obj->type == ESYNC_QUEUE)
+    {
+        msgwait = TRUE;
+        server_set_msgwait( 1 );
+    }
+
+    ret = __fsync_wait_objects( count, handles, wait_any, alertable, timeout );
+
+    if (msgwait)
+        server_set_msgwait( 0 );
+
+    return ret;
+}
+
+NTSTATUS fsync_signal_and_wait( HANDLE signal, HANDLE wait, BOOLEAN alertable,
+    const LARGE_INTEGER *timeout )
+{
+    struct fsync *obj;
+    NTSTATUS ret;
+
+    if ((ret = get_object( signal, &obj ))) return ret;
+
+    switch (obj->type)
+    {
+    case ESYNC_SEMAPHORE:
+        ret = fsync_release_semaphore( signal, 1, NULL );
+        break;
+    case ESYNC_AUTO_EVENT:
+    case ESYNC_MANUAL_EVENT:
+        ret = fsync_set_event( signal, NULL );
+        break;
+    case ESYNC_MUTEX:
+        ret = fsync_release_mutex( signal, NULL );
+        break;
+    default:
+        return STATUS_OBJECT_TYPE_MISMATCH;
+    }
+    if (ret) return ret;
+
+    return fsync_wait_objects( 1, &wait, TRUE, alertable, timeout );
+}
+
+void fsync_init(void)
+{
+    struct stat st;
+
+    if (!do_fsync()) return;
+
+    if (stat( config_dir, &st ) == -1)
+        ERR("Cannot stat %s\n", config_dir);
+
+    if (st.st_ino != (unsigned long)st.st_ino)
+        sprintf( shm_name, "/wine-%lx%08lx-fsync", (unsigned long)((unsigned long long)st.st_ino >> 32), (unsigned long)st.st_ino );
+    else
+        sprintf( shm_name, "/wine-%lx-fsync", (unsigned long)st.st_ino );
+
+    if ((shm_fd = shm_open( shm_name, O_RDWR, 0644 )) == -1)
+    {
+        /* probably the server isn't running with WINEFSYNC, tell the user and bail */
+        if (errno == ENOENT)
+            ERR("Failed to open fsync shared memory file; make sure no stale wineserver instances are running without WINEFSYNC.\n");
+        else
+            ERR("Failed to initialize shared memory: %s\n", strerror( errno ));
+        exit(1);
+    }
+
+    pagesize = sysconf( _SC_PAGESIZE );
+
+    shm_addrs = calloc( 128, sizeof(shm_addrs[0]) );
+    shm_addrs_size = 128;
+
+    wake_seq = get_shm( 0 );
+}
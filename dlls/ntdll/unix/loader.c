@@ -89,6 +89,7 @@ extern char **environ;
 #include "winternl.h"
 #include "unix_private.h"
 #include "esync.h"
+#include "fsync.h"
 #include "wine/list.h"
 #include "ntsyscalls.h"
 #include "wine/debug.h"
@@ -1810,7 +1811,8 @@ static void start_main_thread(void)
     signal_alloc_thread( teb );
     dbg_init();
     startup_info_size = server_init_process();
-    esync_init();
+    if (do_fsync()) fsync_init();
+    else esync_init();
     virtual_map_user_shared_data();
     init_cpu_info();
     init_files();
@@ -80,9 +80,11 @@
 #include "wine/debug.h"
 #include "unix_private.h"
 #include "esync.h"
+#include "fsync.h"
 #include "ddk/wdm.h"
 
 WINE_DEFAULT_DEBUG_CHANNEL(server);
+WINE_DECLARE_DEBUG_CHANNEL(fdcache);
 
 #ifndef MSG_CMSG_CLOEXEC
 #define MSG_CMSG_CLOEXEC 0
@@ -104,6 +106,7 @@ sigset_t server_block_set;  /* signals to block during server calls */
 static int fd_socket = -1;  /* socket to exchange file descriptors with the server */
 static int initial_cwd = -1;
 static pid_t server_pid;
+static void *process_shm;  /* state published by the server, mapped read-only */
 pthread_mutex_t fd_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 /* atomically exchange a 64-bit value */
@@ -254,6 +257,41 @@ static inline unsigned int wait_reply( struct __server_request_info *req )
 }
 
 
+/* handles closed by NtClose whose close_handle request hasn't been sent yet */
+#define CLOSE_BATCH_SIZE 64
+
+static pthread_mutex_t close_batch_mutex = PTHREAD_MUTEX_INITIALIZER;
+static obj_handle_t close_batch[CLOSE_BATCH_SIZE];
+static LONG close_batch_count;
+
+/***********************************************************************
+ *           send_close_batch
+ *
+ * Send the pending closes, followed by the next request if any, so that both
+ * go out in the same round trip. Caller must hold close_batch_mutex.
+ */
+static unsigned int send_close_batch( struct __server_request_info *next )
+{
+    unsigned int ret;
+
+    if (!close_batch_count) return next ? send_request( next ) : STATUS_SUCCESS;
+
+    SERVER_START_REQ( close_handles )
+    {
+        wine_server_add_data( req, close_batch, close_batch_count * sizeof(close_batch[0]) );
+        if (!(ret = send_request( (struct __server_request_info *)req )))
+        {
+            if (next) ret = send_request( next );
+            wait_reply( (struct __server_request_info *)req );
+            TRACE( "closed %u/%u deferred handles\n", reply->closed, (unsigned int)close_batch_count );
+        }
+        close_batch_count = 0;
+    }
+    SERVER_END_REQ;
+    return ret;
+}
+
+
 /***********************************************************************
  *           server_call_unlocked
  */
@@ -262,7 +300,16 @@ unsigned int server_call_unlocked( void *req_ptr )
     struct __server_request_info * const req = req_ptr;
     unsigned int ret;
 
-    if ((ret = send_request( req ))) return ret;
+    /* the new thread's reply fd isn't known to the server before init_thread */
+    if (ReadNoFence( &close_batch_count ) && req->u.req.request_header.req != REQ_init_thread)
+    {
+        pthread_mutex_lock( &close_batch_mutex );
+        ret = send_close_batch( req );
+        pthread_mutex_unlock( &close_batch_mutex );
+    }
+    else ret = send_request( req );
+
+    if (ret) return ret;
     return wait_reply( req );
 }
 
@@ -392,6 +439,8 @@ static void invoke_system_apc( const apc_call_t *call, apc_result_t *result, BOO
             set_async_iosb( call->async_io.sb, result->async_io.status, info );
         }
         else result->async_io.status = STATUS_PENDING; /* restart it */
+        result->async_io.alert_count = ntdll_get_thread_data()->async_alert_count;
+        ntdll_get_thread_data()->async_alert_count = 0;
         break;
     }
     case APC_VIRTUAL_ALLOC:
@@ -983,13 +1032,15 @@ union fd_cache_entry
     struct
     {
         int fd;
-        enum server_fd_type type : 5;
+        unsigned int        type : 4;    /* enum server_fd_type */
+        unsigned int        stream : 1;  /* FD_TYPE_SOCKET of type SOCK_STREAM */
         unsigned int        access : 3;
         unsigned int        options : 24;
     } s;
 };
 
 C_ASSERT( sizeof(union fd_cache_entry) == sizeof(LONG64) );
+C_ASSERT( FD_TYPE_NB_TYPES <= 16 );
 
 #define FD_CACHE_BLOCK_SIZE  (65536 / sizeof(union fd_cache_entry))
 #define FD_CACHE_ENTRIES     128
@@ -997,6 +1048,10 @@ C_ASSERT( sizeof(union fd_cache_entry) == sizeof(LONG64) );
 static union fd_cache_entry *fd_cache[FD_CACHE_ENTRIES];
 static union fd_cache_entry fd_cache_initial_block[FD_CACHE_BLOCK_SIZE];
 
+/* statistics, only maintained when the fdcache channel is enabled */
+static LONG fd_cache_hits;
+static LONG fd_cache_misses;
+
 static inline unsigned int handle_to_index( HANDLE handle, unsigned int *entry )
 {
     unsigned int idx = (wine_server_obj_handle(handle) >> 2) - 1;
@@ -1005,6 +1060,15 @@ static inline unsigned int handle_to_index( HANDLE handle, unsigned int *entry )
 }
 
 
+static BOOL is_stream_socket( int fd )
+{
+    int sock_type;
+    socklen_t len = sizeof(sock_type);
+
+    return !getsockopt( fd, SOL_SOCKET, SO_TYPE, &sock_type, &len ) && sock_type == SOCK_STREAM;
+}
+
+
 /***********************************************************************
  *           add_fd_to_cache
  *
@@ -1037,6 +1101,7 @@ static BOOL add_fd_to_cache( HANDLE handle, int fd, enum server_fd_type type,
     /* store fd+1 so that 0 can be used as the unset value */
     cache.s.fd = fd + 1;
     cache.s.type = type;
+    cache.s.stream = (type == FD_TYPE_SOCKET && is_stream_socket( fd ));
     cache.s.access = access;
     cache.s.options = options;
     cache.data = interlocked_xchg64( &fd_cache[entry][idx].data, cache.data );
@@ -1089,6 +1154,94 @@ static int remove_fd_from_cache( HANDLE handle )
 }
 
 
+/* handles whose close can be deferred and batched, one bit per handle */
+#define DEFERRED_CLOSE_BITS  (8 * sizeof(LONG))
+
+static LONG *deferred_close[FD_CACHE_ENTRIES];
+
+/***********************************************************************
+ *           server_allow_deferred_close
+ *
+ * Mark a handle as safe to close lazily, i.e. one whose close has no side
+ * effects visible to other processes (unnamed synchronization objects).
+ * The mark is keyed on the handle value, so every path closing the handle
+ * must clear it: NtClose() and NtDuplicateObject() with DUPLICATE_CLOSE_SOURCE,
+ * which other processes also end up calling here through APC_DUP_HANDLE.
+ */
+void server_allow_deferred_close( HANDLE handle )
+{
+    unsigned int entry, idx = handle_to_index( handle, &entry );
+    LONG *block;
+
+    if (entry >= FD_CACHE_ENTRIES) return;
+    if (!(block = deferred_close[entry]))
+    {
+        block = anon_mmap_alloc( FD_CACHE_BLOCK_SIZE / 8, PROT_READ | PROT_WRITE );
+        if (block == MAP_FAILED) return;
+        if (InterlockedCompareExchangePointer( (void **)&deferred_close[entry], block, NULL ))
+        {
+            munmap( block, FD_CACHE_BLOCK_SIZE / 8 );
+            block = deferred_close[entry];
+        }
+    }
+    __atomic_fetch_or( &block[idx / DEFERRED_CLOSE_BITS], 1u << (idx % DEFERRED_CLOSE_BITS),
+                       __ATOMIC_SEQ_CST );
+}
+
+
+/***********************************************************************
+ *           take_deferred_close
+ *
+ * Clear the deferred close mark of a handle, returning whether it was set.
+ */
+static BOOL take_deferred_close( HANDLE handle )
+{
+    unsigned int entry, idx = handle_to_index( handle, &entry );
+    LONG bit = 1u << (idx % DEFERRED_CLOSE_BITS);
+
+    if (entry >= FD_CACHE_ENTRIES || !deferred_close[entry]) return FALSE;
+    return !!(__atomic_fetch_and( &deferred_close[entry][idx / DEFERRED_CLOSE_BITS], ~bit,
+                                  __ATOMIC_SEQ_CST ) & bit);
+}
+
+
+/***********************************************************************
+ *           is_deferred_close
+ */
+static BOOL is_deferred_close( HANDLE handle )
+{
+    unsigned int entry, idx = handle_to_index( handle, &entry );
+
+    if (entry >= FD_CACHE_ENTRIES || !deferred_close[entry]) return FALSE;
+    return !!(ReadNoFence( &deferred_close[entry][idx / DEFERRED_CLOSE_BITS] ) &
+              (1u << (idx % DEFERRED_CLOSE_BITS)));
+}
+
+
+/***********************************************************************
+ *           server_disallow_deferred_close
+ */
+void server_disallow_deferred_close( HANDLE handle )
+{
+    take_deferred_close( handle );
+}
+
+
+/***********************************************************************
+ *           defer_close
+ *
+ * Queue a handle to be closed with the next server request.
+ */
+static void defer_close( HANDLE handle )
+{
+    pthread_mutex_lock( &close_batch_mutex );
+    if (close_batch_count == CLOSE_BATCH_SIZE) send_close_batch( NULL );
+    close_batch[close_batch_count] = wine_server_obj_handle( handle );
+    WriteRelease( &close_batch_count, close_batch_count + 1 );
+    pthread_mutex_unlock( &close_batch_mutex );
+}
+
+
 /***********************************************************************
  *           server_get_unix_fd
  *
@@ -1107,11 +1260,19 @@ int server_get_unix_fd( HANDLE handle, unsigned int wanted_access, int *unix_fd,
     wanted_access &= FILE_READ_DATA | FILE_WRITE_DATA | FILE_APPEND_DATA;
 
     ret = get_cached_fd( handle, &fd, type, &access, options );
-    if (ret != STATUS_INVALID_HANDLE) goto done;
+    if (ret != STATUS_INVALID_HANDLE)
+    {
+        if (TRACE_ON(fdcache)) InterlockedIncrement( &fd_cache_hits );
+        goto done;
+    }
 
     server_enter_uninterrupted_section( &fd_cache_mutex, &sigset );
     ret = get_cached_fd( handle, &fd, type, &access, options );
-    if (ret == STATUS_INVALID_HANDLE)
+    if (ret != STATUS_INVALID_HANDLE)
+    {
+        if (TRACE_ON(fdcache)) InterlockedIncrement( &fd_cache_hits );
+    }
+    else
     {
         SERVER_START_REQ( get_handle_fd )
         {
@@ -1134,6 +1295,9 @@ int server_get_unix_fd( HANDLE handle, unsigned int wanted_access, int *unix_fd,
             {
                 add_fd_to_cache( handle, ret, FD_TYPE_INVALID, 0, 0 );
             }
+            TRACE_(fdcache)( "%p type %u status %x %s, %d hits %d misses\n", handle, reply->type, ret,
+                             reply->cacheable ? "cached" : "not cacheable",
+                             (int)fd_cache_hits, (int)InterlockedIncrement( &fd_cache_misses ) );
         }
         SERVER_END_REQ;
     }
@@ -1150,6 +1314,30 @@ done:
 }
 
 
+/***********************************************************************
+ *           server_get_cached_socket_fd
+ *
+ * Retrieve the unix fd of a socket if it is already cached, without a server call.
+ * The returned fd must not be closed.
+ */
+NTSTATUS server_get_cached_socket_fd( HANDLE handle, int *unix_fd, BOOL *stream )
+{
+    unsigned int entry, idx = handle_to_index( handle, &entry );
+    union fd_cache_entry cache;
+
+    if (entry >= FD_CACHE_ENTRIES || !fd_cache[entry]) return STATUS_INVALID_HANDLE;
+
+    cache.data = InterlockedCompareExchange64( &fd_cache[entry][idx].data, 0, 0 );
+    if (!cache.data) return STATUS_INVALID_HANDLE;
+    if (cache.s.type == FD_TYPE_INVALID) return cache.s.fd - 1;
+    if (cache.s.type != FD_TYPE_SOCKET) return STATUS_OBJECT_TYPE_MISMATCH;
+
+    *unix_fd = cache.s.fd - 1;
+    *stream = cache.s.stream;
+    return STATUS_SUCCESS;
+}
+
+
 /***********************************************************************
  *           wine_server_fd_to_handle
  */
@@ -1502,6 +1690,57 @@ static int get_unix_tid(void)
 }
 
 
+/***********************************************************************
+ *           init_process_shm
+ *
+ * Map the state published by the server for the threads of the process.
+ */
+static void init_process_shm(void)
+{
+    obj_handle_t handle;
+    data_size_t size = 0;
+    unsigned int ret;
+    void *ptr;
+    int fd;
+
+    SERVER_START_REQ( get_process_shm )
+    {
+        if (!(ret = wine_server_call( req ))) size = reply->size;
+    }
+    SERVER_END_REQ;
+
+    if (ret || (fd = receive_fd( &handle )) == -1)
+    {
+        WARN( "no process shared memory, status %x\n", ret );
+        return;
+    }
+    if ((ptr = mmap( NULL, size, PROT_READ, MAP_SHARED, fd, 0 )) != MAP_FAILED) process_shm = ptr;
+    else WARN( "failed to map process shared memory: %s\n", strerror(errno) );
+    close( fd );
+}
+
+
+/***********************************************************************
+ *           set_thread_shm
+ */
+static void set_thread_shm( unsigned int slot )
+{
+    if (!process_shm || !slot) return;
+    ntdll_get_thread_data()->thread_shm = (thread_shm_t *)((char *)process_shm + slot * THREAD_SHM_SLOT_SIZE);
+}
+
+
+/***********************************************************************
+ *           wine_server_get_thread_shm   (ntdll.so)
+ *
+ * Return the state published by the server for the current thread, or NULL.
+ */
+const thread_shm_t *wine_server_get_thread_shm(void)
+{
+    return ntdll_get_thread_data()->thread_shm;
+}
+
+
 /***********************************************************************
  *           init_thread_pipe
  *
@@ -1548,7 +1787,7 @@ size_t server_init_process(void)
     const char *arch = getenv( "WINEARCH" );
     const char *env_socket = getenv( "WINESERVERSOCKET" );
     obj_handle_t version;
-    unsigned int i;
+    unsigned int i, shm_slot;
     int ret, reply_pipe;
     struct sigaction sig_act;
     size_t info_size;
@@ -1630,6 +1869,7 @@ size_t server_init_process(void)
         peb->SessionId    = reply->session_id;
         info_size         = reply->info_size;
         server_start_time = reply->server_start;
+        shm_slot          = reply->shm_slot;
         supported_machines_count = wine_server_reply_size( reply ) / sizeof(*supported_machines);
     }
     SERVER_END_REQ;
@@ -1637,6 +1877,9 @@ size_t server_init_process(void)
 
     if (ret) server_protocol_error( "init_first_thread failed with status %x\n", ret );
 
+    init_process_shm();
+    set_thread_shm( shm_slot );
+
     if (!supported_machines_count)
         fatal_error( "'%s' is a 64-bit installation, it cannot be used with a 32-bit wineserver.\n",
                      config_dir );
@@ -1735,6 +1978,7 @@ void server_init_thread( void *entry_point, BOOL *suspend )
         req->wait_fd   = ntdll_get_thread_data()->wait_fd[1];
         wine_server_call( req );
         *suspend = reply->suspend;
+        set_thread_shm( reply->shm_slot );
     }
     SERVER_END_REQ;
     close( reply_pipe );
@@ -1749,6 +1993,7 @@ NTSTATUS WINAPI NtDuplicateObject( HANDLE source_process, HANDLE source, HANDLE
 {
     sigset_t sigset;
     unsigned int ret;
+    BOOL deferred = FALSE;
     int fd = -1;
 
     if (dest) *dest = 0;
@@ -1778,8 +2023,14 @@ NTSTATUS WINAPI NtDuplicateObject( HANDLE source_process, HANDLE source, HANDLE
 
     /* always remove the cached fd; if the server request fails we'll just
      * retrieve it again */
-    if (options & DUPLICATE_CLOSE_SOURCE)
-        fd = remove_fd_from_cache( source );
+    if (options & DUPLICATE_CLOSE_SOURCE) fd = remove_fd_from_cache( source );
+
+    /* the deferred close marks only describe handles of the current process */
+    if (source_process == NtCurrentProcess())
+    {
+        if (options & DUPLICATE_CLOSE_SOURCE) deferred = take_deferred_close( source );
+        else deferred = is_deferred_close( source );
+    }
 
     SERVER_START_REQ( dup_handle )
     {
@@ -1796,6 +2047,9 @@ NTSTATUS WINAPI NtDuplicateObject( HANDLE source_process, HANDLE source, HANDLE
     }
     SERVER_END_REQ;
 
+    if (!ret && dest && deferred && dest_process == NtCurrentProcess())
+        server_allow_deferred_close( *dest );
+
     server_leave_uninterrupted_section( &fd_cache_mutex, &sigset );
 
     if (fd != -1) close( fd );
@@ -1851,15 +2105,26 @@ NTSTATUS WINAPI NtClose( HANDLE handle )
      * retrieve it again */
     fd = remove_fd_from_cache( handle );
 
+    if (do_fsync())
+        fsync_close( handle );
+
     if (do_esync())
         esync_close( handle );
 
-    SERVER_START_REQ( close_handle )
+    if (take_deferred_close( handle ))
     {
-        req->handle = wine_server_obj_handle( handle );
-        ret = wine_server_call( req );
+        defer_close( handle );
+        ret = STATUS_SUCCESS;
+    }
+    else
+    {
+        SERVER_START_REQ( close_handle )
+        {
+            req->handle = wine_server_obj_handle( handle );
+            ret = wine_server_call( req );
+        }
+        SERVER_END_REQ;
     }
-    SERVER_END_REQ;
 
     server_leave_uninterrupted_section( &fd_cache_mutex, &sigset );
 
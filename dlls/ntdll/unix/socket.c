@@ -28,6 +28,10 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
+#ifdef HAVE_SYS_SENDFILE_H
+# include <sys/sendfile.h>
+#endif
+#include <poll.h>
 #include <unistd.h>
 #ifdef HAVE_IFADDRS_H
 # include <ifaddrs.h>
@@ -108,14 +112,28 @@ union unix_sockaddr
 #endif
 };
 
+/* maximum number of pending requests completed by a single recvmmsg() or sendmmsg() */
+#define MAX_BATCH_COUNT 16
+
+struct async_batch
+{
+    struct list  entry;         /* entry in the thread batch list */
+    BOOL         queued;        /* waiting in the thread batch list */
+    BOOL         done;          /* already completed along with another request */
+    unsigned int status;        /* final status if done */
+    ULONG_PTR    info;          /* final information if done */
+};
+
 struct async_recv_ioctl
 {
     struct async_fileio io;
+    struct async_batch batch;
     void *control;
     struct WS_sockaddr *addr;
     int *addr_len;
     unsigned int *ret_flags;
     int unix_flags;
+    int sock_type;
     unsigned int count;
     BOOL icmp_over_dgram;
     struct iovec iov[1];
@@ -124,35 +142,45 @@ struct async_recv_ioctl
 struct async_send_ioctl
 {
     struct async_fileio io;
+    struct async_batch batch;
     const struct WS_sockaddr *addr;
     int addr_len;
     int unix_flags;
+    int sock_type;
     unsigned int sent_len;
     unsigned int count;
     unsigned int iov_cursor;
     struct iovec iov[1];
 };
 
+struct transmit_element
+{
+    HANDLE file;                /* file to send data from, or NULL for a memory buffer */
+    const char *buffer;
+    LARGE_INTEGER offset;       /* file offset, or FILE_USE_FILE_POINTER_POSITION */
+    unsigned int len;           /* length to send, 0 for the whole file */
+    BOOL eof;                   /* end of file has been reached */
+    BOOL more;                  /* more data of the same packet follows */
+};
+
 struct async_transmit_ioctl
 {
     struct async_fileio io;
-    HANDLE file;
-    char *buffer;
+    char *buffer;               /* bounce buffer, used when sendfile() is not available */
     unsigned int buffer_size;   /* allocated size of buffer */
     unsigned int read_len;      /* amount of valid data currently in the buffer */
-    unsigned int head_cursor;   /* amount of header data already sent */
-    unsigned int file_cursor;   /* amount of file data already sent */
     unsigned int buffer_cursor; /* amount of data currently in the buffer already sent */
-    unsigned int tail_cursor;   /* amount of tail data already sent */
-    unsigned int file_len;      /* total file length to send */
+    unsigned int sent_len;      /* total amount of data already sent */
+    unsigned int element;       /* element currently being sent */
+    unsigned int cursor;        /* amount of data of the current element already sent */
     unsigned int flags;
-    const char *head;
-    const char *tail;
-    unsigned int head_len;
-    unsigned int tail_len;
-    LARGE_INTEGER offset;
+    unsigned int count;
+    struct transmit_element elements[1];
 };
 
+/* keep offsetof( struct async_transmit_ioctl, elements[count] ) from overflowing */
+#define MAX_TRANSMIT_ELEMENTS ((0x7fffffff - sizeof(struct async_transmit_ioctl)) / sizeof(struct transmit_element))
+
 static NTSTATUS sock_errno_to_status( int err )
 {
     switch (err)
@@ -719,44 +747,39 @@ static ssize_t fixup_icmp_over_dgram( struct msghdr *hdr, union unix_sockaddr *u
     return recv_len;
 }
 
-static NTSTATUS try_recv( int fd, struct async_recv_ioctl *async, ULONG_PTR *size )
+struct recv_buffers
 {
+    union unix_sockaddr addr;
 #ifndef HAVE_STRUCT_MSGHDR_MSG_ACCRIGHTS
-    char control_buffer[512];
+    char control[512];
 #endif
-    union unix_sockaddr unix_addr;
-    struct msghdr hdr;
-    NTSTATUS status;
-    ssize_t ret;
+};
 
-    memset( &hdr, 0, sizeof(hdr) );
+static void init_recv_msghdr( struct msghdr *hdr, struct async_recv_ioctl *async, struct recv_buffers *buffers )
+{
+    memset( hdr, 0, sizeof(*hdr) );
     if (async->addr || async->icmp_over_dgram)
     {
-        hdr.msg_name = &unix_addr.addr;
-        hdr.msg_namelen = sizeof(unix_addr);
+        hdr->msg_name = &buffers->addr.addr;
+        hdr->msg_namelen = sizeof(buffers->addr);
     }
-    hdr.msg_iov = async->iov;
-    hdr.msg_iovlen = async->count;
+    hdr->msg_iov = async->iov;
+    hdr->msg_iovlen = async->count;
 #ifndef HAVE_STRUCT_MSGHDR_MSG_ACCRIGHTS
-    hdr.msg_control = control_buffer;
-    hdr.msg_controllen = sizeof(control_buffer);
+    hdr->msg_control = buffers->control;
+    hdr->msg_controllen = sizeof(buffers->control);
 #endif
-    while ((ret = virtual_locked_recvmsg( fd, &hdr, async->unix_flags )) < 0 && errno == EINTR);
-
-    if (ret < 0)
-    {
-        /* Unix-like systems return EINVAL when attempting to read OOB data from
-         * an empty socket buffer; Windows returns WSAEWOULDBLOCK. */
-        if ((async->unix_flags & MSG_OOB) && errno == EINVAL)
-            errno = EWOULDBLOCK;
+}
 
-        if (errno != EWOULDBLOCK) WARN( "recvmsg: %s\n", strerror( errno ) );
-        return sock_errno_to_status( errno );
-    }
+/* convert the results of a successful receive */
+static NTSTATUS finish_recv( struct async_recv_ioctl *async, struct msghdr *hdr, union unix_sockaddr *unix_addr,
+                             ssize_t ret, ULONG_PTR *size )
+{
+    NTSTATUS status;
 
-    status = (hdr.msg_flags & MSG_TRUNC) ? STATUS_BUFFER_OVERFLOW : STATUS_SUCCESS;
+    status = (hdr->msg_flags & MSG_TRUNC) ? STATUS_BUFFER_OVERFLOW : STATUS_SUCCESS;
     if (async->icmp_over_dgram)
-        ret = fixup_icmp_over_dgram( &hdr, &unix_addr, async->io.handle, ret, &status );
+        ret = fixup_icmp_over_dgram( hdr, unix_addr, async->io.handle, ret, &status );
 
     if (async->control)
     {
@@ -770,7 +793,7 @@ static NTSTATUS try_recv( int fd, struct async_recv_ioctl *async, ULONG_PTR *siz
 
             wsabuf.len = sizeof(control_buffer64);
             wsabuf.buf = control_buffer64;
-            if (convert_control_headers( &hdr, &wsabuf ))
+            if (convert_control_headers( hdr, &wsabuf ))
             {
                 if (!wow64_translate_control( &wsabuf, async->control ))
                 {
@@ -788,7 +811,7 @@ static NTSTATUS try_recv( int fd, struct async_recv_ioctl *async, ULONG_PTR *siz
         }
         else
         {
-            if (!convert_control_headers( &hdr, async->control ))
+            if (!convert_control_headers( hdr, async->control ))
             {
                 WARN( "Application passed insufficient room for control headers.\n" );
                 *async->ret_flags |= WS_MSG_CTRUNC;
@@ -803,13 +826,139 @@ static NTSTATUS try_recv( int fd, struct async_recv_ioctl *async, ULONG_PTR *siz
      * MSDN says that the address is ignored for connection-oriented sockets, so
      * don't try to translate it.
      */
-    if (async->addr && hdr.msg_namelen)
-        *async->addr_len = sockaddr_from_unix( &unix_addr, async->addr, *async->addr_len );
+    if (async->addr && hdr->msg_namelen)
+        *async->addr_len = sockaddr_from_unix( unix_addr, async->addr, *async->addr_len );
 
     *size = ret;
     return status;
 }
 
+static NTSTATUS try_recv( int fd, struct async_recv_ioctl *async, ULONG_PTR *size )
+{
+    struct recv_buffers buffers;
+    struct msghdr hdr;
+    ssize_t ret;
+
+    init_recv_msghdr( &hdr, async, &buffers );
+    while ((ret = virtual_locked_recvmsg( fd, &hdr, async->unix_flags )) < 0 && errno == EINTR);
+
+    if (ret < 0)
+    {
+        /* Unix-like systems return EINVAL when attempting to read OOB data from
+         * an empty socket buffer; Windows returns WSAEWOULDBLOCK. */
+        if ((async->unix_flags & MSG_OOB) && errno == EINVAL)
+            errno = EWOULDBLOCK;
+
+        if (errno != EWOULDBLOCK) WARN( "recvmsg: %s\n", strerror( errno ) );
+        return sock_errno_to_status( errno );
+    }
+
+    return finish_recv( async, &hdr, &buffers.addr, ret, size );
+}
+
+/* The server only alerts the first request waiting in a socket queue, the
+ * next one is alerted once it completes.  To complete several datagram
+ * requests with a single recvmmsg() or sendmmsg() call, the pending ones are
+ * kept in a per-thread list in issue order, the order the server queues them
+ * in (async callbacks always run in the thread that issued the request).
+ * The alerted request fills the ones following it for the same handle, and
+ * returns their count in the APC result so that the server alerts them too;
+ * their callbacks then simply return the stored results.
+ * The list is also used by async callbacks, which may run from a signal
+ * handler, so it must only be accessed with signals blocked. */
+
+static struct list *get_batch_list( struct list *list )
+{
+    if (!list->next) list_init( list );  /* the TEB is zeroed on allocation */
+    return list;
+}
+
+static void queue_batch( struct list *list, struct async_batch *batch )
+{
+    list_add_tail( get_batch_list( list ), &batch->entry );
+    batch->queued = TRUE;
+}
+
+static void dequeue_batch( struct async_batch *batch )
+{
+    if (!batch->queued) return;
+    list_remove( &batch->entry );
+    batch->queued = FALSE;
+}
+
+static void complete_batch( struct async_batch *batch, unsigned int status, ULONG_PTR info )
+{
+    dequeue_batch( batch );
+    batch->done = TRUE;
+    batch->status = status;
+    batch->info = info;
+    ntdll_get_thread_data()->async_alert_count++;
+}
+
+static BOOL use_recv_batch( const struct async_recv_ioctl *async )
+{
+#ifdef HAVE_RECVMMSG
+    return async->sock_type == WS_SOCK_DGRAM;
+#else
+    return FALSE;
+#endif
+}
+
+#ifdef HAVE_RECVMMSG
+static BOOL can_batch_recv( const struct async_recv_ioctl *async, const struct async_recv_ioctl *first )
+{
+    return !async->icmp_over_dgram && !(async->unix_flags & (MSG_OOB | MSG_PEEK)) &&
+           async->unix_flags == first->unix_flags;
+}
+
+static NTSTATUS try_recv_batch( int fd, struct async_recv_ioctl *async, ULONG_PTR *size )
+{
+    struct list *ptr, *list = &ntdll_get_thread_data()->recv_batch;
+    struct async_recv_ioctl *asyncs[MAX_BATCH_COUNT], *other;
+    struct recv_buffers buffers[MAX_BATCH_COUNT];
+    struct mmsghdr msgs[MAX_BATCH_COUNT];
+    unsigned int i, count = 0;
+    ULONG_PTR info;
+    int ret;
+
+    asyncs[count++] = async;
+    if (can_batch_recv( async, async ))
+    {
+        for (ptr = list_next( list, &async->batch.entry ); ptr && count < MAX_BATCH_COUNT; ptr = list_next( list, ptr ))
+        {
+            other = LIST_ENTRY( ptr, struct async_recv_ioctl, batch.entry );
+            if (other->io.handle != async->io.handle) continue;
+            /* the server alerts the requests that follow, don't skip any */
+            if (!can_batch_recv( other, async )) break;
+            asyncs[count++] = other;
+        }
+    }
+    if (count == 1) return try_recv( fd, async, size );
+
+    for (i = 0; i < count; i++)
+    {
+        init_recv_msghdr( &msgs[i].msg_hdr, asyncs[i], &buffers[i] );
+        msgs[i].msg_len = 0;
+    }
+    while ((ret = virtual_locked_recvmmsg( fd, msgs, count, async->unix_flags )) < 0 && errno == EINTR);
+
+    if (ret < 0)
+    {
+        if (errno != EWOULDBLOCK) WARN( "recvmmsg: %s\n", strerror( errno ) );
+        return sock_errno_to_status( errno );
+    }
+
+    TRACE( "received %d of %u datagrams\n", ret, count );
+    for (i = 1; i < ret; i++)
+    {
+        other = asyncs[i];
+        complete_batch( &other->batch, finish_recv( other, &msgs[i].msg_hdr, &buffers[i].addr,
+                                                    msgs[i].msg_len, &info ), info );
+    }
+    return finish_recv( async, &msgs[0].msg_hdr, &buffers[0].addr, msgs[0].msg_len, size );
+}
+#endif
+
 static BOOL async_recv_proc( void *user, ULONG_PTR *info, unsigned int *status )
 {
     struct async_recv_ioctl *async = user;
@@ -817,18 +966,33 @@ static BOOL async_recv_proc( void *user, ULONG_PTR *info, unsigned int *status )
 
     TRACE( "%#x\n", *status );
 
-    if (*status == STATUS_ALERTED)
+    if (async->batch.done)
+    {
+        *status = async->batch.status;
+        *info = async->batch.info;
+        TRACE( "completed in a batch, status %#x, %#lx bytes read\n", *status, *info );
+    }
+    else if (*status == STATUS_ALERTED)
     {
         if ((*status = server_get_unix_fd( async->io.handle, 0, &fd, &needs_close, NULL, NULL )))
+        {
+            dequeue_batch( &async->batch );
             return TRUE;
+        }
 
-        *status = try_recv( fd, async, info );
+#ifdef HAVE_RECVMMSG
+        if (async->batch.queued)
+            *status = try_recv_batch( fd, async, info );
+        else
+#endif
+            *status = try_recv( fd, async, info );
         TRACE( "got status %#x, %#lx bytes read\n", *status, *info );
         if (needs_close) close( fd );
 
         if (*status == STATUS_DEVICE_NOT_READY)
             return FALSE;
     }
+    dequeue_batch( &async->batch );
     release_fileio( &async->io );
     return TRUE;
 }
@@ -857,6 +1021,7 @@ static NTSTATUS sock_recv( HANDLE handle, HANDLE event, PIO_APC_ROUTINE apc, voi
     BOOL nonblocking;
     unsigned int i, status;
     ULONG options;
+    sigset_t sigset;
 
     for (i = 0; i < async->count; ++i)
     {
@@ -867,6 +1032,12 @@ static NTSTATUS sock_recv( HANDLE handle, HANDLE event, PIO_APC_ROUTINE apc, voi
         }
     }
 
+    async->batch.queued = async->batch.done = FALSE;
+
+    /* the async callback may run as soon as the server knows about the async,
+     * don't let it in until the request has been added to the batch list */
+    pthread_sigmask( SIG_BLOCK, &server_block_set, &sigset );
+
     SERVER_START_REQ( recv_socket )
     {
         req->force_async = force_async;
@@ -876,6 +1047,7 @@ static NTSTATUS sock_recv( HANDLE handle, HANDLE event, PIO_APC_ROUTINE apc, voi
         wait_handle = wine_server_ptr_handle( reply->wait );
         options     = reply->options;
         nonblocking = reply->nonblocking;
+        async->sock_type = reply->type;
     }
     SERVER_END_REQ;
 
@@ -897,6 +1069,11 @@ static NTSTATUS sock_recv( HANDLE handle, HANDLE event, PIO_APC_ROUTINE apc, voi
         set_async_direct_result( &wait_handle, status, information, FALSE );
     }
 
+    if (status == STATUS_PENDING && use_recv_batch( async ))
+        queue_batch( &ntdll_get_thread_data()->recv_batch, &async->batch );
+
+    pthread_sigmask( SIG_SETMASK, &sigset, NULL );
+
     if (status != STATUS_PENDING)
         release_fileio( &async->io );
 
@@ -981,23 +1158,15 @@ NTSTATUS sock_read( HANDLE handle, int fd, HANDLE event, PIO_APC_ROUTINE apc,
 }
 
 
-static NTSTATUS try_send( int fd, struct async_send_ioctl *async )
+static NTSTATUS init_send_msghdr( int fd, struct msghdr *hdr, struct async_send_ioctl *async,
+                                  union unix_sockaddr *unix_addr )
 {
-    union unix_sockaddr unix_addr;
-    struct msghdr hdr;
-    int attempt = 0;
-    int sock_type;
-    socklen_t len = sizeof(sock_type);
-    ssize_t ret;
-
-    getsockopt(fd, SOL_SOCKET, SO_TYPE, &sock_type, &len);
-
-    memset( &hdr, 0, sizeof(hdr) );
-    if (async->addr && sock_type != SOCK_STREAM)
+    memset( hdr, 0, sizeof(*hdr) );
+    if (async->addr && async->sock_type != WS_SOCK_STREAM)
     {
-        hdr.msg_name = &unix_addr;
-        hdr.msg_namelen = sockaddr_to_unix( async->addr, async->addr_len, &unix_addr );
-        if (!hdr.msg_namelen)
+        hdr->msg_name = unix_addr;
+        hdr->msg_namelen = sockaddr_to_unix( async->addr, async->addr_len, unix_addr );
+        if (!hdr->msg_namelen)
         {
             ERR( "failed to convert address\n" );
             return STATUS_ACCESS_VIOLATION;
@@ -1016,13 +1185,41 @@ static NTSTATUS try_send( int fd, struct async_send_ioctl *async )
              * the IPX type in the sockaddr_ipx structure with the stored value.
              */
             if (getsockopt(fd, SOL_IPX, IPX_TYPE, &type, &len) >= 0)
-                unix_addr.ipx.sipx_type = type;
+                unix_addr->ipx.sipx_type = type;
         }
 #endif
     }
 
-    hdr.msg_iov = async->iov + async->iov_cursor;
-    hdr.msg_iovlen = async->count - async->iov_cursor;
+    hdr->msg_iov = async->iov + async->iov_cursor;
+    hdr->msg_iovlen = async->count - async->iov_cursor;
+    return STATUS_SUCCESS;
+}
+
+/* account for the data sent, returns STATUS_DEVICE_NOT_READY if some is left */
+static NTSTATUS finish_send( struct async_send_ioctl *async, ssize_t ret )
+{
+    async->sent_len += ret;
+
+    while (async->iov_cursor < async->count && ret >= async->iov[async->iov_cursor].iov_len)
+        ret -= async->iov[async->iov_cursor++].iov_len;
+    if (async->iov_cursor < async->count)
+    {
+        async->iov[async->iov_cursor].iov_base = (char *)async->iov[async->iov_cursor].iov_base + ret;
+        async->iov[async->iov_cursor].iov_len -= ret;
+        return STATUS_DEVICE_NOT_READY;
+    }
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS try_send( int fd, struct async_send_ioctl *async )
+{
+    union unix_sockaddr unix_addr;
+    struct msghdr hdr;
+    int attempt = 0;
+    NTSTATUS status;
+    ssize_t ret;
+
+    if ((status = init_send_msghdr( fd, &hdr, async, &unix_addr ))) return status;
 
     while ((ret = sendmsg( fd, &hdr, async->unix_flags )) == -1)
     {
@@ -1049,18 +1246,69 @@ static NTSTATUS try_send( int fd, struct async_send_ioctl *async )
         }
     }
 
-    async->sent_len += ret;
+    return finish_send( async, ret );
+}
 
-    while (async->iov_cursor < async->count && ret >= async->iov[async->iov_cursor].iov_len)
-        ret -= async->iov[async->iov_cursor++].iov_len;
-    if (async->iov_cursor < async->count)
+static BOOL use_send_batch( const struct async_send_ioctl *async )
+{
+#ifdef HAVE_SENDMMSG
+    return async->sock_type == WS_SOCK_DGRAM;
+#else
+    return FALSE;
+#endif
+}
+
+#ifdef HAVE_SENDMMSG
+static BOOL can_batch_send( const struct async_send_ioctl *async, const struct async_send_ioctl *first )
+{
+    /* IPX needs the packet type from the socket options, see init_send_msghdr() */
+    return !(async->unix_flags & MSG_OOB) && async->unix_flags == first->unix_flags &&
+           !(async->addr && async->addr->sa_family == WS_AF_IPX);
+}
+
+static NTSTATUS try_send_batch( int fd, struct async_send_ioctl *async )
+{
+    struct list *ptr, *list = &ntdll_get_thread_data()->send_batch;
+    struct async_send_ioctl *asyncs[MAX_BATCH_COUNT], *other;
+    union unix_sockaddr addrs[MAX_BATCH_COUNT];
+    struct mmsghdr msgs[MAX_BATCH_COUNT];
+    unsigned int i, count = 0;
+    int ret;
+
+    if (!can_batch_send( async, async ) || init_send_msghdr( fd, &msgs[0].msg_hdr, async, &addrs[0] ))
+        return try_send( fd, async );
+
+    asyncs[count++] = async;
+    for (ptr = list_next( list, &async->batch.entry ); ptr && count < MAX_BATCH_COUNT; ptr = list_next( list, ptr ))
     {
-        async->iov[async->iov_cursor].iov_base = (char *)async->iov[async->iov_cursor].iov_base + ret;
-        async->iov[async->iov_cursor].iov_len -= ret;
-        return STATUS_DEVICE_NOT_READY;
+        other = LIST_ENTRY( ptr, struct async_send_ioctl, batch.entry );
+        if (other->io.handle != async->io.handle) continue;
+        /* the server alerts the requests that follow, don't skip any */
+        if (!can_batch_send( other, async )) break;
+        if (init_send_msghdr( fd, &msgs[count].msg_hdr, other, &addrs[count] )) break;
+        asyncs[count++] = other;
     }
-    return STATUS_SUCCESS;
+    if (count == 1) return try_send( fd, async );
+
+    for (i = 0; i < count; i++) msgs[i].msg_len = 0;
+    while ((ret = sendmmsg( fd, msgs, count, async->unix_flags )) < 0 && errno == EINTR);
+
+    if (ret < 0)
+    {
+        if (errno == EWOULDBLOCK) return STATUS_DEVICE_NOT_READY;
+        /* let try_send() deal with the errors it knows how to work around */
+        return try_send( fd, async );
+    }
+
+    TRACE( "sent %d of %u datagrams\n", ret, count );
+    for (i = 1; i < ret; i++)
+    {
+        other = asyncs[i];
+        complete_batch( &other->batch, finish_send( other, msgs[i].msg_len ), other->sent_len );
+    }
+    return finish_send( async, msgs[0].msg_len );
 }
+#endif
 
 static BOOL async_send_proc( void *user, ULONG_PTR *info, unsigned int *status )
 {
@@ -1069,12 +1317,25 @@ static BOOL async_send_proc( void *user, ULONG_PTR *info, unsigned int *status )
 
     TRACE( "%#x\n", *status );
 
-    if (*status == STATUS_ALERTED)
+    if (async->batch.done)
+    {
+        *status = async->batch.status;
+        TRACE( "completed in a batch, status %#x\n", *status );
+    }
+    else if (*status == STATUS_ALERTED)
     {
         if ((*status = server_get_unix_fd( async->io.handle, 0, &fd, &needs_close, NULL, NULL )))
+        {
+            dequeue_batch( &async->batch );
             return TRUE;
+        }
 
-        *status = try_send( fd, async );
+#ifdef HAVE_SENDMMSG
+        if (async->batch.queued)
+            *status = try_send_batch( fd, async );
+        else
+#endif
+            *status = try_send( fd, async );
         TRACE( "got status %#x\n", *status );
 
         if (needs_close) close( fd );
@@ -1083,6 +1344,7 @@ static BOOL async_send_proc( void *user, ULONG_PTR *info, unsigned int *status )
             return FALSE;
     }
     *info = async->sent_len;
+    dequeue_batch( &async->batch );
     release_fileio( &async->io );
     return TRUE;
 }
@@ -1119,6 +1381,13 @@ static NTSTATUS sock_send( HANDLE handle, HANDLE event, PIO_APC_ROUTINE apc, voi
     BOOL nonblocking;
     unsigned int status;
     ULONG options;
+    sigset_t sigset;
+
+    async->batch.queued = async->batch.done = FALSE;
+
+    /* the async callback may run as soon as the server knows about the async,
+     * don't let it in until the request has been added to the batch list */
+    pthread_sigmask( SIG_BLOCK, &server_block_set, &sigset );
 
     SERVER_START_REQ( send_socket )
     {
@@ -1128,6 +1397,7 @@ static NTSTATUS sock_send( HANDLE handle, HANDLE event, PIO_APC_ROUTINE apc, voi
         wait_handle = wine_server_ptr_handle( reply->wait );
         options     = reply->options;
         nonblocking = reply->nonblocking;
+        async->sock_type = reply->type;
     }
     SERVER_END_REQ;
 
@@ -1162,6 +1432,11 @@ static NTSTATUS sock_send( HANDLE handle, HANDLE event, PIO_APC_ROUTINE apc, voi
         set_async_direct_result( &wait_handle, status, information, FALSE );
     }
 
+    if (status == STATUS_PENDING && use_send_batch( async ))
+        queue_batch( &ntdll_get_thread_data()->send_batch, &async->batch );
+
+    pthread_sigmask( SIG_SETMASK, &sigset, NULL );
+
     if (status != STATUS_PENDING)
         release_fileio( &async->io );
 
@@ -1219,7 +1494,7 @@ NTSTATUS sock_write( HANDLE handle, int fd, HANDLE event, PIO_APC_ROUTINE apc,
     static const DWORD async_size = offsetof( struct async_send_ioctl, iov[1] );
     struct async_send_ioctl *async;
 
-    if (!(async = (struct async_send_ioctl *)alloc_fileio( async_size, async_recv_proc, handle )))
+    if (!(async = (struct async_send_ioctl *)alloc_fileio( async_size, async_send_proc, handle )))
         return STATUS_NO_MEMORY;
 
     async->count = 1;
@@ -1243,67 +1518,129 @@ static ssize_t do_send( int fd, const void *buffer, size_t len, int flags )
     return ret;
 }
 
-static NTSTATUS try_transmit( int sock_fd, int file_fd, struct async_transmit_ioctl *async )
+static NTSTATUS try_transmit_file( int sock_fd, int file_fd, struct async_transmit_ioctl *async,
+                                   struct transmit_element *element )
 {
+    int flags = 0;
+    unsigned int size;
     ssize_t ret;
 
-    while (async->head_cursor < async->head_len)
-    {
-        TRACE( "sending %u bytes of header data\n", async->head_len - async->head_cursor );
-        ret = do_send( sock_fd, async->head + async->head_cursor,
-                       async->head_len - async->head_cursor, 0 );
-        if (ret < 0) return sock_errno_to_status( errno );
-        TRACE( "send returned %zd\n", ret );
-        async->head_cursor += ret;
-    }
+#ifdef MSG_MORE
+    if (element->more) flags |= MSG_MORE;
+#endif
 
-    while (async->buffer_cursor < async->read_len)
+    for (;;)
     {
-        TRACE( "sending %u bytes of file data\n", async->read_len - async->buffer_cursor );
-        ret = do_send( sock_fd, async->buffer + async->buffer_cursor,
-                       async->read_len - async->buffer_cursor, 0 );
-        if (ret < 0) return sock_errno_to_status( errno );
-        TRACE( "send returned %zd\n", ret );
-        async->buffer_cursor += ret;
-        async->file_cursor += ret;
-    }
+        while (async->buffer_cursor < async->read_len)
+        {
+            TRACE( "sending %u bytes of file data\n", async->read_len - async->buffer_cursor );
+            ret = do_send( sock_fd, async->buffer + async->buffer_cursor,
+                           async->read_len - async->buffer_cursor, flags );
+            if (ret < 0) return sock_errno_to_status( errno );
+            TRACE( "send returned %zd\n", ret );
+            async->buffer_cursor += ret;
+            async->cursor += ret;
+            async->sent_len += ret;
+        }
 
-    if (async->file && async->buffer_cursor == async->read_len)
-    {
-        unsigned int read_size = async->buffer_size;
+        if (element->eof || (element->len && async->cursor == element->len))
+            return STATUS_SUCCESS;
 
-        if (async->file_len)
-            read_size = min( read_size, async->file_len - async->file_cursor );
+        size = element->len ? element->len - async->cursor : ~0u;
 
-        TRACE( "reading %u bytes of file data\n", read_size );
+#ifdef HAVE_SYS_SENDFILE_H
+        if (!async->buffer)
+        {
+            off_t offset = element->offset.QuadPart;
+
+            size = min( size, 0x7ffff000 );
+            TRACE( "sending %u bytes of file data\n", size );
+            do
+            {
+                if (element->offset.QuadPart == FILE_USE_FILE_POINTER_POSITION)
+                    ret = sendfile( sock_fd, file_fd, NULL, size );
+                else
+                    ret = sendfile( sock_fd, file_fd, &offset, size );
+            } while (ret < 0 && errno == EINTR);
+
+            if (ret >= 0)
+            {
+                TRACE( "sendfile returned %zd\n", ret );
+                if (!ret) element->eof = TRUE;
+                if (element->offset.QuadPart != FILE_USE_FILE_POINTER_POSITION)
+                    element->offset.QuadPart += ret;
+                async->cursor += ret;
+                async->sent_len += ret;
+                continue;
+            }
+            if (errno != EINVAL && errno != ENOSYS)
+            {
+                if (errno != EWOULDBLOCK) WARN( "sendfile: %s\n", strerror( errno ) );
+                return sock_errno_to_status( errno );
+            }
+            TRACE( "sendfile not supported for this file, copying the data\n" );
+        }
+#endif
+
+        if (!async->buffer && !(async->buffer = malloc( async->buffer_size )))
+            return STATUS_NO_MEMORY;
+
+        size = min( size, async->buffer_size );
+        TRACE( "reading %u bytes of file data\n", size );
         do
         {
-            if (async->offset.QuadPart == FILE_USE_FILE_POINTER_POSITION)
-                ret = read( file_fd, async->buffer, read_size );
+            if (element->offset.QuadPart == FILE_USE_FILE_POINTER_POSITION)
+                ret = read( file_fd, async->buffer, size );
             else
-                ret = pread( file_fd, async->buffer, read_size, async->offset.QuadPart );
+                ret = pread( file_fd, async->buffer, size, element->offset.QuadPart );
         } while (ret < 0 && errno == EINTR);
         if (ret < 0) return errno_to_status( errno );
         TRACE( "read returned %zd\n", ret );
 
         async->read_len = ret;
         async->buffer_cursor = 0;
-        if (async->offset.QuadPart != FILE_USE_FILE_POINTER_POSITION)
-            async->offset.QuadPart += ret;
-
-        if (ret < read_size || (async->file_len && async->file_cursor == async->file_len))
-            async->file = NULL;
-        return STATUS_DEVICE_NOT_READY; /* still more data to send */
+        if (element->offset.QuadPart != FILE_USE_FILE_POINTER_POSITION)
+            element->offset.QuadPart += ret;
+        if (ret < size) element->eof = TRUE;
     }
+}
 
-    while (async->tail_cursor < async->tail_len)
+static NTSTATUS try_transmit( int sock_fd, struct async_transmit_ioctl *async )
+{
+    NTSTATUS status;
+    ssize_t ret;
+
+    for (; async->element < async->count; ++async->element, async->cursor = 0)
     {
-        TRACE( "sending %u bytes of tail data\n", async->tail_len - async->tail_cursor );
-        ret = do_send( sock_fd, async->tail + async->tail_cursor,
-                       async->tail_len - async->tail_cursor, 0 );
-        if (ret < 0) return sock_errno_to_status( errno );
-        TRACE( "send returned %zd\n", ret );
-        async->tail_cursor += ret;
+        struct transmit_element *element = &async->elements[async->element];
+
+        if (element->file)
+        {
+            int file_fd, needs_close;
+
+            if ((status = server_get_unix_fd( element->file, 0, &file_fd, &needs_close, NULL, NULL )))
+                return status;
+            status = try_transmit_file( sock_fd, file_fd, async, element );
+            if (needs_close) close( file_fd );
+            if (status) return status;
+            async->read_len = async->buffer_cursor = 0;
+            continue;
+        }
+
+        while (async->cursor < element->len)
+        {
+            int flags = 0;
+
+#ifdef MSG_MORE
+            if (element->more) flags |= MSG_MORE;
+#endif
+            TRACE( "sending %u bytes of buffer data\n", element->len - async->cursor );
+            ret = do_send( sock_fd, element->buffer + async->cursor, element->len - async->cursor, flags );
+            if (ret < 0) return sock_errno_to_status( errno );
+            TRACE( "send returned %zd\n", ret );
+            async->cursor += ret;
+            async->sent_len += ret;
+        }
     }
 
     return STATUS_SUCCESS;
@@ -1311,7 +1648,7 @@ static NTSTATUS try_transmit( int sock_fd, int file_fd, struct async_transmit_io
 
 static BOOL async_transmit_proc( void *user, ULONG_PTR *info, unsigned int *status )
 {
-    int sock_fd, file_fd = -1, sock_needs_close = FALSE, file_needs_close = FALSE;
+    int sock_fd, sock_needs_close = FALSE;
     struct async_transmit_ioctl *async = user;
 
     TRACE( "%#x\n", *status );
@@ -1321,77 +1658,87 @@ static BOOL async_transmit_proc( void *user, ULONG_PTR *info, unsigned int *stat
         if ((*status = server_get_unix_fd( async->io.handle, 0, &sock_fd, &sock_needs_close, NULL, NULL )))
             return TRUE;
 
-        if (async->file && (*status = server_get_unix_fd( async->file, 0, &file_fd, &file_needs_close, NULL, NULL )))
-        {
-            if (sock_needs_close) close( sock_fd );
-            return TRUE;
-        }
-
-        *status = try_transmit( sock_fd, file_fd, async );
+        *status = try_transmit( sock_fd, async );
         TRACE( "got status %#x\n", *status );
 
         if (sock_needs_close) close( sock_fd );
-        if (file_needs_close) close( file_fd );
 
         if (*status == STATUS_DEVICE_NOT_READY)
             return FALSE;
     }
-    *info = async->head_cursor + async->file_cursor + async->tail_cursor;
+    *info = async->sent_len;
+    free( async->buffer );
     release_fileio( &async->io );
     return TRUE;
 }
 
-static NTSTATUS sock_transmit( HANDLE handle, HANDLE event, PIO_APC_ROUTINE apc, void *apc_user,
-                               IO_STATUS_BLOCK *io, int fd, const struct afd_transmit_params *params )
+static struct async_transmit_ioctl *alloc_transmit_ioctl( HANDLE handle, unsigned int count,
+                                                          unsigned int buffer_size, unsigned int flags )
 {
-    int file_fd, file_needs_close = FALSE;
     struct async_transmit_ioctl *async;
+    DWORD async_size = offsetof( struct async_transmit_ioctl, elements[count] );
+
+    if (!(async = (struct async_transmit_ioctl *)alloc_fileio( async_size, async_transmit_proc, handle )))
+        return NULL;
+
+    async->buffer = NULL;
+    async->buffer_size = buffer_size ? buffer_size : 65536;
+    async->read_len = 0;
+    async->buffer_cursor = 0;
+    async->sent_len = 0;
+    async->element = 0;
+    async->cursor = 0;
+    async->flags = flags;
+    async->count = 0;
+    return async;
+}
+
+static NTSTATUS add_transmit_file( struct async_transmit_ioctl *async, HANDLE file,
+                                   LARGE_INTEGER offset, unsigned int len )
+{
+    struct transmit_element *element = &async->elements[async->count];
+    int file_fd, file_needs_close = FALSE;
     enum server_fd_type file_type;
-    union unix_sockaddr addr;
-    socklen_t addr_len;
-    HANDLE wait_handle;
     unsigned int status;
-    ULONG options;
 
-    addr_len = sizeof(addr);
-    if (getpeername( fd, &addr.addr, &addr_len ) != 0)
-        return STATUS_INVALID_CONNECTION;
+    if ((status = server_get_unix_fd( file, 0, &file_fd, &file_needs_close, &file_type, NULL )))
+        return status;
+    if (file_needs_close) close( file_fd );
 
-    if (params->file)
+    if (file_type != FD_TYPE_FILE)
     {
-        if ((status = server_get_unix_fd( ULongToHandle( params->file ), 0, &file_fd, &file_needs_close, &file_type, NULL )))
-            return status;
-        if (file_needs_close) close( file_fd );
-
-        if (file_type != FD_TYPE_FILE)
-        {
-            FIXME( "unsupported file type %#x\n", file_type );
-            return STATUS_NOT_IMPLEMENTED;
-        }
+        FIXME( "unsupported file type %#x\n", file_type );
+        return STATUS_NOT_IMPLEMENTED;
     }
 
-    if (!(async = (struct async_transmit_ioctl *)alloc_fileio( sizeof(*async), async_transmit_proc, handle )))
-        return STATUS_NO_MEMORY;
+    element->file = file;
+    element->buffer = NULL;
+    element->offset = offset;
+    element->len = len;
+    element->eof = FALSE;
+    element->more = FALSE;
+    async->count++;
+    return STATUS_SUCCESS;
+}
 
-    async->file = ULongToHandle( params->file );
-    async->buffer_size = params->buffer_size ? params->buffer_size : 65536;
-    if (!(async->buffer = malloc( async->buffer_size )))
-    {
-        release_fileio( &async->io );
-        return STATUS_NO_MEMORY;
-    }
-    async->read_len = 0;
-    async->head_cursor = 0;
-    async->file_cursor = 0;
-    async->buffer_cursor = 0;
-    async->tail_cursor = 0;
-    async->file_len = params->file_len;
-    async->flags = params->flags;
-    async->head = u64_to_user_ptr(params->head_ptr);
-    async->head_len = params->head_len;
-    async->tail = u64_to_user_ptr(params->tail_ptr);
-    async->tail_len = params->tail_len;
-    async->offset = params->offset;
+static void add_transmit_buffer( struct async_transmit_ioctl *async, const void *buffer, unsigned int len )
+{
+    struct transmit_element *element = &async->elements[async->count++];
+
+    element->file = NULL;
+    element->buffer = buffer;
+    element->offset.QuadPart = 0;
+    element->len = len;
+    element->eof = FALSE;
+    element->more = FALSE;
+}
+
+static NTSTATUS sock_transmit_async( HANDLE handle, HANDLE event, PIO_APC_ROUTINE apc, void *apc_user,
+                                     IO_STATUS_BLOCK *io, int fd, struct async_transmit_ioctl *async )
+{
+    HANDLE wait_handle;
+    unsigned int status;
+    ULONG options;
 
     SERVER_START_REQ( send_socket )
     {
@@ -1410,11 +1757,11 @@ static NTSTATUS sock_transmit( HANDLE handle, HANDLE event, PIO_APC_ROUTINE apc,
     {
         ULONG_PTR information;
 
-        status = try_transmit( fd, file_fd, async );
+        status = try_transmit( fd, async );
         if (status == STATUS_DEVICE_NOT_READY)
             status = STATUS_PENDING;
 
-        information = async->head_cursor + async->file_cursor + async->tail_cursor;
+        information = async->sent_len;
         if (!NT_ERROR(status) && status != STATUS_PENDING)
         {
             io->Status = status;
@@ -1425,7 +1772,10 @@ static NTSTATUS sock_transmit( HANDLE handle, HANDLE event, PIO_APC_ROUTINE apc,
     }
 
     if (status != STATUS_PENDING)
+    {
+        free( async->buffer );
         release_fileio( &async->io );
+    }
 
     if (!status && !(options & (FILE_SYNCHRONOUS_IO_ALERT | FILE_SYNCHRONOUS_IO_NONALERT)))
     {
@@ -1439,6 +1789,80 @@ static NTSTATUS sock_transmit( HANDLE handle, HANDLE event, PIO_APC_ROUTINE apc,
     return status;
 }
 
+static NTSTATUS sock_transmit( HANDLE handle, HANDLE event, PIO_APC_ROUTINE apc, void *apc_user,
+                               IO_STATUS_BLOCK *io, int fd, const struct afd_transmit_params *params )
+{
+    struct async_transmit_ioctl *async;
+    union unix_sockaddr addr;
+    socklen_t addr_len;
+    unsigned int status;
+
+    addr_len = sizeof(addr);
+    if (getpeername( fd, &addr.addr, &addr_len ) != 0)
+        return STATUS_INVALID_CONNECTION;
+
+    if (!(async = alloc_transmit_ioctl( handle, 3, params->buffer_size, params->flags )))
+        return STATUS_NO_MEMORY;
+
+    if (params->head_len)
+        add_transmit_buffer( async, u64_to_user_ptr(params->head_ptr), params->head_len );
+    if (params->file &&
+        (status = add_transmit_file( async, ULongToHandle( params->file ), params->offset, params->file_len )))
+    {
+        release_fileio( &async->io );
+        return status;
+    }
+    if (params->tail_len)
+        add_transmit_buffer( async, u64_to_user_ptr(params->tail_ptr), params->tail_len );
+
+    /* let the head and file data be sent together with what follows */
+    if (async->count)
+    {
+        unsigned int i;
+        for (i = 0; i < async->count - 1; ++i) async->elements[i].more = TRUE;
+    }
+
+    return sock_transmit_async( handle, event, apc, apc_user, io, fd, async );
+}
+
+static NTSTATUS sock_transmit_packets( HANDLE handle, HANDLE event, PIO_APC_ROUTINE apc, void *apc_user,
+                                       IO_STATUS_BLOCK *io, int fd,
+                                       const struct afd_transmit_packets_params *params )
+{
+    const struct afd_transmit_packets_element *elements = u64_to_user_ptr(params->elements_ptr);
+    struct async_transmit_ioctl *async;
+    union unix_sockaddr addr;
+    socklen_t addr_len;
+    unsigned int i, status;
+
+    if (params->count > MAX_TRANSMIT_ELEMENTS) return STATUS_INVALID_PARAMETER;
+
+    addr_len = sizeof(addr);
+    if (getpeername( fd, &addr.addr, &addr_len ) != 0)
+        return STATUS_INVALID_CONNECTION;
+
+    if (!(async = alloc_transmit_ioctl( handle, params->count, params->send_size, params->flags )))
+        return STATUS_NO_MEMORY;
+
+    for (i = 0; i < params->count; ++i)
+    {
+        if (elements[i].flags & TP_ELEMENT_FILE)
+        {
+            if ((status = add_transmit_file( async, ULongToHandle( elements[i].file ),
+                                             elements[i].offset, elements[i].length )))
+            {
+                release_fileio( &async->io );
+                return status;
+            }
+        }
+        else add_transmit_buffer( async, u64_to_user_ptr(elements[i].buffer_ptr), elements[i].length );
+
+        async->elements[i].more = i < params->count - 1 && !(elements[i].flags & TP_ELEMENT_EOP);
+    }
+
+    return sock_transmit_async( handle, event, apc, apc_user, io, fd, async );
+}
+
 static void complete_async( HANDLE handle, HANDLE event, PIO_APC_ROUTINE apc, void *apc_user,
                             IO_STATUS_BLOCK *io, NTSTATUS status, ULONG_PTR information )
 {
@@ -1502,6 +1926,85 @@ static int get_sock_type( HANDLE handle )
 }
 
 
+/* maximum number of sockets handled by sock_poll_unix() */
+#define MAX_UNIX_POLL_SOCKETS 64
+
+/* Tries to complete a zero-timeout IOCTL_AFD_POLL without a server round trip.
+ * The server would run poll() on the same fds, and if none of them reports any
+ * event, it has nothing to process and completes the poll with no sockets
+ * signaled. If any socket is ready, the poll is passed on to the server, which
+ * may have to update the socket state or hand the event to a queued async.
+ *
+ * Flags derived from the server-side socket state alone (AFD_POLL_CONNECT, and
+ * AFD_POLL_CONNECT_ERR or AFD_POLL_RESET without a hangup) can't be checked
+ * here; restricting this to stream sockets makes sure that the latter two
+ * always come with POLLHUP. Exclusive polls may complete other pending polls
+ * and also go to the server. Sockets whose fd isn't cached yet (e.g. stream
+ * sockets that aren't connected) would need a server call each, so they go to
+ * the server too. Returns STATUS_BAD_DEVICE_TYPE if the poll has to be handled
+ * by the server. */
+static NTSTATUS sock_poll_unix( HANDLE handle, HANDLE event, PIO_APC_ROUTINE apc, void *apc_user,
+                                IO_STATUS_BLOCK *io, const void *in_buffer, UINT in_size,
+                                void *out_buffer, UINT out_size )
+{
+    const struct afd_poll_params_64 *params64 = in_buffer;
+    const struct afd_poll_params_32 *params32 = in_buffer;
+    struct pollfd pollfds[MAX_UNIX_POLL_SOCKETS];
+    unsigned int i, count, size;
+    int ret;
+
+    /* the parameter layout is the same up to the socket array */
+    if (apc || apc_user || in_size < offsetof( struct afd_poll_params_32, sockets ) || out_size < in_size)
+        return STATUS_BAD_DEVICE_TYPE;
+    if (params64->timeout || params64->exclusive) return STATUS_BAD_DEVICE_TYPE;
+    if (!(count = params64->count) || count > MAX_UNIX_POLL_SOCKETS) return STATUS_BAD_DEVICE_TYPE;
+
+    size = in_wow64_call() ? offsetof( struct afd_poll_params_32, sockets[count] )
+                           : offsetof( struct afd_poll_params_64, sockets[count] );
+    if (in_size < size) return STATUS_BAD_DEVICE_TYPE;
+
+    for (i = 0; i < count; ++i)
+    {
+        HANDLE sock_handle;
+        BOOL stream;
+        int flags;
+
+        if (in_wow64_call())
+        {
+            sock_handle = ULongToHandle( params32->sockets[i].socket );
+            flags = params32->sockets[i].flags;
+        }
+        else
+        {
+            sock_handle = u64_to_user_ptr( params64->sockets[i].socket );
+            flags = params64->sockets[i].flags;
+        }
+
+        if (flags & AFD_POLL_CONNECT) return STATUS_BAD_DEVICE_TYPE;
+        if (server_get_cached_socket_fd( sock_handle, &pollfds[i].fd, &stream ) || !stream)
+            return STATUS_BAD_DEVICE_TYPE;
+
+        pollfds[i].events = 0;
+        if (flags & (AFD_POLL_READ | AFD_POLL_ACCEPT | AFD_POLL_HUP))
+            pollfds[i].events |= POLLIN;
+        if (flags & AFD_POLL_OOB)
+            pollfds[i].events |= POLLIN | POLLPRI;
+        if (flags & AFD_POLL_WRITE)
+            pollfds[i].events |= POLLOUT;
+    }
+
+    while ((ret = poll( pollfds, count, 0 )) < 0 && errno == EINTR);
+    if (ret) return STATUS_BAD_DEVICE_TYPE;
+
+    /* the output has the same layout as the input, with no sockets */
+    size = offsetof( struct afd_poll_params_64, sockets );
+    memmove( out_buffer, in_buffer, size );
+    ((struct afd_poll_params_64 *)out_buffer)->count = 0;
+    complete_async( handle, event, NULL, NULL, io, STATUS_SUCCESS, size );
+    return STATUS_SUCCESS;
+}
+
+
 NTSTATUS sock_ioctl( HANDLE handle, HANDLE event, PIO_APC_ROUTINE apc, void *apc_user, IO_STATUS_BLOCK *io,
                      UINT code, void *in_buffer, UINT in_size, void *out_buffer, UINT out_size )
 {
@@ -1582,7 +2085,9 @@ NTSTATUS sock_ioctl( HANDLE handle, HANDLE event, PIO_APC_ROUTINE apc, void *apc
         }
 
         case IOCTL_AFD_POLL:
-            status = STATUS_BAD_DEVICE_TYPE;
+            if ((status = sock_poll_unix( handle, event, apc, apc_user, io, in_buffer, in_size,
+                                          out_buffer, out_size )) != STATUS_BAD_DEVICE_TYPE)
+                return status;
             break;
 
         case IOCTL_AFD_RECV:
@@ -1718,6 +2223,23 @@ NTSTATUS sock_ioctl( HANDLE handle, HANDLE event, PIO_APC_ROUTINE apc, void *apc
             return status;
         }
 
+        case IOCTL_AFD_WINE_TRANSMIT_PACKETS:
+        {
+            const struct afd_transmit_packets_params *params = in_buffer;
+
+            if ((status = server_get_unix_fd( handle, 0, &fd, &needs_close, NULL, NULL )))
+                return status;
+
+            if (in_size < sizeof(*params))
+            {
+                status = STATUS_BUFFER_TOO_SMALL;
+                break;
+            }
+            status = sock_transmit_packets( handle, event, apc, apc_user, io, fd, params );
+            if (needs_close) close( fd );
+            return status;
+        }
+
         case IOCTL_AFD_WINE_COMPLETE_ASYNC:
         {
             if (in_size != sizeof(NTSTATUS))
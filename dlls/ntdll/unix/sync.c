@@ -64,6 +64,7 @@
 #include "wine/debug.h"
 #include "unix_private.h"
 #include "esync.h"
+#include "fsync.h"
 
 WINE_DEFAULT_DEBUG_CHANNEL(sync);
 
@@ -259,6 +260,15 @@ static unsigned int validate_open_object_attributes( const OBJECT_ATTRIBUTES *at
 }
 
 
+/* closing an unnamed sync object only drops a reference nobody else can
+ * observe, so the server round trip can be batched with a later request */
+static void allow_deferred_close( HANDLE handle, const OBJECT_ATTRIBUTES *attr )
+{
+    if (attr && attr->ObjectName && attr->ObjectName->Length) return;
+    server_allow_deferred_close( handle );
+}
+
+
 /******************************************************************************
  *              NtCreateSemaphore (NTDLL.@)
  */
@@ -273,21 +283,26 @@ NTSTATUS WINAPI NtCreateSemaphore( HANDLE *handle, ACCESS_MASK access, const OBJ
     if (max <= 0 || initial < 0 || initial > max) return STATUS_INVALID_PARAMETER;
     if ((ret = alloc_object_attributes( attr, &objattr, &len ))) return ret;
 
-    if (do_esync())
-        return esync_create_semaphore( handle, access, attr, initial, max );
-
-    SERVER_START_REQ( create_semaphore )
+    if (do_fsync())
+        ret = fsync_create_semaphore( handle, access, attr, initial, max );
+    else if (do_esync())
+        ret = esync_create_semaphore( handle, access, attr, initial, max );
+    else
     {
-        req->access  = access;
-        req->initial = initial;
-        req->max     = max;
-        wine_server_add_data( req, objattr, len );
-        ret = wine_server_call( req );
-        *handle = wine_server_ptr_handle( reply->handle );
+        SERVER_START_REQ( create_semaphore )
+        {
+            req->access  = access;
+            req->initial = initial;
+            req->max     = max;
+            wine_server_add_data( req, objattr, len );
+            ret = wine_server_call( req );
+            *handle = wine_server_ptr_handle( reply->handle );
+        }
+        SERVER_END_REQ;
     }
-    SERVER_END_REQ;
 
     free( objattr );
+    if (!ret) allow_deferred_close( *handle, attr );
     return ret;
 }
 
@@ -301,6 +316,9 @@ NTSTATUS WINAPI NtOpenSemaphore( HANDLE *handle, ACCESS_MASK access, const OBJEC
 
     *handle = 0;
 
+    if (do_fsync())
+        return fsync_open_semaphore( handle, access, attr );
+
     if (do_esync())
         return esync_open_semaphore( handle, access, attr );
 
@@ -340,6 +358,9 @@ NTSTATUS WINAPI NtQuerySemaphore( HANDLE handle, SEMAPHORE_INFORMATION_CLASS cla
 
     if (len != sizeof(SEMAPHORE_BASIC_INFORMATION)) return STATUS_INFO_LENGTH_MISMATCH;
 
+    if (do_fsync())
+        return fsync_query_semaphore( handle, info, ret_len );
+
     if (do_esync())
         return esync_query_semaphore( handle, info, ret_len );
 
@@ -365,6 +386,9 @@ NTSTATUS WINAPI NtReleaseSemaphore( HANDLE handle, ULONG count, ULONG *previous
 {
     unsigned int ret;
 
+    if (do_fsync())
+        return fsync_release_semaphore( handle, count, previous );
+
     if (do_esync())
         return esync_release_semaphore( handle, count, previous );
 
@@ -395,23 +419,29 @@ NTSTATUS WINAPI NtCreateEvent( HANDLE *handle, ACCESS_MASK access, const OBJECT_
     *handle = 0;
     if (type != NotificationEvent && type != SynchronizationEvent) return STATUS_INVALID_PARAMETER;
 
-    if (do_esync())
-        return esync_create_event( handle, access, attr, type, state );
+    if (do_fsync())
+        ret = fsync_create_event( handle, access, attr, type, state );
+    else if (do_esync())
+        ret = esync_create_event( handle, access, attr, type, state );
+    else
+    {
+        if ((ret = alloc_object_attributes( attr, &objattr, &len ))) return ret;
 
-    if ((ret = alloc_object_attributes( attr, &objattr, &len ))) return ret;
+        SERVER_START_REQ( create_event )
+        {
+            req->access = access;
+            req->manual_reset = (type == NotificationEvent);
+            req->initial_state = state;
+            wine_server_add_data( req, objattr, len );
+            ret = wine_server_call( req );
+            *handle = wine_server_ptr_handle( reply->handle );
+        }
+        SERVER_END_REQ;
 
-    SERVER_START_REQ( create_event )
-    {
-        req->access = access;
-        req->manual_reset = (type == NotificationEvent);
-        req->initial_state = state;
-        wine_server_add_data( req, objattr, len );
-        ret = wine_server_call( req );
-        *handle = wine_server_ptr_handle( reply->handle );
+        free( objattr );
     }
-    SERVER_END_REQ;
 
-    free( objattr );
+    if (!ret) allow_deferred_close( *handle, attr );
     return ret;
 }
 
@@ -426,6 +456,9 @@ NTSTATUS WINAPI NtOpenEvent( HANDLE *handle, ACCESS_MASK access, const OBJECT_AT
     *handle = 0;
     if ((ret = validate_open_object_attributes( attr ))) return ret;
 
+    if (do_fsync())
+        return fsync_open_event( handle, access, attr );
+
     if (do_esync())
         return esync_open_event( handle, access, attr );
 
@@ -452,6 +485,9 @@ NTSTATUS WINAPI NtSetEvent( HANDLE handle, LONG *prev_state )
     /* This comment is a dummy to make sure this patch applies in the right place. */
     unsigned int ret;
 
+    if (do_fsync())
+        return fsync_set_event( handle, prev_state );
+
     if (do_esync())
         return esync_set_event( handle );
 
@@ -475,6 +511,9 @@ NTSTATUS WINAPI NtResetEvent( HANDLE handle, LONG *prev_state )
     /* This comment is a dummy to make sure this patch applies in the right place. */
     unsigned int ret;
 
+    if (do_fsync())
+        return fsync_reset_event( handle, prev_state );
+
     if (do_esync())
         return esync_reset_event( handle );
 
@@ -508,6 +547,9 @@ NTSTATUS WINAPI NtPulseEvent( HANDLE handle, LONG *prev_state )
 {
     unsigned int ret;
 
+    if (do_fsync())
+        return fsync_pulse_event( handle, prev_state );
+
     if (do_esync())
         return esync_pulse_event( handle );
 
@@ -542,6 +584,9 @@ NTSTATUS WINAPI NtQueryEvent( HANDLE handle, EVENT_INFORMATION_CLASS class,
 
     if (len != sizeof(EVENT_BASIC_INFORMATION)) return STATUS_INFO_LENGTH_MISMATCH;
 
+    if (do_fsync())
+        return fsync_query_event( handle, info, ret_len );
+
     if (do_esync())
         return esync_query_event( handle, info, ret_len );
 
@@ -572,22 +617,28 @@ NTSTATUS WINAPI NtCreateMutant( HANDLE *handle, ACCESS_MASK access, const OBJECT
 
     *handle = 0;
 
-    if (do_esync())
-        return esync_create_mutex( handle, access, attr, owned );
+    if (do_fsync())
+        ret = fsync_create_mutex( handle, access, attr, owned );
+    else if (do_esync())
+        ret = esync_create_mutex( handle, access, attr, owned );
+    else
+    {
+        if ((ret = alloc_object_attributes( attr, &objattr, &len ))) return ret;
 
-    if ((ret = alloc_object_attributes( attr, &objattr, &len ))) return ret;
+        SERVER_START_REQ( create_mutex )
+        {
+            req->access  = access;
+            req->owned   = owned;
+            wine_server_add_data( req, objattr, len );
+            ret = wine_server_call( req );
+            *handle = wine_server_ptr_handle( reply->handle );
+        }
+        SERVER_END_REQ;
 
-    SERVER_START_REQ( create_mutex )
-    {
-        req->access  = access;
-        req->owned   = owned;
-        wine_server_add_data( req, objattr, len );
-        ret = wine_server_call( req );
-        *handle = wine_server_ptr_handle( reply->handle );
+        free( objattr );
     }
-    SERVER_END_REQ;
 
-    free( objattr );
+    if (!ret) allow_deferred_close( *handle, attr );
     return ret;
 }
 
@@ -602,6 +653,9 @@ NTSTATUS WINAPI NtOpenMutant( HANDLE *handle, ACCESS_MASK access, const OBJECT_A
     *handle = 0;
     if ((ret = validate_open_object_attributes( attr ))) return ret;
 
+    if (do_fsync())
+        return fsync_open_mutex( handle, access, attr );
+
     if (do_esync())
         return esync_open_mutex( handle, access, attr );
 
@@ -627,6 +681,9 @@ NTSTATUS WINAPI NtReleaseMutant( HANDLE handle, LONG *prev_count )
 {
     unsigned int ret;
 
+    if (do_fsync())
+        return fsync_release_mutex( handle, prev_count );
+
     if (do_esync())
         return esync_release_mutex( handle, prev_count );
 
@@ -660,6 +717,9 @@ NTSTATUS WINAPI NtQueryMutant( HANDLE handle, MUTANT_INFORMATION_CLASS class,
 
     if (len != sizeof(MUTANT_BASIC_INFORMATION)) return STATUS_INFO_LENGTH_MISMATCH;
 
+    if (do_fsync())
+        return fsync_query_mutex( handle, info, ret_len );
+
     if (do_esync())
         return esync_query_mutex( handle, info, ret_len );
 
@@ -1521,6 +1581,13 @@ NTSTATUS WINAPI NtWaitForMultipleObjects( DWORD count, const HANDLE *handles, BO
 
     if (!count || count > MAXIMUM_WAIT_OBJECTS) return STATUS_INVALID_PARAMETER_1;
 
+    if (do_fsync())
+    {
+        NTSTATUS ret = fsync_wait_objects( count, handles, wait_any, alertable, timeout );
+        if (ret != STATUS_NOT_IMPLEMENTED)
+            return ret;
+    }
+
     if (do_esync())
     {
         NTSTATUS ret = esync_wait_objects( count, handles, wait_any, alertable, timeout );
@@ -1553,6 +1620,9 @@ NTSTATUS WINAPI NtSignalAndWaitForSingleObject( HANDLE signal, HANDLE wait,
     select_op_t select_op;
     UINT flags = SELECT_INTERRUPTIBLE;
 
+    if (do_fsync())
+        return fsync_signal_and_wait( signal, wait, alertable, timeout );
+
     if (do_esync())
         return esync_signal_and_wait( signal, wait, alertable, timeout );
 
@@ -1974,29 +2044,36 @@ NTSTATUS WINAPI NtRemoveIoCompletion( HANDLE handle, ULONG_PTR *key, ULONG_PTR *
 NTSTATUS WINAPI NtRemoveIoCompletionEx( HANDLE handle, FILE_IO_COMPLETION_INFORMATION *info, ULONG count,
                                         ULONG *written, LARGE_INTEGER *timeout, BOOLEAN alertable )
 {
+    struct completion_entry entries[64];
     unsigned int status;
-    ULONG i = 0;
+    ULONG i = 0, j, n, size;
 
     TRACE( "%p %p %u %p %p %u\n", handle, info, (int)count, written, timeout, alertable );
 
     for (;;)
     {
+        /* fetch the queued entries in batches, a short batch means the queue is drained */
         while (i < count)
         {
-            SERVER_START_REQ( remove_completion )
+            size = min( count - i, ARRAY_SIZE(entries) );
+            n = 0;
+            SERVER_START_REQ( remove_completions )
             {
                 req->handle = wine_server_obj_handle( handle );
+                wine_server_set_reply( req, entries, size * sizeof(*entries) );
                 if (!(status = wine_server_call( req )))
-                {
-                    info[i].CompletionKey             = reply->ckey;
-                    info[i].CompletionValue           = reply->cvalue;
-                    info[i].IoStatusBlock.Information = reply->information;
-                    info[i].IoStatusBlock.Status      = reply->status;
-                }
+                    n = wine_server_reply_size( reply ) / sizeof(*entries);
             }
             SERVER_END_REQ;
             if (status != STATUS_SUCCESS) break;
-            ++i;
+            for (j = 0; j < n; ++j, ++i)
+            {
+                info[i].CompletionKey             = entries[j].ckey;
+                info[i].CompletionValue           = entries[j].cvalue;
+                info[i].IoStatusBlock.Information = entries[j].information;
+                info[i].IoStatusBlock.Status      = entries[j].status;
+            }
+            if (n < size) break;
         }
         if (i || status != STATUS_PENDING)
         {
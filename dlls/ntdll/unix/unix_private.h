@@ -30,6 +30,7 @@
 #include "wine/debug.h"
 
 struct msghdr;
+struct mmsghdr;
 
 typedef struct
 {
@@ -104,6 +105,8 @@ struct ntdll_thread_data
     void              *cpu_data[16];  /* reserved for CPU-specific data */
     void              *kernel_stack;  /* stack for thread startup and kernel syscalls */
     int                esync_apc_fd;  /* fd to wait on for user APCs */
+    int               *fsync_apc_futex; /* futex to wait on for user APCs */
+    const thread_shm_t *thread_shm;   /* state published by the server */
     int                request_fd;    /* fd for sending server requests */
     int                reply_fd;      /* fd for receiving server replies */
     int                wait_fd[2];    /* fd for sleeping server requests */
@@ -112,9 +115,15 @@ struct ntdll_thread_data
     PRTL_THREAD_START_ROUTINE start;  /* thread entry point */
     void              *param;         /* thread entry point parameter */
     void              *jmp_buf;       /* setjmp buffer for exception handling */
+    void              *last_view;     /* last view found by a lockless lookup */
+    unsigned int       last_view_seq; /* views sequence number when last_view was found */
+    struct list        recv_batch;    /* pending datagram socket receives, in issue order */
+    struct list        send_batch;    /* pending datagram socket sends, in issue order */
+    unsigned int       async_alert_count; /* asyncs completed along with the current async callback */
 };
 
-C_ASSERT( sizeof(struct ntdll_thread_data) <= sizeof(((TEB *)0)->GdiTebBatch) );
+/* the last pointer is used by the PE side for the heap thread cache */
+C_ASSERT( sizeof(struct ntdll_thread_data) <= sizeof(((TEB *)0)->GdiTebBatch) - sizeof(void *) );
 
 static inline struct ntdll_thread_data *ntdll_get_thread_data(void)
 {
@@ -214,8 +223,11 @@ extern unsigned int server_wait( const select_op_t *select_op, data_size_t size,
                                  const LARGE_INTEGER *timeout );
 extern unsigned int server_queue_process_apc( HANDLE process, const apc_call_t *call,
                                               apc_result_t *result );
+extern NTSTATUS server_get_cached_socket_fd( HANDLE handle, int *unix_fd, BOOL *stream );
 extern int server_get_unix_fd( HANDLE handle, unsigned int wanted_access, int *unix_fd,
                                int *needs_close, enum server_fd_type *type, unsigned int *options );
+extern void server_allow_deferred_close( HANDLE handle );
+extern void server_disallow_deferred_close( HANDLE handle );
 extern void wine_server_send_fd( int fd );
 extern void process_exit_wrapper( int status ) DECLSPEC_NORETURN;
 extern size_t server_init_process(void);
@@ -265,6 +277,9 @@ extern unsigned int virtual_locked_server_call( void *req_ptr );
 extern ssize_t virtual_locked_read( int fd, void *addr, size_t size );
 extern ssize_t virtual_locked_pread( int fd, void *addr, size_t size, off_t offset );
 extern ssize_t virtual_locked_recvmsg( int fd, struct msghdr *hdr, int flags );
+#ifdef HAVE_RECVMMSG
+extern int virtual_locked_recvmmsg( int fd, struct mmsghdr *msgs, unsigned int count, int flags );
+#endif
 extern BOOL virtual_is_valid_code_address( const void *addr, SIZE_T size );
 extern void *virtual_setup_exception( void *stack_ptr, size_t size, EXCEPTION_RECORD *rec );
 extern BOOL virtual_check_buffer_for_read( const void *ptr, SIZE_T size );
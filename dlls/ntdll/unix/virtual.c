@@ -151,6 +151,9 @@ static const BYTE VIRTUAL_Win32Flags[16] =
 
 static struct wine_rb_tree views_tree;
 static pthread_mutex_t virtual_mutex;
+/* sequence number of the views tree and page protections, odd while they are being modified */
+static unsigned int views_seq;
+static unsigned int virtual_lock_depth;  /* recursion count of virtual_mutex */
 
 static const UINT page_shift = 12;
 static const UINT_PTR page_mask = 0xfff;
@@ -175,6 +178,7 @@ static void *working_set_limit   = (void *)0x7fff0000;
 static void *host_addr_space_limit;  /* top of the host virtual address space */
 
 static SIZE_T vmem_max_size = 0;
+static SIZE_T thp_min_size = 0;  /* minimum size of anonymous views to back with huge pages */
 
 static struct file_view *arm64ec_view;
 
@@ -227,6 +231,34 @@ static inline BOOL is_beyond_limit( const void *addr, size_t size, const void *l
     return (addr >= limit || (const char *)addr + size > (const char *)limit);
 }
 
+
+/***********************************************************************
+ *           virtual_lock
+ *
+ * Acquire virtual_mutex; sigset is NULL when called from a signal handler.
+ */
+static void virtual_lock( sigset_t *sigset )
+{
+    if (sigset) server_enter_uninterrupted_section( &virtual_mutex, sigset );
+    else mutex_lock( &virtual_mutex );
+    virtual_lock_depth++;
+}
+
+
+/***********************************************************************
+ *           virtual_unlock
+ *
+ * Release virtual_mutex, ending the update started by views_update_begin().
+ */
+static void virtual_unlock( sigset_t *sigset )
+{
+    if (!--virtual_lock_depth && (views_seq & 1))
+        __atomic_store_n( &views_seq, views_seq + 1, __ATOMIC_RELEASE );
+    if (sigset) server_leave_uninterrupted_section( &virtual_mutex, sigset );
+    else mutex_unlock( &virtual_mutex );
+}
+
+
 /* mmap() anonymous memory at a fixed address */
 void *anon_mmap_fixed( void *start, size_t size, int prot, int flags )
 {
@@ -621,7 +653,7 @@ void *get_builtin_so_handle( void *module )
     void *ret = NULL;
     struct builtin_module *builtin;
 
-    server_enter_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_lock( &sigset );
     LIST_FOR_EACH_ENTRY( builtin, &builtin_modules, struct builtin_module, entry )
     {
         if (builtin->module != module) continue;
@@ -629,7 +661,7 @@ void *get_builtin_so_handle( void *module )
         if (ret) builtin->refcount++;
         break;
     }
-    server_leave_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_unlock( &sigset );
     return ret;
 }
 
@@ -644,7 +676,7 @@ static NTSTATUS get_builtin_unix_funcs( void *module, BOOL wow, const void **fun
     NTSTATUS status = STATUS_DLL_NOT_FOUND;
     struct builtin_module *builtin;
 
-    server_enter_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_lock( &sigset );
     LIST_FOR_EACH_ENTRY( builtin, &builtin_modules, struct builtin_module, entry )
     {
         if (builtin->module != module) continue;
@@ -657,7 +689,7 @@ static NTSTATUS get_builtin_unix_funcs( void *module, BOOL wow, const void **fun
         }
         break;
     }
-    server_leave_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_unlock( &sigset );
     return status;
 }
 
@@ -671,7 +703,7 @@ NTSTATUS load_builtin_unixlib( void *module, const char *name )
     NTSTATUS status = STATUS_SUCCESS;
     struct builtin_module *builtin;
 
-    server_enter_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_lock( &sigset );
     LIST_FOR_EACH_ENTRY( builtin, &builtin_modules, struct builtin_module, entry )
     {
         if (builtin->module != module) continue;
@@ -679,7 +711,7 @@ NTSTATUS load_builtin_unixlib( void *module, const char *name )
         else status = STATUS_IMAGE_ALREADY_LOADED;
         break;
     }
-    server_leave_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_unlock( &sigset );
     return status;
 }
 
@@ -870,6 +902,47 @@ static inline int is_view_valloc( const struct file_view *view )
     return !(view->protect & (SEC_FILE | SEC_RESERVE | SEC_COMMIT));
 }
 
+/***********************************************************************
+ *           views_update_begin
+ *
+ * Start modifying the views tree or the page protections, so that concurrent
+ * lockless lookups get invalidated. The sequence number stays odd until
+ * virtual_mutex is released, so that readers never see the intermediate
+ * states of an update made of several steps. virtual_mutex must be held by caller.
+ */
+static inline void views_update_begin(void)
+{
+    if (views_seq & 1) return;
+    __atomic_store_n( &views_seq, views_seq + 1, __ATOMIC_RELAXED );
+    __atomic_thread_fence( __ATOMIC_RELEASE );
+}
+
+
+/***********************************************************************
+ *           views_read_begin
+ *
+ * Start a lockless lookup of the views tree or the page protections. Views and page
+ * protection blocks are never unmapped, so they can always be read, but the results
+ * must be checked with views_read_valid() before being used.
+ */
+static inline unsigned int views_read_begin(void)
+{
+    return __atomic_load_n( &views_seq, __ATOMIC_ACQUIRE );
+}
+
+
+/***********************************************************************
+ *           views_read_valid
+ *
+ * Check that nothing was modified since the matching views_read_begin().
+ */
+static inline BOOL views_read_valid( unsigned int seq )
+{
+    __atomic_thread_fence( __ATOMIC_ACQUIRE );
+    return !(seq & 1) && __atomic_load_n( &views_seq, __ATOMIC_RELAXED ) == seq;
+}
+
+
 /***********************************************************************
  *           get_page_vprot
  *
@@ -953,6 +1026,7 @@ static void set_page_vprot( const void *addr, size_t size, BYTE vprot )
     size_t idx = (size_t)addr >> page_shift;
     size_t end = ((size_t)addr + size + page_mask) >> page_shift;
 
+    views_update_begin();
 #ifdef _WIN64
     while (idx >> pages_vprot_shift != end >> pages_vprot_shift)
     {
@@ -977,6 +1051,7 @@ static void set_page_vprot_bits( const void *addr, size_t size, BYTE set, BYTE c
     size_t idx = (size_t)addr >> page_shift;
     size_t end = ((size_t)addr + size + page_mask) >> page_shift;
 
+    views_update_begin();
 #ifdef _WIN64
     for ( ; idx < end; idx++)
     {
@@ -1166,12 +1241,12 @@ static void VIRTUAL_Dump(void)
     struct file_view *view;
 
     TRACE( "Dump of all virtual memory views:\n" );
-    server_enter_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_lock( &sigset );
     WINE_RB_FOR_EACH_ENTRY( view, &views_tree, struct file_view, entry )
     {
         dump_view( view );
     }
-    server_leave_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_unlock( &sigset );
 }
 #endif
 
@@ -1207,6 +1282,45 @@ static struct file_view *find_view( const void *addr, size_t size )
 }
 
 
+/***********************************************************************
+ *           find_view_lockless
+ *
+ * Find the view containing a given address without holding virtual_mutex.
+ * The result must be checked with views_read_valid().
+ */
+static struct file_view *find_view_lockless( const void *addr, size_t size, unsigned int seq )
+{
+    struct ntdll_thread_data *thread_data = ntdll_get_thread_data();
+    struct file_view *view = thread_data->last_view;
+    struct wine_rb_entry *ptr;
+    unsigned int depth;
+
+    if ((const char *)addr + size < (const char *)addr) return NULL; /* overflow */
+
+    /* the last view found by this thread is still valid if nothing was modified since */
+    if (view && thread_data->last_view_seq == seq && view->base <= addr &&
+        (const char *)view->base + view->size >= (const char *)addr + size)
+        return view;
+
+    /* the tree may be modified concurrently, so bound the walk to the maximum tree height */
+    for (ptr = views_tree.root, depth = 0; ptr && depth < 2 * 8 * sizeof(void *); depth++)
+    {
+        view = WINE_RB_ENTRY_VALUE( ptr, struct file_view, entry );
+
+        if (view->base > addr) ptr = ptr->left;
+        else if ((const char *)view->base + view->size <= (const char *)addr) ptr = ptr->right;
+        else if ((const char *)view->base + view->size < (const char *)addr + size) break;  /* size too large */
+        else
+        {
+            thread_data->last_view = view;
+            thread_data->last_view_seq = seq;
+            return view;
+        }
+    }
+    return NULL;
+}
+
+
 /***********************************************************************
  *           is_write_watch_range
  */
@@ -1524,6 +1638,7 @@ static void free_view( struct file_view *view )
  */
 static void unregister_view( struct file_view *view )
 {
+    views_update_begin();
     if (mmap_is_in_reserved_area( view->base, view->size ))
         free_ranges_remove_view( view );
     wine_rb_remove( &views_tree, &view->entry );
@@ -1552,6 +1667,7 @@ static void delete_view( struct file_view *view ) /* [in] View */
  */
 static void register_view( struct file_view *view )
 {
+    views_update_begin();
     wine_rb_put( &views_tree, view->base, &view->entry );
     if (mmap_is_in_reserved_area( view->base, view->size ))
         free_ranges_insert_view( view );
@@ -1777,6 +1893,7 @@ static void commit_arm64ec_map( struct file_view *view )
     size_t size = ROUND_SIZE( start, end + 1 - start );
     void *base = ROUND_ADDR( (char *)arm64ec_view->base + start, page_mask );
 
+    views_update_begin();
     view->protect |= VPROT_ARM64EC;
     set_vprot( arm64ec_view, base, size, VPROT_READ | VPROT_WRITE | VPROT_COMMITTED );
 }
@@ -1991,6 +2108,7 @@ static NTSTATUS map_view( struct file_view **view_ret, void *base, size_t size,
 
         TRACE( "found view %p, size %p, protect %#x.\n", view->base, (void *)view->size, view->protect );
 
+        views_update_begin();
         view->protect = vprot | VPROT_PLACEHOLDER;
         set_vprot( view, base, size, vprot );
         if (vprot & VPROT_WRITEWATCH) reset_write_watches( base, size );
@@ -2262,6 +2380,7 @@ static NTSTATUS free_pages_preserve_placeholder( struct file_view *view, char *b
         if (status) return status;
     }
 
+    views_update_begin();
     view->protect = VPROT_PLACEHOLDER | VPROT_FREE_PLACEHOLDER;
     set_page_vprot( view->base, view->size, 0 );
     anon_mmap_fixed( view->base, view->size, PROT_NONE, 0 );
@@ -3071,7 +3190,7 @@ static NTSTATUS virtual_map_image( HANDLE mapping, void **addr_ptr, SIZE_T *size
         SERVER_END_REQ;
     }
 
-    server_enter_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_lock( &sigset );
 
     status = map_image_view( &view, image_info, size, limit_low, limit_high, alloc_type );
     if (status) goto done;
@@ -3100,7 +3219,7 @@ static NTSTATUS virtual_map_image( HANDLE mapping, void **addr_ptr, SIZE_T *size
     else delete_view( view );
 
 done:
-    server_leave_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_unlock( &sigset );
     if (needs_close) close( unix_fd );
     if (shared_needs_close) close( shared_fd );
     return status;
@@ -3198,7 +3317,7 @@ static unsigned int virtual_map_section( HANDLE handle, PVOID *addr_ptr, ULONG_P
 
     if ((res = server_get_unix_fd( handle, 0, &unix_handle, &needs_close, NULL, NULL ))) return res;
 
-    server_enter_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_lock( &sigset );
 
     res = map_view( &view, base, size, alloc_type, vprot, limit_low, limit_high, 0 );
     if (res) goto done;
@@ -3229,7 +3348,7 @@ static unsigned int virtual_map_section( HANDLE handle, PVOID *addr_ptr, ULONG_P
     else delete_view( view );
 
 done:
-    server_leave_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_unlock( &sigset );
     if (needs_close) close( unix_handle );
     return res;
 }
@@ -3276,7 +3395,7 @@ void virtual_init(void)
 {
     const struct preload_info **preload_info = dlsym( RTLD_DEFAULT, "wine_main_preload_info" );
     const char *preload;
-    const char *vmem_max_size_env;
+    const char *vmem_max_size_env, *thp_min_size_env;
     size_t size;
     int i;
     pthread_mutexattr_t attr;
@@ -3340,6 +3459,11 @@ void virtual_init(void)
         vmem_max_size = (SIZE_T)strtol(vmem_max_size_env, NULL, 10) << 20;
         TRACE( "virtual memory max size: %ld\n", vmem_max_size );
     }
+    if ((thp_min_size_env = getenv( "WINETHPMINSIZE" )))
+    {
+        thp_min_size = (SIZE_T)strtol( thp_min_size_env, NULL, 10 ) << 20;
+        TRACE( "huge pages min size: %ld\n", thp_min_size );
+    }
 }
 
 
@@ -3498,7 +3622,7 @@ NTSTATUS virtual_create_builtin_view( void *module, const UNICODE_STRING *nt_nam
     void *base = wine_server_get_ptr( info->base );
     int i;
 
-    server_enter_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_lock( &sigset );
     status = create_view( &view, base, size, SEC_IMAGE | SEC_FILE | VPROT_SYSTEM |
                           VPROT_COMMITTED | VPROT_READ | VPROT_WRITECOPY | VPROT_EXEC );
     if (!status)
@@ -3535,7 +3659,7 @@ NTSTATUS virtual_create_builtin_view( void *module, const UNICODE_STRING *nt_nam
         }
         else delete_view( view );
     }
-    server_leave_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_unlock( &sigset );
 
     return status;
 }
@@ -3650,6 +3774,8 @@ static TEB *init_teb( void *ptr, BOOL is_wow )
     teb->StaticUnicodeString.MaximumLength = sizeof(teb->StaticUnicodeBuffer);
     thread_data = (struct ntdll_thread_data *)&teb->GdiTebBatch;
     thread_data->esync_apc_fd = -1;
+    thread_data->fsync_apc_futex = NULL;
+    thread_data->thread_shm = NULL;
     thread_data->request_fd = -1;
     thread_data->reply_fd   = -1;
     thread_data->wait_fd[0] = -1;
@@ -3705,7 +3831,7 @@ NTSTATUS virtual_alloc_teb( TEB **ret_teb )
     NTSTATUS status = STATUS_SUCCESS;
     SIZE_T block_size = signal_stack_mask + 1;
 
-    server_enter_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_lock( &sigset );
     if (next_free_teb)
     {
         ptr = next_free_teb;
@@ -3721,7 +3847,7 @@ NTSTATUS virtual_alloc_teb( TEB **ret_teb )
             if ((status = NtAllocateVirtualMemory( NtCurrentProcess(), &ptr, user_space_wow_limit,
                                                    &total, MEM_RESERVE, PAGE_READWRITE )))
             {
-                server_leave_uninterrupted_section( &virtual_mutex, &sigset );
+                virtual_unlock( &sigset );
                 return status;
             }
             teb_block = ptr;
@@ -3732,14 +3858,14 @@ NTSTATUS virtual_alloc_teb( TEB **ret_teb )
                                  MEM_COMMIT, PAGE_READWRITE );
     }
     *ret_teb = teb = init_teb( ptr, is_wow64() );
-    server_leave_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_unlock( &sigset );
 
     if ((status = signal_alloc_thread( teb )))
     {
-        server_enter_uninterrupted_section( &virtual_mutex, &sigset );
+        virtual_lock( &sigset );
         *(void **)ptr = next_free_teb;
         next_free_teb = ptr;
-        server_leave_uninterrupted_section( &virtual_mutex, &sigset );
+        virtual_unlock( &sigset );
     }
     return status;
 }
@@ -3773,13 +3899,13 @@ void virtual_free_teb( TEB *teb )
         NtFreeVirtualMemory( GetCurrentProcess(), &ptr, &size, MEM_RELEASE );
     }
 
-    server_enter_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_lock( &sigset );
     list_remove( &thread_data->entry );
     ptr = teb;
     if (!is_win64) ptr = (char *)ptr - teb_offset;
     *(void **)ptr = next_free_teb;
     next_free_teb = ptr;
-    server_leave_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_unlock( &sigset );
 }
 
 
@@ -3793,7 +3919,7 @@ NTSTATUS virtual_clear_tls_index( ULONG index )
 
     if (index < TLS_MINIMUM_AVAILABLE)
     {
-        server_enter_uninterrupted_section( &virtual_mutex, &sigset );
+        virtual_lock( &sigset );
         LIST_FOR_EACH_ENTRY( thread_data, &teb_list, struct ntdll_thread_data, entry )
         {
             TEB *teb = CONTAINING_RECORD( thread_data, TEB, GdiTebBatch );
@@ -3804,14 +3930,14 @@ NTSTATUS virtual_clear_tls_index( ULONG index )
 #endif
             teb->TlsSlots[index] = 0;
         }
-        server_leave_uninterrupted_section( &virtual_mutex, &sigset );
+        virtual_unlock( &sigset );
     }
     else
     {
         index -= TLS_MINIMUM_AVAILABLE;
         if (index >= 8 * sizeof(peb->TlsExpansionBitmapBits)) return STATUS_INVALID_PARAMETER;
 
-        server_enter_uninterrupted_section( &virtual_mutex, &sigset );
+        virtual_lock( &sigset );
         LIST_FOR_EACH_ENTRY( thread_data, &teb_list, struct ntdll_thread_data, entry )
         {
             TEB *teb = CONTAINING_RECORD( thread_data, TEB, GdiTebBatch );
@@ -3826,7 +3952,7 @@ NTSTATUS virtual_clear_tls_index( ULONG index )
 #endif
             if (teb->TlsExpansionSlots) teb->TlsExpansionSlots[index] = 0;
         }
-        server_leave_uninterrupted_section( &virtual_mutex, &sigset );
+        virtual_unlock( &sigset );
     }
     return STATUS_SUCCESS;
 }
@@ -3850,7 +3976,7 @@ NTSTATUS virtual_alloc_thread_stack( INITIAL_TEB *stack, ULONG_PTR limit_low, UL
     if (size < 1024 * 1024) size = 1024 * 1024;  /* Xlib needs a large stack */
     size = (size + 0xffff) & ~0xffff;  /* round to 64K boundary */
 
-    server_enter_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_lock( &sigset );
 
     status = map_view( &view, NULL, size, 0, VPROT_READ | VPROT_WRITE | VPROT_COMMITTED,
                        limit_low, limit_high, 0 );
@@ -3877,7 +4003,7 @@ NTSTATUS virtual_alloc_thread_stack( INITIAL_TEB *stack, ULONG_PTR limit_low, UL
     stack->StackBase = (char *)view->base + view->size;
     stack->StackLimit = (char *)view->base + (guard_page ? 2 * page_size : 0);
 done:
-    server_leave_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_unlock( &sigset );
     return status;
 }
 
@@ -3983,9 +4109,18 @@ NTSTATUS virtual_handle_fault( void *addr, DWORD err, void *stack )
 {
     NTSTATUS ret = STATUS_ACCESS_VIOLATION;
     char *page = ROUND_ADDR( addr, page_mask );
+    unsigned int seq;
     BYTE vprot;
 
-    mutex_lock( &virtual_mutex );  /* no need for signal masking inside signal handler */
+    /* a fault on a page that isn't writable and has no guard or write watch is a plain
+     * access violation, there's no need to serialize on virtual_mutex to find out */
+    seq = views_read_begin();
+    vprot = get_page_vprot( page );
+    if (!(vprot & (VPROT_GUARD | VPROT_WRITEWATCH)) && !(get_unix_prot( vprot ) & PROT_WRITE) &&
+        views_read_valid( seq ))
+        return STATUS_ACCESS_VIOLATION;
+
+    virtual_lock( NULL );  /* no need for signal masking inside signal handler */
     vprot = get_page_vprot( page );
 
 #ifdef __APPLE__
@@ -4022,7 +4157,7 @@ NTSTATUS virtual_handle_fault( void *addr, DWORD err, void *stack )
                 ret = STATUS_SUCCESS;
         }
     }
-    mutex_unlock( &virtual_mutex );
+    virtual_unlock( NULL );
     return ret;
 }
 
@@ -4060,14 +4195,14 @@ void *virtual_setup_exception( void *stack_ptr, size_t size, EXCEPTION_RECORD *r
     }
     else if (stack < stack_info.limit)
     {
-        mutex_lock( &virtual_mutex );  /* no need for signal masking inside signal handler */
+        virtual_lock( NULL );  /* no need for signal masking inside signal handler */
         if ((get_page_vprot( stack ) & VPROT_GUARD) &&
             grow_thread_stack( ROUND_ADDR( stack, page_mask ), &stack_info ))
         {
             rec->ExceptionCode = STATUS_STACK_OVERFLOW;
             rec->NumberParameters = 0;
         }
-        mutex_unlock( &virtual_mutex );
+        virtual_unlock( NULL );
     }
 #if defined(VALGRIND_MAKE_MEM_UNDEFINED)
     VALGRIND_MAKE_MEM_UNDEFINED( stack, size );
@@ -4116,14 +4251,14 @@ unsigned int virtual_locked_server_call( void *req_ptr )
 
     if (!size) return wine_server_call( req_ptr );
 
-    server_enter_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_lock( &sigset );
     if (!(ret = check_write_access( addr, size, &has_write_watch )))
     {
         ret = server_call_unlocked( req );
         if (has_write_watch) update_write_watches( addr, size, wine_server_reply_size( req ));
     }
     else memset( &req->u.reply, 0, sizeof(req->u.reply) );
-    server_leave_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_unlock( &sigset );
     return ret;
 }
 
@@ -4140,14 +4275,14 @@ ssize_t virtual_locked_read( int fd, void *addr, size_t size )
     ssize_t ret = read( fd, addr, size );
     if (ret != -1 || errno != EFAULT) return ret;
 
-    server_enter_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_lock( &sigset );
     if (!check_write_access( addr, size, &has_write_watch ))
     {
         ret = read( fd, addr, size );
         err = errno;
         if (has_write_watch) update_write_watches( addr, size, max( 0, ret ));
     }
-    server_leave_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_unlock( &sigset );
     errno = err;
     return ret;
 }
@@ -4165,14 +4300,14 @@ ssize_t virtual_locked_pread( int fd, void *addr, size_t size, off_t offset )
     ssize_t ret = pread( fd, addr, size, offset );
     if (ret != -1 || errno != EFAULT) return ret;
 
-    server_enter_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_lock( &sigset );
     if (!check_write_access( addr, size, &has_write_watch ))
     {
         ret = pread( fd, addr, size, offset );
         err = errno;
         if (has_write_watch) update_write_watches( addr, size, max( 0, ret ));
     }
-    server_leave_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_unlock( &sigset );
     errno = err;
     return ret;
 }
@@ -4191,7 +4326,7 @@ ssize_t virtual_locked_recvmsg( int fd, struct msghdr *hdr, int flags )
     ssize_t ret = recvmsg( fd, hdr, flags );
     if (ret != -1 || errno != EFAULT) return ret;
 
-    server_enter_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_lock( &sigset );
     for (i = 0; i < hdr->msg_iovlen; i++)
         if (check_write_access( hdr->msg_iov[i].iov_base, hdr->msg_iov[i].iov_len, &has_write_watch ))
             break;
@@ -4203,12 +4338,58 @@ ssize_t virtual_locked_recvmsg( int fd, struct msghdr *hdr, int flags )
     if (has_write_watch)
         while (i--) update_write_watches( hdr->msg_iov[i].iov_base, hdr->msg_iov[i].iov_len, 0 );
 
-    server_leave_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_unlock( &sigset );
     errno = err;
     return ret;
 }
 
 
+#ifdef HAVE_RECVMMSG
+/***********************************************************************
+ *           virtual_locked_recvmmsg
+ */
+int virtual_locked_recvmmsg( int fd, struct mmsghdr *msgs, unsigned int count, int flags )
+{
+    sigset_t sigset;
+    unsigned int i;
+    size_t j;
+    BOOL has_write_watch = FALSE;
+    int err = EFAULT;
+
+    int ret = recvmmsg( fd, msgs, count, flags, NULL );
+    if (ret != -1 || errno != EFAULT) return ret;
+
+    virtual_lock( &sigset );
+    for (i = 0; i < count; i++)
+    {
+        for (j = 0; j < msgs[i].msg_hdr.msg_iovlen; j++)
+            if (check_write_access( msgs[i].msg_hdr.msg_iov[j].iov_base, msgs[i].msg_hdr.msg_iov[j].iov_len,
+                                    &has_write_watch ))
+                break;
+        if (j < msgs[i].msg_hdr.msg_iovlen) break;
+    }
+    if (i == count)
+    {
+        ret = recvmmsg( fd, msgs, count, flags, NULL );
+        err = errno;
+    }
+    if (has_write_watch)
+    {
+        if (i < count)  /* the failing message has only been checked partially */
+            while (j--)
+                update_write_watches( msgs[i].msg_hdr.msg_iov[j].iov_base, msgs[i].msg_hdr.msg_iov[j].iov_len, 0 );
+        while (i--)
+            for (j = 0; j < msgs[i].msg_hdr.msg_iovlen; j++)
+                update_write_watches( msgs[i].msg_hdr.msg_iov[j].iov_base, msgs[i].msg_hdr.msg_iov[j].iov_len, 0 );
+    }
+
+    virtual_unlock( &sigset );
+    errno = err;
+    return ret;
+}
+#endif
+
+
 /***********************************************************************
  *           virtual_is_valid_code_address
  */
@@ -4217,11 +4398,18 @@ BOOL virtual_is_valid_code_address( const void *addr, SIZE_T size )
     struct file_view *view;
     BOOL ret = FALSE;
     sigset_t sigset;
+    unsigned int seq;
 
-    server_enter_uninterrupted_section( &virtual_mutex, &sigset );
+    seq = views_read_begin();
+    if ((view = find_view_lockless( addr, size, seq )))
+        ret = !(view->protect & VPROT_SYSTEM);  /* system views are not visible to the app */
+    if (views_read_valid( seq )) return ret;
+
+    ret = FALSE;
+    virtual_lock( &sigset );
     if ((view = find_view( addr, size )))
         ret = !(view->protect & VPROT_SYSTEM);  /* system views are not visible to the app */
-    server_leave_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_unlock( &sigset );
     return ret;
 }
 
@@ -4308,7 +4496,7 @@ SIZE_T virtual_uninterrupted_read_memory( const void *addr, void *buffer, SIZE_T
 
     if (!size) return 0;
 
-    server_enter_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_lock( &sigset );
     if ((view = find_view( addr, size )))
     {
         if (!(view->protect & VPROT_SYSTEM))
@@ -4324,7 +4512,7 @@ SIZE_T virtual_uninterrupted_read_memory( const void *addr, void *buffer, SIZE_T
             }
         }
     }
-    server_leave_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_unlock( &sigset );
     return bytes_read;
 }
 
@@ -4344,13 +4532,13 @@ NTSTATUS virtual_uninterrupted_write_memory( void *addr, const void *buffer, SIZ
 
     if (!size) return STATUS_SUCCESS;
 
-    server_enter_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_lock( &sigset );
     if (!(ret = check_write_access( addr, size, &has_write_watch )))
     {
         memcpy( addr, buffer, size );
         if (has_write_watch) update_write_watches( addr, size, size );
     }
-    server_leave_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_unlock( &sigset );
     return ret;
 }
 
@@ -4365,7 +4553,7 @@ void virtual_set_force_exec( BOOL enable )
     struct file_view *view;
     sigset_t sigset;
 
-    server_enter_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_lock( &sigset );
     if (!force_exec_prot != !enable)  /* change all existing views */
     {
         force_exec_prot = enable;
@@ -4378,7 +4566,7 @@ void virtual_set_force_exec( BOOL enable )
             mprotect_range( view->base, view->size, commit, 0 );
         }
     }
-    server_leave_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_unlock( &sigset );
 }
 
 /* free reserved areas within a given range */
@@ -4466,6 +4654,8 @@ static NTSTATUS allocate_virtual_memory( void **ret, SIZE_T *size_ptr, ULONG typ
     struct file_view *view;
     sigset_t sigset;
     SIZE_T size = *size_ptr;
+    SIZE_T large_page_size = user_shared_data->LargePageMinimum;
+    BOOL huge_pages = FALSE;
     NTSTATUS status = STATUS_SUCCESS;
 
     /* Round parameters to a page boundary */
@@ -4509,9 +4699,23 @@ static NTSTATUS allocate_virtual_memory( void **ret, SIZE_T *size_ptr, ULONG typ
     if (type & MEM_RESERVE_PLACEHOLDER && (protect != PAGE_NOACCESS)) return STATUS_INVALID_PARAMETER;
     if (!arm64ec_view && (attributes & MEM_EXTENDED_PARAMETER_EC_CODE)) return STATUS_INVALID_PARAMETER;
 
+    if (type & MEM_LARGE_PAGES)
+    {
+        if (!large_page_size) return STATUS_NOT_SUPPORTED;
+        if ((type & (MEM_RESERVE | MEM_COMMIT)) != (MEM_RESERVE | MEM_COMMIT)) return STATUS_INVALID_PARAMETER;
+        if ((size | (UINT_PTR)base) & (large_page_size - 1)) return STATUS_INVALID_PARAMETER;
+        huge_pages = TRUE;
+    }
+    else if ((type & MEM_RESERVE) && thp_min_size && large_page_size && size >= thp_min_size &&
+             !(type & (MEM_WRITE_WATCH | MEM_RESERVE_PLACEHOLDER)))
+    {
+        huge_pages = TRUE;
+    }
+    if (huge_pages && !base && align < large_page_size) align = large_page_size;
+
     /* Reserve the memory */
 
-    server_enter_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_lock( &sigset );
 
     if ((type & MEM_RESERVE) || !base)
     {
@@ -4521,13 +4725,21 @@ static NTSTATUS allocate_virtual_memory( void **ret, SIZE_T *size_ptr, ULONG typ
             if (type & MEM_WRITE_WATCH) vprot |= VPROT_WRITEWATCH;
             if (type & MEM_RESERVE_PLACEHOLDER) vprot |= VPROT_PLACEHOLDER | VPROT_FREE_PLACEHOLDER;
             if (protect & PAGE_NOCACHE) vprot |= SEC_NOCACHE;
+            if (type & MEM_LARGE_PAGES) vprot |= SEC_LARGE_PAGES;
 
             if (vprot & VPROT_WRITECOPY) status = STATUS_INVALID_PAGE_PROTECTION;
             else if (is_dos_memory) status = allocate_dos_memory( &view, vprot );
             else status = map_view( &view, base, size, type, vprot, limit_low, limit_high,
                                     align ? align - 1 : granularity_mask );
 
-            if (status == STATUS_SUCCESS) base = view->base;
+            if (status == STATUS_SUCCESS)
+            {
+                base = view->base;
+#ifdef MADV_HUGEPAGE
+                if (huge_pages && madvise( base, size, MADV_HUGEPAGE ))
+                    WARN( "failed to enable huge pages for %p-%p: %s\n", base, (char *)base + size, strerror( errno ));
+#endif
+            }
         }
     }
     else if (type & MEM_RESET)
@@ -4561,7 +4773,7 @@ static NTSTATUS allocate_virtual_memory( void **ret, SIZE_T *size_ptr, ULONG typ
 
     if (!status) VIRTUAL_DEBUG_DUMP_VIEW( view );
 
-    server_leave_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_unlock( &sigset );
 
     if (status == STATUS_SUCCESS)
     {
@@ -4582,7 +4794,8 @@ static NTSTATUS allocate_virtual_memory( void **ret, SIZE_T *size_ptr, ULONG typ
 NTSTATUS WINAPI NtAllocateVirtualMemory( HANDLE process, PVOID *ret, ULONG_PTR zero_bits,
                                          SIZE_T *size_ptr, ULONG type, ULONG protect )
 {
-    static const ULONG type_mask = MEM_COMMIT | MEM_RESERVE | MEM_TOP_DOWN | MEM_WRITE_WATCH | MEM_RESET;
+    static const ULONG type_mask = MEM_COMMIT | MEM_RESERVE | MEM_TOP_DOWN | MEM_WRITE_WATCH | MEM_RESET
+                                   | MEM_LARGE_PAGES;
     ULONG_PTR limit;
 
     TRACE("%p %p %08lx %x %08x\n", process, *ret, *size_ptr, (int)type, (int)protect );
@@ -4722,7 +4935,8 @@ NTSTATUS WINAPI NtAllocateVirtualMemoryEx( HANDLE process, PVOID *ret, SIZE_T *s
                                            ULONG count )
 {
     static const ULONG type_mask = MEM_COMMIT | MEM_RESERVE | MEM_TOP_DOWN | MEM_WRITE_WATCH
-                                   | MEM_RESET | MEM_RESERVE_PLACEHOLDER | MEM_REPLACE_PLACEHOLDER;
+                                   | MEM_RESET | MEM_RESERVE_PLACEHOLDER | MEM_REPLACE_PLACEHOLDER
+                                   | MEM_LARGE_PAGES;
     ULONG_PTR limit_low = 0;
     ULONG_PTR limit_high = 0;
     ULONG_PTR align = 0;
@@ -4815,7 +5029,7 @@ NTSTATUS WINAPI NtFreeVirtualMemory( HANDLE process, PVOID *addr_ptr, SIZE_T *si
     if (size) size = ROUND_SIZE( addr, size );
     base = ROUND_ADDR( addr, page_mask );
 
-    server_enter_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_lock( &sigset );
 
     /* avoid freeing the DOS area when a broken app passes a NULL pointer */
     if (!base)
@@ -4860,7 +5074,7 @@ NTSTATUS WINAPI NtFreeVirtualMemory( HANDLE process, PVOID *addr_ptr, SIZE_T *si
         *addr_ptr = base;
         *size_ptr = size;
     }
-    server_leave_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_unlock( &sigset );
     return status;
 }
 
@@ -4914,7 +5128,7 @@ NTSTATUS WINAPI NtProtectVirtualMemory( HANDLE process, PVOID *addr_ptr, SIZE_T
     size = ROUND_SIZE( addr, size );
     base = ROUND_ADDR( addr, page_mask );
 
-    server_enter_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_lock( &sigset );
 
     if ((view = find_view( base, size )))
     {
@@ -4930,7 +5144,7 @@ NTSTATUS WINAPI NtProtectVirtualMemory( HANDLE process, PVOID *addr_ptr, SIZE_T
 
     if (!status) VIRTUAL_DEBUG_DUMP_VIEW( view );
 
-    server_leave_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_unlock( &sigset );
 
     if (status == STATUS_SUCCESS)
     {
@@ -4942,6 +5156,70 @@ NTSTATUS WINAPI NtProtectVirtualMemory( HANDLE process, PVOID *addr_ptr, SIZE_T
 }
 
 
+/* fill basic information about a memory block without holding virtual_mutex; helper for fill_basic_memory_info */
+static BOOL fill_basic_memory_info_lockless( char *base, MEMORY_BASIC_INFORMATION *info )
+{
+    char *alloc_end = working_set_limit;
+    struct wine_rb_entry *ptr;
+    struct file_view *view = NULL;
+    unsigned int depth, protect;
+    SIZE_T view_size;
+    void *view_base;
+    unsigned int seq;
+    BYTE vprot;
+
+    seq = views_read_begin();
+    if (seq & 1) return FALSE;
+
+    for (ptr = views_tree.root, depth = 0; ptr && depth < 2 * 8 * sizeof(void *); depth++)
+    {
+        view = WINE_RB_ENTRY_VALUE( ptr, struct file_view, entry );
+        if ((char *)view->base > base)
+        {
+            alloc_end = view->base;
+            ptr = ptr->left;
+        }
+        else if ((char *)view->base + view->size <= base) ptr = ptr->right;
+        else break;
+    }
+
+    info->BaseAddress = base;
+
+    if (!ptr)
+    {
+#ifdef __i386__
+        return FALSE;  /* free areas depend on the reserved areas */
+#else
+        info->RegionSize        = alloc_end - base;
+        info->State             = MEM_FREE;
+        info->Protect           = PAGE_NOACCESS;
+        info->AllocationBase    = 0;
+        info->AllocationProtect = 0;
+        info->Type              = 0;
+        return views_read_valid( seq );
+#endif
+    }
+
+    view_base = view->base;
+    view_size = view->size;
+    protect = view->protect;
+    if (protect & SEC_RESERVE) return FALSE;  /* committed state is kept by the server */
+
+    /* the page protections must only be read once the view range is known to be valid */
+    if (!views_read_valid( seq )) return FALSE;
+
+    info->RegionSize = get_vprot_range_size( base, (char *)view_base + view_size - base,
+                                             (BYTE)~VPROT_WRITEWATCH, &vprot );
+    info->AllocationBase = view_base;
+    info->State = (vprot & VPROT_COMMITTED) ? MEM_COMMIT : MEM_RESERVE;
+    info->Protect = (vprot & VPROT_COMMITTED) ? get_win32_prot( vprot, protect ) : 0;
+    info->AllocationProtect = get_win32_prot( protect, protect );
+    if (protect & SEC_IMAGE) info->Type = MEM_IMAGE;
+    else if (protect & (SEC_FILE | SEC_RESERVE | SEC_COMMIT)) info->Type = MEM_MAPPED;
+    else info->Type = MEM_PRIVATE;
+    return views_read_valid( seq );
+}
+
 static unsigned int fill_basic_memory_info( const void *addr, MEMORY_BASIC_INFORMATION *info )
 {
     char *base, *alloc_base = 0, *alloc_end = working_set_limit;
@@ -4953,9 +5231,11 @@ static unsigned int fill_basic_memory_info( const void *addr, MEMORY_BASIC_INFOR
 
     if (is_beyond_limit( base, 1, working_set_limit )) return STATUS_INVALID_PARAMETER;
 
+    if (fill_basic_memory_info_lockless( base, info )) return STATUS_SUCCESS;
+
     /* Find the view containing the address */
 
-    server_enter_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_lock( &sigset );
     ptr = views_tree.root;
     while (ptr)
     {
@@ -5049,7 +5329,7 @@ static unsigned int fill_basic_memory_info( const void *addr, MEMORY_BASIC_INFOR
         else if (view->protect & (SEC_FILE | SEC_RESERVE | SEC_COMMIT)) info->Type = MEM_MAPPED;
         else info->Type = MEM_PRIVATE;
     }
-    server_leave_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_unlock( &sigset );
 
     return STATUS_SUCCESS;
 }
@@ -5159,7 +5439,7 @@ static NTSTATUS get_working_set_ex( HANDLE process, LPCVOID addr,
         if (vmentries == NULL)
             WARN( "couldn't get process vmmap, errno %d\n", errno );
 
-        server_enter_uninterrupted_section( &virtual_mutex, &sigset );
+        virtual_lock( &sigset );
         for (p = info; (UINT_PTR)(p + 1) <= (UINT_PTR)info + len; p++)
         {
              int i;
@@ -5183,10 +5463,13 @@ static NTSTATUS get_working_set_ex( HANDLE process, LPCVOID addr,
                  if (p->VirtualAttributes.Shared && p->VirtualAttributes.Valid)
                      p->VirtualAttributes.ShareCount = 1; /* FIXME */
                  if (p->VirtualAttributes.Valid)
+                 {
                      p->VirtualAttributes.Win32Protection = get_win32_prot( vprot, view->protect );
+                     p->VirtualAttributes.LargePage = !!(view->protect & SEC_LARGE_PAGES);
+                 }
              }
         }
-        server_leave_uninterrupted_section( &virtual_mutex, &sigset );
+        virtual_unlock( &sigset );
 
         if (vmentries)
             procstat_freevmmap( pstat, vmentries );
@@ -5196,7 +5479,7 @@ static NTSTATUS get_working_set_ex( HANDLE process, LPCVOID addr,
             procstat_close( pstat );
     }
 #else
-    server_enter_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_lock( &sigset );
     if (pagemap_fd == -2)
     {
 #ifdef O_CLOEXEC
@@ -5232,10 +5515,13 @@ static NTSTATUS get_working_set_ex( HANDLE process, LPCVOID addr,
             if (p->VirtualAttributes.Shared && p->VirtualAttributes.Valid)
                 p->VirtualAttributes.ShareCount = 1; /* FIXME */
             if (p->VirtualAttributes.Valid)
+            {
                 p->VirtualAttributes.Win32Protection = get_win32_prot( vprot, view->protect );
+                p->VirtualAttributes.LargePage = !!(view->protect & SEC_LARGE_PAGES);
+            }
         }
     }
-    server_leave_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_unlock( &sigset );
 #endif
 
     if (res_len)
@@ -5613,7 +5899,7 @@ static NTSTATUS unmap_view_of_section( HANDLE process, PVOID addr, ULONG flags )
         return status;
     }
 
-    server_enter_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_lock( &sigset );
     if (!(view = find_view( addr, 0 )) || is_view_valloc( view )) goto done;
 
     if (flags & MEM_PRESERVE_PLACEHOLDER && !(view->protect & VPROT_PLACEHOLDER))
@@ -5632,7 +5918,7 @@ static NTSTATUS unmap_view_of_section( HANDLE process, PVOID addr, ULONG flags )
             {
                 TRACE( "not freeing in-use builtin %p\n", view->base );
                 builtin->refcount--;
-                server_leave_uninterrupted_section( &virtual_mutex, &sigset );
+                virtual_unlock( &sigset );
                 return STATUS_SUCCESS;
             }
         }
@@ -5652,7 +5938,7 @@ static NTSTATUS unmap_view_of_section( HANDLE process, PVOID addr, ULONG flags )
     }
     else FIXME( "failed to unmap %p %x\n", view->base, status );
 done:
-    server_leave_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_unlock( &sigset );
     return status;
 }
 
@@ -5804,7 +6090,7 @@ NTSTATUS WINAPI NtFlushVirtualMemory( HANDLE process, LPCVOID *addr_ptr,
         return result.virtual_flush.status;
     }
 
-    server_enter_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_lock( &sigset );
     if (!(view = find_view( addr, *size_ptr ))) status = STATUS_INVALID_PARAMETER;
     else
     {
@@ -5814,7 +6100,7 @@ NTSTATUS WINAPI NtFlushVirtualMemory( HANDLE process, LPCVOID *addr_ptr,
         if (msync( addr, *size_ptr, MS_ASYNC )) status = STATUS_NOT_MAPPED_DATA;
 #endif
     }
-    server_leave_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_unlock( &sigset );
     return status;
 }
 
@@ -5841,7 +6127,7 @@ NTSTATUS WINAPI NtGetWriteWatch( HANDLE process, ULONG flags, PVOID base, SIZE_T
     TRACE( "%p %x %p-%p %p %lu\n", process, (int)flags, base, (char *)base + size,
            addresses, *count );
 
-    server_enter_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_lock( &sigset );
 
     if (is_write_watch_range( base, size ))
     {
@@ -5860,7 +6146,7 @@ NTSTATUS WINAPI NtGetWriteWatch( HANDLE process, ULONG flags, PVOID base, SIZE_T
     }
     else status = STATUS_INVALID_PARAMETER;
 
-    server_leave_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_unlock( &sigset );
     return status;
 }
 
@@ -5881,14 +6167,14 @@ NTSTATUS WINAPI NtResetWriteWatch( HANDLE process, PVOID base, SIZE_T size )
 
     if (!size) return STATUS_INVALID_PARAMETER;
 
-    server_enter_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_lock( &sigset );
 
     if (is_write_watch_range( base, size ))
         reset_write_watches( base, size );
     else
         status = STATUS_INVALID_PARAMETER;
 
-    server_leave_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_unlock( &sigset );
     return status;
 }
 
@@ -5965,7 +6251,7 @@ NTSTATUS WINAPI NtAreMappedFilesTheSame(PVOID addr1, PVOID addr2)
 
     TRACE("%p %p\n", addr1, addr2);
 
-    server_enter_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_lock( &sigset );
 
     view1 = find_view( addr1, 0 );
     view2 = find_view( addr2, 0 );
@@ -5989,7 +6275,7 @@ NTSTATUS WINAPI NtAreMappedFilesTheSame(PVOID addr1, PVOID addr2)
         SERVER_END_REQ;
     }
 
-    server_leave_uninterrupted_section( &virtual_mutex, &sigset );
+    virtual_unlock( &sigset );
     return status;
 }
 
@@ -863,11 +863,33 @@ SHORT WINAPI NtUserGetAsyncKeyState( INT key )
     return ret;
 }
 
+/***********************************************************************
+ *           get_shared_queue_bits
+ *
+ * Read the queue bits published by the server, without a server call.
+ */
+static BOOL get_shared_queue_bits( UINT *wake_bits, UINT *changed_bits )
+{
+    const thread_shm_t *shm = wine_server_get_thread_shm();
+    unsigned int seq;
+
+    if (!shm) return FALSE;
+    do
+    {
+        while ((seq = __atomic_load_n( &shm->seq, __ATOMIC_ACQUIRE )) & 1) YieldProcessor();
+        *wake_bits = shm->wake_bits;
+        *changed_bits = shm->changed_bits;
+        __atomic_thread_fence( __ATOMIC_ACQUIRE );
+    } while (__atomic_load_n( &shm->seq, __ATOMIC_RELAXED ) != seq);
+    return TRUE;
+}
+
 /***********************************************************************
  *           NtUserGetQueueStatus (win32u.@)
  */
 DWORD WINAPI NtUserGetQueueStatus( UINT flags )
 {
+    UINT wake_bits, changed_bits;
     DWORD ret;
 
     if (flags & ~(QS_ALLINPUT | QS_ALLPOSTMESSAGE | QS_SMRESULT))
@@ -878,6 +900,10 @@ DWORD WINAPI NtUserGetQueueStatus( UINT flags )
 
     check_for_events( flags );
 
+    /* the server only needs to be involved if some changed bits have to be cleared */
+    if (get_shared_queue_bits( &wake_bits, &changed_bits ) && !(changed_bits & flags))
+        return MAKELONG( 0, wake_bits & flags );
+
     SERVER_START_REQ( get_queue_status )
     {
         req->clear_bits = flags;
@@ -893,10 +919,14 @@ DWORD WINAPI NtUserGetQueueStatus( UINT flags )
  */
 DWORD get_input_state(void)
 {
+    UINT wake_bits, changed_bits;
     DWORD ret;
 
     check_for_events( QS_INPUT );
 
+    if (get_shared_queue_bits( &wake_bits, &changed_bits ))
+        return wake_bits & (QS_KEY | QS_MOUSEBUTTON);
+
     SERVER_START_REQ( get_queue_status )
     {
         req->clear_bits = 0;
@@ -897,6 +897,93 @@ static BOOL WINAPI WS2_TransmitFile( SOCKET s, HANDLE file, DWORD file_len, DWOR
 }
 
 
+static BOOL WINAPI WS2_TransmitPackets( SOCKET s, TRANSMIT_PACKETS_ELEMENT *elements, DWORD count,
+                                        DWORD send_size, OVERLAPPED *overlapped, DWORD flags )
+{
+    struct afd_transmit_packets_params params = {0};
+    struct afd_transmit_packets_element *afd_elements;
+    IO_STATUS_BLOCK iosb, *piosb = &iosb;
+    HANDLE event = NULL;
+    void *cvalue = NULL;
+    NTSTATUS status;
+    DWORD i;
+
+    TRACE( "socket %#Ix, elements %p, count %lu, send_size %lu, overlapped %p, flags %#lx\n",
+           s, elements, count, send_size, overlapped, flags );
+
+    if (count && !elements)
+    {
+        SetLastError( WSAEINVAL );
+        return FALSE;
+    }
+
+    if (!(afd_elements = calloc( max( count, 1 ), sizeof(*afd_elements) )))
+    {
+        SetLastError( WSAENOBUFS );
+        return FALSE;
+    }
+
+    for (i = 0; i < count; ++i)
+    {
+        switch (elements[i].dwElFlags & (TP_ELEMENT_MEMORY | TP_ELEMENT_FILE))
+        {
+        case TP_ELEMENT_MEMORY:
+            afd_elements[i].buffer_ptr = u64_from_user_ptr(elements[i].pBuffer);
+            break;
+
+        case TP_ELEMENT_FILE:
+            afd_elements[i].file = HandleToULong( elements[i].hFile );
+            /* an offset of -1 means the current file position */
+            if (elements[i].nFileOffset.QuadPart == -1)
+                afd_elements[i].offset.QuadPart = FILE_USE_FILE_POINTER_POSITION;
+            else
+                afd_elements[i].offset = elements[i].nFileOffset;
+            break;
+
+        default:
+            free( afd_elements );
+            SetLastError( WSAEINVAL );
+            return FALSE;
+        }
+        afd_elements[i].length = elements[i].cLength;
+        afd_elements[i].flags = elements[i].dwElFlags;
+    }
+
+    if (overlapped)
+    {
+        piosb = (IO_STATUS_BLOCK *)overlapped;
+        if (!((ULONG_PTR)overlapped->hEvent & 1)) cvalue = overlapped;
+        event = overlapped->hEvent;
+        overlapped->Internal = STATUS_PENDING;
+        overlapped->InternalHigh = 0;
+    }
+    else if (!(event = get_sync_event()))
+    {
+        free( afd_elements );
+        return FALSE;
+    }
+
+    params.elements_ptr = u64_from_user_ptr(afd_elements);
+    params.count = count;
+    params.send_size = send_size;
+    params.flags = flags;
+
+    /* the element array is copied before the ioctl returns */
+    status = NtDeviceIoControlFile( (HANDLE)s, event, NULL, cvalue, piosb,
+                                    IOCTL_AFD_WINE_TRANSMIT_PACKETS, &params, sizeof(params), NULL, 0 );
+    free( afd_elements );
+    if (status == STATUS_PENDING && !overlapped)
+    {
+        if (WaitForSingleObject( event, INFINITE ) == WAIT_FAILED)
+            return FALSE;
+        status = piosb->Status;
+    }
+    SetLastError( NtStatusToWSAError( status ) );
+    TRACE( "status %#lx.\n", status );
+    return !status;
+}
+
+
 /***********************************************************************
  *     GetAcceptExSockaddrs
  */
@@ -1095,6 +1182,728 @@ static int WINAPI WS2_WSARecvMsg( SOCKET s, LPWSAMSG msg, LPDWORD lpNumberOfByte
 }
 
 
+/***********************************************************************
+ *     Registered I/O
+ *
+ * Buffers are registered once and referenced by id. Requests are issued as
+ * ordinary asynchronous socket ioctls with their own IO_STATUS_BLOCK, and
+ * the socket is not bound to any completion port, so the application's
+ * other overlapped I/O on it is unaffected. Completion queues collect the
+ * finished requests by polling their status blocks, which costs no server
+ * round trip. Requests also signal a private event of their queue, which is
+ * only waited on while RIONotify() is armed, and when the queue is closed.
+ */
+
+struct rio_buffer
+{
+    char *data;
+    DWORD len;
+};
+
+struct rio_cq
+{
+    CRITICAL_SECTION cs;
+    struct list pending;   /* issued requests, in submission order */
+    RIORESULT *results;
+    ULONG size;            /* capacity of the ring */
+    ULONG head;            /* index of the oldest result */
+    ULONG count;           /* number of queued results */
+    ULONG reserved;        /* outstanding request slots of attached request queues */
+    BOOL corrupt;          /* the ring overflowed */
+    BOOL notify_armed;
+    RIO_NOTIFICATION_COMPLETION notify;
+    HANDLE event;          /* signaled by the requests when they finish */
+    TP_WAIT *wait;
+};
+
+struct rio_rq
+{
+    struct list entry;
+    LONG refcount;
+    SOCKET socket;
+    void *context;
+    struct rio_cq *recv_cq;
+    struct rio_cq *send_cq;
+    ULONG max_recv, max_recv_buffers;
+    ULONG max_send, max_send_buffers;
+    LONG outstanding_recv;
+    LONG outstanding_send;
+};
+
+struct rio_request
+{
+    struct list entry;
+    IO_STATUS_BLOCK iosb;
+    struct rio_rq *rq;
+    void *context;
+    BOOL send;
+    BOOL notify;
+    unsigned int ws_flags;
+    int addr_len;
+    WSABUF control;
+    WSABUF buffers[1];
+};
+
+static struct list rio_queues = LIST_INIT( rio_queues );
+
+DECLARE_CRITICAL_SECTION(cs_rio_queues);
+
+static BOOL rio_get_buffer( const RIO_BUF *buf, WSABUF *wsabuf )
+{
+    const struct rio_buffer *buffer = (const struct rio_buffer *)buf->BufferId;
+
+    if (!buffer || buf->BufferId == RIO_INVALID_BUFFERID) return FALSE;
+    if (buf->Offset > buffer->len || buf->Length > buffer->len - buf->Offset) return FALSE;
+    wsabuf->buf = buffer->data + buf->Offset;
+    wsabuf->len = buf->Length;
+    return TRUE;
+}
+
+static BOOL rio_cq_reserve( struct rio_cq *cq, LONG count )
+{
+    BOOL ret;
+
+    EnterCriticalSection( &cq->cs );
+    if ((ret = (LONGLONG)cq->reserved + count <= cq->size)) cq->reserved += count;
+    LeaveCriticalSection( &cq->cs );
+    return ret;
+}
+
+static void rio_cq_signal( struct rio_cq *cq )
+{
+    if (cq->notify.Type == RIO_EVENT_COMPLETION)
+        SetEvent( cq->notify.Event.EventHandle );
+    else
+        PostQueuedCompletionStatus( cq->notify.Iocp.IocpHandle, 0, (ULONG_PTR)cq->notify.Iocp.CompletionKey,
+                                    cq->notify.Iocp.Overlapped );
+}
+
+static void rio_rq_release( struct rio_rq *rq )
+{
+    if (InterlockedDecrement( &rq->refcount )) return;
+
+    TRACE( "freeing request queue %p\n", rq );
+    rio_cq_reserve( rq->recv_cq, -(LONG)rq->max_recv );
+    rio_cq_reserve( rq->send_cq, -(LONG)rq->max_send );
+    free( rq );
+}
+
+/* Move the finished requests to the result ring, and disarm the notification if one of them
+ * asked for it. Called with the queue lock held; the requests are moved to the done list,
+ * to be freed with rio_free_requests() once the lock is released. Returns TRUE if the
+ * notification needs to be raised. */
+static BOOL rio_cq_collect( struct rio_cq *cq, struct list *done )
+{
+    struct rio_request *request, *next;
+    BOOL notify = FALSE;
+    RIORESULT *result;
+    NTSTATUS status;
+
+    LIST_FOR_EACH_ENTRY_SAFE( request, next, &cq->pending, struct rio_request, entry )
+    {
+        struct rio_rq *rq = request->rq;
+
+        if ((status = ReadAcquire( &request->iosb.Status )) == STATUS_PENDING) continue;
+
+        TRACE( "request %p, status %#lx, size %Iu\n", request, status, request->iosb.Information );
+
+        list_remove( &request->entry );
+        list_add_tail( done, &request->entry );
+        InterlockedDecrement( request->send ? &rq->outstanding_send : &rq->outstanding_recv );
+        notify |= request->notify;
+
+        if (cq->count == cq->size)
+        {
+            ERR( "completion queue %p overflowed\n", cq );
+            cq->corrupt = TRUE;
+            continue;
+        }
+        result = &cq->results[(cq->head + cq->count++) % cq->size];
+        result->Status = NtStatusToWSAError( status );
+        result->BytesTransferred = request->iosb.Information;
+        result->SocketContext = (ULONG_PTR)rq->context;
+        result->RequestContext = (ULONG_PTR)request->context;
+    }
+
+    if (!notify || !cq->notify_armed) return FALSE;
+    cq->notify_armed = FALSE;
+    return TRUE;
+}
+
+static void rio_free_requests( struct list *done )
+{
+    struct rio_request *request, *next;
+
+    LIST_FOR_EACH_ENTRY_SAFE( request, next, done, struct rio_request, entry )
+    {
+        struct rio_rq *rq = request->rq;
+
+        free( request );
+        rio_rq_release( rq );
+    }
+}
+
+/* collect the finished requests of a queue */
+static void rio_cq_poll( struct rio_cq *cq )
+{
+    struct list done = LIST_INIT( done );
+    BOOL signal;
+
+    EnterCriticalSection( &cq->cs );
+    signal = rio_cq_collect( cq, &done );
+    LeaveCriticalSection( &cq->cs );
+
+    if (signal) rio_cq_signal( cq );
+    rio_free_requests( &done );
+}
+
+static void WINAPI rio_wait_callback( TP_CALLBACK_INSTANCE *instance, void *context, TP_WAIT *wait,
+                                      TP_WAIT_RESULT result )
+{
+    struct rio_cq *cq = context;
+    struct list done = LIST_INIT( done );
+    BOOL signal;
+
+    EnterCriticalSection( &cq->cs );
+    signal = rio_cq_collect( cq, &done );
+    if (cq->notify_armed) SetThreadpoolWait( cq->wait, cq->event, NULL );
+    LeaveCriticalSection( &cq->cs );
+
+    if (signal) rio_cq_signal( cq );
+    rio_free_requests( &done );
+}
+
+static void rio_socket_closed( SOCKET s )
+{
+    struct rio_rq *rq, *found = NULL;
+
+    EnterCriticalSection( &cs_rio_queues );
+    LIST_FOR_EACH_ENTRY( rq, &rio_queues, struct rio_rq, entry )
+    {
+        if (rq->socket == s)
+        {
+            list_remove( &rq->entry );
+            found = rq;
+            break;
+        }
+    }
+    LeaveCriticalSection( &cs_rio_queues );
+
+    /* requests still in flight hold their own references */
+    if (found) rio_rq_release( found );
+}
+
+static BOOL rio_submit( struct rio_rq *rq, BOOL send, const RIO_BUF *data, ULONG count,
+                        const RIO_BUF *remote_addr, const RIO_BUF *control, DWORD flags, void *context )
+{
+    LONG *outstanding = send ? &rq->outstanding_send : &rq->outstanding_recv;
+    struct rio_cq *cq = send ? rq->send_cq : rq->recv_cq;
+    ULONG max = send ? rq->max_send : rq->max_recv;
+    ULONG max_buffers = send ? rq->max_send_buffers : rq->max_recv_buffers;
+    struct list done = LIST_INIT( done );
+    struct rio_request *request;
+    NTSTATUS status;
+    BOOL signal;
+    WSABUF addr;
+    ULONG i;
+
+    TRACE( "rq %p, send %d, data %p, count %lu, flags %#lx, context %p\n", rq, send, data, count, flags, context );
+
+    if (flags & ~(RIO_MSG_DONT_NOTIFY | RIO_MSG_DEFER | RIO_MSG_WAITALL | RIO_MSG_COMMIT_ONLY)
+            || (send && (flags & RIO_MSG_WAITALL)) || count > max_buffers || (count && !data))
+    {
+        SetLastError( WSAEINVAL );
+        return FALSE;
+    }
+
+    /* deferred requests are always committed immediately, so there is nothing left to commit */
+    if (flags & RIO_MSG_COMMIT_ONLY)
+    {
+        if (!data && !count) return TRUE;
+        SetLastError( WSAEINVAL );
+        return FALSE;
+    }
+
+    if (!(request = malloc( offsetof( struct rio_request, buffers[max( count, 1 )] ) )))
+    {
+        SetLastError( WSAENOBUFS );
+        return FALSE;
+    }
+
+    for (i = 0; i < count; ++i)
+    {
+        if (!rio_get_buffer( &data[i], &request->buffers[i] ))
+        {
+            free( request );
+            SetLastError( WSAEINVAL );
+            return FALSE;
+        }
+    }
+    request->control.buf = NULL;
+    request->control.len = 0;
+    if (control && !rio_get_buffer( control, &request->control ))
+    {
+        free( request );
+        SetLastError( WSAEINVAL );
+        return FALSE;
+    }
+    addr.buf = NULL;
+    addr.len = 0;
+    if (remote_addr && !rio_get_buffer( remote_addr, &addr ))
+    {
+        free( request );
+        SetLastError( WSAEINVAL );
+        return FALSE;
+    }
+    request->addr_len = addr.len;
+
+    /* slots of finished requests are only released once they have been collected */
+    if ((ULONG)InterlockedIncrement( outstanding ) > max)
+    {
+        InterlockedDecrement( outstanding );
+        rio_cq_poll( cq );
+        if ((ULONG)InterlockedIncrement( outstanding ) > max)
+        {
+            InterlockedDecrement( outstanding );
+            free( request );
+            SetLastError( WSAENOBUFS );
+            return FALSE;
+        }
+    }
+
+    request->iosb.Status = STATUS_PENDING;
+    request->rq = rq;
+    request->context = context;
+    request->send = send;
+    request->notify = !(flags & RIO_MSG_DONT_NOTIFY);
+    request->ws_flags = (flags & RIO_MSG_WAITALL) ? MSG_WAITALL : 0;
+
+    if (send)
+    {
+        struct afd_sendmsg_params params;
+
+        params.addr_ptr = u64_from_user_ptr( addr.buf );
+        params.addr_len = addr.len;
+        params.ws_flags = 0;
+        params.force_async = TRUE;
+        params.count = count;
+        params.buffers_ptr = u64_from_user_ptr( request->buffers );
+        status = NtDeviceIoControlFile( (HANDLE)rq->socket, cq->event, NULL, NULL, &request->iosb,
+                                        IOCTL_AFD_WINE_SENDMSG, &params, sizeof(params), NULL, 0 );
+    }
+    else
+    {
+        struct afd_recvmsg_params params;
+
+        params.control_ptr = u64_from_user_ptr( control ? &request->control : NULL );
+        params.addr_ptr = u64_from_user_ptr( addr.buf );
+        params.addr_len_ptr = u64_from_user_ptr( addr.buf ? &request->addr_len : NULL );
+        params.ws_flags_ptr = u64_from_user_ptr( &request->ws_flags );
+        params.force_async = TRUE;
+        params.count = count;
+        params.buffers_ptr = u64_from_user_ptr( request->buffers );
+        status = NtDeviceIoControlFile( (HANDLE)rq->socket, cq->event, NULL, NULL, &request->iosb,
+                                        IOCTL_AFD_WINE_RECVMSG, &params, sizeof(params), NULL, 0 );
+    }
+
+    if (NT_ERROR( status ))
+    {
+        InterlockedDecrement( outstanding );
+        free( request );
+        SetLastError( NtStatusToWSAError( status ) );
+        return FALSE;
+    }
+
+    InterlockedIncrement( &rq->refcount );
+    EnterCriticalSection( &cq->cs );
+    list_add_tail( &cq->pending, &request->entry );
+    /* issuing the request reset the event, which may have swallowed the signal of a request
+     * that completed in the meantime */
+    signal = cq->notify_armed && rio_cq_collect( cq, &done );
+    LeaveCriticalSection( &cq->cs );
+
+    if (signal) rio_cq_signal( cq );
+    rio_free_requests( &done );
+    return TRUE;
+}
+
+static BOOL WINAPI WS2_RIOReceive( RIO_RQ queue, RIO_BUF *data, ULONG count, DWORD flags, void *context )
+{
+    struct rio_rq *rq = (struct rio_rq *)queue;
+
+    if (!rq)
+    {
+        SetLastError( WSAEINVAL );
+        return FALSE;
+    }
+    return rio_submit( rq, FALSE, data, count, NULL, NULL, flags, context );
+}
+
+static int WINAPI WS2_RIOReceiveEx( RIO_RQ queue, RIO_BUF *data, ULONG count, RIO_BUF *local_addr,
+                                    RIO_BUF *remote_addr, RIO_BUF *control, RIO_BUF *flags_buf,
+                                    DWORD flags, void *context )
+{
+    struct rio_rq *rq = (struct rio_rq *)queue;
+
+    if (!rq)
+    {
+        SetLastError( WSAEINVAL );
+        return FALSE;
+    }
+    if (local_addr) FIXME( "local address is not supported\n" );
+    if (flags_buf) FIXME( "flags buffer is not supported\n" );
+    return rio_submit( rq, FALSE, data, count, remote_addr, control, flags, context );
+}
+
+static BOOL WINAPI WS2_RIOSend( RIO_RQ queue, RIO_BUF *data, ULONG count, DWORD flags, void *context )
+{
+    struct rio_rq *rq = (struct rio_rq *)queue;
+
+    if (!rq)
+    {
+        SetLastError( WSAEINVAL );
+        return FALSE;
+    }
+    return rio_submit( rq, TRUE, data, count, NULL, NULL, flags, context );
+}
+
+static BOOL WINAPI WS2_RIOSendEx( RIO_RQ queue, RIO_BUF *data, ULONG count, RIO_BUF *local_addr,
+                                  RIO_BUF *remote_addr, RIO_BUF *control, RIO_BUF *flags_buf,
+                                  DWORD flags, void *context )
+{
+    struct rio_rq *rq = (struct rio_rq *)queue;
+
+    if (!rq)
+    {
+        SetLastError( WSAEINVAL );
+        return FALSE;
+    }
+    if (local_addr) FIXME( "local address is not supported\n" );
+    if (control) FIXME( "control data is not supported\n" );
+    if (flags_buf) FIXME( "flags buffer is not supported\n" );
+    return rio_submit( rq, TRUE, data, count, remote_addr, NULL, flags, context );
+}
+
+static RIO_BUFFERID WINAPI WS2_RIORegisterBuffer( char *data, DWORD len )
+{
+    struct rio_buffer *buffer;
+
+    TRACE( "data %p, len %lu\n", data, len );
+
+    if (!data)
+    {
+        SetLastError( WSAEFAULT );
+        return RIO_INVALID_BUFFERID;
+    }
+    if (!(buffer = malloc( sizeof(*buffer) )))
+    {
+        SetLastError( WSAENOBUFS );
+        return RIO_INVALID_BUFFERID;
+    }
+    buffer->data = data;
+    buffer->len = len;
+    return (RIO_BUFFERID)buffer;
+}
+
+static void WINAPI WS2_RIODeregisterBuffer( RIO_BUFFERID id )
+{
+    TRACE( "id %p\n", id );
+
+    if (id && id != RIO_INVALID_BUFFERID) free( id );
+}
+
+static RIO_CQ WINAPI WS2_RIOCreateCompletionQueue( DWORD size, RIO_NOTIFICATION_COMPLETION *notify )
+{
+    struct rio_cq *cq;
+
+    TRACE( "size %lu, notify %p\n", size, notify );
+
+    if (!size || size > RIO_MAX_CQ_SIZE
+            || (notify && !(notify->Type == RIO_EVENT_COMPLETION && notify->Event.EventHandle)
+                       && !(notify->Type == RIO_IOCP_COMPLETION && notify->Iocp.IocpHandle)))
+    {
+        SetLastError( WSAEINVAL );
+        return RIO_INVALID_CQ;
+    }
+
+    if (!(cq = calloc( 1, sizeof(*cq) )) || !(cq->results = malloc( size * sizeof(*cq->results) )))
+    {
+        free( cq );
+        SetLastError( WSAENOBUFS );
+        return RIO_INVALID_CQ;
+    }
+    if (notify) cq->notify = *notify;
+    if (!(cq->event = CreateEventW( NULL, FALSE, FALSE, NULL )) ||
+        (notify && !(cq->wait = CreateThreadpoolWait( rio_wait_callback, cq, NULL ))))
+    {
+        if (cq->event) CloseHandle( cq->event );
+        free( cq->results );
+        free( cq );
+        SetLastError( WSAENOBUFS );
+        return RIO_INVALID_CQ;
+    }
+    InitializeCriticalSection( &cq->cs );
+    cq->cs.DebugInfo->Spare[0] = (DWORD_PTR)(__FILE__ ": rio_cq.cs");
+    list_init( &cq->pending );
+    cq->size = size;
+    return (RIO_CQ)cq;
+}
+
+static void WINAPI WS2_RIOCloseCompletionQueue( RIO_CQ queue )
+{
+    struct rio_cq *cq = (struct rio_cq *)queue;
+    struct list done = LIST_INIT( done );
+    struct rio_request *request;
+    IO_STATUS_BLOCK io;
+
+    TRACE( "cq %p\n", cq );
+
+    if (!cq) return;
+    if (cq->wait)
+    {
+        SetThreadpoolWait( cq->wait, NULL, NULL );
+        WaitForThreadpoolWaitCallbacks( cq->wait, TRUE );
+        CloseThreadpoolWait( cq->wait );
+    }
+
+    /* requests still in flight write to their status block and signal the event,
+     * so cancel them and wait until they are all finished */
+    EnterCriticalSection( &cq->cs );
+    if (!list_empty( &cq->pending )) WARN( "closing queue %p with pending requests\n", cq );
+    LIST_FOR_EACH_ENTRY( request, &cq->pending, struct rio_request, entry )
+        NtCancelIoFileEx( (HANDLE)request->rq->socket, &request->iosb, &io );
+    for (;;)
+    {
+        cq->count = 0;  /* the results are discarded */
+        rio_cq_collect( cq, &done );
+        if (list_empty( &cq->pending )) break;
+        LeaveCriticalSection( &cq->cs );
+        WaitForSingleObject( cq->event, INFINITE );
+        EnterCriticalSection( &cq->cs );
+    }
+    LeaveCriticalSection( &cq->cs );
+    rio_free_requests( &done );
+    CloseHandle( cq->event );
+
+    cq->cs.DebugInfo->Spare[0] = 0;
+    DeleteCriticalSection( &cq->cs );
+    free( cq->results );
+    free( cq );
+}
+
+static BOOL WINAPI WS2_RIOResizeCompletionQueue( RIO_CQ queue, DWORD size )
+{
+    struct rio_cq *cq = (struct rio_cq *)queue;
+    RIORESULT *results;
+    ULONG i;
+
+    TRACE( "cq %p, size %lu\n", cq, size );
+
+    if (!cq || !size || size > RIO_MAX_CQ_SIZE)
+    {
+        SetLastError( WSAEINVAL );
+        return FALSE;
+    }
+
+    EnterCriticalSection( &cq->cs );
+    if (size < cq->count || size < cq->reserved)
+    {
+        LeaveCriticalSection( &cq->cs );
+        SetLastError( WSAEINVAL );
+        return FALSE;
+    }
+    if (!(results = malloc( size * sizeof(*results) )))
+    {
+        LeaveCriticalSection( &cq->cs );
+        SetLastError( WSAENOBUFS );
+        return FALSE;
+    }
+    for (i = 0; i < cq->count; ++i)
+        results[i] = cq->results[(cq->head + i) % cq->size];
+    free( cq->results );
+    cq->results = results;
+    cq->size = size;
+    cq->head = 0;
+    LeaveCriticalSection( &cq->cs );
+    return TRUE;
+}
+
+static ULONG WINAPI WS2_RIODequeueCompletion( RIO_CQ queue, RIORESULT *results, ULONG count )
+{
+    struct rio_cq *cq = (struct rio_cq *)queue;
+    struct list done = LIST_INIT( done );
+    BOOL signal;
+    ULONG i, ret;
+
+    TRACE( "cq %p, results %p, count %lu\n", cq, results, count );
+
+    if (!cq) return RIO_CORRUPT_CQ;
+
+    EnterCriticalSection( &cq->cs );
+    signal = rio_cq_collect( cq, &done );
+    if (cq->corrupt)
+    {
+        LeaveCriticalSection( &cq->cs );
+        rio_free_requests( &done );
+        return RIO_CORRUPT_CQ;
+    }
+    ret = min( count, cq->count );
+    for (i = 0; i < ret; ++i)
+        results[i] = cq->results[(cq->head + i) % cq->size];
+    cq->head = (cq->head + ret) % cq->size;
+    cq->count -= ret;
+    LeaveCriticalSection( &cq->cs );
+
+    if (signal) rio_cq_signal( cq );
+    rio_free_requests( &done );
+    return ret;
+}
+
+static int WINAPI WS2_RIONotify( RIO_CQ queue )
+{
+    struct rio_cq *cq = (struct rio_cq *)queue;
+    struct list done = LIST_INIT( done );
+    BOOL signal = FALSE;
+
+    TRACE( "cq %p\n", cq );
+
+    if (!cq || !cq->notify.Type) return WSAEINVAL;
+
+    if (cq->notify.Type == RIO_EVENT_COMPLETION && cq->notify.Event.NotifyReset)
+        ResetEvent( cq->notify.Event.EventHandle );
+
+    EnterCriticalSection( &cq->cs );
+    if (cq->notify_armed)
+    {
+        LeaveCriticalSection( &cq->cs );
+        return WSAEALREADY;
+    }
+    rio_cq_collect( cq, &done );
+    if (cq->count) signal = TRUE;
+    else
+    {
+        cq->notify_armed = TRUE;
+        SetThreadpoolWait( cq->wait, cq->event, NULL );
+    }
+    LeaveCriticalSection( &cq->cs );
+
+    if (signal) rio_cq_signal( cq );
+    rio_free_requests( &done );
+    return ERROR_SUCCESS;
+}
+
+static RIO_RQ WINAPI WS2_RIOCreateRequestQueue( SOCKET s, ULONG max_recv, ULONG max_recv_buffers,
+                                                ULONG max_send, ULONG max_send_buffers,
+                                                RIO_CQ recv_queue, RIO_CQ send_queue, void *context )
+{
+    struct rio_cq *recv_cq = (struct rio_cq *)recv_queue, *send_cq = (struct rio_cq *)send_queue;
+    struct rio_rq *rq;
+
+    TRACE( "socket %#Ix, max_recv %lu, max_recv_buffers %lu, max_send %lu, max_send_buffers %lu, "
+           "recv_cq %p, send_cq %p, context %p\n", s, max_recv, max_recv_buffers, max_send,
+           max_send_buffers, recv_cq, send_cq, context );
+
+    if (!socket_list_find( s ))
+    {
+        SetLastError( WSAENOTSOCK );
+        return RIO_INVALID_RQ;
+    }
+
+    if (!recv_cq || !send_cq || !max_recv_buffers || !max_send_buffers
+            || max_recv > RIO_MAX_CQ_SIZE || max_send > RIO_MAX_CQ_SIZE)
+    {
+        SetLastError( WSAEINVAL );
+        return RIO_INVALID_RQ;
+    }
+
+    if (!rio_cq_reserve( recv_cq, max_recv ))
+    {
+        SetLastError( WSAENOBUFS );
+        return RIO_INVALID_RQ;
+    }
+    if (!rio_cq_reserve( send_cq, max_send ))
+    {
+        rio_cq_reserve( recv_cq, -(LONG)max_recv );
+        SetLastError( WSAENOBUFS );
+        return RIO_INVALID_RQ;
+    }
+
+    if (!(rq = calloc( 1, sizeof(*rq) )))
+    {
+        rio_cq_reserve( recv_cq, -(LONG)max_recv );
+        rio_cq_reserve( send_cq, -(LONG)max_send );
+        SetLastError( WSAENOBUFS );
+        return RIO_INVALID_RQ;
+    }
+
+    rq->refcount = 1;
+    rq->socket = s;
+    rq->context = context;
+    rq->recv_cq = recv_cq;
+    rq->send_cq = send_cq;
+    rq->max_recv = max_recv;
+    rq->max_recv_buffers = max_recv_buffers;
+    rq->max_send = max_send;
+    rq->max_send_buffers = max_send_buffers;
+
+    EnterCriticalSection( &cs_rio_queues );
+    list_add_tail( &rio_queues, &rq->entry );
+    LeaveCriticalSection( &cs_rio_queues );
+
+    return (RIO_RQ)rq;
+}
+
+static BOOL WINAPI WS2_RIOResizeRequestQueue( RIO_RQ queue, DWORD max_recv, DWORD max_send )
+{
+    struct rio_rq *rq = (struct rio_rq *)queue;
+    LONG recv_delta, send_delta;
+
+    TRACE( "rq %p, max_recv %lu, max_send %lu\n", rq, max_recv, max_send );
+
+    if (!rq || max_recv > RIO_MAX_CQ_SIZE || max_send > RIO_MAX_CQ_SIZE
+            || max_recv < (ULONG)rq->outstanding_recv || max_send < (ULONG)rq->outstanding_send)
+    {
+        SetLastError( WSAEINVAL );
+        return FALSE;
+    }
+
+    recv_delta = (LONG)max_recv - (LONG)rq->max_recv;
+    send_delta = (LONG)max_send - (LONG)rq->max_send;
+    if (!rio_cq_reserve( rq->recv_cq, recv_delta ))
+    {
+        SetLastError( WSAENOBUFS );
+        return FALSE;
+    }
+    if (!rio_cq_reserve( rq->send_cq, send_delta ))
+    {
+        rio_cq_reserve( rq->recv_cq, -recv_delta );
+        SetLastError( WSAENOBUFS );
+        return FALSE;
+    }
+    rq->max_recv = max_recv;
+    rq->max_send = max_send;
+    return TRUE;
+}
+
+static const RIO_EXTENSION_FUNCTION_TABLE rio_functions =
+{
+    sizeof(RIO_EXTENSION_FUNCTION_TABLE),
+    WS2_RIOReceive,
+    WS2_RIOReceiveEx,
+    WS2_RIOSend,
+    WS2_RIOSendEx,
+    WS2_RIOCloseCompletionQueue,
+    WS2_RIOCreateCompletionQueue,
+    WS2_RIOCreateRequestQueue,
+    WS2_RIODequeueCompletion,
+    WS2_RIODeregisterBuffer,
+    WS2_RIONotify,
+    WS2_RIORegisterBuffer,
+    WS2_RIOResizeCompletionQueue,
+    WS2_RIOResizeRequestQueue,
+};
+
+
 /***********************************************************************
  *      bind   (ws2_32.2)
  */
@@ -1207,6 +2016,7 @@ int WINAPI closesocket( SOCKET s )
         return -1;
     }
 
+    rio_socket_closed( s );
     CloseHandle( (HANDLE)s );
     return 0;
 }
@@ -2140,6 +2950,7 @@ static const char *debugstr_wsaioctl(DWORD code)
         IOCTL_NAME(SIO_GET_BROADCAST_ADDRESS);
         IOCTL_NAME(SIO_GET_EXTENSION_FUNCTION_POINTER);
         IOCTL_NAME(SIO_GET_GROUP_QOS);
+        IOCTL_NAME(SIO_GET_MULTIPLE_EXTENSION_FUNCTION_POINTER);
         IOCTL_NAME(SIO_GET_INTERFACE_LIST);
         /* IOCTL_NAME(SIO_GET_INTERFACE_LIST_EX); */
         IOCTL_NAME(SIO_GET_QOS);
@@ -2484,7 +3295,7 @@ INT WINAPI WSAIoctl(SOCKET s, DWORD code, LPVOID in_buff, DWORD in_size, LPVOID
             EXTENSION_FUNCTION(WSAID_ACCEPTEX, WS2_AcceptEx)
             EXTENSION_FUNCTION(WSAID_GETACCEPTEXSOCKADDRS, WS2_GetAcceptExSockaddrs)
             EXTENSION_FUNCTION(WSAID_TRANSMITFILE, WS2_TransmitFile)
-            /* EXTENSION_FUNCTION(WSAID_TRANSMITPACKETS, WS2_TransmitPackets) */
+            EXTENSION_FUNCTION(WSAID_TRANSMITPACKETS, WS2_TransmitPackets)
             EXTENSION_FUNCTION(WSAID_WSARECVMSG, WS2_WSARecvMsg)
             EXTENSION_FUNCTION(WSAID_WSASENDMSG, WSASendMsg)
         };
@@ -2514,6 +3325,35 @@ INT WINAPI WSAIoctl(SOCKET s, DWORD code, LPVOID in_buff, DWORD in_size, LPVOID
         return -1;
     }
 
+    case SIO_GET_MULTIPLE_EXTENSION_FUNCTION_POINTER:
+    {
+        static const GUID rio_guid = WSAID_MULTIPLE_RIO;
+        NTSTATUS status = STATUS_SUCCESS;
+        DWORD ret;
+
+        if (in_size < sizeof(GUID) || !IsEqualGUID( in_buff, &rio_guid ))
+        {
+            FIXME( "SIO_GET_MULTIPLE_EXTENSION_FUNCTION_POINTER %s: stub\n",
+                   in_size >= sizeof(GUID) ? debugstr_guid(in_buff) : "(null)" );
+            SetLastError( WSAEINVAL );
+            return -1;
+        }
+        if (out_size < sizeof(rio_functions))
+        {
+            SetLastError( WSAEFAULT );
+            return -1;
+        }
+
+        TRACE( "returning RIO function table\n" );
+        memcpy( out_buff, &rio_functions, sizeof(rio_functions) );
+
+        ret = server_ioctl_sock( s, IOCTL_AFD_WINE_COMPLETE_ASYNC, &status, sizeof(status),
+                                 NULL, 0, ret_size, overlapped, completion );
+        *ret_size = sizeof(rio_functions);
+        SetLastError( ret );
+        return ret ? -1 : 0;
+    }
+
     case SIO_KEEPALIVE_VALS:
     {
         DWORD ret;
@@ -3905,7 +4745,7 @@ SOCKET WINAPI WSASocketW(int af, int type, int protocol,
 
     InitializeObjectAttributes(&attr, &string, (flags & WSA_FLAG_NO_HANDLE_INHERIT) ? 0 : OBJ_INHERIT, NULL, NULL);
     if ((status = NtOpenFile(&handle, GENERIC_READ | GENERIC_WRITE | SYNCHRONIZE, &attr,
-            &io, 0, (flags & WSA_FLAG_OVERLAPPED) ? 0 : FILE_SYNCHRONOUS_IO_NONALERT)))
+            &io, 0, (flags & (WSA_FLAG_OVERLAPPED | WSA_FLAG_REGISTERED_IO)) ? 0 : FILE_SYNCHRONOUS_IO_NONALERT)))
     {
         WARN( "failed to create socket, status %#lx\n", status );
         WSASetLastError(NtStatusToWSAError(status));
@@ -9981,6 +9981,244 @@ static void test_TransmitFile(void)
     closesocket(server);
 }
 
+static void test_TransmitPackets(void)
+{
+    GUID transmit_packets_guid = WSAID_TRANSMITPACKETS;
+    LPFN_TRANSMITPACKETS pTransmitPackets = NULL;
+    char header_msg[] = "hello world", footer_msg[] = "goodbye!!!";
+    char path[MAX_PATH], data[1000], expect[2048], buf[2048];
+    TRANSMIT_PACKETS_ELEMENT elements[4];
+    DWORD size, total_sent;
+    SOCKET client, dest;
+    OVERLAPPED ov = {0};
+    unsigned int i;
+    HANDLE file;
+    int ret, len;
+    BOOL bret;
+
+    tcp_socketpair(&client, &dest);
+
+    ret = WSAIoctl(client, SIO_GET_EXTENSION_FUNCTION_POINTER, &transmit_packets_guid, sizeof(transmit_packets_guid),
+                   &pTransmitPackets, sizeof(pTransmitPackets), &size, NULL, NULL);
+    ok(!ret, "failed to get TransmitPackets, error %u\n", WSAGetLastError());
+    if (ret)
+    {
+        closesocket(client);
+        closesocket(dest);
+        return;
+    }
+
+    for (i = 0; i < sizeof(data); ++i) data[i] = i * 7;
+    GetTempPathA(MAX_PATH, path);
+    GetTempFileNameA(path, "wst", 0, path);
+    file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_FLAG_DELETE_ON_CLOSE, NULL);
+    ok(file != INVALID_HANDLE_VALUE, "failed to create file, error %lu\n", GetLastError());
+    bret = WriteFile(file, data, sizeof(data), &size, NULL);
+    ok(bret && size == sizeof(data), "failed to write file, error %lu\n", GetLastError());
+
+    memset(elements, 0, sizeof(elements));
+    elements[0].dwElFlags = TP_ELEMENT_MEMORY;
+    elements[0].cLength = sizeof(header_msg);
+    elements[0].pBuffer = header_msg;
+    elements[1].dwElFlags = TP_ELEMENT_FILE;
+    elements[1].cLength = 200;
+    elements[1].nFileOffset.QuadPart = 100;
+    elements[1].hFile = file;
+    elements[2].dwElFlags = TP_ELEMENT_FILE;
+    elements[2].cLength = 0;
+    elements[2].nFileOffset.QuadPart = -1;
+    elements[2].hFile = file;
+    elements[3].dwElFlags = TP_ELEMENT_MEMORY | TP_ELEMENT_EOP;
+    elements[3].cLength = sizeof(footer_msg);
+    elements[3].pBuffer = footer_msg;
+
+    len = 0;
+    memcpy(expect + len, header_msg, sizeof(header_msg));
+    len += sizeof(header_msg);
+    memcpy(expect + len, data + 100, 200);
+    len += 200;
+    memcpy(expect + len, data + 900, 100);
+    len += 100;
+    memcpy(expect + len, footer_msg, sizeof(footer_msg));
+    len += sizeof(footer_msg);
+
+    /* the second file element starts at the current file position */
+    SetFilePointer(file, 900, NULL, FILE_BEGIN);
+    bret = pTransmitPackets(client, elements, ARRAY_SIZE(elements), 0, NULL, 0);
+    ok(bret, "TransmitPackets failed, error %u\n", WSAGetLastError());
+    for (size = 0; size < len; size += ret)
+    {
+        ret = recv(dest, buf + size, len - size, 0);
+        ok(ret > 0, "recv returned %d, error %u\n", ret, WSAGetLastError());
+        if (ret <= 0) break;
+    }
+    ok(size == len, "got %lu bytes\n", size);
+    ok(!memcmp(buf, expect, len), "data didn't match\n");
+
+    ov.hEvent = CreateEventW(NULL, FALSE, FALSE, NULL);
+    SetFilePointer(file, 900, NULL, FILE_BEGIN);
+    bret = pTransmitPackets(client, elements, ARRAY_SIZE(elements), 16, &ov, 0);
+    ok(!bret, "TransmitPackets succeeded unexpectedly.\n");
+    ok(WSAGetLastError() == ERROR_IO_PENDING, "got error %u\n", WSAGetLastError());
+    ret = WaitForSingleObject(ov.hEvent, 2000);
+    ok(!ret, "wait timed out\n");
+    bret = WSAGetOverlappedResult(client, &ov, &total_sent, FALSE, &size);
+    ok(bret, "got error %u\n", WSAGetLastError());
+    ok(total_sent == len, "sent %lu bytes\n", total_sent);
+    for (size = 0; size < len; size += ret)
+    {
+        ret = recv(dest, buf + size, len - size, 0);
+        ok(ret > 0, "recv returned %d, error %u\n", ret, WSAGetLastError());
+        if (ret <= 0) break;
+    }
+    ok(size == len, "got %lu bytes\n", size);
+    ok(!memcmp(buf, expect, len), "data didn't match\n");
+
+    elements[0].dwElFlags = TP_ELEMENT_MEMORY | TP_ELEMENT_FILE;
+    bret = pTransmitPackets(client, elements, 1, 0, NULL, 0);
+    ok(!bret, "TransmitPackets succeeded unexpectedly.\n");
+    ok(WSAGetLastError() == WSAEINVAL, "got error %u\n", WSAGetLastError());
+
+    CloseHandle(ov.hEvent);
+    CloseHandle(file);
+    closesocket(client);
+    closesocket(dest);
+}
+
+static void test_rio(void)
+{
+    GUID rio_guid = WSAID_MULTIPLE_RIO;
+    const struct sockaddr_in bind_addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    RIO_EXTENSION_FUNCTION_TABLE rio = {0};
+    RIO_NOTIFICATION_COMPLETION notify;
+    struct sockaddr_in addr;
+    RIORESULT results[4];
+    RIO_BUFFERID buffer_id;
+    SOCKET server, client;
+    char data[64], buf[16];
+    OVERLAPPED *overlapped;
+    RIO_BUF rio_buf;
+    ULONG_PTR key;
+    HANDLE event, port;
+    ULONG count;
+    RIO_CQ cq;
+    RIO_RQ rq;
+    DWORD size;
+    int ret, len;
+
+    server = WSASocketA(AF_INET, SOCK_DGRAM, IPPROTO_UDP, NULL, 0, WSA_FLAG_REGISTERED_IO);
+    ok(server != INVALID_SOCKET, "failed to create socket, error %u\n", WSAGetLastError());
+
+    ret = WSAIoctl(server, SIO_GET_MULTIPLE_EXTENSION_FUNCTION_POINTER, &rio_guid, sizeof(rio_guid),
+                   &rio, sizeof(rio), &size, NULL, NULL);
+    if (ret)
+    {
+        win_skip("RIO is not supported\n");
+        closesocket(server);
+        return;
+    }
+    ok(size == sizeof(rio), "got size %lu\n", size);
+    ok(rio.cbSize == sizeof(rio), "got cbSize %lu\n", rio.cbSize);
+
+    ret = bind(server, (const struct sockaddr *)&bind_addr, sizeof(bind_addr));
+    ok(!ret, "failed to bind, error %u\n", WSAGetLastError());
+    len = sizeof(addr);
+    ret = getsockname(server, (struct sockaddr *)&addr, &len);
+    ok(!ret, "failed to get address, error %u\n", WSAGetLastError());
+
+    client = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    ok(client != INVALID_SOCKET, "failed to create socket, error %u\n", WSAGetLastError());
+    ret = connect(client, (const struct sockaddr *)&addr, sizeof(addr));
+    ok(!ret, "failed to connect, error %u\n", WSAGetLastError());
+
+    event = CreateEventW(NULL, FALSE, FALSE, NULL);
+    notify.Type = RIO_EVENT_COMPLETION;
+    notify.Event.EventHandle = event;
+    notify.Event.NotifyReset = FALSE;
+    cq = rio.RIOCreateCompletionQueue(4, &notify);
+    ok(cq != RIO_INVALID_CQ, "failed to create completion queue, error %u\n", WSAGetLastError());
+
+    buffer_id = rio.RIORegisterBuffer(data, sizeof(data));
+    ok(buffer_id != RIO_INVALID_BUFFERID, "failed to register buffer, error %u\n", WSAGetLastError());
+
+    /* the socket may be associated with a completion port of its own */
+    port = CreateIoCompletionPort((HANDLE)server, NULL, 0x1234, 0);
+    ok(!!port, "failed to create port, error %lu\n", GetLastError());
+
+    rq = rio.RIOCreateRequestQueue(server, 1, 1, 1, 1, cq, cq, (void *)0xdeadbeef);
+    ok(rq != RIO_INVALID_RQ, "failed to create request queue, error %u\n", WSAGetLastError());
+
+    rio_buf.BufferId = buffer_id;
+    rio_buf.Offset = 16;
+    rio_buf.Length = sizeof(data);
+    WSASetLastError(0xdeadbeef);
+    ret = rio.RIOReceive(rq, &rio_buf, 1, 0, (void *)1);
+    ok(!ret, "expected failure\n");
+    ok(WSAGetLastError() == WSAEINVAL, "got error %u\n", WSAGetLastError());
+
+    rio_buf.Length = 32;
+    ret = rio.RIOReceive(rq, &rio_buf, 1, 0, (void *)1);
+    ok(ret, "failed to receive, error %u\n", WSAGetLastError());
+
+    count = rio.RIODequeueCompletion(cq, results, ARRAY_SIZE(results));
+    ok(!count, "got %lu results\n", count);
+
+    ret = rio.RIONotify(cq);
+    ok(!ret, "got %d\n", ret);
+    ret = rio.RIONotify(cq);
+    ok(ret == WSAEALREADY, "got %d\n", ret);
+
+    ret = send(client, "hello", 5, 0);
+    ok(ret == 5, "got %d\n", ret);
+
+    ret = WaitForSingleObject(event, 1000);
+    ok(!ret, "got %d\n", ret);
+    count = rio.RIODequeueCompletion(cq, results, ARRAY_SIZE(results));
+    ok(count == 1, "got %lu results\n", count);
+    ok(!results[0].Status, "got status %ld\n", results[0].Status);
+    ok(results[0].BytesTransferred == 5, "got size %lu\n", results[0].BytesTransferred);
+    ok(results[0].SocketContext == 0xdeadbeef, "got socket context %#I64x\n", results[0].SocketContext);
+    ok(results[0].RequestContext == 1, "got request context %#I64x\n", results[0].RequestContext);
+    ok(!memcmp(data + 16, "hello", 5), "got %s\n", debugstr_an(data + 16, 5));
+
+    len = sizeof(addr);
+    ret = getsockname(client, (struct sockaddr *)&addr, &len);
+    ok(!ret, "failed to get address, error %u\n", WSAGetLastError());
+    ret = connect(server, (const struct sockaddr *)&addr, sizeof(addr));
+    ok(!ret, "failed to connect, error %u\n", WSAGetLastError());
+
+    memcpy(data, "world", 5);
+    rio_buf.Offset = 0;
+    rio_buf.Length = 5;
+    ret = rio.RIOSend(rq, &rio_buf, 1, 0, (void *)2);
+    ok(ret, "failed to send, error %u\n", WSAGetLastError());
+
+    ret = rio.RIONotify(cq);
+    ok(!ret, "got %d\n", ret);
+    ret = WaitForSingleObject(event, 1000);
+    ok(!ret, "got %d\n", ret);
+    count = rio.RIODequeueCompletion(cq, results, ARRAY_SIZE(results));
+    ok(count == 1, "got %lu results\n", count);
+    ok(!results[0].Status, "got status %ld\n", results[0].Status);
+    ok(results[0].BytesTransferred == 5, "got size %lu\n", results[0].BytesTransferred);
+    ok(results[0].RequestContext == 2, "got request context %#I64x\n", results[0].RequestContext);
+
+    ret = recv(client, buf, sizeof(buf), 0);
+    ok(ret == 5, "got %d\n", ret);
+    ok(!memcmp(buf, "world", 5), "got %s\n", debugstr_an(buf, ret));
+
+    ret = GetQueuedCompletionStatus(port, &size, &key, &overlapped, 0);
+    ok(!ret, "expected failure\n");
+    ok(GetLastError() == WAIT_TIMEOUT, "got error %lu\n", GetLastError());
+
+    closesocket(client);
+    closesocket(server);
+    rio.RIODeregisterBuffer(buffer_id);
+    rio.RIOCloseCompletionQueue(cq);
+    CloseHandle(event);
+    CloseHandle(port);
+}
+
 static void test_getpeername(void)
 {
     SOCKET sock;
@@ -13194,6 +13432,88 @@ static void test_simultaneous_async_recv(void)
     for (i = 0; i < num_io; i++) CloseHandle(events[i]);
 }
 
+static void test_simultaneous_async_recv_udp(void)
+{
+    const struct sockaddr_in bind_addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    static const char msgstr[32] = "-- Lorem ipsum dolor sit amet -";
+    struct sockaddr_in addr, client_addr, from[4];
+    OVERLAPPED overlappeds[4] = {{0}};
+    DWORD flags[4] = {0}, size;
+    SOCKET client, server;
+    char buffers[4][16];
+    WSABUF wsabufs[4];
+    HANDLE events[4];
+    int from_len[4];
+    unsigned int i;
+    int ret, len;
+
+    server = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    client = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+    ret = bind(server, (const struct sockaddr *)&bind_addr, sizeof(bind_addr));
+    ok(!ret, "got error %u\n", WSAGetLastError());
+    len = sizeof(addr);
+    ret = getsockname(server, (struct sockaddr *)&addr, &len);
+    ok(!ret, "got error %u\n", WSAGetLastError());
+    ret = bind(client, (const struct sockaddr *)&bind_addr, sizeof(bind_addr));
+    ok(!ret, "got error %u\n", WSAGetLastError());
+    len = sizeof(client_addr);
+    ret = getsockname(client, (struct sockaddr *)&client_addr, &len);
+    ok(!ret, "got error %u\n", WSAGetLastError());
+
+    for (i = 0; i < ARRAY_SIZE(overlappeds); i++)
+    {
+        events[i] = CreateEventW(NULL, TRUE, FALSE, NULL);
+        wsabufs[i].buf = buffers[i];
+        wsabufs[i].len = (i == 2) ? 4 : sizeof(buffers[i]);
+        overlappeds[i].hEvent = events[i];
+        from_len[i] = sizeof(from[i]);
+        ret = WSARecvFrom(server, &wsabufs[i], 1, NULL, &flags[i],
+                          (struct sockaddr *)&from[i], &from_len[i], &overlappeds[i], NULL);
+        ok(ret == -1, "got %d\n", ret);
+        ok(WSAGetLastError() == ERROR_IO_PENDING, "got error %u\n", WSAGetLastError());
+    }
+
+    for (i = 0; i < ARRAY_SIZE(overlappeds); i++)
+    {
+        ret = sendto(client, msgstr + i * 8, 8, 0, (struct sockaddr *)&addr, sizeof(addr));
+        ok(ret == 8, "got %d\n", ret);
+    }
+
+    for (i = 0; i < ARRAY_SIZE(overlappeds); i++)
+    {
+        winetest_push_context("%u", i);
+
+        ret = WaitForSingleObject(events[i], 1000);
+        ok(!ret, "wait timed out\n");
+
+        size = 0;
+        ret = WSAGetOverlappedResult(server, &overlappeds[i], &size, FALSE, &flags[i]);
+        if (i == 2)
+        {
+            ok(!ret, "expected failure\n");
+            ok(WSAGetLastError() == WSAEMSGSIZE, "got error %u\n", WSAGetLastError());
+            ok(size == 4, "got size %lu\n", size);
+        }
+        else
+        {
+            ok(ret, "got error %u\n", WSAGetLastError());
+            ok(size == 8, "got size %lu\n", size);
+        }
+        ok(!memcmp(buffers[i], msgstr + i * 8, size), "expected %s, got %s\n",
+           debugstr_an(msgstr + i * 8, size), debugstr_an(buffers[i], size));
+        ok(from_len[i] == sizeof(client_addr), "got address length %d\n", from_len[i]);
+        ok(!memcmp(&from[i], &client_addr, sizeof(client_addr)), "addresses didn't match\n");
+
+        winetest_pop_context();
+    }
+
+    closesocket(client);
+    closesocket(server);
+
+    for (i = 0; i < ARRAY_SIZE(events); i++) CloseHandle(events[i]);
+}
+
 static void test_empty_recv(void)
 {
     OVERLAPPED overlapped = {0};
@@ -14188,6 +14508,8 @@ START_TEST( sock )
 
     test_ipv6only();
     test_TransmitFile();
+    test_TransmitPackets();
+    test_rio();
     test_AcceptEx();
     test_connect();
     test_shutdown();
@@ -14201,6 +14523,7 @@ START_TEST( sock )
     test_WSAGetOverlappedResult();
     test_nonblocking_async_recv();
     test_simultaneous_async_recv();
+    test_simultaneous_async_recv_udp();
     test_empty_recv();
     test_timeout();
     test_tcp_reset();
@@ -285,6 +285,7 @@ C_ASSERT( sizeof(struct afd_get_events_params) == 56 );
 #define IOCTL_AFD_WINE_SET_IP_RECVTOS                   WINE_AFD_IOC(296)
 #define IOCTL_AFD_WINE_GET_SO_EXCLUSIVEADDRUSE          WINE_AFD_IOC(297)
 #define IOCTL_AFD_WINE_SET_SO_EXCLUSIVEADDRUSE          WINE_AFD_IOC(298)
+#define IOCTL_AFD_WINE_TRANSMIT_PACKETS                 WINE_AFD_IOC(299)
 
 struct afd_iovec
 {
@@ -352,6 +353,27 @@ struct afd_transmit_params
 };
 C_ASSERT( sizeof(struct afd_transmit_params) == 48 );
 
+struct afd_transmit_packets_element
+{
+    LARGE_INTEGER offset;
+    ULONGLONG buffer_ptr;
+    ULONG file;
+    DWORD length;
+    DWORD flags;
+    DWORD padding;
+};
+C_ASSERT( sizeof(struct afd_transmit_packets_element) == 32 );
+
+struct afd_transmit_packets_params
+{
+    ULONGLONG elements_ptr; /* const struct afd_transmit_packets_element[] */
+    unsigned int count;
+    DWORD send_size;
+    DWORD flags;
+    DWORD padding;
+};
+C_ASSERT( sizeof(struct afd_transmit_packets_params) == 24 );
+
 struct afd_message_select_params
 {
     ULONG handle;
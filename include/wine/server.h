@@ -52,6 +52,9 @@ struct __server_request_info
 NTSYSAPI unsigned int CDECL wine_server_call( void *req_ptr );
 NTSYSAPI NTSTATUS CDECL wine_server_fd_to_handle( int fd, unsigned int access, unsigned int attributes, HANDLE *handle );
 NTSYSAPI NTSTATUS CDECL wine_server_handle_to_fd( HANDLE handle, unsigned int access, int *unix_fd, unsigned int *options );
+#ifdef WINE_UNIX_LIB
+NTSYSAPI const thread_shm_t *wine_server_get_thread_shm(void);
+#endif
 
 /* do a server call and set the last error code */
 static inline unsigned int wine_server_call_err( void *req_ptr )
@@ -621,6 +621,7 @@ typedef union
         enum apc_type    type;
         unsigned int     status;
         unsigned int     total;
+        unsigned int     alert_count;
     } async_io;
     struct
     {
@@ -854,6 +855,15 @@ struct rawinput_device
     user_handle_t  target;
 };
 
+struct completion_entry
+{
+    apc_param_t    ckey;
+    apc_param_t    cvalue;
+    apc_param_t    information;
+    unsigned int   status;
+    int            __pad;
+};
+
 typedef struct
 {
     int x;
@@ -863,6 +873,31 @@ typedef struct
     lparam_t info;
 } cursor_pos_t;
 
+/* per-thread state published by the server in the process shared memory;
+ * seq is odd while the server is updating it, readers retry on change */
+typedef volatile struct
+{
+    unsigned int  seq;
+    unsigned int  wake_bits;
+    unsigned int  changed_bits;
+    unsigned int  __pad;
+} thread_shm_t;
+
+#define THREAD_SHM_SLOT_SIZE  64
+#define PROCESS_SHM_SIZE      0x10000
+
+/* request handling statistics; histogram bucket n counts handlers that took
+ * less than 2^(n+1) * 100ns, the last bucket counts all the slower ones */
+#define REQUEST_STATS_BUCKETS 16
+
+typedef struct
+{
+    timeout_t     total;
+    unsigned int  count;
+    unsigned int  histogram[REQUEST_STATS_BUCKETS];
+    unsigned int  __pad;
+} request_stats_t;
+
 
 
 
@@ -983,7 +1018,9 @@ struct init_first_thread_reply
     timeout_t    server_start;
     unsigned int session_id;
     data_size_t  info_size;
+    unsigned int shm_slot;
     /* VARARG(machines,ushorts); */
+    char __pad_36[4];
 };
 
 
@@ -1001,6 +1038,20 @@ struct init_thread_reply
 {
     struct reply_header __header;
     int          suspend;
+    unsigned int shm_slot;
+};
+
+
+
+struct get_process_shm_request
+{
+    struct request_header __header;
+    char __pad_12[4];
+};
+struct get_process_shm_reply
+{
+    struct reply_header __header;
+    data_size_t  size;
     char __pad_12[4];
 };
 
@@ -1266,6 +1317,21 @@ struct close_handle_reply
 
 
 
+struct close_handles_request
+{
+    struct request_header __header;
+    /* VARARG(handles,uints); */
+    char __pad_12[4];
+};
+struct close_handles_reply
+{
+    struct reply_header __header;
+    unsigned int closed;
+    char __pad_12[4];
+};
+
+
+
 struct set_handle_info_request
 {
     struct request_header __header;
@@ -1808,7 +1874,7 @@ struct recv_socket_reply
     obj_handle_t wait;
     unsigned int options;
     int          nonblocking;
-    char __pad_20[4];
+    int          type;
 };
 
 
@@ -1827,7 +1893,7 @@ struct send_socket_reply
     obj_handle_t wait;
     unsigned int options;
     int          nonblocking;
-    char __pad_20[4];
+    int          type;
 };
 
 
@@ -5230,6 +5296,19 @@ struct remove_completion_reply
 
 
 
+struct remove_completions_request
+{
+    struct request_header __header;
+    obj_handle_t handle;
+};
+struct remove_completions_reply
+{
+    struct reply_header __header;
+    /* VARARG(entries,completion_entries); */
+};
+
+
+
 struct query_completion_request
 {
     struct request_header __header;
@@ -5704,6 +5783,22 @@ struct get_esync_apc_fd_request
 struct get_esync_apc_fd_reply
 {
     struct reply_header __header;
+    unsigned int shm_idx;
+    char __pad_12[4];
+};
+
+
+struct get_request_stats_request
+{
+    struct request_header __header;
+    char __pad_12[4];
+};
+struct get_request_stats_reply
+{
+    struct reply_header __header;
+    unsigned int count;
+    /* VARARG(stats,request_stats); */
+    char __pad_12[4];
 };
 
 
@@ -5716,6 +5811,7 @@ enum request
     REQ_init_process_done,
     REQ_init_first_thread,
     REQ_init_thread,
+    REQ_get_process_shm,
     REQ_terminate_process,
     REQ_terminate_thread,
     REQ_get_process_info,
@@ -5731,6 +5827,7 @@ enum request
     REQ_queue_apc,
     REQ_get_apc_result,
     REQ_close_handle,
+    REQ_close_handles,
     REQ_set_handle_info,
     REQ_dup_handle,
     REQ_compare_objects,
@@ -5967,6 +6064,7 @@ enum request
     REQ_open_completion,
     REQ_add_completion,
     REQ_remove_completion,
+    REQ_remove_completions,
     REQ_query_completion,
     REQ_set_completion_info,
     REQ_add_fd_completion,
@@ -5998,6 +6096,7 @@ enum request
     REQ_get_esync_fd,
     REQ_esync_msgwait,
     REQ_get_esync_apc_fd,
+    REQ_get_request_stats,
     REQ_NB_REQUESTS
 };
 
@@ -6012,6 +6111,7 @@ union generic_request
     struct init_process_done_request init_process_done_request;
     struct init_first_thread_request init_first_thread_request;
     struct init_thread_request init_thread_request;
+    struct get_process_shm_request get_process_shm_request;
     struct terminate_process_request terminate_process_request;
     struct terminate_thread_request terminate_thread_request;
     struct get_process_info_request get_process_info_request;
@@ -6027,6 +6127,7 @@ union generic_request
     struct queue_apc_request queue_apc_request;
     struct get_apc_result_request get_apc_result_request;
     struct close_handle_request close_handle_request;
+    struct close_handles_request close_handles_request;
     struct set_handle_info_request set_handle_info_request;
     struct dup_handle_request dup_handle_request;
     struct compare_objects_request compare_objects_request;
@@ -6263,6 +6364,7 @@ union generic_request
     struct open_completion_request open_completion_request;
     struct add_completion_request add_completion_request;
     struct remove_completion_request remove_completion_request;
+    struct remove_completions_request remove_completions_request;
     struct query_completion_request query_completion_request;
     struct set_completion_info_request set_completion_info_request;
     struct add_fd_completion_request add_fd_completion_request;
@@ -6294,6 +6396,7 @@ union generic_request
     struct get_esync_fd_request get_esync_fd_request;
     struct esync_msgwait_request esync_msgwait_request;
     struct get_esync_apc_fd_request get_esync_apc_fd_request;
+    struct get_request_stats_request get_request_stats_request;
 };
 union generic_reply
 {
@@ -6306,6 +6409,7 @@ union generic_reply
     struct init_process_done_reply init_process_done_reply;
     struct init_first_thread_reply init_first_thread_reply;
     struct init_thread_reply init_thread_reply;
+    struct get_process_shm_reply get_process_shm_reply;
     struct terminate_process_reply terminate_process_reply;
     struct terminate_thread_reply terminate_thread_reply;
     struct get_process_info_reply get_process_info_reply;
@@ -6321,6 +6425,7 @@ union generic_reply
     struct queue_apc_reply queue_apc_reply;
     struct get_apc_result_reply get_apc_result_reply;
     struct close_handle_reply close_handle_reply;
+    struct close_handles_reply close_handles_reply;
     struct set_handle_info_reply set_handle_info_reply;
     struct dup_handle_reply dup_handle_reply;
     struct compare_objects_reply compare_objects_reply;
@@ -6557,6 +6662,7 @@ union generic_reply
     struct open_completion_reply open_completion_reply;
     struct add_completion_reply add_completion_reply;
     struct remove_completion_reply remove_completion_reply;
+    struct remove_completions_reply remove_completions_reply;
     struct query_completion_reply query_completion_reply;
     struct set_completion_info_reply set_completion_info_reply;
     struct add_fd_completion_reply add_fd_completion_reply;
@@ -6588,11 +6694,12 @@ union generic_reply
     struct get_esync_fd_reply get_esync_fd_reply;
     struct esync_msgwait_reply esync_msgwait_reply;
     struct get_esync_apc_fd_reply get_esync_apc_fd_reply;
+    struct get_request_stats_reply get_request_stats_reply;
 };
 
 /* ### protocol_version begin ### */
 
-#define SERVER_PROTOCOL_VERSION 794
+#define SERVER_PROTOCOL_VERSION 802
 
 /* ### protocol_version end ### */
 
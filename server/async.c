@@ -676,6 +676,26 @@ void async_wake_up( struct async_queue *queue, unsigned int status )
     }
 }
 
+/* alert the asyncs queued after an async by the same thread for the same handle,
+ * the client completed them along with that one */
+void async_alert_queue( struct object *obj, unsigned int count )
+{
+    struct async *async = (struct async *)obj, *other;
+    struct list *ptr, *next;
+
+    if (obj->ops != &async_ops || !async->queue) return;  /* in case the client messed up the APC results */
+
+    for (ptr = list_next( &async->queue->queue, &async->queue_entry ); ptr && count; ptr = next)
+    {
+        next = list_next( &async->queue->queue, ptr );
+        other = LIST_ENTRY( ptr, struct async, queue_entry );
+        if (other->thread != async->thread || other->data.handle != async->data.handle) continue;
+        if (other->terminated) continue;
+        async_terminate( other, STATUS_ALERTED );
+        count--;
+    }
+}
+
 static void iosb_dump( struct object *obj, int verbose );
 static void iosb_destroy( struct object *obj );
 
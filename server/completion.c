@@ -237,6 +237,40 @@ DECL_HANDLER(remove_completion)
     release_object( completion );
 }
 
+/* get several completions from completion port */
+DECL_HANDLER(remove_completions)
+{
+    struct completion* completion = get_completion_obj( current->process, req->handle, IO_COMPLETION_MODIFY_STATE );
+    struct completion_entry *entries;
+    struct list *entry;
+    struct comp_msg *msg;
+    data_size_t count, i;
+
+    if (!completion) return;
+
+    count = min( get_reply_max_size() / sizeof(*entries), completion->depth );
+    if (!count)
+        set_error( completion->depth ? STATUS_BUFFER_TOO_SMALL : STATUS_PENDING );
+    else if ((entries = set_reply_data_size( count * sizeof(*entries) )))
+    {
+        for (i = 0; i < count; i++)
+        {
+            entry = list_head( &completion->queue );
+            list_remove( entry );
+            completion->depth--;
+            msg = LIST_ENTRY( entry, struct comp_msg, queue_entry );
+            entries[i].ckey = msg->ckey;
+            entries[i].cvalue = msg->cvalue;
+            entries[i].information = msg->information;
+            entries[i].status = msg->status;
+            entries[i].__pad = 0;
+            free( msg );
+        }
+    }
+
+    release_object( completion );
+}
+
 /* get queue depth for completion port */
 DECL_HANDLER(query_completion)
 {
@@ -835,7 +835,7 @@ static void device_manager_destroy( struct object *obj )
     }
 
     if (do_esync())
-        close( manager->esync_fd );
+        esync_close_fd( manager->esync_fd );
 }
 
 static struct device_manager *create_device_manager(void)
@@ -32,6 +32,10 @@
 #ifdef HAVE_SYS_STAT_H
 # include <sys/stat.h>
 #endif
+#ifdef HAVE_SYS_SYSCALL_H
+# include <sys/syscall.h>
+#endif
+#include <limits.h>
 #include <unistd.h>
 
 #include "ntstatus.h"
@@ -44,17 +48,64 @@
 #include "file.h"
 #include "esync.h"
 
+#if defined(__linux__) && defined(__NR_futex)
+
+#define FUTEX_WAIT 0
+#define FUTEX_WAKE 1
+
+static inline int futex_wake( int *addr, int val )
+{
+    return syscall( __NR_futex, addr, FUTEX_WAKE, val, NULL, 0, 0 );
+}
+
+int do_fsync(void)
+{
+    static int do_fsync_cached = -1;
+
+    if (do_fsync_cached == -1)
+    {
+        static int dummy;
+
+        do_fsync_cached = getenv("WINEFSYNC") && atoi(getenv("WINEFSYNC"));
+        if (do_fsync_cached && syscall( __NR_futex, &dummy, FUTEX_WAIT, 1, NULL, 0, 0 ) == -1
+                && errno == ENOSYS)
+        {
+            fprintf( stderr, "fsync: futexes are not supported, falling back.\n" );
+            do_fsync_cached = 0;
+        }
+    }
+
+    return do_fsync_cached;
+}
+
+#else
+
+static inline int futex_wake( int *addr, int val )
+{
+    return -1;
+}
+
+int do_fsync(void)
+{
+    return 0;
+}
+
+#endif
+
+/* The fsync backend reuses all of the esync object hooks; the only difference
+ * is that the "fd" values handed around by esync_create_fd() and friends are
+ * indices into the shared memory section instead of eventfds. */
 int do_esync(void)
 {
 #ifdef HAVE_SYS_EVENTFD_H
     static int do_esync_cached = -1;
 
     if (do_esync_cached == -1)
-        do_esync_cached = getenv("WINEESYNC") && atoi(getenv("WINEESYNC"));
+        do_esync_cached = (getenv("WINEESYNC") && atoi(getenv("WINEESYNC"))) || do_fsync();
 
     return do_esync_cached;
 #else
-    return 0;
+    return do_fsync();
 #endif
 }
 
@@ -65,6 +116,12 @@ static void **shm_addrs;
 static int shm_addrs_size;  /* length of the allocated shm_addrs array */
 static long pagesize;
 
+/* fsync shared memory index allocator */
+static unsigned int shm_idx_next = 1;  /* index 0 is reserved */
+static unsigned int *shm_idx_free;
+static unsigned int shm_idx_free_count;
+static unsigned int shm_idx_free_size;
+
 static void shm_cleanup(void)
 {
     close( shm_fd );
@@ -80,9 +137,10 @@ void esync_init(void)
         fatal_error( "cannot stat config dir\n" );
 
     if (st.st_ino != (unsigned long)st.st_ino)
-        sprintf( shm_name, "/wine-%lx%08lx-esync", (unsigned long)((unsigned long long)st.st_ino >> 32), (unsigned long)st.st_ino );
+        sprintf( shm_name, "/wine-%lx%08lx-%s", (unsigned long)((unsigned long long)st.st_ino >> 32),
+                 (unsigned long)st.st_ino, do_fsync() ? "fsync" : "esync" );
     else
-        sprintf( shm_name, "/wine-%lx-esync", (unsigned long)st.st_ino );
+        sprintf( shm_name, "/wine-%lx-%s", (unsigned long)st.st_ino, do_fsync() ? "fsync" : "esync" );
 
     shm_unlink( shm_name );
 
@@ -99,7 +157,7 @@ void esync_init(void)
     if (ftruncate( shm_fd, shm_size ) == -1)
         perror( "ftruncate" );
 
-    fprintf( stderr, "esync: up and running.\n" );
+    fprintf( stderr, "%s: up and running.\n", do_fsync() ? "fsync" : "esync" );
 
     atexit( shm_cleanup );
 }
@@ -149,7 +207,10 @@ static void esync_dump( struct object *obj, int verbose )
 {
     struct esync *esync = (struct esync *)obj;
     assert( obj->ops == &esync_ops );
-    fprintf( stderr, "esync fd=%d\n", esync->fd );
+    if (do_fsync())
+        fprintf( stderr, "fsync idx=%u\n", esync->shm_idx );
+    else
+        fprintf( stderr, "esync fd=%d\n", esync->fd );
 }
 
 static int esync_get_esync_fd( struct object *obj, enum esync_type *type )
@@ -174,7 +235,7 @@ static void esync_destroy( struct object *obj )
     struct esync *esync = (struct esync *)obj;
     if (esync->type == ESYNC_MUTEX)
         list_remove( &esync->mutex_entry );
-    close( esync->fd );
+    esync_close_fd( esync->fd );
 }
 
 static int type_matches( enum esync_type type1, enum esync_type type2 )
@@ -241,6 +302,76 @@ struct event
 };
 C_ASSERT(sizeof(struct event) == 8);
 
+/* Slot 0 of the fsync section; waiters which can't use futex_waitv() sleep on
+ * the sequence number, which is bumped on every wake. */
+struct wake_seq
+{
+    int seq;
+    int waiters;
+};
+C_ASSERT(sizeof(struct wake_seq) == 8);
+
+static void grow_shm( unsigned int idx )
+{
+    while (idx * 8 >= shm_size)
+    {
+        /* Better expand the shm section. */
+        shm_size += pagesize;
+        if (ftruncate( shm_fd, shm_size ) == -1)
+        {
+            fprintf( stderr, "esync: couldn't expand %s to size %ld: ",
+                     shm_name, (long)shm_size );
+            perror( "ftruncate" );
+        }
+    }
+}
+
+static unsigned int fsync_alloc_shm_idx(void)
+{
+    unsigned int idx;
+
+    if (shm_idx_free_count) idx = shm_idx_free[--shm_idx_free_count];
+    else
+    {
+        idx = shm_idx_next++;
+        grow_shm( idx );
+    }
+    return idx;
+}
+
+static void fsync_free_shm_idx( unsigned int idx )
+{
+    unsigned int *shm = get_shm( idx );
+
+    shm[0] = shm[1] = 0;
+
+    if (shm_idx_free_count == shm_idx_free_size)
+    {
+        unsigned int new_size = max( shm_idx_free_size * 2, 64 );
+        unsigned int *new_free = realloc( shm_idx_free, new_size * sizeof(*shm_idx_free) );
+
+        if (!new_free)
+        {
+            fprintf( stderr, "fsync: couldn't expand free index list, leaking index %u\n", idx );
+            return;
+        }
+        shm_idx_free = new_free;
+        shm_idx_free_size = new_size;
+    }
+    shm_idx_free[shm_idx_free_count++] = idx;
+}
+
+/* Wake everybody waiting on a futex in the shared section. */
+static void fsync_wake_futex( int *addr )
+{
+    struct wake_seq *wake_seq = get_shm( 0 );
+
+    futex_wake( addr, INT_MAX );
+    __atomic_add_fetch( &wake_seq->seq, 1, __ATOMIC_SEQ_CST );
+    if (__atomic_load_n( &wake_seq->waiters, __ATOMIC_SEQ_CST ))
+        futex_wake( &wake_seq->seq, INT_MAX );
+}
+
 struct esync *create_esync( struct object *root, const struct unicode_str *name,
                             unsigned int attr, int initval, int max, enum esync_type type,
                             const struct security_descriptor *sd )
@@ -257,30 +388,31 @@ struct esync *create_esync( struct object *root, const struct unicode_str *name,
             if (type == ESYNC_SEMAPHORE)
                 flags |= EFD_SEMAPHORE;
 
-            /* initialize it if it didn't already exist */
-            esync->fd = eventfd( initval, flags );
-            if (esync->fd == -1)
-            {
-                perror( "eventfd" );
-                file_set_error();
-                release_object( esync );
-                return NULL;
-            }
             esync->type = type;
 
-            /* Use the fd as index, since that'll be unique across all
-             * processes, but should hopefully end up also allowing reuse. */
-            esync->shm_idx = esync->fd + 1; /* we keep index 0 reserved */
-            while (esync->shm_idx * 8 >= shm_size)
+            if (do_fsync())
             {
-                /* Better expand the shm section. */
-                shm_size += pagesize;
-                if (ftruncate( shm_fd, shm_size ) == -1)
+                /* the shm slot is the whole object; the futex lives in it */
+                esync->shm_idx = fsync_alloc_shm_idx();
+                esync->fd = esync->shm_idx;
+            }
+            else
+            {
+                /* initialize it if it didn't already exist */
+                esync->fd = eventfd( initval, flags );
+                if (esync->fd == -1)
                 {
-                    fprintf( stderr, "esync: couldn't expand %s to size %ld: ",
-                             shm_name, (long)shm_size );
-                    perror( "ftruncate" );
+                    perror( "eventfd" );
+                    file_set_error();
+                    esync->type = 0;
+                    release_object( esync );
+                    return NULL;
                 }
+
+                /* Use the fd as index, since that'll be unique across all
+                 * processes, but should hopefully end up also allowing reuse. */
+                esync->shm_idx = esync->fd + 1; /* we keep index 0 reserved */
+                grow_shm( esync->shm_idx );
             }
 
             /* Initialize the shared memory portion. We want to do this on the
@@ -337,12 +469,22 @@ struct esync *create_esync( struct object *root, const struct unicode_str *name,
 
 /* Create a file descriptor for an existing handle.
  * Caller must close the handle when it's done; it's not linked to an esync
- * server object in any way. */
+ * server object in any way. With fsync this is a shm index instead. */
 int esync_create_fd( int initval, int flags )
 {
 #ifdef HAVE_SYS_EVENTFD_H
     int fd;
 
+    if (do_fsync())
+    {
+        unsigned int idx = fsync_alloc_shm_idx();
+        struct event *event = get_shm( idx );
+
+        event->signaled = initval ? 1 : 0;
+        event->locked = 0;
+        return idx;
+    }
+
     fd = eventfd( initval, flags | EFD_CLOEXEC | EFD_NONBLOCK );
     if (fd == -1)
         perror( "eventfd" );
@@ -353,11 +495,32 @@ int esync_create_fd( int initval, int flags )
 #endif
 }
 
+/* Close an fd returned by esync_create_fd(). */
+void esync_close_fd( int fd )
+{
+    if (do_fsync())
+    {
+        if (fd > 0) fsync_free_shm_idx( fd );
+        return;
+    }
+
+    close( fd );
+}
+
 /* Wake up a specific fd. */
 void esync_wake_fd( int fd )
 {
     static const uint64_t value = 1;
 
+    if (do_fsync())
+    {
+        struct event *event = get_shm( fd );
+
+        if (!__atomic_exchange_n( &event->signaled, 1, __ATOMIC_SEQ_CST ))
+            fsync_wake_futex( &event->signaled );
+        return;
+    }
+
     if (write( fd, &value, sizeof(value) ) == -1)
         perror( "esync: write" );
 }
@@ -379,6 +542,14 @@ void esync_clear( int fd )
 {
     uint64_t value;
 
+    if (do_fsync())
+    {
+        struct event *event = get_shm( fd );
+
+        __atomic_store_n( &event->signaled, 0, __ATOMIC_SEQ_CST );
+        return;
+    }
+
     /* we don't care about the return value */
     read( fd, &value, sizeof(value) );
 }
@@ -404,6 +575,13 @@ void esync_set_event( struct esync *esync )
     if (debug_level)
         fprintf( stderr, "esync_set_event() fd=%d\n", esync->fd );
 
+    if (do_fsync())
+    {
+        if (!__atomic_exchange_n( &event->signaled, 1, __ATOMIC_SEQ_CST ))
+            fsync_wake_futex( &event->signaled );
+        return;
+    }
+
     if (esync->type == ESYNC_MANUAL_EVENT)
     {
         /* Acquire the spinlock. */
@@ -435,6 +613,12 @@ void esync_reset_event( struct esync *esync )
     if (debug_level)
         fprintf( stderr, "esync_reset_event() fd=%d\n", esync->fd );
 
+    if (do_fsync())
+    {
+        __atomic_store_n( &event->signaled, 0, __ATOMIC_SEQ_CST );
+        return;
+    }
+
     if (esync->type == ESYNC_MANUAL_EVENT)
     {
         /* Acquire the spinlock. */
@@ -468,8 +652,14 @@ void esync_abandon_mutexes( struct thread *thread )
         {
             if (debug_level)
                 fprintf( stderr, "esync_abandon_mutexes() fd=%d\n", esync->fd );
-            mutex->tid = ~0;
             mutex->count = 0;
+            if (do_fsync())
+            {
+                __atomic_store_n( &mutex->tid, ~0, __ATOMIC_SEQ_CST );
+                fsync_wake_futex( (int *)&mutex->tid );
+                continue;
+            }
+            mutex->tid = ~0;
             esync_wake_fd( esync->fd );
         }
     }
@@ -507,7 +697,7 @@ DECL_HANDLER(create_esync)
 
         reply->type = esync->type;
         reply->shm_idx = esync->shm_idx;
-        send_client_fd( current->process, esync->fd, reply->handle );
+        if (!do_fsync()) send_client_fd( current->process, esync->fd, reply->handle );
         release_object( esync );
     }
 
@@ -540,7 +730,7 @@ DECL_HANDLER(open_esync)
         reply->type = esync->type;
         reply->shm_idx = esync->shm_idx;
 
-        send_client_fd( current->process, esync->fd, reply->handle );
+        if (!do_fsync()) send_client_fd( current->process, esync->fd, reply->handle );
         release_object( esync );
     }
 }
@@ -566,8 +756,8 @@ DECL_HANDLER(get_esync_fd)
             reply->shm_idx = esync->shm_idx;
         }
         else
-            reply->shm_idx = 0;
-        send_client_fd( current->process, fd, req->handle );
+            reply->shm_idx = (do_fsync() && fd > 0) ? fd : 0;
+        if (!do_fsync()) send_client_fd( current->process, fd, req->handle );
     }
     else
     {
@@ -585,5 +775,10 @@ DECL_HANDLER(get_esync_fd)
 /* Return the fd used for waiting on user APCs. */
 DECL_HANDLER(get_esync_apc_fd)
 {
+    if (do_fsync())
+    {
+        reply->shm_idx = current->esync_apc_fd;
+        return;
+    }
     send_client_fd( current->process, current->esync_apc_fd, current->id );
 }
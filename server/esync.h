@@ -21,8 +21,10 @@
 #include <unistd.h>
 
 extern int do_esync(void);
+extern int do_fsync(void);
 void esync_init(void);
 int esync_create_fd( int initval, int flags );
+void esync_close_fd( int fd );
 void esync_wake_fd( int fd );
 void esync_wake_up( struct object *obj );
 void esync_clear( int fd );
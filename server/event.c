@@ -262,7 +262,7 @@ static void event_destroy( struct object *obj )
     struct event *event = (struct event *)obj;
 
     if (do_esync())
-        close( event->esync_fd );
+        esync_close_fd( event->esync_fd );
 }
 
 struct keyed_event *create_keyed_event( struct object *root, const struct unicode_str *name,
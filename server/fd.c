@@ -110,6 +110,11 @@
 #if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_EPOLL_CREATE)
 # include <sys/epoll.h>
 # define USE_EPOLL
+# if defined(HAVE_LINUX_IO_URING_H) && defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#  include <sys/mman.h>
+#  include <linux/io_uring.h>
+#  define USE_IO_URING
+# endif
 #endif /* HAVE_SYS_EPOLL_H && HAVE_EPOLL_CREATE */
 
 #if defined(HAVE_PORT_H) && defined(HAVE_PORT_CREATE)
@@ -506,6 +511,7 @@ static struct fd **poll_users;              /* users array */
 static struct pollfd *pollfd;               /* poll fd array */
 static int nb_users;                        /* count of array entries actually in use */
 static int active_users;                    /* current number of active users */
+unsigned int poll_backlog;                  /* ready events still waiting to be processed */
 static int allocated_users;                 /* count of allocated entries in the array */
 static struct fd **freelist;                /* list of free entries in the array */
 
@@ -520,8 +526,341 @@ static inline void fd_poll_event( struct fd *fd, int event )
 
 static int epoll_fd = -1;
 
-static inline void init_epoll(void)
+#ifdef USE_IO_URING
+
+/* The io_uring backend uses one-shot poll requests that are re-armed once the
+ * event has been processed, which gives the same level-triggered behavior as
+ * epoll. Poll changes are only queued in the submission ring, and get
+ * submitted together with the wait for the next events, so that a loop
+ * iteration costs a single syscall. */
+
+#define URING_ENTRIES  256
+#define URING_IGNORE   (~(__u64)0)  /* user data of requests whose completion is ignored */
+
+static int uring_fd = -1;
+static struct
+{
+    unsigned int        *sq_head;
+    unsigned int        *sq_tail;
+    unsigned int        *sq_mask;
+    unsigned int        *sq_array;
+    unsigned int         sq_entries;
+    unsigned int         to_submit;
+    struct io_uring_sqe *sqes;
+    unsigned int        *cq_head;
+    unsigned int        *cq_tail;
+    unsigned int        *cq_mask;
+    struct io_uring_cqe *cqes;
+} uring;
+static int uring_disabled;                /* io_uring failed at runtime, never use it again */
+static unsigned int *uring_tokens;        /* token of the armed poll request of each user, 0 if none */
+static int uring_tokens_count;            /* allocated size of uring_tokens */
+static unsigned int uring_next_token;
+static int *uring_ready;                  /* users with a reaped completion that was not processed yet */
+static int uring_ready_count;
+static int uring_ready_size;
+
+static inline int io_uring_setup( unsigned int entries, struct io_uring_params *params )
+{
+    return syscall( __NR_io_uring_setup, entries, params );
+}
+
+static inline int io_uring_enter( unsigned int to_submit, unsigned int min_complete, unsigned int flags,
+                                  void *arg, size_t size )
+{
+    return syscall( __NR_io_uring_enter, uring_fd, to_submit, min_complete, flags, arg, size );
+}
+
+static int init_uring(void)
+{
+    const char *env = getenv( "WINESERVERURING" );
+    struct io_uring_params params;
+    size_t sq_size, cq_size;
+    char *sq_ring, *cq_ring;
+    void *sqes;
+    int fd;
+
+    if (uring_disabled || (env && !atoi( env ))) return 0;
+
+    memset( &params, 0, sizeof(params) );
+    if ((fd = io_uring_setup( URING_ENTRIES, &params )) == -1) return 0;
+
+    /* we need completions never to be dropped, and waits with a timeout */
+    if (!(params.features & IORING_FEAT_NODROP) || !(params.features & IORING_FEAT_EXT_ARG) ||
+        !(params.features & IORING_FEAT_SINGLE_MMAP))
+    {
+        close( fd );
+        return 0;
+    }
+
+    sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (cq_size > sq_size) sq_size = cq_size;
+    sq_ring = mmap( NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING );
+    if (sq_ring == MAP_FAILED)
+    {
+        close( fd );
+        return 0;
+    }
+    sqes = mmap( NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES );
+    if (sqes == MAP_FAILED)
+    {
+        munmap( sq_ring, sq_size );
+        close( fd );
+        return 0;
+    }
+    cq_ring = sq_ring;
+
+    uring.sq_head    = (unsigned int *)(sq_ring + params.sq_off.head);
+    uring.sq_tail    = (unsigned int *)(sq_ring + params.sq_off.tail);
+    uring.sq_mask    = (unsigned int *)(sq_ring + params.sq_off.ring_mask);
+    uring.sq_array   = (unsigned int *)(sq_ring + params.sq_off.array);
+    uring.sq_entries = params.sq_entries;
+    uring.sqes       = sqes;
+    uring.cq_head    = (unsigned int *)(cq_ring + params.cq_off.head);
+    uring.cq_tail    = (unsigned int *)(cq_ring + params.cq_off.tail);
+    uring.cq_mask    = (unsigned int *)(cq_ring + params.cq_off.ring_mask);
+    uring.cqes       = (struct io_uring_cqe *)(cq_ring + params.cq_off.cqes);
+    uring_fd = fd;
+    return 1;
+}
+
+/* switch to epoll if io_uring fails at runtime; the ring memory is leaked */
+static void uring_fallback(void)
+{
+    int user;
+
+    perror( "io_uring_enter" );
+    close( uring_fd );
+    uring_fd = -1;
+    uring_disabled = 1;
+    /* epoll is level-triggered, so the events of reaped but unprocessed users get reported again */
+    uring_ready_count = 0;
+    if ((epoll_fd = epoll_create( 128 )) == -1) return;
+    for (user = 0; user < nb_users; user++)
+    {
+        struct epoll_event ev;
+
+        if (pollfd[user].fd == -1) continue;
+        ev.events = pollfd[user].events;
+        memset( &ev.data, 0, sizeof(ev.data) );
+        ev.data.u32 = user;
+        epoll_ctl( epoll_fd, EPOLL_CTL_ADD, pollfd[user].fd, &ev );
+    }
+}
+
+/* move the completions from the ring to the ready list; returns the number of reaped entries */
+static unsigned int uring_reap(void)
+{
+    unsigned int head = *uring.cq_head, tail = __atomic_load_n( uring.cq_tail, __ATOMIC_ACQUIRE );
+    unsigned int ret = tail - head;
+
+    for ( ; head != tail; head++)
+    {
+        const struct io_uring_cqe *cqe = &uring.cqes[head & *uring.cq_mask];
+        int user = cqe->user_data >> 32;
+
+        if (cqe->user_data == URING_IGNORE) continue;
+        if (user >= uring_tokens_count || uring_tokens[user] != (unsigned int)cqe->user_data)
+            continue;  /* stale completion of a cancelled request */
+        if (uring_ready_count == uring_ready_size)
+        {
+            int new_size = max( uring_ready_size * 2, 64 );
+            int *new_ready = realloc( uring_ready, new_size * sizeof(*uring_ready) );
+
+            if (!new_ready) break;  /* leave the rest in the ring */
+            uring_ready = new_ready;
+            uring_ready_size = new_size;
+        }
+        uring_tokens[user] = 0;
+        if (pollfd[user].fd == -1) continue;
+        pollfd[user].revents = cqe->res >= 0 ? cqe->res : POLLERR;
+        uring_ready[uring_ready_count++] = user;
+    }
+    ret -= tail - head;
+    __atomic_store_n( uring.cq_head, head, __ATOMIC_RELEASE );
+    return ret;
+}
+
+/* submit the queued requests, and optionally wait for a completion; timeout is in milliseconds */
+static int uring_submit( int wait, int timeout )
+{
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    int ret;
+
+    memset( &arg, 0, sizeof(arg) );
+    if (wait && timeout != -1)
+    {
+        ts.tv_sec = timeout / 1000;
+        ts.tv_nsec = (timeout % 1000) * 1000000;
+        arg.ts = (unsigned long)&ts;
+    }
+    for (;;)
+    {
+        ret = io_uring_enter( uring.to_submit, wait ? 1 : 0,
+                              (wait ? IORING_ENTER_GETEVENTS : 0) | IORING_ENTER_EXT_ARG, &arg, sizeof(arg) );
+        if (ret >= 0)
+        {
+            uring.to_submit -= ret;
+            return 1;
+        }
+        if (errno != EBUSY) break;
+        /* the completion queue is full and nothing was submitted; make room and try again */
+        if (!uring_reap()) return 0;
+        wait = 0;
+    }
+    return errno == EINTR || errno == ETIME || errno == EAGAIN;
+}
+
+static struct io_uring_sqe *uring_get_sqe(void)
+{
+    unsigned int tail = *uring.sq_tail, idx;
+    struct io_uring_sqe *sqe;
+
+    if (tail - __atomic_load_n( uring.sq_head, __ATOMIC_ACQUIRE ) == uring.sq_entries)
+    {
+        if (!uring_submit( 0, 0 )) return NULL;
+        if (tail - __atomic_load_n( uring.sq_head, __ATOMIC_ACQUIRE ) == uring.sq_entries) return NULL;
+    }
+    idx = tail & *uring.sq_mask;
+    sqe = &uring.sqes[idx];
+    memset( sqe, 0, sizeof(*sqe) );
+    uring.sq_array[idx] = idx;
+    __atomic_store_n( uring.sq_tail, tail + 1, __ATOMIC_RELEASE );
+    uring.to_submit++;
+    return sqe;
+}
+
+static int uring_grow_tokens( int user )
+{
+    unsigned int *new_tokens;
+    int new_count;
+
+    if (user < uring_tokens_count) return 1;
+    new_count = max( allocated_users, user + 1 );
+    if (!(new_tokens = realloc( uring_tokens, new_count * sizeof(*uring_tokens) ))) return 0;
+    memset( new_tokens + uring_tokens_count, 0, (new_count - uring_tokens_count) * sizeof(*uring_tokens) );
+    uring_tokens = new_tokens;
+    uring_tokens_count = new_count;
+    return 1;
+}
+
+/* queue a poll request for a user */
+static void uring_arm( int user, int unix_fd, int events )
+{
+    struct io_uring_sqe *sqe;
+
+    if (!uring_grow_tokens( user ) || !(sqe = uring_get_sqe()))
+    {
+        uring_fallback();
+        return;
+    }
+    if (!++uring_next_token) ++uring_next_token;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = unix_fd;
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    sqe->poll32_events = ((unsigned int)events << 16) | ((unsigned int)events >> 16);
+#else
+    sqe->poll32_events = events;
+#endif
+    sqe->user_data = ((__u64)user << 32) | uring_next_token;
+    uring_tokens[user] = uring_next_token;
+}
+
+/* cancel the pending poll request of a user */
+static void uring_disarm( int user )
+{
+    struct io_uring_sqe *sqe;
+
+    if (user >= uring_tokens_count || !uring_tokens[user]) return;
+    if (!(sqe = uring_get_sqe()))
+    {
+        uring_fallback();
+        return;
+    }
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->addr = ((__u64)user << 32) | uring_tokens[user];
+    sqe->user_data = URING_IGNORE;
+    uring_tokens[user] = 0;
+}
+
+static inline void set_fd_uring_events( struct fd *fd, int user, int events )
+{
+    if (events == -1)  /* stop waiting on this fd completely */
+    {
+        uring_disarm( user );
+        return;
+    }
+    if (pollfd[user].fd != -1 && pollfd[user].events == events &&
+        user < uring_tokens_count && uring_tokens[user]) return;  /* nothing to do */
+    uring_disarm( user );
+    if (uring_fd != -1) uring_arm( user, fd->unix_fd, events );
+}
+
+static inline void main_loop_uring(void)
+{
+    int i, count, timeout;
+
+    while (active_users && uring_fd != -1)
+    {
+        timeout = get_next_timeout();
+
+        if (!active_users) break;  /* last user removed by a timeout */
+        if (uring_fd == -1) break;  /* an error occurred with io_uring */
+
+        /* don't block if an earlier submission already reaped some events */
+        if (!uring_submit( !uring_ready_count, timeout ))
+        {
+            uring_fallback();
+            break;
+        }
+        set_current_time();
+
+        /* put the events into the pollfd array first, like poll does */
+        uring_reap();
+        count = uring_ready_count;
+
+        /* read events from the pollfd array, as set_fd_events may modify them; the ready
+         * list may grow while processing if a submission needs to make room in the ring */
+        for (i = 0; i < count && uring_fd != -1; i++)
+        {
+            int user = uring_ready[i], revents = pollfd[user].revents;
+            poll_backlog = count - i - 1;
+            pollfd[user].revents = 0;
+            if (revents) fd_poll_event( poll_users[user], revents );
+        }
+        poll_backlog = 0;
+        if (uring_fd == -1) break;
+
+        /* re-arm the one-shot requests that are still wanted */
+        for (i = 0; i < count && uring_fd != -1; i++)
+        {
+            int user = uring_ready[i];
+            if (pollfd[user].fd != -1 && !uring_tokens[user])
+                uring_arm( user, pollfd[user].fd, pollfd[user].events );
+        }
+        if (uring_fd == -1) break;
+
+        uring_ready_count -= count;
+        memmove( uring_ready, uring_ready + count, uring_ready_count * sizeof(*uring_ready) );
+    }
+}
+
+#else  /* USE_IO_URING */
+
+static const int uring_fd = -1;
+static inline int init_uring(void) { return 0; }
+static inline void uring_disarm( int user ) { }
+static inline void set_fd_uring_events( struct fd *fd, int user, int events ) { }
+static inline void main_loop_uring(void) { }
+
+#endif  /* USE_IO_URING */
+
+static void init_epoll(void)
 {
+    if (init_uring()) return;
     epoll_fd = epoll_create( 128 );
 }
 
@@ -531,6 +870,12 @@ static inline void set_fd_epoll_events( struct fd *fd, int user, int events )
     struct epoll_event ev;
     int ctl;
 
+    if (uring_fd != -1)
+    {
+        set_fd_uring_events( fd, user, events );
+        if (uring_fd != -1) return;
+        /* io_uring failed, apply the change to the epoll registration made by the fallback */
+    }
     if (epoll_fd == -1) return;
 
     if (events == -1)  /* stop waiting on this fd completely */
@@ -565,6 +910,11 @@ static inline void set_fd_epoll_events( struct fd *fd, int user, int events )
 
 static inline void remove_epoll_user( struct fd *fd, int user )
 {
+    if (uring_fd != -1)
+    {
+        uring_disarm( user );
+        if (uring_fd != -1) return;
+    }
     if (epoll_fd == -1) return;
 
     if (pollfd[user].fd != -1)
@@ -584,6 +934,7 @@ static inline void main_loop_epoll(void)
     assert( POLLERR == EPOLLERR );
     assert( POLLHUP == EPOLLHUP );
 
+    main_loop_uring();
     if (epoll_fd == -1) return;
 
     while (active_users)
@@ -607,8 +958,10 @@ static inline void main_loop_epoll(void)
         for (i = 0; i < ret; i++)
         {
             int user = events[i].data.u32;
+            poll_backlog = ret - i - 1;
             if (pollfd[user].revents) fd_poll_event( poll_users[user], pollfd[user].revents );
         }
+        poll_backlog = 0;
     }
 }
 
@@ -718,9 +1071,11 @@ static inline void main_loop_epoll(void)
         for (i = 0; i < ret; i++)
         {
             long user = (long)events[i].udata;
+            poll_backlog = ret - i - 1;
             if (pollfd[user].revents) fd_poll_event( poll_users[user], pollfd[user].revents );
             pollfd[user].revents = 0;
         }
+        poll_backlog = 0;
     }
 }
 
@@ -815,12 +1170,14 @@ static inline void main_loop_epoll(void)
         for (i = 0; i < nget; i++)
         {
             long user = (long)events[i].portev_user;
+            poll_backlog = nget - i - 1;
             if (pollfd[user].revents) fd_poll_event( poll_users[user], pollfd[user].revents );
             /* if we are still interested, reassociate the fd */
             if (pollfd[user].fd != -1) {
                 port_associate( port_fd, PORT_SOURCE_FD, pollfd[user].fd, pollfd[user].events, (void *)user );
             }
         }
+        poll_backlog = 0;
     }
 }
 
@@ -981,10 +1338,12 @@ void main_loop(void)
             {
                 if (pollfd[i].revents)
                 {
+                    poll_backlog = ret - 1;
                     fd_poll_event( poll_users[i], pollfd[i].revents );
                     if (!--ret) break;
                 }
             }
+            poll_backlog = 0;
         }
     }
 }
@@ -1653,7 +2012,7 @@ static void fd_destroy( struct object *obj )
     }
 
     if (do_esync())
-        close( fd->esync_fd );
+        esync_close_fd( fd->esync_fd );
 }
 
 /* check if the desired access is possible without violating */
@@ -128,6 +128,7 @@ extern void no_fd_queue_async( struct fd *fd, struct async *async, int type, int
 extern void default_fd_queue_async( struct fd *fd, struct async *async, int type, int count );
 extern void default_fd_reselect_async( struct fd *fd, struct async_queue *queue );
 extern void main_loop(void);
+extern unsigned int poll_backlog;
 extern void remove_process_locks( struct process *process );
 
 static inline struct fd *get_obj_fd( struct object *obj ) { return obj->ops->get_fd( obj ); }
@@ -177,6 +178,7 @@ struct memory_view;
 
 extern void init_memory(void);
 extern int grow_file( int unix_fd, file_pos_t new_size );
+extern int create_temp_file( file_pos_t size );
 extern void free_map_addr( client_ptr_t base, mem_size_t size );
 extern struct memory_view *find_mapped_view( struct process *process, client_ptr_t base );
 extern struct memory_view *get_exe_view( struct process *process );
@@ -245,6 +247,7 @@ extern void async_request_complete( struct async *async, unsigned int status, da
 extern void async_request_complete_alloc( struct async *async, unsigned int status, data_size_t result,
                                           data_size_t out_size, const void *out_data );
 extern void async_wake_up( struct async_queue *queue, unsigned int status );
+extern void async_alert_queue( struct object *obj, unsigned int count );
 extern struct completion *fd_get_completion( struct fd *fd, apc_param_t *p_key );
 extern void fd_copy_completion( struct fd *src, struct fd *dst );
 extern struct iosb *async_get_iosb( struct async *async );
@@ -41,18 +41,22 @@
 
 struct handle_entry
 {
-    struct object *ptr;       /* object */
-    unsigned int   access;    /* access rights */
+    struct object *ptr;       /* object, NULL if the entry is free */
+    unsigned int   access;    /* access rights, or index of the next free entry if free */
 };
 
+/* Entries are allocated by pages that never move once allocated, so that an entry pointer
+ * remains valid while the table grows, and growing doesn't need to copy the entries.
+ * Closed entries are kept in a free list, which may also contain entries beyond the
+ * last used one; it is rebuilt when the table is shrunk or copied. */
 struct handle_table
 {
     struct object        obj;         /* object header */
     struct process      *process;     /* process owning this table */
     int                  count;       /* number of allocated entries */
     int                  last;        /* last used entry */
-    int                  free;        /* first entry that may be free */
-    struct handle_entry *entries;     /* handle entries */
+    int                  free;        /* first entry of the free list, -1 if empty */
+    struct handle_entry **pages;      /* pages of handle entries */
 };
 
 static struct handle_table *global_table;
@@ -63,9 +67,16 @@ static struct handle_table *global_table;
 #define RESERVED_CLOSE_PROTECT (HANDLE_FLAG_PROTECT_FROM_CLOSE << RESERVED_SHIFT)
 #define RESERVED_ALL           (RESERVED_INHERIT | RESERVED_CLOSE_PROTECT)
 
-#define MIN_HANDLE_ENTRIES  32
+#define HANDLE_PAGE_SHIFT   8
+#define HANDLE_PAGE_SIZE    (1 << HANDLE_PAGE_SHIFT)  /* entries per page */
+#define MIN_HANDLE_ENTRIES  HANDLE_PAGE_SIZE
 #define MAX_HANDLE_ENTRIES  0x00ffffff
 
+static inline struct handle_entry *get_entry( struct handle_table *table, int index )
+{
+    return table->pages[index >> HANDLE_PAGE_SHIFT] + (index & (HANDLE_PAGE_SIZE - 1));
+}
+
 
 /* handle to table index conversion */
 
@@ -155,9 +166,9 @@ static void handle_table_dump( struct object *obj, int verbose )
     fprintf( stderr, "Handle table last=%d count=%d process=%p\n",
              table->last, table->count, table->process );
     if (!verbose) return;
-    entry = table->entries;
-    for (i = 0; i <= table->last; i++, entry++)
+    for (i = 0; i <= table->last; i++)
     {
+        entry = get_entry( table, i );
         if (!entry->ptr) continue;
         fprintf( stderr, "    %04x: %p %08x ",
                  index_to_handle(i), entry->ptr, entry->access );
@@ -175,9 +186,12 @@ static void handle_table_destroy( struct object *obj )
 
     assert( obj->ops == &handle_table_ops );
 
-    for (i = 0, entry = table->entries; i <= table->last; i++, entry++)
+    for (i = 0; i <= table->last; i++)
     {
-        struct object *obj = entry->ptr;
+        struct object *obj;
+
+        entry = get_entry( table, i );
+        obj = entry->ptr;
         entry->ptr = NULL;
         if (obj)
         {
@@ -186,7 +200,8 @@ static void handle_table_destroy( struct object *obj )
             release_object_from_handle( obj );
         }
     }
-    free( table->entries );
+    for (i = 0; i < table->count >> HANDLE_PAGE_SHIFT; i++) free( table->pages[i] );
+    free( table->pages );
 }
 
 /* close all the process handles and free the handle table */
@@ -198,6 +213,33 @@ void close_process_handles( struct process *process )
     if (table) release_object( table );
 }
 
+/* grow a handle table by one page */
+static int grow_handle_table( struct handle_table *table )
+{
+    struct handle_entry **new_pages, *page;
+    int nb_pages = table->count >> HANDLE_PAGE_SHIFT;
+
+    if (table->count + HANDLE_PAGE_SIZE > MAX_HANDLE_ENTRIES ||
+        !(page = calloc( HANDLE_PAGE_SIZE, sizeof(*page) )))
+    {
+        set_error( STATUS_INSUFFICIENT_RESOURCES );
+        return 0;
+    }
+    if (!(nb_pages & (nb_pages - 1)))  /* the page array size is a power of 2, double it */
+    {
+        if (!(new_pages = realloc( table->pages, max( 2 * nb_pages, 1 ) * sizeof(*new_pages) )))
+        {
+            free( page );
+            set_error( STATUS_INSUFFICIENT_RESOURCES );
+            return 0;
+        }
+        table->pages = new_pages;
+    }
+    table->pages[nb_pages] = page;
+    table->count += HANDLE_PAGE_SIZE;
+    return 1;
+}
+
 /* allocate a new handle table */
 struct handle_table *alloc_handle_table( struct process *process, int count )
 {
@@ -207,46 +249,53 @@ struct handle_table *alloc_handle_table( struct process *process, int count )
     if (!(table = alloc_object( &handle_table_ops )))
         return NULL;
     table->process = process;
-    table->count   = count;
+    table->count   = 0;
     table->last    = -1;
-    table->free    = 0;
-    if ((table->entries = mem_alloc( count * sizeof(*table->entries) ))) return table;
-    release_object( table );
-    return NULL;
+    table->free    = -1;
+    table->pages   = NULL;
+    while (table->count < count)
+    {
+        if (grow_handle_table( table )) continue;
+        release_object( table );
+        return NULL;
+    }
+    return table;
 }
 
-/* grow a handle table */
-static int grow_handle_table( struct handle_table *table )
+/* rebuild the free list from the free entries up to the last used one */
+static void init_free_list( struct handle_table *table )
 {
-    struct handle_entry *new_entries;
-    int count = min( table->count * 2, MAX_HANDLE_ENTRIES );
+    struct handle_entry *entry;
+    int i;
 
-    if (count == table->count ||
-        !(new_entries = realloc( table->entries, count * sizeof(struct handle_entry) )))
+    table->free = -1;
+    for (i = table->last; i >= 0; i--)
     {
-        set_error( STATUS_INSUFFICIENT_RESOURCES );
-        return 0;
+        entry = get_entry( table, i );
+        if (entry->ptr) continue;
+        entry->access = table->free;
+        table->free = i;
     }
-    table->entries = new_entries;
-    table->count   = count;
-    return 1;
 }
 
-/* allocate the first free entry in the handle table */
+/* allocate a free entry in the handle table */
 static obj_handle_t alloc_entry( struct handle_table *table, void *obj, unsigned int access )
 {
-    struct handle_entry *entry = table->entries + table->free;
+    struct handle_entry *entry;
     int i;
 
-    for (i = table->free; i <= table->last; i++, entry++) if (!entry->ptr) goto found;
-    if (i >= table->count)
+    if ((i = table->free) != -1)
+    {
+        entry = get_entry( table, i );
+        table->free = entry->access;
+    }
+    else
     {
-        if (!grow_handle_table( table )) return 0;
-        entry = table->entries + i;  /* the entries may have moved */
+        i = table->last + 1;
+        if (i >= table->count && !grow_handle_table( table )) return 0;
+        entry = get_entry( table, i );
     }
-    table->last = i;
- found:
-    table->free = i + 1;
+    table->last = max( table->last, i );
     entry->ptr    = grab_object_for_handle( obj );
     entry->access = access;
     return index_to_handle(i);
@@ -327,7 +376,7 @@ static struct handle_entry *get_handle( struct process *process, obj_handle_t ha
     index = handle_to_index( handle );
     if (index < 0) return NULL;
     if (index > table->last) return NULL;
-    entry = table->entries + index;
+    entry = get_entry( table, index );
     if (!entry->ptr) return NULL;
     return entry;
 }
@@ -335,22 +384,14 @@ static struct handle_entry *get_handle( struct process *process, obj_handle_t ha
 /* attempt to shrink a table */
 static void shrink_handle_table( struct handle_table *table )
 {
-    struct handle_entry *entry = table->entries + table->last;
-    struct handle_entry *new_entries;
-    int count = table->count;
+    int nb_pages = table->count >> HANDLE_PAGE_SHIFT;
 
-    while (table->last >= 0)
-    {
-        if (entry->ptr) break;
-        table->last--;
-        entry--;
-    }
-    if (table->last >= count / 4) return;  /* no need to shrink */
-    if (count < MIN_HANDLE_ENTRIES * 2) return;  /* too small to shrink */
-    count /= 2;
-    if (!(new_entries = realloc( table->entries, count * sizeof(*new_entries) ))) return;
-    table->count   = count;
-    table->entries = new_entries;
+    while (table->last >= 0 && !get_entry( table, table->last )->ptr) table->last--;
+    if (table->last >= table->count / 4) return;  /* no need to shrink */
+    if (table->count < MIN_HANDLE_ENTRIES * 2) return;  /* too small to shrink */
+    while (nb_pages > (table->count >> (HANDLE_PAGE_SHIFT + 1))) free( table->pages[--nb_pages] );
+    table->count = nb_pages << HANDLE_PAGE_SHIFT;
+    init_free_list( table );  /* drop the entries of the freed pages */
 }
 
 static void inherit_handle( struct process *parent, const obj_handle_t handle, struct handle_table *table )
@@ -358,14 +399,13 @@ static void inherit_handle( struct process *parent, const obj_handle_t handle, s
     struct handle_entry *dst, *src;
     int index;
 
-    dst = table->entries;
-
     src = get_handle( parent, handle );
     if (!src || !(src->access & RESERVED_INHERIT)) return;
     index = handle_to_index( handle );
-    if (dst[index].ptr) return;
+    dst = get_entry( table, index );
+    if (dst->ptr) return;
     grab_object_for_handle( src->ptr );
-    dst[index] = *src;
+    *dst = *src;
     table->last = max( table->last, index );
 }
 
@@ -387,8 +427,6 @@ struct handle_table *copy_handle_table( struct process *process, struct process
 
     if (handles)
     {
-        memset( table->entries, 0, parent_table->count * sizeof(*table->entries) );
-
         for (i = 0; i < handle_count; i++)
         {
             inherit_handle( parent, handles[i], table );
@@ -401,18 +439,18 @@ struct handle_table *copy_handle_table( struct process *process, struct process
     }
     else
     {
-        if ((table->last = parent_table->last) >= 0)
+        for (i = 0; i <= parent_table->last; i++)
         {
-            struct handle_entry *ptr = table->entries;
-            memcpy( ptr, parent_table->entries, (table->last + 1) * sizeof(struct handle_entry) );
-            for (i = 0; i <= table->last; i++, ptr++)
-            {
-                if (!ptr->ptr) continue;
-                if (ptr->access & RESERVED_INHERIT) grab_object_for_handle( ptr->ptr );
-                else ptr->ptr = NULL; /* don't inherit this entry */
-            }
+            struct handle_entry *ptr = get_entry( table, i );
+
+            *ptr = *get_entry( parent_table, i );
+            if (!ptr->ptr) continue;
+            if (ptr->access & RESERVED_INHERIT) grab_object_for_handle( ptr->ptr );
+            else ptr->ptr = NULL; /* don't inherit this entry */
         }
+        table->last = parent_table->last;
     }
+    init_free_list( table );
     /* attempt to shrink the table */
     shrink_handle_table( table );
     return table;
@@ -424,15 +462,26 @@ unsigned int close_handle( struct process *process, obj_handle_t handle )
     struct handle_table *table;
     struct handle_entry *entry;
     struct object *obj;
+    int index;
 
     if (!(entry = get_handle( process, handle ))) return STATUS_INVALID_HANDLE;
     if (entry->access & RESERVED_CLOSE_PROTECT) return STATUS_HANDLE_NOT_CLOSABLE;
     obj = entry->ptr;
     if (!obj->ops->close_handle( obj, process, handle )) return STATUS_HANDLE_NOT_CLOSABLE;
     entry->ptr = NULL;
-    table = handle_is_global(handle) ? global_table : process->handles;
-    if (entry < table->entries + table->free) table->free = entry - table->entries;
-    if (entry == table->entries + table->last) shrink_handle_table( table );
+    if (handle_is_global(handle))
+    {
+        table = global_table;
+        index = handle_to_index( handle_global_to_local(handle) );
+    }
+    else
+    {
+        table = process->handles;
+        index = handle_to_index( handle );
+    }
+    entry->access = table->free;
+    table->free = index;
+    if (index == table->last) shrink_handle_table( table );
     release_object_from_handle( obj );
     return STATUS_SUCCESS;
 }
@@ -512,8 +561,9 @@ obj_handle_t find_inherited_handle( struct process *process, const struct object
 
     if (!table) return 0;
 
-    for (i = 0, ptr = table->entries; i <= table->last; i++, ptr++)
+    for (i = 0; i <= table->last; i++)
     {
+        ptr = get_entry( table, i );
         if (!ptr->ptr) continue;
         if (ptr->ptr->ops != ops) continue;
         if (ptr->access & RESERVED_INHERIT) return index_to_handle(i);
@@ -531,8 +581,11 @@ unsigned int get_obj_handle_count( struct process *process, const struct object
 
     if (!table) return 0;
 
-    for (i = 0, ptr = table->entries; i <= table->last; i++, ptr++)
+    for (i = 0; i <= table->last; i++)
+    {
+        ptr = get_entry( table, i );
         if (ptr->ptr == obj) ++count;
+    }
     return count;
 }
 
@@ -666,6 +719,16 @@ DECL_HANDLER(close_handle)
     set_error( err );
 }
 
+/* close a batch of handles; failures on individual handles are ignored */
+DECL_HANDLER(close_handles)
+{
+    const obj_handle_t *handles = get_req_data();
+    unsigned int i, count = get_req_data_size() / sizeof(*handles);
+
+    for (i = 0; i < count; i++)
+        if (!close_handle( current->process, handles[i] )) reply->closed++;
+}
+
 /* set a handle information */
 DECL_HANDLER(set_handle_info)
 {
@@ -843,8 +906,9 @@ static int enum_handles( struct process *process, void *user )
     if (!table)
         return 0;
 
-    for (i = 0, entry = table->entries; i <= table->last; i++, entry++)
+    for (i = 0; i <= table->last; i++)
     {
+        entry = get_entry( table, i );
         if (!entry->ptr) continue;
         if (!info->handle)
         {
@@ -25,6 +25,7 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
@@ -321,7 +322,7 @@ static int check_current_dir_for_exec(void)
 }
 
 /* create a temp file for anonymous mappings */
-static int create_temp_file( file_pos_t size )
+int create_temp_file( file_pos_t size )
 {
     static int temp_dir_fd = -1;
     char tmpfn[16];
@@ -1259,6 +1260,27 @@ int get_page_size(void)
     return page_mask + 1;
 }
 
+/* get the size of the large pages used for MEM_LARGE_PAGES, or 0 if not supported */
+static unsigned int get_large_page_size(void)
+{
+    unsigned int size = 0;
+#ifdef __linux__
+    char buffer[64];
+    FILE *f;
+
+    /* large pages are implemented with transparent huge pages */
+    if (!(f = fopen( "/sys/kernel/mm/transparent_hugepage/enabled", "r" ))) return 0;
+    if (!fgets( buffer, sizeof(buffer), f ) || strstr( buffer, "[never]" )) buffer[0] = 0;
+    fclose( f );
+    if (!buffer[0]) return 0;
+
+    if (!(f = fopen( "/sys/kernel/mm/transparent_hugepage/hpage_pmd_size", "r" ))) return 0;
+    if (fscanf( f, "%u", &size ) != 1 || (size & (size - 1)) || size <= page_mask) size = 0;
+    fclose( f );
+#endif
+    return size;
+}
+
 struct object *create_user_data_mapping( struct object *root, const struct unicode_str *name,
                                         unsigned int attr, const struct security_descriptor *sd )
 {
@@ -1272,6 +1294,7 @@ struct object *create_user_data_mapping( struct object *root, const struct unico
     {
         user_shared_data = ptr;
         user_shared_data->SystemCall = 1;
+        user_shared_data->LargePageMinimum = get_large_page_size();
     }
     return &mapping->obj;
 }
@@ -32,6 +32,7 @@
 #include <sys/types.h>
 #include <sys/time.h>
 #include <sys/socket.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <poll.h>
 #ifdef HAVE_SYS_PARAM_H
@@ -690,6 +691,9 @@ struct process *create_process( int fd, struct process *parent, unsigned int fla
     process->rawinput_kbd    = NULL;
     memset( &process->image_info, 0, sizeof(process->image_info) );
     process->esync_fd        = -1;
+    process->shm_fd          = -1;
+    process->shm             = NULL;
+    memset( process->shm_used, 0, sizeof(process->shm_used) );
     list_init( &process->kernel_object );
     list_init( &process->thread_list );
     list_init( &process->locks );
@@ -796,7 +800,50 @@ static void process_destroy( struct object *obj )
     free( process->rawinput_devices );
     free( process->dir_cache );
     free( process->image );
-    if (do_esync()) close( process->esync_fd );
+    if (do_esync()) esync_close_fd( process->esync_fd );
+    if (process->shm) munmap( process->shm, PROCESS_SHM_SIZE );
+    if (process->shm_fd != -1) close( process->shm_fd );
+}
+
+/* allocate a slot in the process shared memory for a thread */
+thread_shm_t *alloc_thread_shm( struct process *process, unsigned int *slot )
+{
+    unsigned int i, bit;
+
+    *slot = 0;
+    if (!process->shm)
+    {
+        void *ptr;
+        int fd;
+
+        if ((fd = create_temp_file( PROCESS_SHM_SIZE )) == -1) return NULL;
+        if ((ptr = mmap( NULL, PROCESS_SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 )) == MAP_FAILED)
+        {
+            close( fd );
+            return NULL;
+        }
+        process->shm_fd = fd;
+        process->shm = ptr;
+        process->shm_used[0] = 1;  /* slot 0 means no slot */
+    }
+
+    for (i = 0; i < ARRAY_SIZE(process->shm_used); i++)
+    {
+        if (process->shm_used[i] == ~0u) continue;
+        for (bit = 0; process->shm_used[i] & (1u << bit); bit++) ;
+        process->shm_used[i] |= 1u << bit;
+        *slot = i * 32 + bit;
+        return (thread_shm_t *)((char *)process->shm + *slot * THREAD_SHM_SLOT_SIZE);
+    }
+    return NULL;
+}
+
+/* free a thread slot in the process shared memory */
+void free_thread_shm( struct process *process, unsigned int slot )
+{
+    if (!slot) return;
+    memset( (char *)process->shm + slot * THREAD_SHM_SLOT_SIZE, 0, THREAD_SHM_SLOT_SIZE );
+    process->shm_used[slot / 32] &= ~(1u << (slot % 32));
 }
 
 /* dump a process on stdout for debugging purposes */
@@ -1483,6 +1530,20 @@ DECL_HANDLER(terminate_process)
     release_object( process );
 }
 
+/* retrieve the fd of the process shared memory */
+DECL_HANDLER(get_process_shm)
+{
+    struct process *process = current->process;
+
+    if (process->shm_fd == -1)
+    {
+        set_error( STATUS_NOT_SUPPORTED );
+        return;
+    }
+    reply->size = PROCESS_SHM_SIZE;
+    send_client_fd( process, process->shm_fd, 0 );
+}
+
 /* fetch information about a process */
 DECL_HANDLER(get_process_info)
 {
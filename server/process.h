@@ -86,6 +86,9 @@ struct process
     struct list          kernel_object;   /* list of kernel object pointers */
     pe_image_info_t      image_info;      /* main exe image info */
     int                  esync_fd;        /* esync file descriptor (signaled on exit) */
+    int                  shm_fd;          /* fd of the shared memory published to the client */
+    void                *shm;             /* shared memory mapping in the server */
+    unsigned int         shm_used[PROCESS_SHM_SIZE / THREAD_SHM_SLOT_SIZE / 32]; /* bitmap of used slots */
 };
 
 /* process functions */
@@ -115,6 +118,8 @@ extern void kill_process( struct process *process, int violent_death );
 extern void kill_console_processes( struct thread *renderer, int exit_code );
 extern void detach_debugged_processes( struct debug_obj *debug_obj, int exit_code );
 extern void enum_processes( int (*cb)(struct process*, void*), void *user);
+extern thread_shm_t *alloc_thread_shm( struct process *process, unsigned int *slot );
+extern void free_thread_shm( struct process *process, unsigned int slot );
 
 /* console functions */
 extern struct thread *console_get_renderer( struct console *console );
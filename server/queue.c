@@ -149,6 +149,7 @@ struct msg_queue
     unsigned int           ignore_post_msg; /* ignore post messages newer than this unique id */
     int                    esync_fd;        /* esync file descriptor (signalled on message) */
     int                    esync_in_msgwait; /* our thread is currently waiting on us */
+    thread_shm_t          *shm;             /* owner thread shared memory */
 };
 
 struct hotkey
@@ -323,6 +324,7 @@ static struct msg_queue *create_msg_queue( struct thread *thread, struct thread_
         queue->ignore_post_msg = 0;
         queue->esync_fd        = -1;
         queue->esync_in_msgwait = 0;
+        queue->shm             = thread->shm;
         list_init( &queue->send_result );
         list_init( &queue->callback_result );
         list_init( &queue->pending_timers );
@@ -338,11 +340,26 @@ static struct msg_queue *create_msg_queue( struct thread *thread, struct thread_
     return queue;
 }
 
+/* publish the queue bits to the owner thread shared memory */
+static void update_queue_shm( struct msg_queue *queue )
+{
+    thread_shm_t *shm = queue->shm;
+
+    if (!shm) return;
+    SHARED_WRITE_BEGIN( shm )
+    {
+        shm->wake_bits    = queue->wake_bits;
+        shm->changed_bits = queue->changed_bits;
+    }
+    SHARED_WRITE_END( shm );
+}
+
 /* free the message queue of a thread at thread exit */
 void free_msg_queue( struct thread *thread )
 {
     remove_thread_hooks( thread );
     if (!thread->queue) return;
+    thread->queue->shm = NULL;  /* the slot is released with the thread */
     release_object( thread->queue );
     thread->queue = NULL;
 }
@@ -607,6 +624,7 @@ static inline void set_queue_bits( struct msg_queue *queue, unsigned int bits )
     }
     queue->wake_bits |= bits;
     queue->changed_bits |= bits;
+    update_queue_shm( queue );
     if (is_signaled( queue )) wake_up( &queue->obj, 0 );
 }
 
@@ -615,6 +633,7 @@ static inline void clear_queue_bits( struct msg_queue *queue, unsigned int bits
 {
     queue->wake_bits &= ~bits;
     queue->changed_bits &= ~bits;
+    update_queue_shm( queue );
     if (!(queue->wake_bits & (QS_KEY | QS_MOUSEBUTTON)))
     {
         if (queue->keystate_lock) unlock_input_keystate( queue->input );
@@ -1230,7 +1249,7 @@ static void msg_queue_destroy( struct object *obj )
     release_object( queue->input );
     if (queue->hooks) release_object( queue->hooks );
     if (queue->fd) release_object( queue->fd );
-    if (do_esync()) close( queue->esync_fd );
+    if (do_esync()) esync_close_fd( queue->esync_fd );
 }
 
 static void msg_queue_poll_event( struct fd *fd, int event )
@@ -2735,6 +2754,7 @@ DECL_HANDLER(get_queue_status)
         reply->wake_bits    = queue->wake_bits;
         reply->changed_bits = queue->changed_bits;
         queue->changed_bits &= ~req->clear_bits;
+        update_queue_shm( queue );
 
         if (do_esync() && !is_signaled( queue ))
             esync_clear( queue->esync_fd );
@@ -2919,6 +2939,7 @@ DECL_HANDLER(get_message)
     }
     if (filter & QS_INPUT) queue->changed_bits &= ~QS_INPUT;
     if (filter & QS_PAINT) queue->changed_bits &= ~QS_PAINT;
+    update_queue_shm( queue );
 
     /* then check for posted messages */
     if ((filter & QS_POSTMESSAGE) &&
@@ -33,8 +33,10 @@
 #include <stdarg.h>
 #include <string.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #include "ntstatus.h"
@@ -83,13 +85,18 @@ struct key
     int               last_subkey; /* last in use subkey */
     int               nb_subkeys;  /* count of allocated subkeys */
     struct key      **subkeys;     /* subkeys array */
+    struct name_index *subkey_index; /* hash index of subkeys, for keys with many subkeys */
     struct key       *wow6432node; /* Wow6432Node subkey */
     int               last_value;  /* last in use value */
     int               nb_values;   /* count of allocated values in array */
     struct key_value *values;      /* values array */
+    struct name_index *value_index; /* hash index of values, for keys with many values */
     unsigned int      flags;       /* flags */
     timeout_t         modif;       /* last modification time */
     struct list       notify_list; /* list of notifications */
+    struct list       journal_entry; /* entry in the list of keys with changes not yet journaled */
+    const struct hive *hive;       /* hive holding the contents of the key, if not loaded yet */
+    unsigned int      hive_offset; /* offset of the key in the hive, 0 once loaded */
 };
 
 /* key flags */
@@ -114,6 +121,73 @@ struct key_value
 
 #define MIN_SUBKEYS  8   /* min. number of allocated subkeys per key */
 #define MIN_VALUES   8   /* min. number of allocated values per key */
+#define MIN_INDEXED  64  /* min. number of subkeys or values to build a hash index */
+
+/* hash index of the subkeys or values of a key; the sorted arrays remain the
+ * reference for enumeration, the index maps names to positions in them */
+struct name_index_slot
+{
+    const WCHAR      *name;        /* name of the entry, which also identifies it */
+    data_size_t       len;         /* length of the name */
+    int               pos;         /* cached position + 1 in the array, 0 if free, -1 if deleted */
+};
+
+struct name_index
+{
+    unsigned int      size;        /* number of slots, a power of 2 */
+    unsigned int      used;        /* number of used or deleted slots */
+    struct name_index_slot slots[1];
+};
+
+/* Binary hive files cache the contents of a branch file in a form that can be mapped
+ * at startup. Keys are loaded from the hive one level at a time when first accessed;
+ * the text file remains the reference, the hive is only used if it matches it. */
+#define HIVE_MAGIC   0x45564948  /* "HIVE" */
+#define HIVE_VERSION 1
+
+struct hive_header
+{
+    unsigned int     magic;        /* HIVE_MAGIC */
+    unsigned int     version;      /* HIVE_VERSION */
+    unsigned __int64 file_size;    /* size of the branch file saved along with the hive */
+    unsigned __int64 file_inode;   /* inode of the branch file */
+    unsigned __int64 file_mtime;   /* modification time of the branch file, in ns */
+    unsigned int     prefix_type;  /* prefix type at the time of the save */
+    unsigned int     root;         /* offset of the branch root key */
+};
+
+struct hive_key
+{
+    timeout_t        modif;        /* last modification time */
+    unsigned int     flags;        /* key flags (only KEY_SYMLINK) */
+    unsigned int     namelen;      /* length of the key name */
+    unsigned int     name;         /* offset of the key name */
+    unsigned int     classlen;     /* length of the class name */
+    unsigned int     class;        /* offset of the class name */
+    unsigned int     subkey_count; /* number of subkeys */
+    unsigned int     subkeys;      /* offset of the array of subkey offsets, in name order */
+    unsigned int     value_count;  /* number of values */
+    unsigned int     values;       /* offset of the array of values, in name order */
+    unsigned int     __pad;
+};
+
+struct hive_value
+{
+    unsigned int     type;         /* value type */
+    unsigned int     namelen;      /* length of the value name */
+    unsigned int     name;         /* offset of the value name */
+    unsigned int     len;          /* length of the value data */
+    unsigned int     data;         /* offset of the value data */
+};
+
+/* a mapped hive file, kept as long as the server runs */
+struct hive
+{
+    const char      *base;         /* start of the mapping */
+    size_t           size;         /* size of the mapping */
+};
+
+typedef void (*get_entry_name_func)( const struct key *key, int pos, struct unicode_str *name );
 
 #define MAX_NAME_LEN  256    /* max. length of a key name */
 #define MAX_VALUE_LEN 16383  /* max. length of a value name */
@@ -131,19 +205,33 @@ static const WCHAR symlink_value[] = {'S','y','m','b','o','l','i','c','L','i','n
 static const struct unicode_str symlink_str = { symlink_value, sizeof(symlink_value) };
 
 static void set_periodic_save_timer(void);
-static struct key_value *find_value( const struct key *key, const struct unicode_str *name, int *index );
+static struct key_value *find_value( struct key *key, const struct unicode_str *name, int *index );
+static void load_hive_key( struct key *key );
+static void get_value_name( const struct key *key, int pos, struct unicode_str *name );
 
 /* information about where to save a registry branch */
 struct save_branch_info
 {
     struct key  *key;
     const char  *path;
+    FILE        *journal;      /* journal of the changes since the last full save */
+    int          compact;      /* a full save is needed, the journal cannot describe the changes */
+    pid_t        saver_pid;    /* process doing a full save in the background */
 };
 
 #define MAX_SAVE_BRANCH_INFO 3
 static int save_branch_count;
 static struct save_branch_info save_branch_info[MAX_SAVE_BRANCH_INFO];
 
+/* Changes are appended to a per-branch journal file at each periodic save, and
+ * replayed on top of the branch file at startup. Once the journal gets too big,
+ * the branch file is rewritten by a forked process, and the journal is rotated
+ * so that the old one can be removed once the new branch file is in place. */
+static struct list journal_keys = LIST_INIT( journal_keys );  /* keys with changes to journal */
+static int journal_enabled;  /* not while loading the initial registry files */
+
+#define MIN_JOURNAL_COMPACT_SIZE (1024 * 1024)  /* min. journal size before compacting */
+
 unsigned int supported_machines_count = 0;
 unsigned short supported_machines[8];
 unsigned short native_machine = 0;
@@ -286,12 +374,162 @@ static void dump_value( const struct key_value *value, FILE *f )
     fputc( '\n', f );
 }
 
+static void get_subkey_name( const struct key *key, int pos, struct unicode_str *name )
+{
+    name->str = key->subkeys[pos]->obj.name->name;
+    name->len = key->subkeys[pos]->obj.name->len;
+}
+
+static void get_value_name( const struct key *key, int pos, struct unicode_str *name )
+{
+    name->str = key->values[pos].name;
+    name->len = key->values[pos].namelen;
+}
+
+static void name_index_add( struct name_index *index, const struct unicode_str *name, int pos )
+{
+    unsigned int slot = hash_strW( name->str, name->len, index->size );
+
+    while (index->slots[slot].pos > 0) slot = (slot + 1) & (index->size - 1);
+    if (!index->slots[slot].pos) index->used++;
+    index->slots[slot].name = name->str;
+    index->slots[slot].len  = name->len;
+    index->slots[slot].pos  = pos + 1;
+}
+
+/* build the index of count entries; the name of the entry at new_pos, if any, is passed explicitly */
+static struct name_index *create_name_index( const struct key *key, int count, get_entry_name_func get_name,
+                                             int new_pos, const struct unicode_str *new_name )
+{
+    struct name_index *index;
+    struct unicode_str name;
+    unsigned int size = 2 * MIN_INDEXED;
+    int pos;
+
+    while (size < 2 * count) size *= 2;
+    if (!(index = calloc( 1, offsetof( struct name_index, slots[size] ) ))) return NULL;
+    index->size = size;
+    for (pos = 0; pos < count; pos++)
+    {
+        if (pos == new_pos) name = *new_name;
+        else get_name( key, pos, &name );
+        name_index_add( index, &name, pos );
+    }
+    return index;
+}
+
+/* return the position of an indexed entry; positions shift as entries are inserted and
+ * removed, so the cached one is checked and looked up again in the sorted array if stale */
+static int name_index_get_pos( struct name_index_slot *slot, const struct key *key, int count,
+                               get_entry_name_func get_name )
+{
+    int min = 0, max = count - 1, pos = slot->pos - 1, res;
+    struct unicode_str str;
+
+    if (pos < count)
+    {
+        get_name( key, pos, &str );
+        if (str.str == slot->name) return pos;
+    }
+    while (min <= max)
+    {
+        pos = (min + max) / 2;
+        get_name( key, pos, &str );
+        if (str.str == slot->name) break;
+        res = memicmp_strW( str.str, slot->name, min( str.len, slot->len ) );
+        if (!res) res = str.len - slot->len;
+        if (res > 0) max = pos - 1;
+        else min = pos + 1;
+    }
+    assert( min <= max );
+    slot->pos = pos + 1;
+    return pos;
+}
+
+/* look up a name in the index and return its position, or -1 if not found */
+static int name_index_find( struct name_index *index, const struct key *key, int count,
+                            get_entry_name_func get_name, const struct unicode_str *name )
+{
+    unsigned int slot = hash_strW( name->str, name->len, index->size );
+    struct name_index_slot *entry;
+
+    while ((entry = &index->slots[slot])->pos)
+    {
+        if (entry->pos > 0 && entry->len == name->len && !memicmp_strW( entry->name, name->str, name->len ))
+            return name_index_get_pos( entry, key, count, get_name );
+        slot = (slot + 1) & (index->size - 1);
+    }
+    return -1;
+}
+
+/* update the index once an entry has been inserted in the array at position pos */
+static void name_index_insert( struct name_index **index_ptr, const struct key *key, int count,
+                               get_entry_name_func get_name, int pos, const struct unicode_str *name )
+{
+    struct name_index *index = *index_ptr;
+
+    if (!index || 4 * (index->used + 1) > 3 * index->size)
+    {
+        if (!index && count < MIN_INDEXED) return;
+        free( index );
+        *index_ptr = create_name_index( key, count, get_name, pos, name );
+        return;
+    }
+    name_index_add( index, name, pos );
+}
+
+/* remove an entry from the index; the name must be the one stored in the entry */
+static void name_index_remove( struct name_index *index, const struct unicode_str *name )
+{
+    unsigned int slot;
+
+    if (!index) return;
+    slot = hash_strW( name->str, name->len, index->size );
+    while (index->slots[slot].pos <= 0 || index->slots[slot].name != name->str)
+    {
+        assert( index->slots[slot].pos );
+        slot = (slot + 1) & (index->size - 1);
+    }
+    index->slots[slot].pos = -1;
+}
+
+/* find the position of a subkey that is being unlinked, and whose object name is already cleared */
+static int get_subkey_pos( const struct key *parent, const struct key *key, const struct unicode_str *name )
+{
+    int min = 0, max = parent->last_subkey, pos, res;
+    const struct object_name *obj_name;
+
+    while (min <= max)
+    {
+        pos = (min + max) / 2;
+        if (parent->subkeys[pos] == key) return pos;
+        obj_name = parent->subkeys[pos]->obj.name;
+        res = memicmp_strW( obj_name->name, name->str, min( obj_name->len, name->len ) );
+        if (!res) res = obj_name->len - name->len;
+        if (res > 0) max = pos - 1;
+        else min = pos + 1;
+    }
+    return parent->last_subkey + 1;
+}
+
 /* find the named child of a given key and return its index */
-static struct key *find_subkey( const struct key *key, const struct unicode_str *name, int *index )
+/* index may be NULL if the insertion index is not needed */
+static struct key *find_subkey( struct key *key, const struct unicode_str *name, int *index )
 {
     int i, min, max, res;
     data_size_t len;
 
+    load_hive_key( key );
+    if (key->subkey_index)
+    {
+        if ((i = name_index_find( key->subkey_index, key, key->last_subkey + 1, get_subkey_name, name )) != -1)
+        {
+            if (index) *index = i;
+            return key->subkeys[i];
+        }
+        if (!index) return NULL;
+    }
+
     min = 0;
     max = key->last_subkey;
     while (min <= max)
@@ -302,13 +540,13 @@ static struct key *find_subkey( const struct key *key, const struct unicode_str
         if (!res) res = key->subkeys[i]->obj.name->len - name->len;
         if (!res)
         {
-            *index = i;
+            if (index) *index = i;
             return key->subkeys[i];
         }
         if (res > 0) max = i - 1;
         else min = i + 1;
     }
-    *index = min;  /* this is where we should insert it */
+    if (index) *index = min;  /* this is where we should insert it */
     return NULL;
 }
 
@@ -337,29 +575,36 @@ static int grow_subkeys( struct key *key )
     return 1;
 }
 
+/* save a registry key and its values to a text file */
+static void save_key( struct key *key, const struct key *base, FILE *f )
+{
+    int i;
+
+    fprintf( f, "\n[" );
+    if (key != base) dump_path( key, base, f );
+    fprintf( f, "] %u\n", (unsigned int)((key->modif - ticks_1601_to_1970) / TICKS_PER_SEC) );
+    fprintf( f, "#time=%x%08x\n", (unsigned int)(key->modif >> 32), (unsigned int)key->modif );
+    if (key->class)
+    {
+        fprintf( f, "#class=\"" );
+        dump_strW( key->class, key->classlen, f, "\"\"" );
+        fprintf( f, "\"\n" );
+    }
+    if (key->flags & KEY_SYMLINK) fputs( "#link\n", f );
+    for (i = 0; i <= key->last_value; i++) dump_value( &key->values[i], f );
+}
+
 /* save a registry and all its subkeys to a text file */
-static void save_subkeys( const struct key *key, const struct key *base, FILE *f )
+static void save_subkeys( struct key *key, const struct key *base, FILE *f )
 {
     int i;
 
     if (key->flags & KEY_VOLATILE) return;
+    load_hive_key( key );
     /* save key if it has either some values or no subkeys, or needs special options */
     /* keys with no values but subkeys are saved implicitly by saving the subkeys */
     if ((key->last_value >= 0) || (key->last_subkey == -1) || key->class || (key->flags & KEY_SYMLINK))
-    {
-        fprintf( f, "\n[" );
-        if (key != base) dump_path( key, base, f );
-        fprintf( f, "] %u\n", (unsigned int)((key->modif - ticks_1601_to_1970) / TICKS_PER_SEC) );
-        fprintf( f, "#time=%x%08x\n", (unsigned int)(key->modif >> 32), (unsigned int)key->modif );
-        if (key->class)
-        {
-            fprintf( f, "#class=\"" );
-            dump_strW( key->class, key->classlen, f, "\"\"" );
-            fprintf( f, "\"\n" );
-        }
-        if (key->flags & KEY_SYMLINK) fputs( "#link\n", f );
-        for (i = 0; i <= key->last_value; i++) dump_value( &key->values[i], f );
-    }
+        save_key( key, base, f );
     for (i = 0; i <= key->last_subkey; i++) save_subkeys( key->subkeys[i], base, f );
 }
 
@@ -480,7 +725,6 @@ static struct object *key_lookup_name( struct object *obj, struct unicode_str *n
     struct key *found, *key = (struct key *)obj;
     struct unicode_str tmp;
     data_size_t next;
-    int index;
 
     assert( obj->ops == &key_ops );
 
@@ -499,7 +743,7 @@ static struct object *key_lookup_name( struct object *obj, struct unicode_str *n
 
         if (!name->len && (attr & OBJ_OPENLINK)) return NULL;
 
-        if (!(value = find_value( key, &symlink_str, &index )) ||
+        if (!(value = find_value( key, &symlink_str, NULL )) ||
             value->len < sizeof(WCHAR) || *(WCHAR *)value->data != '\\')
         {
             set_error( STATUS_OBJECT_NAME_NOT_FOUND );
@@ -544,13 +788,13 @@ static struct object *key_lookup_name( struct object *obj, struct unicode_str *n
     for (next = tmp.len; next < name->len; next += sizeof(WCHAR))
         if (name->str[next / sizeof(WCHAR)] != '\\') break;
 
-    if (!(found = find_subkey( key, &tmp, &index )))
+    if (!(found = find_subkey( key, &tmp, NULL )))
     {
         if ((key->flags & KEY_WOWSHARE) && (attr & OBJ_KEY_WOW64))
         {
             /* try in the 64-bit parent */
             key = get_parent( key );
-            if (!(found = find_subkey( key, &tmp, &index ))) return grab_object( key );
+            if (!(found = find_subkey( key, &tmp, NULL ))) return grab_object( key );
         }
     }
 
@@ -567,8 +811,11 @@ static struct object *key_lookup_name( struct object *obj, struct unicode_str *n
     {
         name->str += next / sizeof(WCHAR);
         name->len -= next;
-        if ((attr & OBJ_KEY_WOW64) && found->wow6432node && !is_wow6432node( name->str, name->len ))
-            found = found->wow6432node;
+        if (attr & OBJ_KEY_WOW64)
+        {
+            load_hive_key( found );
+            if (found->wow6432node && !is_wow6432node( name->str, name->len )) found = found->wow6432node;
+        }
     }
     else
     {
@@ -583,7 +830,7 @@ static int key_link_name( struct object *obj, struct object_name *name, struct o
     struct key *key = (struct key *)obj;
     struct key *parent_key = (struct key *)parent;
     struct unicode_str tmp;
-    int i, index;
+    int index;
 
     if (parent->ops != &key_ops)
     {
@@ -602,9 +849,11 @@ static int key_link_name( struct object *obj, struct object_name *name, struct o
     tmp.len = name->len;
     find_subkey( parent_key, &tmp, &index );
 
-    for (i = ++parent_key->last_subkey; i > index; i--)
-        parent_key->subkeys[i] = parent_key->subkeys[i - 1];
+    memmove( parent_key->subkeys + index + 1, parent_key->subkeys + index,
+             (++parent_key->last_subkey - index) * sizeof(*parent_key->subkeys) );
     parent_key->subkeys[index] = (struct key *)grab_object( key );
+    name_index_insert( &parent_key->subkey_index, parent_key, parent_key->last_subkey + 1,
+                       get_subkey_name, index, &tmp );
     if (is_wow6432node( name->name, name->len ) &&
         !is_wow6432node( parent_key->obj.name->name, parent_key->obj.name->len ))
         parent_key->wow6432node = key;
@@ -616,6 +865,7 @@ static void key_unlink_name( struct object *obj, struct object_name *name )
 {
     struct key *key = (struct key *)obj;
     struct key *parent = (struct key *)name->parent;
+    struct unicode_str tmp;
     int i, nb_subkeys;
 
     if (!parent) return;
@@ -626,9 +876,12 @@ static void key_unlink_name( struct object *obj, struct object_name *name )
         return;
     }
 
-    for (i = 0; i <= parent->last_subkey; i++) if (parent->subkeys[i] == key) break;
+    tmp.str = name->name;
+    tmp.len = name->len;
+    i = get_subkey_pos( parent, key, &tmp );
     assert( i <= parent->last_subkey );
-    for ( ; i < parent->last_subkey; i++) parent->subkeys[i] = parent->subkeys[i + 1];
+    name_index_remove( parent->subkey_index, &tmp );
+    memmove( parent->subkeys + i, parent->subkeys + i + 1, (parent->last_subkey - i) * sizeof(*parent->subkeys) );
     parent->last_subkey--;
     name->parent = NULL;
     if (parent->wow6432node == key) parent->wow6432node = NULL;
@@ -670,12 +923,15 @@ static void key_destroy( struct object *obj )
         free( key->values[i].data );
     }
     free( key->values );
+    free( key->value_index );
     for (i = 0; i <= key->last_subkey; i++)
     {
         key->subkeys[i]->obj.name->parent = NULL;
         release_object( key->subkeys[i] );
     }
     free( key->subkeys );
+    free( key->subkey_index );
+    list_remove( &key->journal_entry );
     /* unconditionally notify everything waiting on this key */
     while ((ptr = list_head( &key->notify_list )))
     {
@@ -704,12 +960,17 @@ static struct key *create_key_object( struct object *parent, const struct unicod
             key->last_subkey = -1;
             key->nb_subkeys  = 0;
             key->subkeys     = NULL;
+            key->subkey_index = NULL;
             key->wow6432node = NULL;
             key->nb_values   = 0;
             key->last_value  = -1;
             key->values      = NULL;
+            key->value_index = NULL;
             key->modif       = modif;
+            key->hive        = NULL;
+            key->hive_offset = 0;
             list_init( &key->notify_list );
+            list_init( &key->journal_entry );
 
             if (options & REG_OPTION_CREATE_LINK) key->flags |= KEY_SYMLINK;
             if (options & REG_OPTION_VOLATILE) key->flags |= KEY_VOLATILE;
@@ -761,11 +1022,107 @@ static void check_notify( struct key *key, unsigned int change, int not_subtree
     }
 }
 
+/* find the saved branch that contains a key */
+static struct save_branch_info *get_save_branch( const struct key *key )
+{
+    int i;
+
+    for ( ; key; key = get_parent( key ))
+        for (i = 0; i < save_branch_count; i++)
+            if (save_branch_info[i].key == key) return &save_branch_info[i];
+    return NULL;
+}
+
+static void get_journal_path( const struct save_branch_info *branch, int old, char *buffer, size_t size )
+{
+    snprintf( buffer, size, "%s.journal%s", branch->path, old ? ".old" : "" );
+}
+
+/* open the journal of a branch for appending, relative to the config dir */
+static FILE *open_journal( struct save_branch_info *branch )
+{
+    struct stat st;
+    char path[64];
+    int fd;
+
+    if (branch->journal) return branch->journal;
+
+    get_journal_path( branch, 0, path, sizeof(path) );
+    if ((fd = openat( config_dir_fd, path, O_WRONLY | O_CREAT | O_APPEND, 0666 )) == -1) return NULL;
+    if (!(branch->journal = fdopen( fd, "a" )))
+    {
+        close( fd );
+        return NULL;
+    }
+    if (!fstat( fd, &st ) && !st.st_size)
+    {
+        fprintf( branch->journal, "WINE REGISTRY Version 2\n" );
+        fprintf( branch->journal, ";; Changes to %s since it was last saved\n", branch->path );
+    }
+    return branch->journal;
+}
+
+/* remember that a key has changes to journal */
+static void journal_key( struct key *key )
+{
+    if (!journal_enabled || (key->flags & KEY_VOLATILE)) return;
+    if (list_empty( &key->journal_entry )) list_add_tail( &journal_keys, &key->journal_entry );
+}
+
+/* write the pending changes to the journals */
+static void flush_journal_keys(void)
+{
+    struct save_branch_info *branch;
+    struct key *key, *next;
+    FILE *f;
+
+    LIST_FOR_EACH_ENTRY_SAFE( key, next, &journal_keys, struct key, journal_entry )
+    {
+        list_remove( &key->journal_entry );
+        list_init( &key->journal_entry );
+        if (!(branch = get_save_branch( key ))) continue;
+        if (!(f = open_journal( branch ))) branch->compact = 1;
+        else save_key( key, branch->key, f );
+    }
+}
+
+/* journal the deletion of a key; this is written right away, as the key path is lost once
+ * it is unlinked, but the pending changes to other keys can still be written afterwards
+ * since they can only be to keys outside of the deleted subtree */
+static void journal_delete( struct key *key )
+{
+    struct save_branch_info *branch;
+    FILE *f;
+
+    list_remove( &key->journal_entry );
+    list_init( &key->journal_entry );
+    if (!journal_enabled || (key->flags & KEY_VOLATILE)) return;
+    if (!(branch = get_save_branch( key )) || key == branch->key) return;
+
+    if (!(f = open_journal( branch )))
+    {
+        branch->compact = 1;
+        return;
+    }
+    fprintf( f, "\n[" );
+    dump_path( key, branch->key, f );
+    fprintf( f, "]\n#delete\n" );
+}
+
+/* request a full save of the branch containing a key */
+static void journal_compact( const struct key *key )
+{
+    struct save_branch_info *branch;
+
+    if (journal_enabled && (branch = get_save_branch( key ))) branch->compact = 1;
+}
+
 /* update key modification time */
 static void touch_key( struct key *key, unsigned int change )
 {
     key->modif = current_time;
     make_dirty( key );
+    if (change & REG_NOTIFY_CHANGE_LAST_SET) journal_key( key );
 
     /* do notifications */
     check_notify( key, change, 1 );
@@ -775,9 +1132,10 @@ static void touch_key( struct key *key, unsigned int change )
 /* get the wow6432node key if any, grabbing it and releasing the original key */
 static struct key *grab_wow6432node( struct key *key )
 {
-    struct key *ret = key->wow6432node;
+    struct key *ret;
 
-    if (!ret) return key;
+    load_hive_key( key );
+    if (!(ret = key->wow6432node)) return key;
     if (ret->flags & KEY_WOWSHARE) return key;
     grab_object( ret );
     release_object( key );
@@ -789,11 +1147,11 @@ static struct key *get_wow6432node( struct key *key )
 {
     struct key *parent, *ret;
     struct unicode_str name;
-    int index;
 
     if (!key)
         return NULL;
 
+    load_hive_key( key );
     if (key->wow6432node)
         return key->wow6432node;
 
@@ -806,7 +1164,7 @@ static struct key *get_wow6432node( struct key *key )
 
     name.str = key->obj.name->name;
     name.len = key->obj.name->len;
-    return find_subkey( ret, &name, &index );
+    return find_subkey( ret, &name, NULL );
 }
 
 /* open a subkey */
@@ -867,6 +1225,7 @@ static struct key *create_key( struct key *parent, const struct unicode_str *nam
     else
     {
         if (parent) touch_key( get_parent( key ), REG_NOTIFY_CHANGE_NAME );
+        journal_key( key );
         if (debug_level > 1) dump_operation( key, NULL, "Create" );
     }
     return key;
@@ -919,6 +1278,7 @@ static void enum_key( struct key *key, int index, int info_class, struct enum_ke
 
     if (index != -1)  /* -1 means use the specified key directly */
     {
+        load_hive_key( key );
         if ((index < 0) || (index > key->last_subkey))
         {
             set_error( STATUS_NO_MORE_ENTRIES );
@@ -946,6 +1306,7 @@ static void enum_key( struct key *key, int index, int info_class, struct enum_ke
         break;
     case KeyFullInformation:
     case KeyCachedInformation:
+        load_hive_key( key );
         for (i = 0; i <= key->last_subkey; i++)
         {
             if (key->subkeys[i]->obj.name->len > max_subkey) max_subkey = key->subkeys[i]->obj.name->len;
@@ -969,8 +1330,17 @@ static void enum_key( struct key *key, int index, int info_class, struct enum_ke
         set_error( STATUS_INVALID_PARAMETER );
         return;
     }
-    reply->subkeys = key->last_subkey + 1;
-    reply->values  = key->last_value + 1;
+    if (key->hive_offset)  /* not loaded yet, the hive knows the counts */
+    {
+        const struct hive_key *hive_key = (const struct hive_key *)(key->hive->base + key->hive_offset);
+        reply->subkeys = hive_key->subkey_count;
+        reply->values  = hive_key->value_count;
+    }
+    else
+    {
+        reply->subkeys = key->last_subkey + 1;
+        reply->values  = key->last_value + 1;
+    }
     reply->modif   = key->modif;
     reply->total   = namelen + classlen;
 
@@ -1049,10 +1419,23 @@ static void rename_key( struct key *key, const struct unicode_str *new_name )
     }
     parent->subkeys[index] = key;
 
+    if (parent->subkey_index)
+    {
+        struct unicode_str str;
+
+        str.str = key->obj.name->name;
+        str.len = key->obj.name->len;
+        name_index_remove( parent->subkey_index, &str );
+        str.str = new_name_ptr->name;
+        str.len = new_name_ptr->len;
+        name_index_insert( &parent->subkey_index, parent, parent->last_subkey + 1, get_subkey_name, index, &str );
+    }
+
     free( key->obj.name );
     key->obj.name = new_name_ptr;
 
     if (debug_level > 1) dump_operation( key, NULL, "Rename" );
+    journal_compact( key );
     touch_key( key, REG_NOTIFY_CHANGE_NAME );
 }
 
@@ -1074,6 +1457,7 @@ static int delete_key( struct key *key, int recurse )
         return 0;
     }
 
+    load_hive_key( key );
     if (recurse)
     {
         while (key->last_subkey >= 0)
@@ -1086,6 +1470,7 @@ static int delete_key( struct key *key, int recurse )
     }
 
     if (debug_level > 1) dump_operation( key, NULL, "Delete" );
+    journal_delete( key );
     key->flags |= KEY_DELETED;
     unlink_named_object( &key->obj );
     touch_key( parent, REG_NOTIFY_CHANGE_NAME );
@@ -1118,11 +1503,23 @@ static int grow_values( struct key *key )
 }
 
 /* find the named value of a given key and return its index in the array */
-static struct key_value *find_value( const struct key *key, const struct unicode_str *name, int *index )
+/* index may be NULL if the insertion index is not needed */
+static struct key_value *find_value( struct key *key, const struct unicode_str *name, int *index )
 {
     int i, min, max, res;
     data_size_t len;
 
+    load_hive_key( key );
+    if (key->value_index)
+    {
+        if ((i = name_index_find( key->value_index, key, key->last_value + 1, get_value_name, name )) != -1)
+        {
+            if (index) *index = i;
+            return &key->values[i];
+        }
+        if (!index) return NULL;
+    }
+
     min = 0;
     max = key->last_value;
     while (min <= max)
@@ -1133,13 +1530,13 @@ static struct key_value *find_value( const struct key *key, const struct unicode
         if (!res) res = key->values[i].namelen - name->len;
         if (!res)
         {
-            *index = i;
+            if (index) *index = i;
             return &key->values[i];
         }
         if (res > 0) max = i - 1;
         else min = i + 1;
     }
-    *index = min;  /* this is where we should insert it */
+    if (index) *index = min;  /* this is where we should insert it */
     return NULL;
 }
 
@@ -1147,8 +1544,8 @@ static struct key_value *find_value( const struct key *key, const struct unicode
 static struct key_value *insert_value( struct key *key, const struct unicode_str *name, int index )
 {
     struct key_value *value;
+    struct unicode_str str;
     WCHAR *new_name = NULL;
-    int i;
 
     if (name->len > MAX_VALUE_LEN * sizeof(WCHAR))
     {
@@ -1160,12 +1557,14 @@ static struct key_value *insert_value( struct key *key, const struct unicode_str
         if (!grow_values( key )) return NULL;
     }
     if (name->len && !(new_name = memdup( name->str, name->len ))) return NULL;
-    for (i = ++key->last_value; i > index; i--) key->values[i] = key->values[i - 1];
+    memmove( key->values + index + 1, key->values + index, (++key->last_value - index) * sizeof(*value) );
     value = &key->values[index];
     value->name    = new_name;
     value->namelen = name->len;
     value->len     = 0;
     value->data    = NULL;
+    get_value_name( key, index, &str );
+    name_index_insert( &key->value_index, key, key->last_value + 1, get_value_name, index, &str );
     return value;
 }
 
@@ -1227,7 +1626,6 @@ static void set_value( struct key *key, const struct unicode_str *name,
 static void get_value( struct key *key, const struct unicode_str *name, int *type, data_size_t *len )
 {
     struct key_value *value;
-    int index;
 
     if (key->flags & KEY_PREDEF)
     {
@@ -1235,7 +1633,7 @@ static void get_value( struct key *key, const struct unicode_str *name, int *typ
         return;
     }
 
-    if ((value = find_value( key, name, &index )))
+    if ((value = find_value( key, name, NULL )))
     {
         *type = value->type;
         *len  = value->len;
@@ -1260,6 +1658,7 @@ static void enum_value( struct key *key, int i, int info_class, struct enum_key_
         return;
     }
 
+    load_hive_key( key );
     if (i < 0 || i > key->last_value) set_error( STATUS_NO_MORE_ENTRIES );
     else
     {
@@ -1306,11 +1705,28 @@ static void enum_value( struct key *key, int i, int info_class, struct enum_key_
     }
 }
 
+/* delete all the values of a key, when replaying its journaled state */
+static void clear_values( struct key *key )
+{
+    int i;
+
+    load_hive_key( key );
+    for (i = 0; i <= key->last_value; i++)
+    {
+        free( key->values[i].name );
+        free( key->values[i].data );
+    }
+    key->last_value = -1;
+    free( key->value_index );
+    key->value_index = NULL;
+}
+
 /* delete a value */
 static void delete_value( struct key *key, const struct unicode_str *name )
 {
     struct key_value *value;
-    int i, index, nb_values;
+    struct unicode_str str;
+    int index, nb_values;
 
     if (key->flags & KEY_PREDEF)
     {
@@ -1324,9 +1740,11 @@ static void delete_value( struct key *key, const struct unicode_str *name )
         return;
     }
     if (debug_level > 1) dump_operation( key, value, "Delete" );
+    get_value_name( key, index, &str );
+    name_index_remove( key->value_index, &str );
     free( value->name );
     free( value->data );
-    for (i = index; i < key->last_value; i++) key->values[i] = key->values[i + 1];
+    memmove( key->values + index, key->values + index + 1, (key->last_value - index) * sizeof(*value) );
     key->last_value--;
     touch_key( key, REG_NOTIFY_CHANGE_LAST_SET );
 
@@ -1715,7 +2133,8 @@ static int get_prefix_len( struct key *key, const char *name, struct file_load_i
 
 /* load all the keys from the input file */
 /* prefix_len is the number of key name prefixes to skip, or -1 for autodetection */
-static void load_keys( struct key *key, const char *filename, FILE *f, int prefix_len )
+/* in a journal, each key replaces the previous values, and can be deleted */
+static void load_keys( struct key *key, const char *filename, FILE *f, int prefix_len, int journal )
 {
     struct key *subkey = NULL;
     struct file_load_info info;
@@ -1756,6 +2175,7 @@ static void load_keys( struct key *key, const char *filename, FILE *f, int prefi
             if (prefix_len == -1) prefix_len = get_prefix_len( key, p + 1, &info );
             if (!(subkey = load_key( key, p + 1, prefix_len, &info, &modif )))
                 file_read_error( "Error creating key", &info );
+            else if (journal) clear_values( subkey );
             break;
         case '@':   /* default value */
         case '\"':  /* value */
@@ -1763,7 +2183,13 @@ static void load_keys( struct key *key, const char *filename, FILE *f, int prefi
             else file_read_error( "Value without key", &info );
             break;
         case '#':   /* option */
-            if (subkey) load_key_option( subkey, p, &info );
+            if (subkey && journal && !strcmp( p, "#delete" ))
+            {
+                delete_key( subkey, 1 );
+                release_object( subkey );
+                subkey = NULL;
+            }
+            else if (subkey) load_key_option( subkey, p, &info );
             else if (!load_global_option( p, &info )) goto done;
             break;
         case ';':   /* comment */
@@ -1785,6 +2211,163 @@ static void load_keys( struct key *key, const char *filename, FILE *f, int prefi
     free( info.tmp );
 }
 
+/* get a pointer to a range of a hive, checking that it is within the file */
+static const void *get_hive_data( const struct hive *hive, unsigned int offset, size_t count, size_t size )
+{
+    if (offset > hive->size || count > (hive->size - offset) / size) return NULL;
+    return hive->base + offset;
+}
+
+/* set the state of a key from its hive record; its contents will be loaded on first access */
+static int init_hive_key( struct key *key, const struct hive *hive, unsigned int offset )
+{
+    const struct hive_key *hive_key;
+    const WCHAR *class;
+
+    if ((offset % sizeof(timeout_t)) || !(hive_key = get_hive_data( hive, offset, 1, sizeof(*hive_key) )))
+        return 0;
+    if (hive_key->classlen)
+    {
+        if (!(class = get_hive_data( hive, hive_key->class, hive_key->classlen, 1 ))) return 0;
+        free( key->class );
+        if (!(key->class = memdup( class, hive_key->classlen ))) return 0;
+        key->classlen = hive_key->classlen;
+    }
+    key->modif = hive_key->modif;
+    key->flags |= hive_key->flags & KEY_SYMLINK;
+    key->hive = hive;
+    key->hive_offset = offset;
+    return 1;
+}
+
+/* create the values and subkeys of a key from the hive */
+static void load_hive_key( struct key *key )
+{
+    const struct hive *hive = key->hive;
+    const struct hive_key *hive_key, *hive_subkey;
+    const struct hive_value *hive_values;
+    const unsigned int *hive_subkeys;
+    struct key_value *value;
+    struct key *subkey;
+    struct unicode_str name;
+    const void *data;
+    unsigned int i;
+
+    if (!key->hive_offset) return;
+    hive_key = (const struct hive_key *)(hive->base + key->hive_offset);
+    key->hive_offset = 0;  /* from now on the key is accessed normally */
+
+    if (!(hive_values = get_hive_data( hive, hive_key->values, hive_key->value_count, sizeof(*hive_values) )) ||
+        !(hive_subkeys = get_hive_data( hive, hive_key->subkeys, hive_key->subkey_count, sizeof(*hive_subkeys) )))
+        goto error;
+
+    /* entries are stored in name order, so they are simply appended */
+    for (i = 0; i < hive_key->value_count; i++)
+    {
+        if (!(name.str = get_hive_data( hive, hive_values[i].name, hive_values[i].namelen, 1 )) ||
+            !(data = get_hive_data( hive, hive_values[i].data, hive_values[i].len, 1 )))
+            goto error;
+        name.len = hive_values[i].namelen;
+        if (!(value = insert_value( key, &name, key->last_value + 1 ))) return;
+        value->type = hive_values[i].type;
+        if (hive_values[i].len && !(value->data = memdup( data, hive_values[i].len ))) return;
+        value->len = hive_values[i].len;
+    }
+
+    for (i = 0; i < hive_key->subkey_count; i++)
+    {
+        if (!(hive_subkey = get_hive_data( hive, hive_subkeys[i], 1, sizeof(*hive_subkey) )) ||
+            !hive_subkey->namelen ||
+            !(name.str = get_hive_data( hive, hive_subkey->name, hive_subkey->namelen, 1 )))
+            goto error;
+        name.len = hive_subkey->namelen;
+        if (!(subkey = create_key_object( &key->obj, &name, 0, 0, current_time, NULL ))) goto error;
+        subkey->flags &= ~KEY_DIRTY;
+        if (!init_hive_key( subkey, hive, hive_subkeys[i] ))
+        {
+            release_object( subkey );
+            goto error;
+        }
+        release_object( subkey );
+    }
+    return;
+
+error:
+    set_error( STATUS_REGISTRY_CORRUPT );
+    fprintf( stderr, "wineserver: registry hive is corrupted at key " );
+    dump_path( key, NULL, stderr );
+    fprintf( stderr, "\n" );
+}
+
+/* get the name of the hive file corresponding to a branch file */
+static char *get_hive_path( const char *path )
+{
+    char *ret;
+
+    if ((ret = malloc( strlen(path) + sizeof(".hive") ))) sprintf( ret, "%s.hive", path );
+    return ret;
+}
+
+/* fill the branch file information of a hive header */
+static void get_hive_file_info( const struct stat *st, struct hive_header *header )
+{
+    header->file_size  = st->st_size;
+    header->file_inode = st->st_ino;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+    header->file_mtime = st->st_mtim.tv_sec * (unsigned __int64)1000000000 + st->st_mtim.tv_nsec;
+#else
+    header->file_mtime = st->st_mtime * (unsigned __int64)1000000000;
+#endif
+}
+
+/* map the hive of a branch file, if it is up to date with it */
+static int load_hive( struct key *key, const char *filename )
+{
+    const struct hive_header *header;
+    struct hive_header info;
+    struct hive *hive;
+    struct stat st;
+    char *path;
+    void *base;
+    int fd;
+
+    if (key->last_subkey != -1 || key->last_value != -1) return 0;
+    if (stat( filename, &st ) || !(path = get_hive_path( filename ))) return 0;
+    fd = open( path, O_RDONLY );
+    free( path );
+    if (fd == -1) return 0;
+    get_hive_file_info( &st, &info );
+    if (fstat( fd, &st ) || st.st_size < sizeof(*header) || st.st_size > UINT_MAX ||
+        (base = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 )) == MAP_FAILED)
+    {
+        close( fd );
+        return 0;
+    }
+    close( fd );
+
+    header = base;
+    if (header->magic != HIVE_MAGIC || header->version != HIVE_VERSION ||
+        header->file_size != info.file_size || header->file_inode != info.file_inode ||
+        header->file_mtime != info.file_mtime ||
+        (prefix_type != PREFIX_UNKNOWN && header->prefix_type != prefix_type) ||
+        !(hive = mem_alloc( sizeof(*hive) )))
+        goto failed;
+
+    hive->base = base;
+    hive->size = st.st_size;
+    if (!init_hive_key( key, hive, header->root ))
+    {
+        free( hive );
+        goto failed;
+    }
+    if (prefix_type == PREFIX_UNKNOWN) prefix_type = header->prefix_type;
+    return 1;
+
+failed:
+    munmap( base, st.st_size );
+    return 0;
+}
+
 /* load a part of the registry from a file */
 static void load_registry( struct key *key, obj_handle_t handle )
 {
@@ -1799,21 +2382,40 @@ static void load_registry( struct key *key, obj_handle_t handle )
         FILE *f = fdopen( fd, "r" );
         if (f)
         {
-            load_keys( key, NULL, f, -1 );
+            load_keys( key, NULL, f, -1, 0 );
             fclose( f );
+            make_dirty( key );
+            journal_compact( key );
         }
         else file_set_error();
     }
 }
 
+/* replay a journal of changes on top of an initial registry file */
+static void load_journal( struct save_branch_info *branch, int old )
+{
+    char path[64];
+    FILE *f;
+
+    get_journal_path( branch, old, path, sizeof(path) );
+    if (!(f = fopen( path, "r" ))) return;
+    load_keys( branch->key, path, f, 0, 1 );
+    fclose( f );
+    if (get_error() == STATUS_NOT_REGISTRY_FILE)
+        fprintf( stderr, "%s is not a valid registry journal\n", path );
+    clear_error();
+}
+
 /* load one of the initial registry files */
 static int load_init_registry_from_file( const char *filename, struct key *key )
 {
-    FILE *f;
+    struct save_branch_info *branch;
+    FILE *f = NULL;
+    int hive;
 
-    if ((f = fopen( filename, "r" )))
+    if (!(hive = load_hive( key, filename )) && (f = fopen( filename, "r" )))
     {
-        load_keys( key, filename, f, 0 );
+        load_keys( key, filename, f, 0, 0 );
         fclose( f );
         if (get_error() == STATUS_NOT_REGISTRY_FILE)
         {
@@ -1824,10 +2426,15 @@ static int load_init_registry_from_file( const char *filename, struct key *key )
 
     assert( save_branch_count < MAX_SAVE_BRANCH_INFO );
 
-    save_branch_info[save_branch_count].path = filename;
-    save_branch_info[save_branch_count++].key = (struct key *)grab_object( key );
+    branch = &save_branch_info[save_branch_count++];
+    branch->path = filename;
+    branch->key = (struct key *)grab_object( key );
     make_object_permanent( &key->obj );
-    return (f != NULL);
+    branch->compact = (f != NULL);  /* create the hive at the next periodic save */
+
+    load_journal( branch, 1 );
+    load_journal( branch, 0 );
+    return hive || (f != NULL);
 }
 
 static WCHAR *format_user_registry_path( const struct sid *sid, struct unicode_str *path )
@@ -1970,6 +2577,7 @@ void init_registry(void)
     release_object( hkcu );
 
     /* start the periodic save timer */
+    journal_enabled = 1;
     set_periodic_save_timer();
 
     /* create windows directories */
@@ -2037,6 +2645,108 @@ static void save_registry( struct key *key, obj_handle_t handle )
     }
 }
 
+/* information about a hive being written */
+struct hive_writer
+{
+    FILE            *file;         /* output file */
+    unsigned __int64 pos;          /* current position */
+};
+
+/* append data to a hive and return its offset */
+static unsigned int write_hive_data( struct hive_writer *writer, const void *data, size_t size, size_t align )
+{
+    static const char zero[sizeof(timeout_t)];
+    size_t pad = -writer->pos & (align - 1);
+
+    fwrite( zero, 1, pad, writer->file );
+    fwrite( data, 1, size, writer->file );
+    writer->pos += pad + size;
+    return writer->pos - size;
+}
+
+/* save a key and its subkeys to a hive; subkeys are written first so that their offsets are known */
+static unsigned int save_hive_key( struct hive_writer *writer, struct key *key )
+{
+    struct hive_key hive_key;
+    struct hive_value *hive_values;
+    unsigned int *hive_subkeys;
+    unsigned int ret = 0;
+    int i;
+
+    load_hive_key( key );
+    hive_values = malloc( (key->last_value + 1) * sizeof(*hive_values) + 1 );
+    hive_subkeys = malloc( (key->last_subkey + 1) * sizeof(*hive_subkeys) + 1 );
+    if (!hive_values || !hive_subkeys) goto done;
+
+    memset( &hive_key, 0, sizeof(hive_key) );
+    for (i = 0; i <= key->last_subkey; i++)
+    {
+        if (key->subkeys[i]->flags & KEY_VOLATILE) continue;
+        if (!(hive_subkeys[hive_key.subkey_count++] = save_hive_key( writer, key->subkeys[i] ))) goto done;
+    }
+    for (i = 0; i <= key->last_value; i++)
+    {
+        hive_values[i].type    = key->values[i].type;
+        hive_values[i].namelen = key->values[i].namelen;
+        hive_values[i].name    = write_hive_data( writer, key->values[i].name, key->values[i].namelen, 1 );
+        hive_values[i].len     = key->values[i].len;
+        hive_values[i].data    = write_hive_data( writer, key->values[i].data, key->values[i].len, 1 );
+    }
+    hive_key.modif        = key->modif;
+    hive_key.flags        = key->flags & KEY_SYMLINK;
+    hive_key.namelen      = key->obj.name->len;
+    hive_key.name         = write_hive_data( writer, key->obj.name->name, key->obj.name->len, 1 );
+    hive_key.classlen     = key->classlen;
+    hive_key.class        = write_hive_data( writer, key->class, key->classlen, 1 );
+    hive_key.value_count  = key->last_value + 1;
+    hive_key.values       = write_hive_data( writer, hive_values, hive_key.value_count * sizeof(*hive_values),
+                                             sizeof(int) );
+    hive_key.subkeys      = write_hive_data( writer, hive_subkeys, hive_key.subkey_count * sizeof(*hive_subkeys),
+                                             sizeof(int) );
+    ret = write_hive_data( writer, &hive_key, sizeof(hive_key), sizeof(timeout_t) );
+
+done:
+    free( hive_values );
+    free( hive_subkeys );
+    return ret;
+}
+
+/* save the hive of a branch that has just been saved to a text file */
+static void save_hive( struct key *key, const char *path )
+{
+    struct hive_writer writer;
+    struct hive_header header;
+    struct stat st;
+    char *hive_path, *tmp;
+    int ret = 0;
+
+    if (!(hive_path = get_hive_path( path ))) return;
+    if (!(tmp = malloc( strlen(hive_path) + sizeof(".tmp") ))) goto done;
+    sprintf( tmp, "%s.tmp", hive_path );
+    if (stat( path, &st ) || !(writer.file = fopen( tmp, "w" ))) goto done;
+
+    memset( &header, 0, sizeof(header) );
+    header.magic   = HIVE_MAGIC;
+    header.version = HIVE_VERSION;
+    header.prefix_type = prefix_type;
+    get_hive_file_info( &st, &header );
+    writer.pos = 0;
+    write_hive_data( &writer, &header, sizeof(header), 1 );
+    header.root = save_hive_key( &writer, key );
+
+    if (header.root && writer.pos <= UINT_MAX && !fseek( writer.file, 0, SEEK_SET ))
+        ret = fwrite( &header, sizeof(header), 1, writer.file );
+    if (fclose( writer.file )) ret = 0;
+    if (ret) ret = !rename( tmp, hive_path );
+    if (!ret) unlink( tmp );
+
+done:
+    /* a stale hive would be ignored anyway, but don't keep it around */
+    if (!ret) unlink( hive_path );
+    free( hive_path );
+    free( tmp );
+}
+
 /* save a registry branch to a file */
 static int save_branch( struct key *key, const char *path )
 {
@@ -2105,21 +2815,92 @@ static int save_branch( struct key *key, const char *path )
         if (!ret) unlink( tmp );
     }
 
+    if (ret) save_hive( key, path );
+
 done:
     free( tmp );
     if (ret) make_clean( key );
     return ret;
 }
 
+/* remove the journals of a branch that has just been fully saved */
+static void remove_journals( struct save_branch_info *branch )
+{
+    char path[64];
+
+    if (branch->journal) fclose( branch->journal );
+    branch->journal = NULL;
+    branch->compact = 0;
+    get_journal_path( branch, 0, path, sizeof(path) );
+    unlink( path );
+    get_journal_path( branch, 1, path, sizeof(path) );
+    unlink( path );
+}
+
+/* wait for the background save of a branch; return 0 if it is still running and we don't block */
+static int wait_branch_saver( struct save_branch_info *branch, int block )
+{
+    if (!branch->saver_pid) return 1;
+    /* the child may also have been reaped by the SIGCHLD handler */
+    if (!waitpid( branch->saver_pid, NULL, block ? 0 : WNOHANG )) return 0;
+    branch->saver_pid = 0;
+    return 1;
+}
+
+/* rewrite a branch file in a forked process, so that it is a snapshot of the current state
+ * and request handling is not blocked; the journal is rotated and the old one removed
+ * by the child once the branch file is in place */
+static void compact_branch( struct save_branch_info *branch )
+{
+    char path[64], old_path[64];
+    pid_t pid;
+
+    if (!wait_branch_saver( branch, 0 )) return;
+
+    get_journal_path( branch, 0, path, sizeof(path) );
+    get_journal_path( branch, 1, old_path, sizeof(old_path) );
+    if (branch->journal) fclose( branch->journal );
+    branch->journal = NULL;
+
+    /* an old journal left over means a failed save, replace everything synchronously */
+    if (!access( old_path, F_OK ) || (rename( path, old_path ) == -1 && errno != ENOENT) ||
+        (pid = fork()) == -1)
+    {
+        if (save_branch( branch->key, branch->path )) remove_journals( branch );
+        return;
+    }
+    if (!pid)
+    {
+        make_dirty( branch->key );
+        if (!save_branch( branch->key, branch->path )) _exit( 1 );
+        _exit( unlink( old_path ) == -1 && errno != ENOENT );
+    }
+    branch->saver_pid = pid;
+    branch->compact = 0;
+}
+
 /* periodic saving of the registry */
 static void periodic_save( void *arg )
 {
+    struct save_branch_info *branch;
+    struct stat st;
     int i;
 
     if (fchdir( config_dir_fd ) == -1) return;
     save_timeout_user = NULL;
+    flush_journal_keys();
     for (i = 0; i < save_branch_count; i++)
-        save_branch( save_branch_info[i].key, save_branch_info[i].path );
+    {
+        branch = &save_branch_info[i];
+        if (branch->journal && fflush( branch->journal )) branch->compact = 1;
+        if (!branch->compact)
+        {
+            if (!branch->journal) continue;
+            if (stat( branch->path, &st )) st.st_size = 0;
+            if (ftell( branch->journal ) < max( MIN_JOURNAL_COMPACT_SIZE, st.st_size / 4 )) continue;
+        }
+        compact_branch( branch );
+    }
     if (fchdir( server_dir_fd ) == -1) fatal_error( "chdir to server dir: %s\n", strerror( errno ));
     set_periodic_save_timer();
 }
@@ -2137,14 +2918,18 @@ void flush_registry(void)
     int i;
 
     if (fchdir( config_dir_fd ) == -1) return;
+    flush_journal_keys();
     for (i = 0; i < save_branch_count; i++)
     {
+        wait_branch_saver( &save_branch_info[i], 1 );
+        if (save_branch_info[i].journal) fflush( save_branch_info[i].journal );
         if (!save_branch( save_branch_info[i].key, save_branch_info[i].path ))
         {
             fprintf( stderr, "wineserver: could not save registry branch to %s",
                      save_branch_info[i].path );
             perror( " " );
         }
+        else remove_journals( &save_branch_info[i] );
     }
     if (fchdir( server_dir_fd ) == -1) fatal_error( "chdir to server dir: %s\n", strerror( errno ));
 }
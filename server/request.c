@@ -289,11 +289,152 @@ static void send_reply( union generic_reply *reply )
         fatal_protocol_error( current, "reply write: %s\n", strerror( errno ));
 }
 
+/* per request type statistics, always collected */
+static request_stats_t req_stats[REQ_NB_REQUESTS];
+
+/* serialization profile of request handling, grouped by subsystem */
+/* handlers always run one at a time on the main thread: objects, handles, */
+/* the namespace and the wait queues are not locked, so this only measures */
+/* what a multi-threaded dispatch would have to split out first */
+struct subsystem_profile
+{
+    const char   *name;       /* subsystem name (handler source file) */
+    unsigned int  count;      /* number of requests handled */
+    timeout_t     busy;       /* time spent in handlers */
+    timeout_t     max;        /* longest single handler */
+    timeout_t     blocked;    /* time other ready clients spent waiting behind handlers */
+};
+
+static int profile_enabled = -1;
+static unsigned int profile_count;
+static struct subsystem_profile profiles[64];
+static unsigned char req_profile_index[REQ_NB_REQUESTS];
+
+/* map each request to its subsystem profile; returns 0 if profiling is disabled */
+static int init_profile(void)
+{
+    const char *env = getenv( "WINESERVERPROFILE" );
+    unsigned int i, j;
+
+    if (!(profile_enabled = env && atoi( env ))) return 0;
+
+    for (i = 0; i < REQ_NB_REQUESTS; i++)
+    {
+        for (j = 0; j < profile_count; j++)
+            if (!strcmp( profiles[j].name, req_subsystems[i] )) break;
+        if (j == profile_count)
+        {
+            assert( profile_count < ARRAY_SIZE(profiles) );
+            profiles[profile_count++].name = req_subsystems[i];
+        }
+        req_profile_index[i] = j;
+    }
+    return 1;
+}
+
+static int compare_profiles( const void *p1, const void *p2 )
+{
+    const struct subsystem_profile *prof1 = p1, *prof2 = p2;
+
+    if (prof1->blocked != prof2->blocked) return prof1->blocked < prof2->blocked ? 1 : -1;
+    if (prof1->busy != prof2->busy) return prof1->busy < prof2->busy ? 1 : -1;
+    return 0;
+}
+
+/* dump the serialization profile to stderr */
+void dump_server_profile(void)
+{
+    struct subsystem_profile sorted[ARRAY_SIZE(profiles)];
+    unsigned int i;
+
+    if (profile_enabled < 0) init_profile();
+    if (!profile_enabled) return;
+
+    memcpy( sorted, profiles, profile_count * sizeof(*profiles) );
+    qsort( sorted, profile_count, sizeof(*sorted), compare_profiles );
+
+    fprintf( stderr, "wineserver: %-12s %10s %12s %10s %12s\n",
+             "subsystem", "requests", "busy ms", "max us", "blocked ms" );
+    for (i = 0; i < profile_count; i++)
+    {
+        if (!sorted[i].count) continue;
+        fprintf( stderr, "wineserver: %-12s %10u %12.1f %10.1f %12.1f\n", sorted[i].name, sorted[i].count,
+                 sorted[i].busy / 10000.0, sorted[i].max / 10.0, sorted[i].blocked / 10000.0 );
+    }
+}
+
+static int compare_request_stats( const void *p1, const void *p2 )
+{
+    const request_stats_t *stats1 = &req_stats[*(const unsigned short *)p1];
+    const request_stats_t *stats2 = &req_stats[*(const unsigned short *)p2];
+
+    if (stats1->total != stats2->total) return stats1->total < stats2->total ? 1 : -1;
+    return 0;
+}
+
+/* return the upper bound in microseconds of the histogram bucket containing the given percentile;
+ * for the last bucket this is a lower bound instead */
+static double get_request_percentile( const request_stats_t *stats, unsigned int percent )
+{
+    unsigned int i, sum = 0, limit = (stats->count * (unsigned __int64)percent + 99) / 100;
+
+    for (i = 0; i < REQUEST_STATS_BUCKETS - 1; i++)
+        if ((sum += stats->histogram[i]) >= limit) break;
+    return (2 << i) / 10.0;
+}
+
+/* dump the request statistics to stderr, slowest request types first */
+void dump_request_stats(void)
+{
+    unsigned short sorted[REQ_NB_REQUESTS];
+    unsigned int i, count = 0;
+
+    for (i = 0; i < REQ_NB_REQUESTS; i++) if (req_stats[i].count) sorted[count++] = i;
+    qsort( sorted, count, sizeof(*sorted), compare_request_stats );
+
+    fprintf( stderr, "wineserver: %-32s %10s %12s %10s %10s %10s\n",
+             "request", "count", "total ms", "avg us", "p50 us", "p99 us" );
+    for (i = 0; i < count; i++)
+    {
+        const request_stats_t *stats = &req_stats[sorted[i]];
+
+        fprintf( stderr, "wineserver: %-32s %10u %12.1f %10.2f %10.1f %10.1f\n",
+                 get_req_name( sorted[i] ), stats->count, stats->total / 10000.0,
+                 stats->total / 10.0 / stats->count,
+                 get_request_percentile( stats, 50 ), get_request_percentile( stats, 99 ) );
+    }
+}
+
+/* account for a handled request in the request statistics */
+static inline void account_request( enum request req, timeout_t elapsed )
+{
+    request_stats_t *stats = &req_stats[req];
+    unsigned int bucket = 0;
+    timeout_t val;
+
+    for (val = elapsed >> 1; val && bucket < REQUEST_STATS_BUCKETS - 1; val >>= 1) bucket++;
+    stats->count++;
+    stats->total += elapsed;
+    stats->histogram[bucket]++;
+}
+
+/* account for a handled request in the subsystem profile */
+static void profile_request( enum request req, timeout_t elapsed )
+{
+    struct subsystem_profile *prof = &profiles[req_profile_index[req]];
+
+    prof->count++;
+    prof->busy += elapsed;
+    prof->blocked += elapsed * poll_backlog;
+    if (elapsed > prof->max) prof->max = elapsed;
+}
+
 /* call a request handler */
 static void call_req_handler( struct thread *thread )
 {
     union generic_reply reply;
     enum request req = thread->req.request_header.req;
+    timeout_t start, elapsed;
 
     current = thread;
     current->reply_size = 0;
@@ -303,7 +444,13 @@ static void call_req_handler( struct thread *thread )
     if (debug_level) trace_request();
 
     if (req < REQ_NB_REQUESTS)
+    {
+        start = monotonic_counter();
         req_handlers[req]( &current->req, &reply );
+        elapsed = monotonic_counter() - start;
+        account_request( req, elapsed );
+        if (profile_enabled && (profile_enabled > 0 || init_profile())) profile_request( req, elapsed );
+    }
     else
         set_error( STATUS_NOT_IMPLEMENTED );
 
@@ -959,3 +1106,12 @@ void close_master_socket( timeout_t timeout )
 
     master_timeout = add_timeout_user( timeout, close_socket_timeout, NULL );
 }
+
+/* retrieve the request handling statistics */
+DECL_HANDLER(get_request_stats)
+{
+    data_size_t size = min( get_reply_max_size(), sizeof(req_stats) );
+
+    reply->count = REQ_NB_REQUESTS;
+    set_reply_data( req_stats, size - size % sizeof(req_stats[0]) );
+}
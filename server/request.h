@@ -55,6 +55,8 @@ extern int send_client_fd( struct process *process, int fd, obj_handle_t handle
 extern void read_request( struct thread *thread );
 extern void write_reply( struct thread *thread );
 extern timeout_t monotonic_counter(void);
+extern void dump_server_profile(void);
+extern void dump_request_stats(void);
 extern void open_master_socket(void);
 extern void close_master_socket( timeout_t timeout );
 extern void shutdown_master_socket(void);
@@ -65,6 +67,7 @@ extern int server_dir_fd, config_dir_fd;
 
 extern void trace_request(void);
 extern void trace_reply( enum request req, const union generic_reply *reply );
+extern const char *get_req_name( enum request req );
 
 /* get current tick count to return to client */
 static inline unsigned int get_tick_count(void)
@@ -126,6 +129,7 @@ DECL_HANDLER(get_startup_info);
 DECL_HANDLER(init_process_done);
 DECL_HANDLER(init_first_thread);
 DECL_HANDLER(init_thread);
+DECL_HANDLER(get_process_shm);
 DECL_HANDLER(terminate_process);
 DECL_HANDLER(terminate_thread);
 DECL_HANDLER(get_process_info);
@@ -141,6 +145,7 @@ DECL_HANDLER(resume_thread);
 DECL_HANDLER(queue_apc);
 DECL_HANDLER(get_apc_result);
 DECL_HANDLER(close_handle);
+DECL_HANDLER(close_handles);
 DECL_HANDLER(set_handle_info);
 DECL_HANDLER(dup_handle);
 DECL_HANDLER(compare_objects);
@@ -377,6 +382,7 @@ DECL_HANDLER(create_completion);
 DECL_HANDLER(open_completion);
 DECL_HANDLER(add_completion);
 DECL_HANDLER(remove_completion);
+DECL_HANDLER(remove_completions);
 DECL_HANDLER(query_completion);
 DECL_HANDLER(set_completion_info);
 DECL_HANDLER(add_fd_completion);
@@ -408,6 +414,7 @@ DECL_HANDLER(open_esync);
 DECL_HANDLER(get_esync_fd);
 DECL_HANDLER(esync_msgwait);
 DECL_HANDLER(get_esync_apc_fd);
+DECL_HANDLER(get_request_stats);
 
 #ifdef WANT_REQUEST_HANDLERS
 
@@ -421,6 +428,7 @@ static const req_handler req_handlers[REQ_NB_REQUESTS] =
     (req_handler)req_init_process_done,
     (req_handler)req_init_first_thread,
     (req_handler)req_init_thread,
+    (req_handler)req_get_process_shm,
     (req_handler)req_terminate_process,
     (req_handler)req_terminate_thread,
     (req_handler)req_get_process_info,
@@ -436,6 +444,7 @@ static const req_handler req_handlers[REQ_NB_REQUESTS] =
     (req_handler)req_queue_apc,
     (req_handler)req_get_apc_result,
     (req_handler)req_close_handle,
+    (req_handler)req_close_handles,
     (req_handler)req_set_handle_info,
     (req_handler)req_dup_handle,
     (req_handler)req_compare_objects,
@@ -672,6 +681,7 @@ static const req_handler req_handlers[REQ_NB_REQUESTS] =
     (req_handler)req_open_completion,
     (req_handler)req_add_completion,
     (req_handler)req_remove_completion,
+    (req_handler)req_remove_completions,
     (req_handler)req_query_completion,
     (req_handler)req_set_completion_info,
     (req_handler)req_add_fd_completion,
@@ -703,6 +713,305 @@ static const req_handler req_handlers[REQ_NB_REQUESTS] =
     (req_handler)req_get_esync_fd,
     (req_handler)req_esync_msgwait,
     (req_handler)req_get_esync_apc_fd,
+    (req_handler)req_get_request_stats,
+};
+
+/* source file of each handler, used to group requests by subsystem */
+static const char * const req_subsystems[REQ_NB_REQUESTS] =
+{
+    "process",
+    "process",
+    "thread",
+    "process",
+    "process",
+    "thread",
+    "thread",
+    "process",
+    "process",
+    "thread",
+    "process",
+    "process",
+    "process",
+    "process",
+    "process",
+    "thread",
+    "thread",
+    "thread",
+    "thread",
+    "thread",
+    "thread",
+    "thread",
+    "handle",
+    "handle",
+    "handle",
+    "handle",
+    "handle",
+    "handle",
+    "process",
+    "thread",
+    "thread",
+    "event",
+    "event",
+    "event",
+    "event",
+    "event",
+    "event",
+    "mutex",
+    "mutex",
+    "mutex",
+    "mutex",
+    "semaphore",
+    "semaphore",
+    "semaphore",
+    "semaphore",
+    "file",
+    "fd",
+    "file",
+    "fd",
+    "fd",
+    "change",
+    "fd",
+    "fd",
+    "fd",
+    "file",
+    "file",
+    "sock",
+    "sock",
+    "sock",
+    "sock",
+    "sock",
+    "console",
+    "change",
+    "change",
+    "mapping",
+    "mapping",
+    "mapping",
+    "mapping",
+    "mapping",
+    "mapping",
+    "mapping",
+    "mapping",
+    "mapping",
+    "mapping",
+    "mapping",
+    "mapping",
+    "mapping",
+    "process",
+    "debugger",
+    "debugger",
+    "debugger",
+    "debugger",
+    "debugger",
+    "debugger",
+    "debugger",
+    "process",
+    "process",
+    "registry",
+    "registry",
+    "registry",
+    "registry",
+    "registry",
+    "registry",
+    "registry",
+    "registry",
+    "registry",
+    "registry",
+    "registry",
+    "registry",
+    "registry",
+    "registry",
+    "timer",
+    "timer",
+    "timer",
+    "timer",
+    "timer",
+    "thread",
+    "thread",
+    "thread",
+    "atom",
+    "atom",
+    "atom",
+    "atom",
+    "queue",
+    "queue",
+    "queue",
+    "queue",
+    "process",
+    "queue",
+    "queue",
+    "queue",
+    "queue",
+    "queue",
+    "queue",
+    "queue",
+    "queue",
+    "queue",
+    "queue",
+    "serial",
+    "serial",
+    "async",
+    "fd",
+    "async",
+    "async",
+    "async",
+    "fd",
+    "fd",
+    "fd",
+    "device",
+    "named_pipe",
+    "named_pipe",
+    "window",
+    "window",
+    "window",
+    "window",
+    "window",
+    "window",
+    "window",
+    "window",
+    "window",
+    "window",
+    "window",
+    "window",
+    "window",
+    "window",
+    "window",
+    "window",
+    "window",
+    "window",
+    "window",
+    "window",
+    "window",
+    "window",
+    "window",
+    "window",
+    "window",
+    "window",
+    "window",
+    "winstation",
+    "winstation",
+    "winstation",
+    "winstation",
+    "winstation",
+    "winstation",
+    "winstation",
+    "winstation",
+    "winstation",
+    "winstation",
+    "winstation",
+    "winstation",
+    "winstation",
+    "winstation",
+    "queue",
+    "queue",
+    "queue",
+    "queue",
+    "queue",
+    "queue",
+    "queue",
+    "queue",
+    "queue",
+    "queue",
+    "queue",
+    "queue",
+    "queue",
+    "hook",
+    "hook",
+    "hook",
+    "hook",
+    "hook",
+    "class",
+    "class",
+    "class",
+    "clipboard",
+    "clipboard",
+    "clipboard",
+    "clipboard",
+    "clipboard",
+    "clipboard",
+    "clipboard",
+    "clipboard",
+    "clipboard",
+    "clipboard",
+    "clipboard",
+    "clipboard",
+    "token",
+    "token",
+    "window",
+    "token",
+    "token",
+    "token",
+    "token",
+    "token",
+    "token",
+    "token",
+    "token",
+    "token",
+    "token",
+    "handle",
+    "handle",
+    "handle",
+    "mailslot",
+    "mailslot",
+    "directory",
+    "directory",
+    "directory",
+    "symlink",
+    "symlink",
+    "symlink",
+    "handle",
+    "handle",
+    "directory",
+    "directory",
+    "token",
+    "device",
+    "device",
+    "device",
+    "device",
+    "device",
+    "device",
+    "device",
+    "device",
+    "device",
+    "process",
+    "token",
+    "token",
+    "completion",
+    "completion",
+    "completion",
+    "completion",
+    "completion",
+    "completion",
+    "fd",
+    "fd",
+    "fd",
+    "fd",
+    "fd",
+    "fd",
+    "window",
+    "window",
+    "user",
+    "user",
+    "queue",
+    "queue",
+    "queue",
+    "queue",
+    "process",
+    "process",
+    "process",
+    "process",
+    "process",
+    "process",
+    "process",
+    "process",
+    "process",
+    "process",
+    "thread",
+    "esync",
+    "esync",
+    "esync",
+    "queue",
+    "esync",
+    "request",
 };
 
 C_ASSERT( sizeof(abstime_t) == 8 );
@@ -733,6 +1042,7 @@ C_ASSERT( sizeof(pe_image_info_t) == 88 );
 C_ASSERT( sizeof(process_id_t) == 4 );
 C_ASSERT( sizeof(property_data_t) == 16 );
 C_ASSERT( sizeof(rectangle_t) == 16 );
+C_ASSERT( sizeof(request_stats_t) == 80 );
 C_ASSERT( sizeof(select_op_t) == 264 );
 C_ASSERT( sizeof(short int) == 2 );
 C_ASSERT( sizeof(startup_info_t) == 96 );
@@ -801,7 +1111,8 @@ C_ASSERT( FIELD_OFFSET(struct init_first_thread_reply, tid) == 12 );
 C_ASSERT( FIELD_OFFSET(struct init_first_thread_reply, server_start) == 16 );
 C_ASSERT( FIELD_OFFSET(struct init_first_thread_reply, session_id) == 24 );
 C_ASSERT( FIELD_OFFSET(struct init_first_thread_reply, info_size) == 28 );
-C_ASSERT( sizeof(struct init_first_thread_reply) == 32 );
+C_ASSERT( FIELD_OFFSET(struct init_first_thread_reply, shm_slot) == 32 );
+C_ASSERT( sizeof(struct init_first_thread_reply) == 40 );
 C_ASSERT( FIELD_OFFSET(struct init_thread_request, unix_tid) == 12 );
 C_ASSERT( FIELD_OFFSET(struct init_thread_request, reply_fd) == 16 );
 C_ASSERT( FIELD_OFFSET(struct init_thread_request, wait_fd) == 20 );
@@ -809,7 +1120,11 @@ C_ASSERT( FIELD_OFFSET(struct init_thread_request, teb) == 24 );
 C_ASSERT( FIELD_OFFSET(struct init_thread_request, entry) == 32 );
 C_ASSERT( sizeof(struct init_thread_request) == 40 );
 C_ASSERT( FIELD_OFFSET(struct init_thread_reply, suspend) == 8 );
+C_ASSERT( FIELD_OFFSET(struct init_thread_reply, shm_slot) == 12 );
 C_ASSERT( sizeof(struct init_thread_reply) == 16 );
+C_ASSERT( sizeof(struct get_process_shm_request) == 16 );
+C_ASSERT( FIELD_OFFSET(struct get_process_shm_reply, size) == 8 );
+C_ASSERT( sizeof(struct get_process_shm_reply) == 16 );
 C_ASSERT( FIELD_OFFSET(struct terminate_process_request, handle) == 12 );
 C_ASSERT( FIELD_OFFSET(struct terminate_process_request, exit_code) == 16 );
 C_ASSERT( sizeof(struct terminate_process_request) == 24 );
@@ -905,6 +1220,9 @@ C_ASSERT( FIELD_OFFSET(struct get_apc_result_reply, result) == 8 );
 C_ASSERT( sizeof(struct get_apc_result_reply) == 48 );
 C_ASSERT( FIELD_OFFSET(struct close_handle_request, handle) == 12 );
 C_ASSERT( sizeof(struct close_handle_request) == 16 );
+C_ASSERT( sizeof(struct close_handles_request) == 16 );
+C_ASSERT( FIELD_OFFSET(struct close_handles_reply, closed) == 8 );
+C_ASSERT( sizeof(struct close_handles_reply) == 16 );
 C_ASSERT( FIELD_OFFSET(struct set_handle_info_request, handle) == 12 );
 C_ASSERT( FIELD_OFFSET(struct set_handle_info_request, flags) == 16 );
 C_ASSERT( FIELD_OFFSET(struct set_handle_info_request, mask) == 20 );
@@ -1092,6 +1410,7 @@ C_ASSERT( sizeof(struct recv_socket_request) == 64 );
 C_ASSERT( FIELD_OFFSET(struct recv_socket_reply, wait) == 8 );
 C_ASSERT( FIELD_OFFSET(struct recv_socket_reply, options) == 12 );
 C_ASSERT( FIELD_OFFSET(struct recv_socket_reply, nonblocking) == 16 );
+C_ASSERT( FIELD_OFFSET(struct recv_socket_reply, type) == 20 );
 C_ASSERT( sizeof(struct recv_socket_reply) == 24 );
 C_ASSERT( FIELD_OFFSET(struct send_socket_request, async) == 16 );
 C_ASSERT( FIELD_OFFSET(struct send_socket_request, force_async) == 56 );
@@ -1099,6 +1418,7 @@ C_ASSERT( sizeof(struct send_socket_request) == 64 );
 C_ASSERT( FIELD_OFFSET(struct send_socket_reply, wait) == 8 );
 C_ASSERT( FIELD_OFFSET(struct send_socket_reply, options) == 12 );
 C_ASSERT( FIELD_OFFSET(struct send_socket_reply, nonblocking) == 16 );
+C_ASSERT( FIELD_OFFSET(struct send_socket_reply, type) == 20 );
 C_ASSERT( sizeof(struct send_socket_reply) == 24 );
 C_ASSERT( FIELD_OFFSET(struct socket_get_events_request, handle) == 12 );
 C_ASSERT( FIELD_OFFSET(struct socket_get_events_request, event) == 16 );
@@ -2232,6 +2552,9 @@ C_ASSERT( FIELD_OFFSET(struct remove_completion_reply, cvalue) == 16 );
 C_ASSERT( FIELD_OFFSET(struct remove_completion_reply, information) == 24 );
 C_ASSERT( FIELD_OFFSET(struct remove_completion_reply, status) == 32 );
 C_ASSERT( sizeof(struct remove_completion_reply) == 40 );
+C_ASSERT( FIELD_OFFSET(struct remove_completions_request, handle) == 12 );
+C_ASSERT( sizeof(struct remove_completions_request) == 16 );
+C_ASSERT( sizeof(struct remove_completions_reply) == 8 );
 C_ASSERT( FIELD_OFFSET(struct query_completion_request, handle) == 12 );
 C_ASSERT( sizeof(struct query_completion_request) == 16 );
 C_ASSERT( FIELD_OFFSET(struct query_completion_reply, depth) == 8 );
@@ -2371,6 +2694,11 @@ C_ASSERT( sizeof(struct get_esync_fd_reply) == 16 );
 C_ASSERT( FIELD_OFFSET(struct esync_msgwait_request, in_msgwait) == 12 );
 C_ASSERT( sizeof(struct esync_msgwait_request) == 16 );
 C_ASSERT( sizeof(struct get_esync_apc_fd_request) == 16 );
+C_ASSERT( FIELD_OFFSET(struct get_esync_apc_fd_reply, shm_idx) == 8 );
+C_ASSERT( sizeof(struct get_esync_apc_fd_reply) == 16 );
+C_ASSERT( sizeof(struct get_request_stats_request) == 16 );
+C_ASSERT( FIELD_OFFSET(struct get_request_stats_reply, count) == 8 );
+C_ASSERT( sizeof(struct get_request_stats_reply) == 16 );
 
 #endif  /* WANT_REQUEST_HANDLERS */
 
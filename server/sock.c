@@ -2040,6 +2040,8 @@ static struct sock *accept_socket( struct sock *sock )
             release_object( acceptsock );
             return NULL;
         }
+        /* an accepted socket is connected and can't be accepted into */
+        allow_fd_caching( acceptsock->fd );
         unix_len = sizeof(unix_addr);
         if (!getsockname( acceptfd, &unix_addr.addr, &unix_len ))
         {
@@ -2102,6 +2104,8 @@ static int accept_into_socket( struct sock *sock, struct sock *acceptsock )
     fd_copy_completion( acceptsock->fd, newfd );
     release_object( acceptsock->fd );
     acceptsock->fd = newfd;
+    /* the socket is now connected and can't be accepted into again */
+    allow_fd_caching( acceptsock->fd );
 
     unix_len = sizeof(unix_addr);
     if (!getsockname( get_unix_fd( newfd ), &unix_addr.addr, &unix_len ))
@@ -3889,6 +3893,7 @@ DECL_HANDLER(recv_socket)
         reply->wait = async_handoff( async, NULL, 0 );
         reply->options = get_fd_options( fd );
         reply->nonblocking = sock->nonblocking;
+        reply->type = sock->type;
         release_object( async );
     }
     release_object( sock );
@@ -4012,6 +4017,7 @@ DECL_HANDLER(send_socket)
         reply->wait = async_handoff( async, NULL, 0 );
         reply->options = get_fd_options( fd );
         reply->nonblocking = sock->nonblocking;
+        reply->type = sock->type;
         release_object( async );
     }
     release_object( sock );
@@ -233,6 +233,8 @@ static inline void init_thread_structure( struct thread *thread )
     thread->entry_point     = 0;
     thread->esync_fd        = -1;
     thread->esync_apc_fd    = -1;
+    thread->shm_slot        = 0;
+    thread->shm             = NULL;
     thread->system_regs     = 0;
     thread->queue           = NULL;
     thread->wait            = NULL;
@@ -386,6 +388,8 @@ struct thread *create_thread( int fd, struct process *process, const struct secu
         thread->esync_apc_fd = esync_create_fd( 0, 0 );
     }
 
+    thread->shm = alloc_thread_shm( process, &thread->shm_slot );
+
     set_fd_events( thread->request_fd, POLLIN );  /* start listening to events */
     add_process_thread( thread->process, thread );
     return thread;
@@ -461,13 +465,17 @@ static void destroy_thread( struct object *obj )
 
     list_remove( &thread->entry );
     cleanup_thread( thread );
+    free_thread_shm( thread->process, thread->shm_slot );
     release_object( thread->process );
     if (thread->exit_poll) remove_timeout_user( thread->exit_poll );
     if (thread->id) free_ptid( thread->id );
     if (thread->token) release_object( thread->token );
 
     if (do_esync())
-        close( thread->esync_fd );
+    {
+        esync_close_fd( thread->esync_fd );
+        esync_close_fd( thread->esync_apc_fd );
+    }
 }
 
 /* dump a thread on stdout for debugging purposes */
@@ -523,7 +531,11 @@ static void thread_apc_destroy( struct object *obj )
     if (apc->owner)
     {
         if (apc->result.type == APC_ASYNC_IO)
+        {
+            if (apc->result.async_io.alert_count)
+                async_alert_queue( apc->owner, apc->result.async_io.alert_count );
             async_set_result( apc->owner, apc->result.async_io.status, apc->result.async_io.total );
+        }
         else if (apc->call.type == APC_ASYNC_IO)
             async_set_result( apc->owner, apc->call.async_io.status, 0 );
         release_object( apc->owner );
@@ -1488,6 +1500,7 @@ DECL_HANDLER(init_first_thread)
     reply->session_id   = process->session_id;
     reply->info_size    = get_process_startup_info_size( process );
     reply->server_start = server_start_time;
+    reply->shm_slot     = current->shm_slot;
     set_reply_data( supported_machines,
                     min( supported_machines_count * sizeof(unsigned short), get_reply_max_size() ));
 }
@@ -1513,6 +1526,7 @@ DECL_HANDLER(init_thread)
     set_thread_affinity( current, current->affinity );
 
     reply->suspend = (current->suspend || current->process->suspend || current->context != NULL);
+    reply->shm_slot = current->shm_slot;
 }
 
 /* terminate a thread */
@@ -56,6 +56,8 @@ struct thread
     struct list            mutex_list;    /* list of currently owned mutexes */
     int                    esync_fd;      /* esync file descriptor (signalled on exit) */
     int                    esync_apc_fd;  /* esync apc fd (signalled when APCs are present) */
+    unsigned int           shm_slot;      /* slot in the process shared memory */
+    thread_shm_t          *shm;           /* state published in the process shared memory */
     unsigned int           system_regs;   /* which system regs have been set */
     struct msg_queue      *queue;         /* message queue */
     struct thread_wait    *wait;          /* current wait condition if sleeping */
@@ -95,6 +97,18 @@ struct thread
     struct timeout_user   *exit_poll;     /* poll if the thread/process has exited already */
 };
 
+/* update shared memory read locklessly by the client; the server is the only writer */
+#define SHARED_WRITE_BEGIN( shm ) \
+    do { \
+        __atomic_store_n( &(shm)->seq, (shm)->seq + 1, __ATOMIC_RELAXED ); \
+        __atomic_thread_fence( __ATOMIC_RELEASE ); \
+        do
+
+#define SHARED_WRITE_END( shm ) \
+        while(0); \
+        __atomic_store_n( &(shm)->seq, (shm)->seq + 1, __ATOMIC_RELEASE ); \
+    } while(0)
+
 extern struct thread *current;
 
 /* thread functions */
@@ -273,8 +273,9 @@ static void dump_apc_result( const char *prefix, const apc_result_t *result )
     case APC_NONE:
         break;
     case APC_ASYNC_IO:
-        fprintf( stderr, "APC_ASYNC_IO,status=%s,total=%u",
-                 get_status_name( result->async_io.status ), result->async_io.total );
+        fprintf( stderr, "APC_ASYNC_IO,status=%s,total=%u,alert_count=%u",
+                 get_status_name( result->async_io.status ), result->async_io.total,
+                 result->async_io.alert_count );
         break;
     case APC_VIRTUAL_ALLOC:
         fprintf( stderr, "APC_VIRTUAL_ALLOC,status=%s",
@@ -496,6 +497,25 @@ static void dump_varargs_uints( const char *prefix, data_size_t size )
     remove_data( size );
 }
 
+static void dump_varargs_request_stats( const char *prefix, data_size_t size )
+{
+    const request_stats_t *stats = cur_data;
+    data_size_t i, len = size / sizeof(*stats);
+    const char *sep = "";
+
+    fprintf( stderr, "%s{", prefix );
+    for (i = 0; i < len; i++)
+    {
+        if (!stats[i].count) continue;
+        fprintf( stderr, "%s{req=%u,count=%u", sep, i, stats[i].count );
+        sep = ",";
+        dump_uint64( ",total=", (const unsigned __int64 *)&stats[i].total );
+        fputc( '}', stderr );
+    }
+    fputc( '}', stderr );
+    remove_data( size );
+}
+
 static void dump_varargs_uints64( const char *prefix, data_size_t size )
 {
     const unsigned __int64 *data = cur_data;
@@ -1350,6 +1370,25 @@ static void dump_varargs_rawinput_devices(const char *prefix, data_size_t size )
     fputc( '}', stderr );
 }
 
+static void dump_varargs_completion_entries( const char *prefix, data_size_t size )
+{
+    const struct completion_entry *entry;
+
+    fprintf( stderr, "%s{", prefix );
+    while (size >= sizeof(*entry))
+    {
+        entry = cur_data;
+        dump_uint64( "{ckey=", &entry->ckey );
+        dump_uint64( ",cvalue=", &entry->cvalue );
+        dump_uint64( ",information=", &entry->information );
+        fprintf( stderr, ",status=%s}", get_status_name( entry->status ) );
+        size -= sizeof(*entry);
+        remove_data( sizeof(*entry) );
+        if (size) fputc( ',', stderr );
+    }
+    fputc( '}', stderr );
+}
+
 static void dump_varargs_handle_infos( const char *prefix, data_size_t size )
 {
     const struct handle_info *handle;
@@ -1464,6 +1503,7 @@ static void dump_init_first_thread_reply( const struct init_first_thread_reply *
     dump_timeout( ", server_start=", &req->server_start );
     fprintf( stderr, ", session_id=%08x", req->session_id );
     fprintf( stderr, ", info_size=%u", req->info_size );
+    fprintf( stderr, ", shm_slot=%08x", req->shm_slot );
     dump_varargs_ushorts( ", machines=", cur_size );
 }
 
@@ -1479,6 +1519,16 @@ static void dump_init_thread_request( const struct init_thread_request *req )
 static void dump_init_thread_reply( const struct init_thread_reply *req )
 {
     fprintf( stderr, " suspend=%d", req->suspend );
+    fprintf( stderr, ", shm_slot=%08x", req->shm_slot );
+}
+
+static void dump_get_process_shm_request( const struct get_process_shm_request *req )
+{
+}
+
+static void dump_get_process_shm_reply( const struct get_process_shm_reply *req )
+{
+    fprintf( stderr, " size=%u", req->size );
 }
 
 static void dump_terminate_process_request( const struct terminate_process_request *req )
@@ -1663,6 +1713,16 @@ static void dump_close_handle_request( const struct close_handle_request *req )
     fprintf( stderr, " handle=%04x", req->handle );
 }
 
+static void dump_close_handles_request( const struct close_handles_request *req )
+{
+    dump_varargs_uints( " handles=", cur_size );
+}
+
+static void dump_close_handles_reply( const struct close_handles_reply *req )
+{
+    fprintf( stderr, " closed=%08x", req->closed );
+}
+
 static void dump_set_handle_info_request( const struct set_handle_info_request *req )
 {
     fprintf( stderr, " handle=%04x", req->handle );
@@ -2058,6 +2118,7 @@ static void dump_recv_socket_reply( const struct recv_socket_reply *req )
     fprintf( stderr, " wait=%04x", req->wait );
     fprintf( stderr, ", options=%08x", req->options );
     fprintf( stderr, ", nonblocking=%d", req->nonblocking );
+    fprintf( stderr, ", type=%d", req->type );
 }
 
 static void dump_send_socket_request( const struct send_socket_request *req )
@@ -2071,6 +2132,7 @@ static void dump_send_socket_reply( const struct send_socket_reply *req )
     fprintf( stderr, " wait=%04x", req->wait );
     fprintf( stderr, ", options=%08x", req->options );
     fprintf( stderr, ", nonblocking=%d", req->nonblocking );
+    fprintf( stderr, ", type=%d", req->type );
 }
 
 static void dump_socket_get_events_request( const struct socket_get_events_request *req )
@@ -4360,6 +4422,16 @@ static void dump_remove_completion_reply( const struct remove_completion_reply *
     fprintf( stderr, ", status=%08x", req->status );
 }
 
+static void dump_remove_completions_request( const struct remove_completions_request *req )
+{
+    fprintf( stderr, " handle=%04x", req->handle );
+}
+
+static void dump_remove_completions_reply( const struct remove_completions_reply *req )
+{
+    dump_varargs_completion_entries( " entries=", cur_size );
+}
+
 static void dump_query_completion_request( const struct query_completion_request *req )
 {
     fprintf( stderr, " handle=%04x", req->handle );
@@ -4641,6 +4713,21 @@ static void dump_get_esync_apc_fd_request( const struct get_esync_apc_fd_request
 {
 }
 
+static void dump_get_esync_apc_fd_reply( const struct get_esync_apc_fd_reply *req )
+{
+    fprintf( stderr, " shm_idx=%08x", req->shm_idx );
+}
+
+static void dump_get_request_stats_request( const struct get_request_stats_request *req )
+{
+}
+
+static void dump_get_request_stats_reply( const struct get_request_stats_reply *req )
+{
+    fprintf( stderr, " count=%08x", req->count );
+    dump_varargs_request_stats( ", stats=", cur_size );
+}
+
 static const dump_func req_dumpers[REQ_NB_REQUESTS] = {
     (dump_func)dump_new_process_request,
     (dump_func)dump_get_new_process_info_request,
@@ -4649,6 +4736,7 @@ static const dump_func req_dumpers[REQ_NB_REQUESTS] = {
     (dump_func)dump_init_process_done_request,
     (dump_func)dump_init_first_thread_request,
     (dump_func)dump_init_thread_request,
+    (dump_func)dump_get_process_shm_request,
     (dump_func)dump_terminate_process_request,
     (dump_func)dump_terminate_thread_request,
     (dump_func)dump_get_process_info_request,
@@ -4664,6 +4752,7 @@ static const dump_func req_dumpers[REQ_NB_REQUESTS] = {
     (dump_func)dump_queue_apc_request,
     (dump_func)dump_get_apc_result_request,
     (dump_func)dump_close_handle_request,
+    (dump_func)dump_close_handles_request,
     (dump_func)dump_set_handle_info_request,
     (dump_func)dump_dup_handle_request,
     (dump_func)dump_compare_objects_request,
@@ -4900,6 +4989,7 @@ static const dump_func req_dumpers[REQ_NB_REQUESTS] = {
     (dump_func)dump_open_completion_request,
     (dump_func)dump_add_completion_request,
     (dump_func)dump_remove_completion_request,
+    (dump_func)dump_remove_completions_request,
     (dump_func)dump_query_completion_request,
     (dump_func)dump_set_completion_info_request,
     (dump_func)dump_add_fd_completion_request,
@@ -4931,6 +5021,7 @@ static const dump_func req_dumpers[REQ_NB_REQUESTS] = {
     (dump_func)dump_get_esync_fd_request,
     (dump_func)dump_esync_msgwait_request,
     (dump_func)dump_get_esync_apc_fd_request,
+    (dump_func)dump_get_request_stats_request,
 };
 
 static const dump_func reply_dumpers[REQ_NB_REQUESTS] = {
@@ -4941,6 +5032,7 @@ static const dump_func reply_dumpers[REQ_NB_REQUESTS] = {
     (dump_func)dump_init_process_done_reply,
     (dump_func)dump_init_first_thread_reply,
     (dump_func)dump_init_thread_reply,
+    (dump_func)dump_get_process_shm_reply,
     (dump_func)dump_terminate_process_reply,
     (dump_func)dump_terminate_thread_reply,
     (dump_func)dump_get_process_info_reply,
@@ -4956,6 +5048,7 @@ static const dump_func reply_dumpers[REQ_NB_REQUESTS] = {
     (dump_func)dump_queue_apc_reply,
     (dump_func)dump_get_apc_result_reply,
     NULL,
+    (dump_func)dump_close_handles_reply,
     (dump_func)dump_set_handle_info_reply,
     (dump_func)dump_dup_handle_reply,
     NULL,
@@ -5192,6 +5285,7 @@ static const dump_func reply_dumpers[REQ_NB_REQUESTS] = {
     (dump_func)dump_open_completion_reply,
     NULL,
     (dump_func)dump_remove_completion_reply,
+    (dump_func)dump_remove_completions_reply,
     (dump_func)dump_query_completion_reply,
     NULL,
     NULL,
@@ -5222,7 +5316,8 @@ static const dump_func reply_dumpers[REQ_NB_REQUESTS] = {
     (dump_func)dump_open_esync_reply,
     (dump_func)dump_get_esync_fd_reply,
     NULL,
-    NULL,
+    (dump_func)dump_get_esync_apc_fd_reply,
+    (dump_func)dump_get_request_stats_reply,
 };
 
 static const char * const req_names[REQ_NB_REQUESTS] = {
@@ -5233,6 +5328,7 @@ static const char * const req_names[REQ_NB_REQUESTS] = {
     "init_process_done",
     "init_first_thread",
     "init_thread",
+    "get_process_shm",
     "terminate_process",
     "terminate_thread",
     "get_process_info",
@@ -5248,6 +5344,7 @@ static const char * const req_names[REQ_NB_REQUESTS] = {
     "queue_apc",
     "get_apc_result",
     "close_handle",
+    "close_handles",
     "set_handle_info",
     "dup_handle",
     "compare_objects",
@@ -5484,6 +5581,7 @@ static const char * const req_names[REQ_NB_REQUESTS] = {
     "open_completion",
     "add_completion",
     "remove_completion",
+    "remove_completions",
     "query_completion",
     "set_completion_info",
     "add_fd_completion",
@@ -5515,6 +5613,7 @@ static const char * const req_names[REQ_NB_REQUESTS] = {
     "get_esync_fd",
     "esync_msgwait",
     "get_esync_apc_fd",
+    "get_request_stats",
 };
 
 static const struct
@@ -5637,6 +5736,7 @@ static const struct
     { "PROCESS_IN_JOB",              STATUS_PROCESS_IN_JOB },
     { "PROCESS_IS_TERMINATING",      STATUS_PROCESS_IS_TERMINATING },
     { "PROCESS_NOT_IN_JOB",          STATUS_PROCESS_NOT_IN_JOB },
+    { "REGISTRY_CORRUPT",            STATUS_REGISTRY_CORRUPT },
     { "REPARSE_POINT_NOT_RESOLVED",  STATUS_REPARSE_POINT_NOT_RESOLVED },
     { "SECTION_TOO_BIG",             STATUS_SECTION_TOO_BIG },
     { "SEMAPHORE_LIMIT_EXCEEDED",    STATUS_SEMAPHORE_LIMIT_EXCEEDED },
@@ -5713,6 +5813,11 @@ static const char *get_status_name( unsigned int status )
     return buffer;
 }
 
+const char *get_req_name( enum request req )
+{
+    return req < REQ_NB_REQUESTS ? req_names[req] : "?";
+}
+
 void trace_request(void)
 {
     enum request req = current->req.request_header.req;